@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdint>
+#include <cstddef>
 
 namespace bmp {
 
@@ -48,7 +49,7 @@ static_assert(sizeof(BITMAPINFOHEADER) == 40);
 /// problem supporting BITMAPV2INFOHEADER: masks can be used (via BI_BITFIELDS),
 /// but header size must be 40.
 struct BITMAPV2INFOHEADER : BITMAPINFOHEADER {
-	BITMAPV2INFOHEADER()
+	constexpr BITMAPV2INFOHEADER()
 		: BITMAPINFOHEADER()
 	{
 		headerSize = 52;
@@ -61,7 +62,7 @@ struct BITMAPV2INFOHEADER : BITMAPINFOHEADER {
 static_assert(sizeof(BITMAPV2INFOHEADER) == 52);
 
 struct BITMAPV3INFOHEADER : BITMAPV2INFOHEADER {
-	BITMAPV3INFOHEADER()
+	constexpr BITMAPV3INFOHEADER()
 		: BITMAPV2INFOHEADER()
 	{
 		headerSize = 56;
@@ -76,6 +77,210 @@ struct ColorTableEntry
 	uint8_t r, g, b, _reserved;
 };
 
+/// Headers for 16 bpp RGB565 bitmap, using bit masks.
+struct Rgb565Headers {
+	BITMAPFILEHEADER file;
+	BITMAPV3INFOHEADER dib;
+};
+
+/// Headers for 8 bpp grayscale bitmap, to be followed by the color table.
+struct GrayscaleHeaders {
+	BITMAPFILEHEADER file;
+	BITMAPINFOHEADER dib;
+};
+
 #pragma pack(pop)
 
+/// Returns number of bytes per row, which are padded to 4 bytes.
+constexpr uint32_t rowStride(int32_t width, uint16_t bitsPerPixel)
+{
+	return (static_cast<uint32_t>(width) * bitsPerPixel + 31) / 32 * 4;
+}
+
+/// Prepares headers for top-down (rows order as in camera frames) RGB565 bitmap.
+constexpr Rgb565Headers makeRgb565Headers(int32_t width, int32_t height)
+{
+	Rgb565Headers h {};
+	h.dib.width = width;
+	h.dib.height = -height; // negative for top-down
+	h.dib.bitsPerPixel = 16;
+	h.dib.compression = BI_BITFIELDS;
+	h.dib.imageSize = rowStride(width, 16) * height;
+	h.dib.redMask   = 0xF800;
+	h.dib.greenMask = 0x07E0;
+	h.dib.blueMask  = 0x001F;
+	h.dib.alphaMask = 0;
+	h.file.signature = expectedSignature;
+	h.file.offsetToPixelArray = sizeof(Rgb565Headers);
+	h.file.size = h.file.offsetToPixelArray + h.dib.imageSize;
+	return h;
+}
+
+/// Prepares headers for top-down (rows order as in camera frames) grayscale bitmap.
+constexpr GrayscaleHeaders makeGrayscaleHeaders(int32_t width, int32_t height)
+{
+	GrayscaleHeaders h {};
+	h.dib.width = width;
+	h.dib.height = -height; // negative for top-down
+	h.dib.bitsPerPixel = 8;
+	h.dib.compression = BI_RGB;
+	h.dib.imageSize = rowStride(width, 8) * height;
+	h.dib.colorsUsed = 256;
+	h.file.signature = expectedSignature;
+	h.file.offsetToPixelArray = sizeof(GrayscaleHeaders) + 256 * sizeof(ColorTableEntry);
+	h.file.size = h.file.offsetToPixelArray + h.dib.imageSize;
+	return h;
+}
+
+/// Color table for grayscale bitmaps.
+struct GrayscaleColorTable {
+	ColorTableEntry entries[256];
+
+	constexpr GrayscaleColorTable()
+		: entries()
+	{
+		for (int i = 0; i < 256; i++) {
+			const uint8_t v = i;
+			entries[i] = { v, v, v, 0 };
+		}
+	}
+};
+inline constexpr GrayscaleColorTable grayscaleColorTable {};
+static_assert(sizeof(grayscaleColorTable) == 1024);
+
+////////////////////////////////////////////////////////////////////////////////
+// Row conversion kernels
+// Rows are expected to be 4 bytes aligned (even width for 16 bpp sources),
+// as they usually are for camera frames, allowing to process two pixels at once
+// using 32-bit words. Little-endian CPU is assumed.
+
+/// Row conversion kernel, from source row to bitmap row.
+using RowKernel = void (*)(const uint8_t* source, uint8_t* destination, int32_t width);
+
+/// Swaps bytes of RGB565 pixels, from big-endian (as cameras output)
+/// to little-endian (as bitmap requires).
+inline void convertRowRgb565(const uint8_t* source, uint8_t* destination, int32_t width)
+{
+	auto s = reinterpret_cast<const uint32_t*>(source);
+	auto d = reinterpret_cast<uint32_t*>(destination);
+	for (int32_t i = 0; i < width / 2; i++) {
+		const uint32_t x = s[i];
+		d[i] = ((x & 0x00FF00FF) << 8) | ((x >> 8) & 0x00FF00FF);
+	}
+	if (width & 1) {
+		destination[width * 2 - 2] = source[width * 2 - 1];
+		destination[width * 2 - 1] = source[width * 2 - 2];
+	}
+}
+
+constexpr uint8_t clamp8(int32_t v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+constexpr uint16_t packRgb565(int32_t r, int32_t g, int32_t b)
+{
+	return ((clamp8(r) & 0xF8) << 8) | ((clamp8(g) & 0xFC) << 3) | (clamp8(b) >> 3);
+}
+
+/// Converts YUV422 (Y0 U Y1 V) pixels to little-endian RGB565. 
+/// Each pair of pixels shares chroma, so it's calculated once per pair.
+inline void convertRowYuv422ToRgb565(const uint8_t* source, uint8_t* destination, int32_t width)
+{
+	auto s = reinterpret_cast<const uint32_t*>(source);
+	auto d = reinterpret_cast<uint32_t*>(destination);
+	for (int32_t i = 0; i < width / 2; i++) {
+		const uint32_t x = s[i];
+		const int32_t y0 = x & 0xFF;
+		const int32_t u  = static_cast<int32_t>((x >> 8) & 0xFF) - 128;
+		const int32_t y1 = (x >> 16) & 0xFF;
+		const int32_t v  = static_cast<int32_t>(x >> 24) - 128;
+		// BT.601, fixed point 8.8
+		const int32_t dr = (359 * v) >> 8;
+		const int32_t dg = (88 * u + 183 * v) >> 8;
+		const int32_t db = (454 * u) >> 8;
+		d[i] = packRgb565(y0 + dr, y0 - dg, y0 + db) 
+			| (static_cast<uint32_t>(packRgb565(y1 + dr, y1 - dg, y1 + db)) << 16);
+	}
+}
+static_assert(packRgb565(255, 255, 255) == 0xFFFF);
+static_assert(packRgb565(-10, 300, 0) == 0x07E0);
+
+/// Converts YUV422 (Y0 U Y1 V) pixels to grayscale (luma only), four at once.
+inline void convertRowYuv422ToGrayscale(const uint8_t* source, uint8_t* destination, int32_t width)
+{
+	auto s = reinterpret_cast<const uint32_t*>(source);
+	auto d = reinterpret_cast<uint32_t*>(destination);
+	const int32_t quads = width / 4;
+	for (int32_t i = 0; i < quads; i++) {
+		const uint32_t a = s[2 * i];
+		const uint32_t b = s[2 * i + 1];
+		d[i] = (a & 0xFF) | ((a >> 8) & 0xFF00) | ((b & 0xFF) << 16) | ((b << 8) & 0xFF000000);
+	}
+	for (int32_t i = quads * 4; i < width; i++) {
+		destination[i] = source[i * 2];
+	}
+}
+
+/// Converts image row by row into small (reused) line buffer, allowing to 
+/// stream the bitmap pixel data without copying the whole frame. 
+/// If no kernel is given, rows are passed straight from the source (zero-copy),
+/// which requires the source stride to match the bitmap stride.
+class RowConverter
+{
+	RowKernel kernel;
+	const uint8_t* source;
+	uint32_t sourceStride;
+	int32_t width;
+	int32_t height;
+	uint32_t stride;
+	uint8_t* lineBuffer;
+	int32_t rowsPerBatch;
+	int32_t row = 0;
+	const uint8_t* batch = nullptr;
+
+public:
+	RowConverter(
+		RowKernel kernel, const uint8_t* source, uint32_t sourceStride,
+		int32_t width, int32_t height, uint16_t bitsPerPixel,
+		uint8_t* lineBuffer, size_t lineBufferSize
+	)
+		: kernel(kernel), source(source), sourceStride(sourceStride)
+		, width(width), height(height), stride(rowStride(width, bitsPerPixel))
+		, lineBuffer(lineBuffer)
+		, rowsPerBatch(kernel ? lineBufferSize / stride : height)
+	{
+		if (kernel && lineBuffer) {
+			// Padding bytes are never written by kernels, so clear them once.
+			for (size_t i = 0; i < lineBufferSize; i++) lineBuffer[i] = 0;
+		}
+	}
+
+	/// False if the line buffer is too small for even single row.
+	operator bool() const { return rowsPerBatch > 0; }
+
+	/// Converts next batch of rows. Returns number of bytes ready, or 0 if finished.
+	uint32_t next()
+	{
+		if (row >= height || rowsPerBatch <= 0) 
+			return 0;
+		const int32_t rows = (height - row < rowsPerBatch) ? height - row : rowsPerBatch;
+		const uint8_t* s = source + row * sourceStride;
+		if (kernel) {
+			for (int32_t i = 0; i < rows; i++) {
+				kernel(s + i * sourceStride, lineBuffer + i * stride, width);
+			}
+			batch = lineBuffer;
+		}
+		else {
+			batch = s;
+		}
+		row += rows;
+		return rows * stride;
+	}
+
+	/// Data of the last converted batch.
+	const uint8_t* data() const { return batch; }
+};
+
 }
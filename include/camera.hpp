@@ -1,7 +1,9 @@
 #pragma once
 #include <sdkconfig.h>
+#include <atomic>
 #include <esp_camera.h>
 #include "common.hpp"
+#include "pool.hpp"
 
 namespace app::camera 
 {
@@ -11,14 +13,15 @@ class FrameBufferGuard : SemaphoreGuard
 {
 protected:
 	camera_fb_t* fb;
+	uptime_t takenTime; // us, for metrics of mutex holding time
 
-	FrameBufferGuard(SemaphoreGuard&& sg, camera_fb_t* fb)
-		: SemaphoreGuard(std::move(sg)), fb(fb)
+	FrameBufferGuard(SemaphoreGuard&& sg, camera_fb_t* fb, uptime_t takenTime)
+		: SemaphoreGuard(std::move(sg)), fb(fb), takenTime(takenTime)
 	{}
 
 public:
 	FrameBufferGuard(FrameBufferGuard&& o) 
-		: SemaphoreGuard(std::move(o)), fb(std::exchange(o.fb, nullptr))
+		: SemaphoreGuard(std::move(o)), fb(std::exchange(o.fb, nullptr)), takenTime(o.takenTime)
 	{}
 
 	~FrameBufferGuard();
@@ -35,6 +38,194 @@ public:
 	static FrameBufferGuard take(TickType_t blockTime = portMAX_DELAY);
 };
 
+/// Reference-counted handle to frame buffer grabbed by the shared capture loop.
+/// Many consumers can hold the same frame at once; the buffer is returned
+/// to the camera driver after the last handle is released.
+/// The camera mutex is only held while grabbing the frame, not after.
+class SharedFrame
+{
+public:
+	struct Slot
+	{
+		camera_fb_t* fb;
+		std::atomic<uint16_t> references;
+		uint32_t sequence; // incremented for every frame grabbed by the loop
+	};
+
+protected:
+	Slot* slot;
+
+	explicit SharedFrame(Slot* slot)
+		: slot(slot)
+	{}
+
+public:
+	SharedFrame()
+		: slot(nullptr)
+	{}
+
+	SharedFrame(const SharedFrame& o)
+		: slot(o.slot)
+	{
+		if (slot) slot->references.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	SharedFrame(SharedFrame&& o)
+		: slot(std::exchange(o.slot, nullptr))
+	{}
+
+	SharedFrame& operator=(SharedFrame o)
+	{
+		std::swap(slot, o.slot);
+		return *this;
+	}
+
+	~SharedFrame() { reset(); }
+
+	/// Releases the handle, returning the buffer to the driver if it was the last one.
+	void reset();
+
+	operator bool() const { return slot != nullptr; }
+
+	operator camera_fb_t*() const { return slot->fb; }
+	camera_fb_t& operator*() const { return *slot->fb; }
+	camera_fb_t* operator->() const { return slot->fb; }
+
+	uint32_t sequence() const { return slot->sequence; }
+
+	friend void swap(SharedFrame& a, SharedFrame& b) { std::swap(a.slot, b.slot); }
+
+	/// Grabs new frame from the camera. Used by the capture loop.
+	static SharedFrame capture(TickType_t blockTime = portMAX_DELAY);
+};
+
+/// Consumer endpoint of the shared capture loop. Each subscriber has its own
+/// short queue of latest frames, dropping the oldest ones if consumer is too
+/// slow, so it never holds up the sensor nor other subscribers.
+/// Registers itself in the capture loop on construction and unregisters on destruction.
+class FrameSubscriber
+{
+	static constexpr uint8_t queueLength = 2;
+
+	/// Number of frames to be queued, limited by count of the driver buffers,
+	/// so slow consumer doesn't hold all of them, stalling the capture loop.
+	static uint8_t capacity();
+
+	SharedFrame queue[queueLength];
+	uint8_t head = 0; // index of the oldest frame in the queue
+	uint8_t count = 0;
+	uint32_t dropped = 0;
+	bool registered = false;
+	portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+	StaticSemaphore_t readySemaphoreBuffer;
+	SemaphoreHandle_t readySemaphore;
+
+public:
+	FrameSubscriber();
+	~FrameSubscriber();
+
+	FrameSubscriber(const FrameSubscriber&) = delete;
+	FrameSubscriber& operator=(const FrameSubscriber&) = delete;
+
+	/// False if the subscriber couldn't be registered (too many subscribers).
+	operator bool() const { return registered; }
+
+	/// Waits for next frame, returns empty handle on timeout.
+	SharedFrame next(TickType_t blockTime = portMAX_DELAY);
+
+	/// Number of frames dropped because of the consumer being too slow.
+	uint32_t droppedCount() const { return dropped; }
+
+	/// Pushes the frame to the queue, dropping the oldest one if full. Used by the capture loop.
+	void push(const SharedFrame& frame);
+
+	/// Releases all queued frames.
+	void clear();
+};
+
+/// Returns number of subscribers currently registered in the capture loop.
+uint8_t getSubscribersCount();
+
+/// Returns number of frames grabbed by the capture loop during last full second.
+uint16_t getFrameRate();
+
+/// Named camera profiles, allowing to quickly switch between uses, 
+/// i.e. streaming (JPEG) and vision processing (small raw frames).
+enum class Profile : uint8_t {
+	Stream, // follows the camera config
+	AI,
+	_Count,
+};
+
+struct ProfileSettings
+{
+	pixformat_t pixformat;
+	framesize_t framesize;
+	uint8_t quality; // for JPEG
+};
+
+ProfileSettings& getProfileSettings(Profile profile);
+Profile getCurrentProfile();
+
+/// Switches the sensor to given profile. Only sensor registers are changed 
+/// if possible (same pixel format, JPEG frame size not above the initial one),
+/// falling back to full reinitialization otherwise.
+void switchProfile(Profile profile);
+
+/// Returns frame size the driver was initialized with, which JPEG buffers are sized for.
+framesize_t getInitFramesize();
+
+/// Checks whenever switching the sensor to given settings would require
+/// reinitialization of the driver (see `canSwitchWithoutReinit`).
+bool requiresReinit(pixformat_t pixformat, framesize_t framesize);
+
+/// Sets JPEG quality (lower number is better) of the stream profile, applying
+/// it to the sensor if the profile is active. Like `quality` in the config.
+void setStreamQuality(uint8_t quality);
+
+/// Settings of adaptive rate control of the stream, adjusting JPEG quality 
+/// (and optionally frame size) to hold target frame rate over the link.
+struct RateControlSettings
+{
+	bool enabled;
+	bool adjustFramesize;      // if false, only quality is adjusted
+	uint8_t fps;               // target frame rate
+	uint8_t minQuality;        // best allowed (lower number is better)
+	uint8_t maxQuality;        // worst allowed
+	framesize_t minFramesize;
+	framesize_t maxFramesize;  // also limited by the initial one (JPEG buffers size)
+};
+
+RateControlSettings& getRateControlSettings();
+
+/// Reports JPEG frame sent by stream client, as input of the adaptive rate control.
+/// @param length Size of the frame in bytes.
+/// @param sendTime Time it took to send the frame, in microseconds.
+void reportStreamFrame(size_t length, uint32_t sendTime);
+
+/// Frame converted in software, owning its buffer. Used for profiles with raw 
+/// pixel format while the sensor runs in JPEG (i.e. shared with the stream).
+class ConvertedFrame
+{
+	camera_fb_t fb {};
+	pool::Buffer buffer; // from the large buffers pool, so converting doesn't allocate
+
+public:
+	ConvertedFrame() = default;
+	ConvertedFrame(ConvertedFrame&& o);
+	ConvertedFrame(const ConvertedFrame&) = delete;
+
+	operator bool() const { return fb.buf != nullptr; }
+
+	operator const camera_fb_t*() const { return &fb; }
+	const camera_fb_t& operator*() const { return fb; }
+	const camera_fb_t* operator->() const { return &fb; }
+
+	/// Decodes JPEG frame into RGB565 or grayscale, downscaled (by power of 2) 
+	/// to the largest size that still fits given frame size.
+	static ConvertedFrame fromJpeg(const camera_fb_t* source, pixformat_t pixformat, framesize_t framesize);
+};
+
 /// Initializes camera system
 void init();
 
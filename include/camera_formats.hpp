@@ -0,0 +1,215 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <iterator>
+#include <sensor.h>
+#include "utils.hpp"
+
+namespace app::camera
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Descriptors of frame sizes and pixel formats
+
+/// Describes frame size supported by the sensor (OV2640).
+struct FramesizeDescriptor
+{
+	framesize_t framesize;
+	const char* name;       // as in `framesize_t`, without prefix
+	const char* dimensions; // alias, like "320x240"
+	uint16_t width;
+	uint16_t height;
+	bool native;            // sensor mode, others are scaled down from it
+	uint32_t nameHash;      // case-insensitive, for parsing
+	uint32_t dimensionsHash;
+
+	constexpr size_t pixels() const { return static_cast<size_t>(width) * height; }
+};
+
+/// Describes pixel format of the camera driver.
+struct PixformatDescriptor
+{
+	pixformat_t pixformat;
+	const char* name;     // as in `pixformat_t`, without prefix
+	uint8_t bitsPerPixel; // or 0 if compressed
+	uint32_t nameHash;    // case-insensitive, for parsing
+
+	constexpr bool compressed() const { return bitsPerPixel == 0; }
+};
+
+constexpr FramesizeDescriptor describeFramesize(framesize_t framesize, const char* name, const char* dimensions,
+	uint16_t width, uint16_t height, bool native = false)
+{
+	return { framesize, name, dimensions, width, height, native, fnv1a32i(name), fnv1a32i(dimensions) };
+}
+
+constexpr PixformatDescriptor describePixformat(pixformat_t pixformat, const char* name, uint8_t bitsPerPixel)
+{
+	return { pixformat, name, bitsPerPixel, fnv1a32i(name) };
+}
+
+/// Frame sizes supported by the sensor, ascending. Larger ones of the driver
+/// (like `FHD` or `QXGA`) are for other sensors.
+constexpr FramesizeDescriptor framesizes[] = {
+	describeFramesize(FRAMESIZE_96X96,   "96X96",   "96x96",      96,   96),
+	describeFramesize(FRAMESIZE_QQVGA,   "QQVGA",   "160x120",   160,  120),
+	describeFramesize(FRAMESIZE_QCIF,    "QCIF",    "176x144",   176,  144),
+	describeFramesize(FRAMESIZE_HQVGA,   "HQVGA",   "240x176",   240,  176),
+	describeFramesize(FRAMESIZE_240X240, "240X240", "240x240",   240,  240),
+	describeFramesize(FRAMESIZE_QVGA,    "QVGA",    "320x240",   320,  240),
+	describeFramesize(FRAMESIZE_CIF,     "CIF",     "400x296",   400,  296, true),
+	describeFramesize(FRAMESIZE_HVGA,    "HVGA",    "480x320",   480,  320),
+	describeFramesize(FRAMESIZE_VGA,     "VGA",     "640x480",   640,  480),
+	describeFramesize(FRAMESIZE_SVGA,    "SVGA",    "800x600",   800,  600, true),
+	describeFramesize(FRAMESIZE_XGA,     "XGA",     "1024x768", 1024,  768),
+	describeFramesize(FRAMESIZE_HD,      "HD",      "1280x720", 1280,  720),
+	describeFramesize(FRAMESIZE_SXGA,    "SXGA",    "1280x1024", 1280, 1024),
+	describeFramesize(FRAMESIZE_UXGA,    "UXGA",    "1600x1200", 1600, 1200, true),
+};
+
+/// Pixel formats of the driver.
+constexpr PixformatDescriptor pixformats[] = {
+	describePixformat(PIXFORMAT_RGB565,    "RGB565",    16),
+	describePixformat(PIXFORMAT_YUV422,    "YUV422",    16),
+	describePixformat(PIXFORMAT_YUV420,    "YUV420",    12),
+	describePixformat(PIXFORMAT_GRAYSCALE, "GRAYSCALE",  8),
+	describePixformat(PIXFORMAT_JPEG,      "JPEG",       0),
+	describePixformat(PIXFORMAT_RGB888,    "RGB888",    24),
+	describePixformat(PIXFORMAT_RAW,       "RAW",        8),
+	describePixformat(PIXFORMAT_RGB444,    "RGB444",    12), // 3 bytes per 2 pixels
+	describePixformat(PIXFORMAT_RGB555,    "RGB555",    12), // 3 bytes per 2 pixels
+};
+
+/// No invalid value in the enum, so artificial value used here.
+constexpr pixformat_t invalidPixformat = static_cast<pixformat_t>(-1);
+
+namespace detail
+{
+
+/// Checks the table: ascending, dimensions matching their alias, unique hashes.
+constexpr bool validateFramesizes()
+{
+	for (size_t i = 0; i < std::size(framesizes); i++) {
+		const auto& f = framesizes[i];
+		const std::string_view dimensions = f.dimensions;
+		const auto x = dimensions.find('x');
+		if (x == std::string_view::npos) return false;
+		if (parseUnsigned(dimensions.substr(0, x)) != f.width) return false;
+		if (parseUnsigned(dimensions.substr(x + 1)) != f.height) return false;
+		if (i && (f.framesize <= framesizes[i - 1].framesize || f.pixels() < framesizes[i - 1].pixels())) return false;
+		for (size_t j = 0; j < i; j++) {
+			const auto& o = framesizes[j];
+			if (f.nameHash == o.nameHash || f.nameHash == o.dimensionsHash) return false;
+			if (f.dimensionsHash == o.nameHash || f.dimensionsHash == o.dimensionsHash) return false;
+		}
+	}
+	return true;
+}
+
+constexpr bool validatePixformats()
+{
+	for (size_t i = 0; i < std::size(pixformats); i++)
+		for (size_t j = 0; j < i; j++)
+			if (pixformats[i].nameHash == pixformats[j].nameHash || pixformats[i].pixformat == pixformats[j].pixformat)
+				return false;
+	return true;
+}
+
+}
+static_assert(detail::validateFramesizes(), "Invalid frame sizes table");
+static_assert(detail::validatePixformats(), "Invalid pixel formats table");
+
+/// Returns descriptor of the frame size, or null if unsupported.
+constexpr const FramesizeDescriptor* findFramesize(framesize_t framesize)
+{
+	for (const auto& f : framesizes)
+		if (f.framesize == framesize)
+			return &f;
+	return nullptr;
+}
+
+/// Returns descriptor of the pixel format, or null if unknown.
+constexpr const PixformatDescriptor* findPixformat(pixformat_t pixformat)
+{
+	for (const auto& p : pixformats)
+		if (p.pixformat == pixformat)
+			return &p;
+	return nullptr;
+}
+
+/// Parses frame size by its value (number), name or dimensions (like `QVGA`,
+/// `FRAMESIZE_QVGA` or `320x240`, case-insensitive). Returns `FRAMESIZE_INVALID` if unsupported.
+constexpr framesize_t parseFramesize(std::string_view sv)
+{
+	if (!sv.empty() && isDigit(sv.front()) && sv.find('x') == std::string_view::npos && sv.find('X') == std::string_view::npos) {
+		const auto* f = findFramesize(static_cast<framesize_t>(parseUnsigned(sv)));
+		return f ? f->framesize : FRAMESIZE_INVALID;
+	}
+	const auto pos = sv.find('_'); // try skip FRAMESIZE_
+	if (pos != std::string_view::npos) sv.remove_prefix(pos + 1);
+	const uint32_t hash = fnv1a32i(sv);
+	for (const auto& f : framesizes)
+		if (f.nameHash == hash || f.dimensionsHash == hash)
+			return f.framesize;
+	return FRAMESIZE_INVALID;
+}
+
+/// Parses pixel format by its value (number) or name (like `JPEG` or
+/// `PIXFORMAT_JPEG`, case-insensitive). Returns `invalidPixformat` if unknown.
+constexpr pixformat_t parsePixformat(std::string_view sv)
+{
+	if (!sv.empty() && isDigit(sv.front())) {
+		const auto* p = findPixformat(static_cast<pixformat_t>(parseUnsigned(sv)));
+		return p ? p->pixformat : invalidPixformat;
+	}
+	const auto pos = sv.find('_'); // try skip PIXFORMAT_
+	if (pos != std::string_view::npos) sv.remove_prefix(pos + 1);
+	const uint32_t hash = fnv1a32i(sv);
+	for (const auto& p : pixformats)
+		if (p.nameHash == hash)
+			return p.pixformat;
+	return invalidPixformat;
+}
+
+/// Returns size of frame buffer for given settings (for JPEG as reserved by the driver),
+/// or 0 if unsupported.
+constexpr size_t frameBufferSize(pixformat_t pixformat, framesize_t framesize)
+{
+	const auto* f = findFramesize(framesize);
+	const auto* p = findPixformat(pixformat);
+	if (!f || !p) return 0;
+	if (p->compressed()) return f->pixels() / 5;
+	return f->pixels() * p->bitsPerPixel / 8;
+}
+
+/// Checks whenever the driver (initialized with given frame size) can switch
+/// between given settings by changing the sensor registers only, without
+/// reinitialization. Changing pixel format, or frame size of raw frames, requires it;
+/// JPEG frame size can change freely, as long as it fits the buffers sized for
+/// the initial one. See comment from the library maintainer https://github.com/espressif/esp32-camera/issues/612#issuecomment-1880837969
+/// and source code of esp32-camera (especially `cam_config` function).
+constexpr bool canSwitchWithoutReinit(
+	pixformat_t fromPixformat, framesize_t fromFramesize,
+	pixformat_t toPixformat, framesize_t toFramesize,
+	framesize_t initFramesize
+) {
+	if (fromPixformat != toPixformat)
+		return false;
+	if (fromFramesize == toFramesize)
+		return true;
+	if (toPixformat != PIXFORMAT_JPEG)
+		return false;
+	const auto* to = findFramesize(toFramesize);
+	const auto* init = findFramesize(initFramesize);
+	return to && init && to->width <= init->width && to->height <= init->height;
+}
+
+static_assert(parseFramesize("qvga") == FRAMESIZE_QVGA && parseFramesize("FRAMESIZE_UXGA") == FRAMESIZE_UXGA);
+static_assert(parseFramesize("400x296") == FRAMESIZE_CIF && parseFramesize("8") == FRAMESIZE_VGA);
+static_assert(parsePixformat("jpeg") == PIXFORMAT_JPEG && parsePixformat("3") == PIXFORMAT_GRAYSCALE);
+static_assert(canSwitchWithoutReinit(PIXFORMAT_JPEG, FRAMESIZE_SVGA, PIXFORMAT_JPEG, FRAMESIZE_QVGA, FRAMESIZE_UXGA));
+static_assert(!canSwitchWithoutReinit(PIXFORMAT_JPEG, FRAMESIZE_QVGA, PIXFORMAT_JPEG, FRAMESIZE_SVGA, FRAMESIZE_VGA));
+static_assert(!canSwitchWithoutReinit(PIXFORMAT_GRAYSCALE, FRAMESIZE_QVGA, PIXFORMAT_GRAYSCALE, FRAMESIZE_QQVGA, FRAMESIZE_UXGA));
+
+}
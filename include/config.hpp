@@ -0,0 +1,266 @@
+#pragma once
+#include <sdkconfig.h>
+#include <array>
+#include <atomic>
+#include <string_view>
+#include <esp_err.h>
+#include "common.hpp"
+#include "json.hpp"
+
+/// Configuration described by compile-time tables of fields (key, hash, setter,
+/// getter and type), from which parsing dispatch, JSON serialization and binary
+/// encoding are done. Adding field only requires adding entry to the table.
+namespace app::config
+{
+
+/// Types of configuration fields, deciding how values are serialized.
+enum class Type : uint8_t {
+	Boolean, // as 0 or 1 in JSON (like the other numbers)
+	Integer,
+	Float,   // with single decimal digit in JSON
+	String,
+	Ip4,     // IPv4 address (network byte order), as dotted string in JSON
+	Object,
+};
+
+struct Object;
+
+/// Setter applying the value, passed as text (from JSON or decoded from binary).
+using Setter = esp_err_t (*)(const json::Field& field);
+
+/// Descriptor of single configuration field. Fields without getter are
+/// write-only (i.e. aliases or actions), without setter are read-only.
+struct Field
+{
+	const char* key;
+	uint32_t hash;
+	Type type;
+	Setter set;
+	union {
+		bool (*boolean)();
+		int32_t (*integer)(); // also for IPv4 addresses
+		float (*number)();
+		std::string_view (*string)();
+		const Object* object;
+		const void* any;
+	} get;
+
+	bool readable() const { return get.any != nullptr; }
+};
+
+constexpr Field boolean(const char* key, Setter set, bool (*get)())
+{
+	return { key, fnv1a32(key), Type::Boolean, set, { .boolean = get } };
+}
+constexpr Field integer(const char* key, Setter set, int32_t (*get)())
+{
+	return { key, fnv1a32(key), Type::Integer, set, { .integer = get } };
+}
+constexpr Field number(const char* key, Setter set, float (*get)())
+{
+	return { key, fnv1a32(key), Type::Float, set, { .number = get } };
+}
+constexpr Field string(const char* key, Setter set, std::string_view (*get)())
+{
+	return { key, fnv1a32(key), Type::String, set, { .string = get } };
+}
+constexpr Field ip4(const char* key, Setter set, int32_t (*get)())
+{
+	return { key, fnv1a32(key), Type::Ip4, set, { .integer = get } };
+}
+constexpr Field object(const char* key, const Object& object)
+{
+	return { key, fnv1a32(key), Type::Object, nullptr, { .object = &object } };
+}
+/// Write-only field, i.e. alternative key for other field or an action.
+constexpr Field alias(const char* key, Setter set)
+{
+	return { key, fnv1a32(key), Type::Integer, set, { .any = nullptr } };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Generations
+
+/// Counter of changes of configuration object, allowing clients to skip 
+/// unchanged data. All objects take values from single sequence, so single 
+/// number (see `currentGeneration`) tells the client what changed since. 
+class Generation
+{
+	std::atomic<uint32_t> value { 0 }; // relative to boot, 0 if not changed since
+
+public:
+	/// Marks the object as changed. Has to be called after the change
+	/// is visible to getters, so clients can't get old data with new generation.
+	void bump();
+
+	/// Checks if the object changed after given generation (assuming it is valid).
+	bool changedSince(uint32_t since) const;
+};
+
+/// Returns the latest generation. Starts at random (non-zero) value every boot,
+/// so it can be used as entity tag.
+uint32_t currentGeneration();
+
+/// Checks if the generation could be returned by `currentGeneration` since boot.
+bool isValidGeneration(uint32_t generation);
+
+////////////////////////////////////////////////////////////////////////////////
+// Tables
+
+struct IndexEntry
+{
+	uint32_t hash;
+	uint8_t field;
+};
+
+/// Fields indices sorted by key hashes, for binary search.
+template <size_t N>
+struct Index
+{
+	std::array<IndexEntry, N> entries;
+	bool unique; // false if any keys hashes collide
+
+	constexpr Index(const Field (&fields)[N])
+		: entries(), unique(true)
+	{
+		static_assert(N < 256);
+		for (size_t i = 0; i < N; i++) {
+			IndexEntry entry { fields[i].hash, static_cast<uint8_t>(i) };
+			size_t j = i;
+			for (; j > 0 && entries[j - 1].hash > entry.hash; j--)
+				entries[j] = entries[j - 1];
+			entries[j] = entry;
+		}
+		for (size_t i = 1; i < N; i++)
+			if (entries[i - 1].hash == entries[i].hash)
+				unique = false;
+	}
+};
+
+/// Table of fields, optionally with hooks called around reading/applying them.
+struct Object
+{
+	const Field* fields;
+	const IndexEntry* index;
+	uint8_t count;
+	esp_err_t (*begin)();         // i.e. to load state; on error the object is written empty
+	esp_err_t (*end)(bool apply); // apply is false if only reading or if request failed
+	Generation* generation;       // bumped after changes were applied; null to inherit parent one
+
+	template <size_t N>
+	constexpr Object(
+		const Field (&fields)[N], const Index<N>& index,
+		esp_err_t (*begin)() = nullptr, esp_err_t (*end)(bool apply) = nullptr,
+		Generation* generation = nullptr
+	)
+		: fields(fields), index(index.entries.data()), count(N), begin(begin), end(end), generation(generation)
+	{}
+
+	const Field* find(uint32_t hash) const;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Output
+
+/// Buffered output, flushed (i.e. sent as chunk) using the callback when full.
+/// Without the callback, it fails when the buffer is full.
+class Writer
+{
+public:
+	using Callback = bool (*)(void* context, const char* data, size_t length);
+
+protected:
+	char* buffer;
+	size_t length;
+	size_t used = 0;
+	Callback callback;
+	void* context;
+	bool failed = false;
+
+public:
+	Writer(char* buffer, size_t length, Callback callback = nullptr, void* context = nullptr)
+		: buffer(buffer), length(length), callback(callback), context(context)
+	{}
+
+	inline void put(char c)
+	{
+		if (unlikely(used == length) && !flush()) return;
+		buffer[used++] = c;
+	}
+
+	void write(const void* data, size_t count);
+	inline void write(std::string_view sv) { write(sv.data(), sv.size()); }
+
+	/// Passes the buffered data to the callback.
+	bool flush();
+
+	bool ok() const { return !failed; }
+	size_t size() const { return used; }
+	const char* data() const { return buffer; }
+};
+
+/// Writes unsigned number, digit by digit, without `printf`.
+void writeUnsigned(Writer& writer, uint64_t value);
+void writeInteger(Writer& writer, int32_t value);
+void writeFloat(Writer& writer, float value, uint8_t decimals);
+void writeIp4(Writer& writer, uint32_t address);
+void writeJsonString(Writer& writer, std::string_view sv);
+
+/// Writes current values of readable fields as JSON object,
+/// calling the hooks (written empty if failed to begin).
+/// @param braces False to skip the object braces and prefix every field
+///		with comma instead, i.e. to follow other fields.
+/// @param since Generation (see `currentGeneration`) to skip nested objects
+///		not changed since, or 0 to write everything.
+void writeJson(Writer& writer, const Object& object, bool braces = true, uint32_t since = 0);
+
+////////////////////////////////////////////////////////////////////////////////
+// Input
+
+/// Dispatcher of events from the JSON push parser to the setters,
+/// calling the hooks of (nested) objects.
+class Dispatcher
+{
+	const Object* objects[json::PushParser::maxDepth + 1]; // null for ignored ones
+	uint16_t touched = 0; // bit set for objects with any setter called, for generations
+
+public:
+	Dispatcher(const Object& root)
+		: objects { &root }
+	{}
+
+	/// To be used as `json::PushParser` callback, with the dispatcher as context.
+	static esp_err_t callback(void* context, const json::Field& field);
+
+	/// Ends (with `apply` false) all still open objects, i.e. after parsing failed.
+	void abort();
+
+protected:
+	esp_err_t dispatch(const json::Field& field);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Binary encoding
+
+/// Binary encoding: magic (2 bytes), version (1 byte), schema hash (4 bytes, little endian),
+/// then values of readable fields, in tables order: booleans as single byte,
+/// integers as zigzag varints, floats as 4 bytes (little endian), strings as
+/// varint length followed by bytes, IPv4 addresses as 4 bytes (network order),
+/// objects as presence byte (0 if failed to begin) followed by its fields.
+constexpr char binaryMagic[2] = { 'Y', 'C' };
+constexpr uint8_t binaryVersion = 1;
+constexpr size_t binaryHeaderLength = 7;
+
+/// Calculates hash of the layout (keys and types of readable fields),
+/// allowing to detect incompatible binary data.
+uint32_t schemaHash(const Object& object);
+
+/// Writes current values of readable fields using the binary encoding.
+void writeBinary(Writer& writer, const Object& object);
+
+/// Applies all writable fields from the binary encoding, bumping generations.
+/// @return `ESP_ERR_INVALID_VERSION` if magic, version or layout mismatch,
+///		`ESP_ERR_INVALID_SIZE` if data is truncated, or error from the setters.
+esp_err_t readBinary(const Object& object, const uint8_t* data, size_t length);
+
+}
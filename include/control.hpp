@@ -1,19 +1,13 @@
 #pragma once
 #include <sdkconfig.h>
+#include "common.hpp"
 
 namespace app::control 
 {
 
-/// Initializes control system state (motor & lights).
+/// Initializes control system state (motor & lights) and starts the control loop.
 void init();
 
-/// Runs control system update tick, incl. safety stop checks 
-/// (like in case of timeout, for no control request in some time).
-void tick();
-
-/// Marks current control state as fresh (prevents timeout for safety stop).
-void refresh();
-
 /// Enum type used to specify motor among them all.
 enum class Motor {
 	Left,
@@ -21,13 +15,91 @@ enum class Motor {
 	_Count,
 };
 
+/// Profiles of smooth transition between motor duty values.
+enum class SmoothingProfile : uint8_t {
+	Linear,
+	SCurve, // Smoothstep: gentle start and end, limiting current spikes.
+};
+
+/// Command for the control loop. Only fields selected in the mask are applied.
+struct Command
+{
+	enum Fields : uint8_t {
+		None       = 0,
+		MainLight  = 1 << 0,
+		OtherLight = 1 << 1,
+		MotorLeft  = 1 << 2,
+		MotorRight = 1 << 3,
+		Motors     = MotorLeft | MotorRight,
+		All        = MainLight | OtherLight | Motors,
+	};
+
+	uint8_t fields;
+	bool mainLight;
+	bool otherLight;
+	SmoothingProfile profile;
+	uint16_t smoothingTime; // ms
+	float left;  // 12.3f = 12.3%
+	float right;
+	bool hint; // automated (like vision steering), doesn't mark the control state as fresh
+	uptime_t posted; // us, set when posting
+};
+
+/// Fills fields missing in the command from older one, which it replaces
+/// (like pending one in the mailbox, or coalesced packets).
+constexpr void mergeCommand(Command& command, const Command& older)
+{
+	const uint8_t missing = older.fields & ~command.fields;
+	if (missing & Command::MainLight) 
+		command.mainLight = older.mainLight;
+	if (missing & Command::OtherLight) 
+		command.otherLight = older.otherLight;
+	if (missing & Command::MotorLeft) 
+		command.left = older.left;
+	if (missing & Command::MotorRight) 
+		command.right = older.right;
+	if (!(command.fields & Command::Motors)) {
+		command.smoothingTime = older.smoothingTime;
+		command.profile = older.profile;
+	}
+	command.fields |= missing;
+	command.hint = command.hint && older.hint;
+}
+
+/// Posts command to the control loop, merged into previous one if it was not yet
+/// applied (latest wins for fields present in both, others are kept). Lock-free, 
+/// can be used from any task. Any command, even empty, marks the control state
+/// as fresh (prevents timeout for safety stop), unless it's only a hint.
+void post(Command command);
+
+/// Statistics of time between posting the command and applying it (to PWM).
+struct LatencyStats
+{
+	uint32_t last;    // us
+	uint32_t average; // us, exponential moving average
+	uint32_t max;     // us
+	uint32_t count;   // number of commands applied
+};
+
+LatencyStats getLatencyStats();
+
+// Setters below are applied directly, used by the control loop itself,
+// other tasks should use `post` instead.
+
 void setMainLight(bool on);
 bool getMainLight();
 
 void setOtherLight(bool on);
 bool getOtherLight();
 
+/// Sets motor duty (12.3f = 12.3%) immediately (on next control loop tick).
 void setMotor(Motor which, float duty);
+
+/// Sets motor duty (12.3f = 12.3%), smoothly transitioning from current value
+/// over given time (in milliseconds). Interpolated by the control loop.
+void setMotor(Motor which, float duty, uint32_t smoothingTime, SmoothingProfile profile = SmoothingProfile::Linear);
+
+/// Returns current motor duty (12.3f = 12.3%), as applied by the control loop.
 float getMotor(Motor which);
 
 }
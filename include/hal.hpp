@@ -5,6 +5,7 @@
 #include "common.hpp"
 
 #define MOTORS_FREQUENCY 100 // Hz
+#define MOTORS_TIMER_RESOLUTION 1'000'000 // Hz, used by the (legacy) MCPWM driver
 #define GPIO_MOTORS_RIGHT_FORWARD  GPIO_NUM_12
 #define GPIO_MOTORS_RIGHT_BACKWARD GPIO_NUM_2
 #define GPIO_MOTORS_LEFT_FORWARD   GPIO_NUM_15
@@ -30,6 +31,19 @@ enum class Motor {
 /// Use negative values to move backwards.
 void setMotor(Motor which, float duty);
 
+/// Number of MCPWM timer ticks in single period of the motors PWM signal.
+constexpr int32_t motorPeriodTicks = MOTORS_TIMER_RESOLUTION / MOTORS_FREQUENCY;
+
+/// Quantizes duty cycle (12.3f = 12.3%) to signed MCPWM compare value, 
+/// allowing to tell whenever the change would actually affect the output.
+constexpr int32_t quantizeMotorDuty(float duty)
+{
+	const float ticks = duty * motorPeriodTicks / 100;
+	return static_cast<int32_t>(ticks < 0 ? ticks - 0.5f : ticks + 0.5f);
+}
+static_assert(quantizeMotorDuty(0.001f) == 0);
+static_assert(quantizeMotorDuty(-50.f) == -motorPeriodTicks / 2);
+
 /// Initializes project custom hardware: motors and lights
 void init();
 
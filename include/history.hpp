@@ -0,0 +1,88 @@
+#pragma once
+#include <sdkconfig.h>
+#include "common.hpp"
+
+/// History of recent frames (ring in PSRAM, within configured budget), fed by
+/// the shared capture loop, for analysis of incidents like safety stops.
+namespace app::history
+{
+
+struct Settings
+{
+	bool enabled;
+	uint16_t budget;   // KB, memory for the frames, allocated while enabled
+	uint16_t duration; // ms, older frames are dropped
+	uint16_t interval; // ms, minimal time between recorded frames, 0 to record every frame
+};
+
+Settings& getSettings();
+
+/// Recorded frame metadata, with control state at the time of recording.
+struct Entry
+{
+	uint32_t offset;    // of the data in the ring
+	uint32_t length;
+	uptime_t timestamp; // us, capture time
+	uint32_t sequence;  // of the capture loop
+	uint16_t width;
+	uint16_t height;
+	uint8_t pixformat;  // `pixformat_t`
+	float left;         // motors duty (12.3f = 12.3%)
+	float right;
+};
+
+enum class Trigger : uint8_t {
+	None,
+	SafetyStop, // by the control loop, stopping moving motors
+	Request,    // by client
+};
+
+const char* toString(Trigger trigger);
+
+/// Freezes the history (stops recording), preserving frames from before the
+/// event, until resumed. Only the first trigger is kept. Lock-free, cheap
+/// enough to be called from the control loop.
+void trigger(Trigger reason);
+
+/// Resumes recording after being frozen.
+void resume();
+
+struct Status
+{
+	Trigger trigger;
+	uptime_t triggerTime; // us
+	uint16_t count;       // frames
+	uint32_t used;        // bytes
+	uint32_t capacity;    // bytes
+};
+
+Status getStatus();
+
+/// Exclusive access to the recorded frames, pausing recording while held,
+/// so the frames can be sent straight from the ring (without copying).
+class Reader
+{
+	bool acquired;
+
+public:
+	Reader();
+	~Reader();
+
+	Reader(const Reader&) = delete;
+	Reader& operator=(const Reader&) = delete;
+
+	/// False if other reader is active.
+	operator bool() const { return acquired; }
+
+	uint16_t count() const;
+
+	/// Returns entry by index, from the oldest.
+	const Entry& entry(uint16_t index) const;
+
+	const uint8_t* data(const Entry& entry) const;
+};
+
+/// Starts the history task, waiting until enabled.
+void init();
+
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <sdkconfig.h>
+#include <string_view>
+#include <esp_err.h>
+#include "common.hpp"
+
+namespace app::json
+{
+
+enum class FieldType : uint8_t {
+	String,
+	Primitive,   // number, boolean or null (not validated)
+	ObjectBegin,
+	ObjectEnd,
+};
+
+/// Event emitted by the push parser for every member of (nested) objects.
+/// Arrays (and everything inside them) are skipped.
+struct Field
+{
+	FieldType type;
+	uint8_t depth;         // number of enclosing objects, excluding the root one
+	const uint32_t* path;  // hashes of keys of enclosing objects, `depth` elements
+	std::string_view key;  // empty for `ObjectEnd`
+	uint32_t keyHash;      // also set for `ObjectEnd`
+	char* value;           // null-terminated, can be modified in place; only for strings and primitives
+	uint8_t valueLength;
+
+	bool isString() const { return type == FieldType::String; }
+	bool isObject() const { return type == FieldType::ObjectBegin || type == FieldType::ObjectEnd; }
+
+	/// Returns the same field, but relative to the first enclosing object,
+	/// used to pass fields of nested object to its own handler.
+	Field inner() const
+	{
+		Field f = *this;
+		f.path++;
+		f.depth--;
+		return f;
+	}
+};
+
+/// Incremental (push) JSON parser, consuming input in chunks of any size
+/// and emitting events for members of objects. The root has to be object.
+/// Memory usage is constant, whatever the document size: only current key
+/// and value are buffered (both limited in length), with hashes of keys
+/// of enclosing objects.
+class PushParser
+{
+public:
+	static constexpr uint8_t maxDepth = 8;
+	static constexpr uint8_t maxKeyLength = 31;
+	static constexpr uint8_t maxValueLength = 127;
+
+	/// Callback for the events. Returning error stops the parsing.
+	using Callback = esp_err_t (*)(void* context, const Field& field);
+
+protected:
+	enum class State : uint8_t {
+		Start,          // expecting root object
+		KeyOrEnd,       // after opening object
+		Key,            // after comma in object
+		KeyString,
+		Colon,
+		Value,
+		ValueOrEnd,     // after opening array
+		ValueString,
+		ValuePrimitive,
+		CommaOrEnd,
+		Finished,
+	};
+
+	Callback callback;
+	void* context;
+	State state = State::Start;
+	uint8_t depth = 0;      // number of open containers, including the root
+	uint8_t arrayDepth = 0; // depth of the outermost open array, 0 if none
+	uint8_t escape = 0;     // 1 after backslash, 2 to 5 for unicode escape digits
+	uint16_t codepoint = 0;
+	uint32_t arrays = 0;    // bit set for open containers being arrays
+	uint32_t path[maxDepth];
+	uint32_t keyHash = 0;
+	char key[maxKeyLength + 1];
+	char value[maxValueLength + 1];
+	uint8_t keyLength = 0;
+	uint8_t valueLength = 0;
+	esp_err_t error = ESP_OK;
+
+public:
+	PushParser(Callback callback, void* context)
+		: callback(callback), context(context)
+	{}
+
+	/// Consumes next chunk of the document.
+	/// @return `ESP_OK` if all correct so far, `ESP_ERR_INVALID_ARG` for malformed document,
+	///		`ESP_ERR_INVALID_SIZE` for too long keys/values or too deep nesting,
+	///		or error returned by the callback.
+	esp_err_t feed(const char* data, size_t length);
+
+	/// Checks if the whole document was consumed.
+	esp_err_t finish();
+
+protected:
+	inline bool inArray() const { return arrays & (1u << (depth - 1)); }
+	inline bool emitting() const { return arrayDepth == 0; }
+
+	esp_err_t emit(FieldType type);
+	esp_err_t open(bool array);
+	esp_err_t close(bool array);
+	bool append(char c);
+	bool appendCodepoint(uint16_t cp);
+};
+
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include <sdkconfig.h>
+#include <atomic>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include "common.hpp"
+
+namespace app::metrics
+{
+
+/// Counters of events, kept per core.
+enum class Counter : uint8_t {
+	FramesCaptured,   // by the shared capture loop
+	FramesDropped,    // by stream clients (subscribers) being too slow
+	StreamFramesSent,
+	UdpPackets,
+	ControlCommands,  // applied by the control loop
+	WifiDisconnects,  // of the station from AP
+	WifiReconnects,   // attempts with full scan
+	WifiFastReconnects, // attempts using cached BSSID & channel
+	WifiFallbacks,    // to AP mode, after failing to reconnect
+	RadioProfileSwitches,
+	RateControlAdjustments, // of stream JPEG quality or frame size
+	UdpVideoFramesSent,
+	UdpVideoFramesDropped,  // given up on, due to network buffers full
+	PoolAllocations,  // buffers (re)allocated by the pools, should stop growing after warm up
+	HttpAsyncFallbacks, // long requests handled in the main HTTP server task, all workers busy
+	HistoryTriggers,  // frames history frozen, by safety stop or client
+	StreamClients,    // stream viewers started
+	UdpBatches,       // protocol v2 batches handled (not dropped)
+	UdpAcksSent,
+	HttpNotModified,  // responses of embedded files or config, as clients had them cached
+	WebSocketMessages, // received on `/ws`, including ignored ones
+	_Count,
+};
+
+/// Histograms of measured values (mostly durations in microseconds), kept per core.
+enum class Histogram : uint8_t {
+	CameraMutexWait,  // us
+	CameraMutexHold,  // us
+	CameraAcquire,    // us, time of getting frame buffer from the driver
+	JpegSize,         // bytes
+	StreamSend,       // us, per frame
+	ControlLatency,   // us, from posting the command to applying it to PWM
+	HttpStatus,       // us, handlers durations
+	HttpConfig,
+	HttpCapture,
+	WifiReconnectTime, // ms, from losing connection as station to getting it back
+	VisionProcess,    // us, per frame (including JPEG decoding)
+	UdpBatchProcess,  // us, dispatching commands of the batch
+	_Count,
+};
+
+/// Number of buckets, each one for the next power of 2 (last one is open).
+/// Bucket `i` counts values in range [2^(i-1), 2^i), bucket 0 counts zeros.
+constexpr uint8_t bucketsCount = 20;
+
+constexpr uint8_t bucketFor(uint32_t value)
+{
+	if (value == 0) return 0;
+	const uint8_t b = 32 - __builtin_clz(value);
+	return b < bucketsCount ? b : bucketsCount - 1;
+}
+static_assert(bucketFor(1) == 1);
+static_assert(bucketFor(1023) == 10);
+static_assert(bucketFor(1024) == 11);
+static_assert(bucketFor(UINT32_MAX) == bucketsCount - 1);
+
+struct HistogramData
+{
+	std::atomic<uint32_t> count;
+	std::atomic<uint32_t> sum; // wraps around, use with count of the same read
+	std::atomic<uint32_t> max;
+	std::atomic<uint32_t> buckets[bucketsCount];
+};
+
+struct PerCoreData
+{
+	std::atomic<uint32_t> counters[static_cast<uint8_t>(Counter::_Count)];
+	HistogramData histograms[static_cast<uint8_t>(Histogram::_Count)];
+};
+
+extern PerCoreData perCoreData[portNUM_PROCESSORS];
+
+/// Counts the event. Lock-free, cheap enough to be used anywhere.
+inline void count(Counter which, uint32_t n = 1)
+{
+	perCoreData[xPortGetCoreID()].counters[static_cast<uint8_t>(which)].fetch_add(n, std::memory_order_relaxed);
+}
+
+/// Records the value in the histogram. Lock-free, cheap enough to be used anywhere.
+inline void record(Histogram which, uint32_t value)
+{
+	auto& h = perCoreData[xPortGetCoreID()].histograms[static_cast<uint8_t>(which)];
+	h.count.fetch_add(1, std::memory_order_relaxed);
+	h.sum.fetch_add(value, std::memory_order_relaxed);
+	h.buckets[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+	uint32_t max = h.max.load(std::memory_order_relaxed);
+	while (max < value && !h.max.compare_exchange_weak(max, value, std::memory_order_relaxed));
+}
+
+/// Records time passed since given timestamp (from `esp_timer_get_time`).
+inline void recordSince(Histogram which, uptime_t start)
+{
+	record(which, static_cast<uint32_t>(esp_timer_get_time() - start));
+}
+
+/// Records duration of the scope.
+class ScopedTimer
+{
+	Histogram which;
+	uptime_t start;
+
+public:
+	ScopedTimer(Histogram which)
+		: which(which), start(esp_timer_get_time())
+	{}
+
+	~ScopedTimer()
+	{
+		recordSince(which, start);
+	}
+};
+
+/// Writes metrics in compact text format, line by line, using the callback.
+/// Returns false if the callback failed.
+bool write(bool (*callback)(void* context, const char* line, size_t length), void* context);
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <sdkconfig.h>
+#include <utility>
+#include "common.hpp"
+
+/// Pools of buffers derived from frames (BMP line buffers, converted frames,
+/// stream send buffers). Released buffers keep their memory for reuse, so after
+/// warming up the hot paths don't allocate, and the heap doesn't fragment.
+namespace app::pool
+{
+
+enum class Kind : uint8_t {
+	Internal, // small buffers in internal RAM, i.e. BMP line buffers
+	Large,    // frame sized buffers, in PSRAM if available
+	_Count,
+};
+
+struct Slot
+{
+	uint8_t* data;
+	size_t capacity;
+	bool used;
+};
+
+/// Handle to buffer taken from the pool, returned on destruction.
+class Buffer
+{
+	Kind kind;
+	Slot* slot;
+
+public:
+	Buffer()
+		: kind(Kind::Internal), slot(nullptr)
+	{}
+
+	Buffer(Kind kind, Slot* slot)
+		: kind(kind), slot(slot)
+	{}
+
+	Buffer(Buffer&& o)
+		: kind(o.kind), slot(std::exchange(o.slot, nullptr))
+	{}
+
+	Buffer& operator=(Buffer&& o)
+	{
+		std::swap(kind, o.kind);
+		std::swap(slot, o.slot);
+		return *this;
+	}
+
+	Buffer(const Buffer&) = delete;
+	Buffer& operator=(const Buffer&) = delete;
+
+	~Buffer() { reset(); }
+
+	/// Returns the buffer to the pool (keeping its memory).
+	void reset();
+
+	operator bool() const { return slot != nullptr; }
+
+	uint8_t* data() const { return slot ? slot->data : nullptr; }
+	size_t capacity() const { return slot ? slot->capacity : 0; }
+
+	/// Grows the buffer if necessary, without preserving the contents.
+	/// Returns false if allocation failed (the buffer is left without memory).
+	bool reserve(size_t size);
+};
+
+/// Takes buffer of at least given size, preferring free one that already fits.
+/// Returns empty handle if all the pool slots are in use or allocation failed.
+Buffer acquire(Kind kind, size_t size);
+
+struct Stats
+{
+	uint32_t capacity; // bytes allocated by all the slots
+	uint8_t used;
+	uint8_t allocated; // slots with memory allocated
+	uint8_t count;
+};
+
+Stats getStats(Kind kind);
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <string_view>
+#include <utility>
+#include <iterator>
+
+namespace app::http
+{
+
+/// Returns part of the URI after the `?` (or the whole string if there is none).
+inline std::string_view skipToQuerystring(std::string_view uri) {
+	auto pos = uri.rfind('?');
+	if (pos != std::string_view::npos) uri.remove_prefix(pos + 1);
+	return uri;
+}
+
+/// Iterator over key-value pairs of querystring, without decoding nor copying.
+class QuerystringCrawlerIterator
+{
+	const char* keyStart;
+	const char* keyEnd;
+	const char* valueEnd;
+
+	void forward() noexcept {
+		const char* p = keyStart;
+		for(;;) {
+			if (*p == '=') {
+				keyEnd = p;
+				while (*++p)
+					if (*p == '&')
+						break;
+				valueEnd = p;
+				return;
+			}
+			if (*p == '&' || !*p) {
+				keyEnd = p;
+				valueEnd = keyEnd + 1; // will end up as 0 length value
+				return;
+			}
+			p++;
+		}
+	}
+
+public:
+	QuerystringCrawlerIterator(const char* position)
+		: keyStart(position)
+	{
+		forward();
+	}
+
+	QuerystringCrawlerIterator& operator++() noexcept {
+		if (*keyEnd == '&') {
+			// Key without value, the next one starts right after
+			keyStart = keyEnd + 1;
+			forward();
+		}
+		else if (*keyEnd && *valueEnd) {
+			keyStart = valueEnd + 1;
+			forward();
+		}
+		else {
+			keyStart = *keyEnd ? valueEnd : keyEnd;
+		}
+		return *this;
+	}
+	
+	std::pair<std::string_view, std::string_view> operator*() const noexcept {
+		const auto valueStart = keyEnd + 1;
+		return {
+			{ keyStart, static_cast<size_t>(keyEnd - keyStart) }, 
+			{ valueStart, static_cast<size_t>(valueEnd - valueStart) }
+		};
+	}
+
+	bool operator!=(const QuerystringCrawlerIterator& other) const noexcept {
+		return this->keyStart != other.keyStart;
+	}
+};
+
+/// Range of key-value pairs of querystring, to be used with range-based for loop.
+/// Keys without value have it empty. The view must be null-terminated.
+class QuerystringCrawler
+{
+	const std::string_view view;
+public:
+	using iterator = QuerystringCrawlerIterator;
+
+	QuerystringCrawler(std::string_view&& view)
+		: view(view)
+	{}
+
+	iterator begin() const noexcept {
+		return iterator(std::cbegin(this->view));
+	}
+	iterator end() const noexcept {
+		return iterator(std::cend(this->view));
+	}
+};
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <sdkconfig.h>
+#include "common.hpp"
+
+/// Placement (core affinity & priority) of application tasks, configured
+/// by Kconfig (see `src/Kconfig`), so the layout can be tuned in one place.
+namespace app::tasks
+{
+
+struct Placement
+{
+	BaseType_t core; // or `tskNO_AFFINITY`
+	UBaseType_t priority;
+};
+
+constexpr BaseType_t core(int configured)
+{
+	return configured < 0 ? tskNO_AFFINITY : configured;
+}
+
+constexpr Placement httpdMain    { core(CONFIG_APP_HTTPD_MAIN_CORE),    CONFIG_APP_HTTPD_MAIN_PRIORITY };
+constexpr Placement httpdWorker  { core(CONFIG_APP_HTTPD_WORKER_CORE),  CONFIG_APP_HTTPD_WORKER_PRIORITY };
+constexpr Placement httpdStream  { core(CONFIG_APP_HTTPD_STREAM_CORE),  CONFIG_APP_HTTPD_STREAM_PRIORITY };
+constexpr Placement streamClient { core(CONFIG_APP_STREAM_CLIENT_CORE), CONFIG_APP_STREAM_CLIENT_PRIORITY };
+constexpr Placement cameraLoop   { core(CONFIG_APP_CAMERA_LOOP_CORE),   CONFIG_APP_CAMERA_LOOP_PRIORITY };
+constexpr Placement control      { core(CONFIG_APP_CONTROL_CORE),       CONFIG_APP_CONTROL_PRIORITY };
+constexpr Placement telemetry    { core(CONFIG_APP_TELEMETRY_CORE),     CONFIG_APP_TELEMETRY_PRIORITY };
+constexpr Placement udpVideo     { core(CONFIG_APP_UDP_VIDEO_CORE),     CONFIG_APP_UDP_VIDEO_PRIORITY };
+constexpr Placement history      { core(CONFIG_APP_HISTORY_CORE),       CONFIG_APP_HISTORY_PRIORITY };
+constexpr Placement vision       { 1,                                   CONFIG_APP_VISION_PRIORITY };
+
+/// Creates the task with given placement.
+inline BaseType_t create(TaskFunction_t function, const char* name, uint32_t stackSize, void* arg, const Placement& placement, TaskHandle_t* handle = nullptr)
+{
+	return xTaskCreatePinnedToCore(function, name, stackSize, arg, placement.priority, handle, placement.core);
+}
+
+/// Starts periodic logging of tasks CPU usage, if enabled (`CONFIG_APP_TASKS_BENCHMARK`).
+void init();
+
+}
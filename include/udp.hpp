@@ -3,7 +3,6 @@
 #include "common.hpp"
 
 #define UDP_PORT 83
-#define UDP_TIMEOUT 10'000 // us, or 0 to use non-blocking mode
 
 namespace app::udp
 {
@@ -13,6 +12,14 @@ extern const char* TAG;
 enum class PacketType : uint8_t {
 	ShortControl = 1,
 	LongControl = 2,
+	SequencedControl = 3,
+	TelemetrySubscribe = 4,
+	Telemetry = 5,
+	VideoSubscribe = 6,
+	VideoFragment = 7,
+	Vision = 8,
+	Batch = 9,
+	Ack = 10,
 };
 
 struct ShortControlPacket {
@@ -37,15 +44,219 @@ struct LongControlPacket {
 		struct {
 			bool mainLight      : 1;
 			bool otherLight     : 1;
-			uint8_t _reserved   : 6;
+			bool sCurve         : 1; // smoothing profile, linear if not set
+			uint8_t _reserved   : 5;
+		};
+	};
+	uint16_t smoothingTime; // ms
+	float targetLeftDuty; // 63.8f == 62.8%
+	float targetRightDuty;
+};
+
+/// Like long control packet, but with sequence number and timestamp, allowing
+/// to drop reordered or outdated packets.
+struct SequencedControlPacket {
+	PacketType type;
+	union {
+		uint8_t flags;
+		struct {
+			bool mainLight      : 1;
+			bool otherLight     : 1;
+			bool sCurve         : 1; // smoothing profile, linear if not set
+			uint8_t _reserved   : 5;
 		};
 	};
 	uint16_t smoothingTime; // ms
+	uint32_t sequence; // incremented by client for each packet
+	uint32_t timestamp; // ms, client time
 	float targetLeftDuty; // 63.8f == 62.8%
 	float targetRightDuty;
 };
+static_assert(sizeof(SequencedControlPacket) == 20);
+
+/// Subscribes (or renews subscription) for telemetry packets to be pushed 
+/// to the sender address. Subscriptions expire, if not renewed.
+struct TelemetrySubscribePacket {
+	PacketType type;
+	uint8_t _reserved;
+	uint16_t interval; // ms, or 0 to unsubscribe
+};
+
+/// Telemetry, pushed to the subscribers.
+struct TelemetryPacket {
+	PacketType type;
+	union {
+		uint8_t flags;
+		struct {
+			bool mainLight      : 1;
+			bool otherLight     : 1;
+			uint8_t _reserved   : 6;
+		};
+	};
+	int8_t rssi; // or 0 if not connected as station
+	uint8_t _reserved2;
+	uint32_t sequence; // incremented for each packet
+	int64_t uptime; // us
+	float leftDuty; // 63.8f == 62.8%
+	float rightDuty;
+	uint32_t freeHeap; // bytes
+	uint16_t frameRate; // frames grabbed by the camera during last second
+	uint16_t controlLatency; // us, average
+};
+static_assert(sizeof(TelemetryPacket) == 32);
+
+/// Results of the on-device vision, pushed to the telemetry subscribers
+/// (after the telemetry packet) if new frame was processed since last one.
+struct VisionPacket {
+	PacketType type;
+	uint8_t _reserved;
+	uint16_t processingTime; // us, saturated
+	uint32_t frame; // sequence number of the capture loop
+	int64_t timestamp; // us, capture time (uptime)
+	uint16_t width;
+	uint16_t height;
+	uint32_t darkPixels;
+	uint32_t changedPixels; // from previous frame
+	float centroidX; // of dark pixels, from -1 (left) to 1 (right), 0 if none
+	float centroidY; // of dark pixels, from -1 (top) to 1 (bottom), 0 if none
+	uint16_t boxLeft; // bounding box of dark pixels (inclusive), empty (left > right) if none
+	uint16_t boxTop;
+	uint16_t boxRight;
+	uint16_t boxBottom;
+	uint32_t _reserved2;
+};
+static_assert(sizeof(VisionPacket) == 48);
+
+/// Subscribes (or renews subscription) for video frames to be pushed to 
+/// the sender address, as fragments. Subscriptions expire, if not renewed.
+struct VideoSubscribePacket {
+	PacketType type;
+	uint8_t _reserved;
+	uint16_t fragmentLength; // max payload bytes per datagram (0 for max fitting MTU), or 0xFFFF to unsubscribe
+};
+
+/// Header of video frame fragment, followed by the payload (part of the frame data).
+/// Frame can be assembled when all fragments with the same frame sequence
+/// arrive; receivers should drop incomplete frames when newer one starts.
+struct VideoFragmentHeader {
+	PacketType type;
+	uint8_t pixformat; // as `pixformat_t`
+	uint16_t fragment; // index of the fragment in the frame
+	uint16_t fragmentsCount;
+	uint16_t width;
+	uint16_t height;
+	uint16_t _reserved;
+	uint32_t frame;  // sequence number of the capture loop, gaps are dropped frames
+	uint32_t offset; // of the payload in the frame data
+	uint32_t length; // of the whole frame data
+	int64_t timestamp; // us, capture time (uptime)
+};
+static_assert(sizeof(VideoFragmentHeader) == 32);
+
+/// Max length of video fragment datagram, to avoid IP fragmentation (1500 bytes MTU).
+constexpr size_t maxVideoDatagramLength = 1500 - 20 - 8; // IP & UDP headers
+constexpr size_t maxVideoFragmentLength = maxVideoDatagramLength - sizeof(VideoFragmentHeader);
+
+////////////////////////////////////////
+// Protocol v2: batches of commands
+
+constexpr uint8_t batchProtocolVersion = 2;
+
+/// Header of batch packet, followed by commands: each is `CommandHeader` and 
+/// its payload. Commands are applied in order. Unknown ones are skipped (using
+/// their length), so older firmware can ignore commands added later.
+struct BatchHeader {
+	PacketType type; // `Batch`
+	uint8_t version; // `batchProtocolVersion`, newer ones are rejected
+	union {
+		uint8_t flags;
+		struct {
+			bool ack            : 1; // acknowledgement requested
+			bool sequenced      : 1; // drop the batch if reordered or outdated, like sequenced control
+			uint8_t _reserved   : 6;
+		};
+	};
+	uint8_t _reserved2;
+	uint32_t sequence; // incremented by client for each packet, echoed in ack
+	uint32_t timestamp; // ms, client time, echoed in ack (for RTT)
+};
+static_assert(sizeof(BatchHeader) == 12);
+
+enum class CommandType : uint8_t {
+	Motors = 1,
+	Lights = 2,
+	CameraQuality = 3,
+	TelemetrySubscribe = 4,
+	VideoSubscribe = 5,
+	Ping = 6, // no payload, only requests acknowledgement
+	_Count,
+};
+
+/// Header of command in the batch. Payloads are unaligned (copied before use).
+/// Shorter payloads than expected are rejected, longer ones are truncated
+/// (fields added later are ignored).
+struct CommandHeader {
+	CommandType type;
+	uint8_t length; // of the payload following
+};
+static_assert(sizeof(CommandHeader) == 2);
 
-constexpr size_t maxPacketLength = 16;
+struct MotorsCommand {
+	union {
+		uint8_t flags;
+		struct {
+			bool sCurve         : 1; // smoothing profile, linear if not set
+			uint8_t _reserved   : 7;
+		};
+	};
+	uint8_t _reserved2;
+	uint16_t smoothingTime; // ms
+	float left; // 63.8f == 62.8%
+	float right;
+};
+static_assert(sizeof(MotorsCommand) == 12);
+
+struct LightsCommand {
+	uint8_t mask; // lights to be set: 1 - main, 2 - other
+	uint8_t values; // same bits, set to turn on
+};
+
+struct CameraQualityCommand {
+	uint8_t quality; // JPEG quality of the stream (lower number is better)
+};
+
+struct TelemetrySubscribeCommand {
+	uint16_t interval; // ms, or 0 to unsubscribe, like `TelemetrySubscribePacket`
+};
+
+struct VideoSubscribeCommand {
+	uint16_t fragmentLength; // like `VideoSubscribePacket`
+};
+
+enum class AckStatus : uint8_t {
+	Ok = 0,
+	Stale = 1, // sequenced batch dropped as reordered or outdated
+	UnsupportedVersion = 2,
+};
+
+/// Acknowledgement of the batch, sent back to the sender if requested (or pinged).
+/// Client can calculate round trip time from echoed timestamp.
+struct AckPacket {
+	PacketType type; // `Ack`
+	AckStatus status;
+	uint8_t accepted; // commands
+	uint8_t rejected; // commands, unknown or invalid
+	uint32_t sequence; // echoed
+	uint32_t timestamp; // echoed
+	uint32_t processingTime; // us, from receiving the batch to sending the ack
+	int64_t uptime; // us, when sending
+};
+static_assert(sizeof(AckPacket) == 24);
+
+////////////////////////////////////////
+
+/// Max length of received packet, limiting the batches.
+constexpr size_t maxPacketLength = 128;
 union UnknownPacket {
 	char buffer[maxPacketLength];
 	struct {
@@ -53,9 +264,35 @@ union UnknownPacket {
 	};
 	ShortControlPacket asShortControl;
 	LongControlPacket asLongControl;
+	SequencedControlPacket asSequencedControl;
+	TelemetrySubscribePacket asTelemetrySubscribe;
+	VideoSubscribePacket asVideoSubscribe;
+	BatchHeader asBatch;
 };
 static_assert(sizeof(UnknownPacket) == maxPacketLength);
 
+/// Packets statistics, counted per second.
+struct PacketsStats {
+	uint16_t received;
+	uint16_t stale;     // dropped as reordered or outdated (by sequence)
+	uint16_t coalesced; // superseded by newer packet received in the same batch
+	uint16_t applied;
+};
+
+/// Returns packets statistics for last full second.
+PacketsStats getPacketsStats();
+
+/// Sends packet to the client of other transport than the UDP socket. 
+/// Returns false if it failed (i.e. client is gone), dropping its subscriptions.
+using Sender = bool (*)(int handle, const void* data, size_t length);
+
+/// Handles packet received by other transport than the UDP socket (i.e. WebSocket),
+/// like the one received alone on the socket: control is posted right away 
+/// (sharing sequencing with UDP clients), while acknowledgements and telemetry 
+/// are sent back to the client (by its handle) using the sender. 
+/// Video subscriptions are supported only by UDP socket.
+void handlePacket(const UnknownPacket& packet, size_t length, Sender sender, int handle);
+
 void destroy();
 void init();
 void listen();
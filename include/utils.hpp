@@ -118,6 +118,22 @@ constexpr char tolower(const char c) {
     return (c < 'A' || 'Z' < c) ? c : c + ('a' - 'A');
 }
 
+/// Compile-time version of `isdigit`, without support for locales.
+constexpr bool isDigit(const char c) {
+	return '0' <= c && c <= '9';
+}
+
+/// Parses leading decimal digits of the string (stopping at first other character).
+constexpr uint32_t parseUnsigned(std::string_view sv) {
+	uint32_t value = 0;
+	for (const char c : sv) {
+		if (!isDigit(c)) break;
+		value = value * 10 + (c - '0');
+	}
+	return value;
+}
+static_assert(parseUnsigned("1234x5") == 1234);
+
 /// Returns result of saturated subtraction. Example: `3 - 7 == 0`.
 constexpr uint32_t saturatedSubtract(uint32_t x, uint32_t y)
 {
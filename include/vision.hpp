@@ -0,0 +1,48 @@
+#pragma once
+#include <sdkconfig.h>
+#include "common.hpp"
+
+/// On-device vision stage, processing grayscale frames from the shared capture
+/// loop on the second core (next to the camera loop), removing Wi-Fi round-trip
+/// for simple heuristics like line following or detecting obstacles.
+namespace app::vision
+{
+
+struct Settings
+{
+	bool enabled;
+	uint8_t threshold;       // pixels below it are dark
+	uint8_t motionThreshold; // pixels with difference (from previous frame) above it are changed
+	uint16_t minDarkPixels;  // to consider the dark blob (i.e. line) found
+	bool steering;           // if set, motors are driven towards the dark pixels centroid
+	float speed;             // 12.3f = 12.3%, base duty for steering
+	float gain;              // duty difference per centroid offset (from -1 to 1)
+};
+
+Settings& getSettings();
+
+/// Results of processing single frame.
+struct Results
+{
+	uint32_t frame;          // sequence number of the capture loop, 0 if none processed yet
+	uptime_t timestamp;      // us, capture time
+	uint16_t width;
+	uint16_t height;
+	uint32_t darkPixels;
+	uint32_t changedPixels;  // from previous frame
+	float centroidX;         // of dark pixels, from -1 (left) to 1 (right), 0 if none
+	float centroidY;         // of dark pixels, from -1 (top) to 1 (bottom), 0 if none
+	uint16_t boxLeft;        // bounding box of dark pixels (from rows & columns histograms),
+	uint16_t boxTop;         //	inclusive, empty (left > right) if none
+	uint16_t boxRight;
+	uint16_t boxBottom;
+	uint32_t processingTime; // us
+};
+
+/// Returns results of the latest processed frame.
+Results getResults();
+
+/// Starts the vision task (pinned to the second core), waiting until enabled.
+void init();
+
+}
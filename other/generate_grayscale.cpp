@@ -95,14 +95,13 @@ int main(int argc, char* argv[])
 		std::cerr << "Invalid width or height." << std::endl;
 		return 1;
 	}
-	if (width > maxWidth || height > maxHeight) {
+	if (width > maxWidth || std::abs(height) > maxHeight) {
 		std::cerr << "Max size is " << maxWidth << 'x' << maxHeight << '.' << std::endl;
 		return 1;
 	}
-	if (height < 0) {
-		std::cerr << "Top-to-bottom rows order not supported." << std::endl;
-		return 1;
-	}
+	// Negative height for top-to-bottom rows order, like the device sends.
+	const bool topDown = height < 0;
+	const int32_t rowsCount = std::abs(height);
 
 	const uint8_t bitsPerPixel = argc > 4 ? std::stoi(argv[4]) : 8;
 	if (!contains(supportedBitsPerPixel, bitsPerPixel)) {
@@ -114,7 +113,11 @@ int main(int argc, char* argv[])
 	bool useColorTable = bitsPerPixel <= 8; 
 	// bool useColorTable = false;
 
-	bool noise = true; // TODO: make it switch
+	const bool noise = argc > 5 ? std::stoi(argv[5]) != 0 : true;
+
+	// For 8 bpp top-down, use the same headers & color table as the device,
+	// so output can be compared against bottom-up one (use without noise).
+	const bool deviceHeaders = topDown && bitsPerPixel == 8;
 
 	// Prepare headers
 	BITMAPFILEHEADER fileHeader;
@@ -179,12 +182,28 @@ int main(int argc, char* argv[])
 	}
 
 	// Write headers & color table
-	output.write(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
-	std::fprintf(stderr, "DIB header  @ 0x%04X\n", static_cast<int32_t>(output.tellp()));
-	output.write(reinterpret_cast<char*>(&dibHeader), dibHeaderRealSize);
-	if (useColorTable) {
-		std::fprintf(stderr, "Color table @ 0x%04X\n", static_cast<int32_t>(output.tellp()));
-		output.write(reinterpret_cast<char*>(colorTable.data()), colorTableBytesSize);
+	if (deviceHeaders) {
+		constexpr auto check = makeGrayscaleHeaders(320, 240);
+		static_assert(check.file.offsetToPixelArray == sizeof(GrayscaleHeaders) + sizeof(grayscaleColorTable));
+		static_assert(check.dib.height == -240);
+
+		const auto headers = makeGrayscaleHeaders(width, rowsCount);
+		assert(headers.file.size == fileHeader.size - (dibHeaderRealSize - sizeof(BITMAPINFOHEADER)));
+		fileHeader.size = headers.file.size;
+		fileHeader.offsetToPixelArray = headers.file.offsetToPixelArray;
+		std::fprintf(stderr, "Using device headers\n");
+		output.write(reinterpret_cast<const char*>(&headers), sizeof(headers));
+		std::fprintf(stderr, "Color table @ 0x%04X\n", static_cast<int32_t>(sizeof(headers)));
+		output.write(reinterpret_cast<const char*>(&grayscaleColorTable), sizeof(grayscaleColorTable));
+	}
+	else {
+		output.write(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
+		std::fprintf(stderr, "DIB header  @ 0x%04X\n", static_cast<int32_t>(output.tellp()));
+		output.write(reinterpret_cast<char*>(&dibHeader), dibHeaderRealSize);
+		if (useColorTable) {
+			std::fprintf(stderr, "Color table @ 0x%04X\n", static_cast<int32_t>(output.tellp()));
+			output.write(reinterpret_cast<char*>(colorTable.data()), colorTableBytesSize);
+		}
 	}
 
 	std::fprintf(stderr, "Pixels data @ 0x%04X\n", static_cast<int32_t>(output.tellp()));
@@ -198,8 +217,9 @@ int main(int argc, char* argv[])
 	chunk_t* chunkPointer;
 	chunk_t chunk;
 	uint8_t shift;
-	for (int32_t y = 0; y < height; y++) {
-		const auto v = static_cast<float>(y) / height;
+	for (int32_t y = 0; y < rowsCount; y++) {
+		// Texture coordinates are bottom-to-top, so both rows orders give the same image.
+		const auto v = static_cast<float>(topDown ? rowsCount - 1 - y : y) / rowsCount;
 		rowBuffer.assign(rowLength, 0u);
 		chunkPointer = reinterpret_cast<chunk_t*>(rowBuffer.data());
 		chunk = 0;
@@ -0,0 +1,385 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <unordered_map>
+#include "utils.hpp"
+#include "bmp.hpp"
+#include "camera_formats.hpp"
+#include "querystring.hpp"
+#include "json.hpp"
+#include "config.hpp"
+#include "udp.hpp"
+#include "fakes.hpp"
+#include "sample.hpp"
+
+// Micro-benchmarks of the hot kernels of the firmware, for profiling and
+// regression checks on PC. Absolute numbers are for the host CPU, not ESP32,
+// but relative changes of the kernels usually carry over.
+//
+// Usage: host_bench [--filter TEXT] [--min-time MS] [--json] [--baseline PATH [--tolerance PERCENT]]
+//   --filter     Runs only benchmarks with names containing given text.
+//   --min-time   Time to spend in each benchmark, in milliseconds. Default: 200.
+//   --json       Writes results as JSON to standard output (for `--baseline`).
+//   --baseline   Compares with results written before (using `--json`),
+//                failing if any benchmark got slower by more than tolerance.
+//   --tolerance  Allowed slowdown in percents. Default: 20.
+
+using namespace app;
+namespace sample = host::sample;
+
+////////////////////////////////////////////////////////////////////////////////
+// Helpers
+
+/// Prevents the compiler from optimizing out the value (or the memory behind).
+template <typename T>
+inline void keep(const T& value)
+{
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+/// Sink for the writers, counting the data without storing it.
+bool count_output(void* context, const char* data, size_t length)
+{
+	*static_cast<size_t*>(context) += length;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Kernels
+
+constexpr int32_t vgaWidth = 640;
+constexpr int32_t qvgaWidth = 320;
+constexpr int32_t qvgaHeight = 240;
+
+alignas(4) uint8_t sourceFrame[qvgaWidth * qvgaHeight * 2];
+alignas(4) uint8_t rowBuffer[vgaWidth * 2];
+alignas(4) uint8_t lineBuffer[6 * 1024]; // like `bitmapLineBufferSize` in `http.cpp`
+
+void setup_frame()
+{
+	for (size_t i = 0; i < sizeof(sourceFrame); i++)
+		sourceFrame[i] = (i * 7) ^ (i >> 5);
+}
+
+void bench_rgb565_row()
+{
+	bmp::convertRowRgb565(sourceFrame, rowBuffer, vgaWidth);
+	keep(rowBuffer);
+}
+
+void bench_yuv422_rgb565_row()
+{
+	bmp::convertRowYuv422ToRgb565(sourceFrame, rowBuffer, vgaWidth);
+	keep(rowBuffer);
+}
+
+void bench_yuv422_grayscale_row()
+{
+	bmp::convertRowYuv422ToGrayscale(sourceFrame, rowBuffer, vgaWidth);
+	keep(rowBuffer);
+}
+
+void bench_row_converter()
+{
+	bmp::RowConverter converter(bmp::convertRowYuv422ToGrayscale, sourceFrame, qvgaWidth * 2,
+		qvgaWidth, qvgaHeight, 8, lineBuffer, sizeof(lineBuffer));
+	uint32_t total = 0;
+	while (const uint32_t length = converter.next())
+		total += length;
+	keep(total);
+}
+
+constexpr std::string_view sampleKey = "rate_control_min_quality";
+
+void bench_fnv1a32()
+{
+	std::string_view key = sampleKey;
+	keep(key);
+	keep(fnv1a32(key));
+}
+
+void bench_fnv1a32i()
+{
+	std::string_view key = sampleKey;
+	keep(key);
+	keep(fnv1a32i(key));
+}
+
+const char sampleUri[] = "/capture?bmp=gray&framesize=vga&quality=10&flash=1&foo";
+
+/// Like the handlers do: crawls the querystring, dispatching by keys hashes.
+void bench_querystring()
+{
+	uint32_t matched = 0;
+	const char* uri = sampleUri;
+	keep(uri);
+	for (auto&& [key, value] : http::QuerystringCrawler(http::skipToQuerystring(uri))) {
+		switch (fnv1a32(key)) {
+			case fnv1a32("bmp"):
+			case fnv1a32("framesize"):
+			case fnv1a32("quality"):
+			case fnv1a32("flash"):
+				matched += value.size();
+				break;
+		}
+	}
+	keep(matched);
+}
+
+const std::string_view sampleFramesizes[] = { "vga", "1600x1200", "FRAMESIZE_QVGA", "8" };
+
+/// Parsing of frame sizes, as in the camera config (by name, dimensions or value).
+void bench_parse_framesize()
+{
+	uint32_t sum = 0;
+	for (auto sv : sampleFramesizes) {
+		keep(sv);
+		sum += camera::parseFramesize(sv);
+	}
+	keep(sum);
+}
+
+esp_err_t ignore_field(void* context, const json::Field& field)
+{
+	*static_cast<uint32_t*>(context) += field.keyHash;
+	return ESP_OK;
+}
+
+void bench_json_parse()
+{
+	uint32_t sum = 0;
+	json::PushParser parser(ignore_field, &sum);
+	parser.feed(sample::document.data(), sample::document.size());
+	parser.finish();
+	keep(sum);
+}
+
+void bench_config_dispatch()
+{
+	config::Dispatcher dispatcher(sample::root);
+	json::PushParser parser(config::Dispatcher::callback, &dispatcher);
+	parser.feed(sample::document.data(), sample::document.size());
+	parser.finish();
+	keep(sample::settings);
+}
+
+void bench_config_write_json()
+{
+	char buffer[256];
+	size_t total = 0;
+	config::Writer writer(buffer, sizeof(buffer), count_output, &total);
+	config::writeJson(writer, sample::root);
+	writer.flush();
+	keep(total);
+}
+
+void bench_config_write_binary()
+{
+	char buffer[256];
+	size_t total = 0;
+	config::Writer writer(buffer, sizeof(buffer), count_output, &total);
+	config::writeBinary(writer, sample::root);
+	writer.flush();
+	keep(total);
+}
+
+constexpr uint8_t batchesPerListen = 16; // like `maxBatchLength` in `udp.cpp`
+
+uint32_t sequence = 0;
+std::vector<std::vector<uint8_t>> batches;
+
+void setup_udp()
+{
+	host::resetSocket();
+	udp::init();
+	sample::reset();
+	batches.clear();
+	for (uint8_t i = 0; i < batchesPerListen; i++)
+		batches.push_back(sample::controlBatch(0, true));
+}
+
+/// Queues the batch with next sequence (prepared, so only dispatch is measured).
+inline void push_batch(std::vector<uint8_t>& batch)
+{
+	++sequence;
+	std::memcpy(batch.data() + offsetof(udp::BatchHeader, sequence), &sequence, sizeof(sequence));
+	std::memcpy(batch.data() + offsetof(udp::BatchHeader, timestamp), &sequence, sizeof(sequence));
+	host::pushDatagram(batch.data(), batch.size());
+}
+
+void bench_udp_batch()
+{
+	push_batch(batches[0]);
+	udp::listen();
+}
+
+void bench_udp_coalesce()
+{
+	for (auto& batch : batches)
+		push_batch(batch);
+	udp::listen();
+}
+
+struct Benchmark
+{
+	const char* name;    // up to `json::PushParser::maxKeyLength`, for baselines
+	void (*run)();       // single operation
+	void (*setup)();
+	size_t bytes;        // processed by single operation, 0 if throughput is not applicable
+};
+
+const Benchmark benchmarks[] = {
+	{ "bmp.rgb565_row_vga",         bench_rgb565_row,           setup_frame, vgaWidth * 2 },
+	{ "bmp.yuv422_rgb565_row_vga",  bench_yuv422_rgb565_row,    setup_frame, vgaWidth * 2 },
+	{ "bmp.yuv422_gray_row_vga",    bench_yuv422_grayscale_row, setup_frame, vgaWidth * 2 },
+	{ "bmp.row_converter_qvga",     bench_row_converter,        setup_frame, sizeof(sourceFrame) },
+	{ "utils.fnv1a32",              bench_fnv1a32,              nullptr,     sampleKey.size() },
+	{ "utils.fnv1a32i",             bench_fnv1a32i,             nullptr,     sampleKey.size() },
+	{ "http.querystring",           bench_querystring,          nullptr,     sizeof(sampleUri) - 1 },
+	{ "camera.parse_framesize",     bench_parse_framesize,      nullptr,     0 },
+	{ "json.parse",                 bench_json_parse,           nullptr,     sample::document.size() },
+	{ "config.dispatch",            bench_config_dispatch,      sample::reset, sample::document.size() },
+	{ "config.write_json",          bench_config_write_json,    sample::reset, 0 },
+	{ "config.write_binary",        bench_config_write_binary,  sample::reset, 0 },
+	{ "udp.batch",                  bench_udp_batch,            setup_udp,   0 },
+	{ "udp.coalesce_16",            bench_udp_coalesce,         setup_udp,   0 },
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Runner
+
+using Clock = std::chrono::steady_clock;
+
+struct Result
+{
+	const Benchmark* benchmark;
+	double ns;    // per operation, median of the samples
+	double mbps;  // MB/s, 0 if not applicable
+	uint64_t iterations;
+};
+
+constexpr uint8_t samplesCount = 5;
+
+double measure(const Benchmark& benchmark, uint64_t iterations)
+{
+	const auto start = Clock::now();
+	for (uint64_t i = 0; i < iterations; i++)
+		benchmark.run();
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+/// Calibrates number of iterations to fill the sample time, then takes median of the samples.
+Result run(const Benchmark& benchmark, double minTime)
+{
+	if (benchmark.setup) benchmark.setup();
+	const double sampleTime = minTime * 1e6 / samplesCount;
+	uint64_t iterations = 1;
+	for (;;) {
+		const double elapsed = measure(benchmark, iterations);
+		if (elapsed >= sampleTime / 2 || iterations >= (1ull << 40)) {
+			if (elapsed < sampleTime)
+				iterations = std::max<uint64_t>(1, iterations * sampleTime / std::max(elapsed, 1.0));
+			break;
+		}
+		iterations *= 2;
+	}
+	double samples[samplesCount];
+	for (auto& sample : samples)
+		sample = measure(benchmark, iterations) / iterations;
+	std::sort(std::begin(samples), std::end(samples));
+	const double ns = samples[samplesCount / 2];
+	return { &benchmark, ns, benchmark.bytes ? benchmark.bytes / ns * 1e3 : 0, iterations * samplesCount };
+}
+
+void print_json(const std::vector<Result>& results)
+{
+	std::printf("{\n\t\"results\": {");
+	for (size_t i = 0; i < results.size(); i++) {
+		const auto& r = results[i];
+		std::printf("%s\n\t\t\"%s\": { \"ns\": %.3f, \"mbps\": %.3f, \"iterations\": %llu }",
+			i ? "," : "", r.benchmark->name, r.ns, r.mbps, static_cast<unsigned long long>(r.iterations));
+	}
+	std::printf("\n\t}\n}\n");
+}
+
+/// Reads `ns` of results written before by `print_json`, by benchmark name hash.
+bool read_baseline(const char* path, std::unordered_map<uint32_t, double>& baseline)
+{
+	std::ifstream file(path);
+	if (!file) return false;
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	const std::string text = buffer.str();
+
+	json::PushParser parser([] (void* context, const json::Field& field) {
+		if (field.depth == 2 && field.path[0] == fnv1a32("results") && field.keyHash == fnv1a32("ns"))
+			(*static_cast<std::unordered_map<uint32_t, double>*>(context))[field.path[1]] = std::atof(field.value);
+		return ESP_OK;
+	}, &baseline);
+	return parser.feed(text.data(), text.size()) == ESP_OK && parser.finish() == ESP_OK;
+}
+
+int main(int argc, char** argv)
+{
+	const char* filter = nullptr;
+	const char* baselinePath = nullptr;
+	double minTime = 200;   // ms
+	double tolerance = 20;  // %
+	bool json = false;
+	for (int i = 1; i < argc; i++) {
+		const std::string_view arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (arg == "--filter" && hasValue)         filter = argv[++i];
+		else if (arg == "--min-time" && hasValue)  minTime = std::atof(argv[++i]);
+		else if (arg == "--baseline" && hasValue)  baselinePath = argv[++i];
+		else if (arg == "--tolerance" && hasValue) tolerance = std::atof(argv[++i]);
+		else if (arg == "--json")                  json = true;
+		else {
+			std::fprintf(stderr, "Usage: %s [--filter TEXT] [--min-time MS] [--json] [--baseline PATH [--tolerance PERCENT]]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	std::unordered_map<uint32_t, double> baseline;
+	if (baselinePath && !read_baseline(baselinePath, baseline)) {
+		std::fprintf(stderr, "Failed to read baseline from '%s'\n", baselinePath);
+		return 2;
+	}
+
+	std::vector<Result> results;
+	unsigned regressions = 0;
+	FILE* log = json ? stderr : stdout;
+	std::fprintf(log, "%-28s %12s %12s %12s\n", "benchmark", "ns/op", "MB/s", baselinePath ? "change" : "");
+	for (const auto& benchmark : benchmarks) {
+		if (filter && !std::strstr(benchmark.name, filter)) continue;
+		const Result result = run(benchmark, minTime);
+		results.push_back(result);
+
+		char mbps[16] = "-";
+		if (result.mbps) std::snprintf(mbps, sizeof(mbps), "%.1f", result.mbps);
+		char change[32] = "";
+		const auto it = baseline.find(fnv1a32(benchmark.name));
+		if (it != baseline.end() && it->second > 0) {
+			const double percent = (result.ns / it->second - 1) * 100;
+			const bool regressed = percent > tolerance;
+			regressions += regressed;
+			std::snprintf(change, sizeof(change), "%+.1f%%%s", percent, regressed ? " !" : "");
+		}
+		std::fprintf(log, "%-28s %12.2f %12s %12s\n", benchmark.name, result.ns, mbps, change);
+	}
+
+	if (json)
+		print_json(results);
+	if (regressions) {
+		std::fprintf(stderr, "%u benchmark(s) slower than baseline by more than %.0f%%\n", regressions, tolerance);
+		return 1;
+	}
+	return 0;
+}
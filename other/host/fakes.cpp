@@ -0,0 +1,230 @@
+#include "fakes.hpp"
+#include <chrono>
+#include <deque>
+#include <random>
+#include <cstring>
+#include <algorithm>
+#include <esp_err.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp_random.h>
+#include <esp_wifi.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <lwip/sockets.h>
+#include "camera.hpp"
+#include "vision.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// Platform
+
+static const auto startTime = std::chrono::steady_clock::now();
+
+extern "C" int64_t esp_timer_get_time(void)
+{
+	const auto elapsed = std::chrono::steady_clock::now() - startTime;
+	return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+extern "C" uint32_t esp_get_free_heap_size(void)
+{
+	return 128 * 1024;
+}
+
+extern "C" uint32_t esp_random(void)
+{
+	static std::mt19937 generator { std::random_device {}() };
+	return generator();
+}
+
+extern "C" esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t* ap_info)
+{
+	return ESP_FAIL; // not connected
+}
+
+void _esp_error_check_failed_without_abort(esp_err_t rc, const char* file, int line, const char* function, const char* expression)
+{
+	std::fprintf(stderr, "ESP_ERROR_CHECK failed: 0x%x at %s:%d (%s): %s\n", rc, file, line, function, expression);
+}
+
+// Tasks are never started, as the tests and benchmarks are single-threaded;
+// the compiled code is driven by calling its functions directly.
+
+extern "C" BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stackSize,
+	void* arg, UBaseType_t priority, TaskHandle_t* handle, BaseType_t core)
+{
+	static uint8_t dummy;
+	if (handle) *handle = reinterpret_cast<TaskHandle_t>(&dummy);
+	return pdPASS;
+}
+
+extern "C" void vTaskDelay(TickType_t ticks) {}
+extern "C" uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) { return 0; }
+extern "C" BaseType_t xTaskNotifyGive(TaskHandle_t task) { return pdPASS; }
+
+extern "C" void vPortEnterCritical(portMUX_TYPE* mux) { mux->count++; }
+extern "C" void vPortExitCritical(portMUX_TYPE* mux) { mux->count--; }
+extern "C" BaseType_t xPortGetCoreID(void) { return 0; }
+
+extern "C" BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) { return pdTRUE; }
+extern "C" BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) { return pdTRUE; }
+
+////////////////////////////////////////////////////////////////////////////////
+// Socket
+
+namespace host
+{
+
+constexpr int fakeSocket = 3;
+
+std::deque<std::vector<uint8_t>> received;
+std::vector<uint8_t> sent;
+size_t sentDatagrams = 0;
+
+void pushDatagram(const void* data, size_t length)
+{
+	const auto* bytes = static_cast<const uint8_t*>(data);
+	received.emplace_back(bytes, bytes + length);
+}
+
+size_t pendingDatagrams()
+{
+	return received.size();
+}
+
+size_t sentCount()
+{
+	return sentDatagrams;
+}
+
+const std::vector<uint8_t>& lastSent()
+{
+	return sent;
+}
+
+void resetSocket()
+{
+	received.clear();
+	sent.clear();
+	sentDatagrams = 0;
+}
+
+}
+
+extern "C" int lwip_socket(int domain, int type, int protocol) { return host::fakeSocket; }
+extern "C" int lwip_bind(int s, const struct sockaddr* name, socklen_t namelen) { return 0; }
+extern "C" int lwip_setsockopt(int s, int level, int optname, const void* optval, socklen_t optlen) { return 0; }
+extern "C" int lwip_shutdown(int s, int how) { return 0; }
+extern "C" int lwip_close(int s) { return 0; }
+
+/// Receives queued datagram. Nothing to receive fails with `EAGAIN` even if
+/// blocking (instead of waiting forever), so the caller just returns.
+extern "C" ssize_t lwip_recvfrom(int s, void* mem, size_t len, int flags, struct sockaddr* from, socklen_t* fromlen)
+{
+	if (host::received.empty()) {
+		errno = EAGAIN;
+		return -1;
+	}
+	const auto& datagram = host::received.front();
+	const size_t length = std::min(len, datagram.size());
+	std::memcpy(mem, datagram.data(), length);
+	host::received.pop_front();
+	if (from && fromlen && *fromlen >= sizeof(sockaddr_in)) {
+		sockaddr_in address {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(host::clientPort);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		std::memcpy(from, &address, sizeof(address));
+		*fromlen = sizeof(address);
+	}
+	return length;
+}
+
+extern "C" ssize_t lwip_sendto(int s, const void* data, size_t size, int flags, const struct sockaddr* to, socklen_t tolen)
+{
+	const auto* bytes = static_cast<const uint8_t*>(data);
+	host::sent.assign(bytes, bytes + size);
+	host::sentDatagrams++;
+	return size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Modules
+
+namespace host
+{
+
+size_t posted = 0;
+app::control::Command postedCommand {};
+uint8_t streamQuality = 0;
+
+size_t postedCount()
+{
+	return posted;
+}
+
+const app::control::Command& lastPosted()
+{
+	return postedCommand;
+}
+
+uint8_t lastStreamQuality()
+{
+	return streamQuality;
+}
+
+void resetModules()
+{
+	posted = 0;
+	postedCommand = {};
+	streamQuality = 0;
+}
+
+}
+
+namespace app::control
+{
+
+void post(Command command)
+{
+	command.posted = esp_timer_get_time();
+	host::postedCommand = command;
+	host::posted++;
+}
+
+LatencyStats getLatencyStats() { return {}; }
+bool getMainLight() { return host::postedCommand.mainLight; }
+bool getOtherLight() { return host::postedCommand.otherLight; }
+
+float getMotor(Motor which)
+{
+	return which == Motor::Left ? host::postedCommand.left : host::postedCommand.right;
+}
+
+}
+
+namespace app::camera
+{
+
+void setStreamQuality(uint8_t quality)
+{
+	host::streamQuality = quality;
+}
+
+uint16_t getFrameRate() { return 0; }
+
+// No frames on the host: subscribers are never registered.
+FrameSubscriber::FrameSubscriber() {}
+FrameSubscriber::~FrameSubscriber() {}
+SharedFrame FrameSubscriber::next(TickType_t blockTime) { return {}; }
+void SharedFrame::reset() { slot = nullptr; }
+
+}
+
+namespace app::vision
+{
+
+Results getResults() { return {}; }
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "control.hpp"
+
+/// Fakes of the platform (ESP-IDF, FreeRTOS, lwIP) and of firmware modules
+/// not compiled for the host, recording what the compiled code did with them,
+/// so tests and benchmarks can drive the firmware code without hardware.
+namespace host
+{
+
+////////////////////////////////////////
+// Socket
+
+/// Queues datagram to be received by the (only) fake socket. Datagrams
+/// come from the same client address, see `clientPort`.
+void pushDatagram(const void* data, size_t length);
+
+/// Number of datagrams still waiting to be received.
+size_t pendingDatagrams();
+
+/// Number of datagrams sent using the fake socket since last reset.
+size_t sentCount();
+
+/// Last datagram sent using the fake socket, empty if none.
+const std::vector<uint8_t>& lastSent();
+
+/// Drops queued datagrams and clears the sent ones.
+void resetSocket();
+
+constexpr uint16_t clientPort = 50'000;
+
+////////////////////////////////////////
+// Modules
+
+/// Number of commands posted to the (fake) control loop since last reset.
+size_t postedCount();
+
+/// Last command posted to the (fake) control loop.
+const app::control::Command& lastPosted();
+
+/// Last quality set for the stream, or 0 if none since last reset.
+uint8_t lastStreamQuality();
+
+/// Resets records of the modules fakes.
+void resetModules();
+
+}
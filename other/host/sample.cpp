@@ -0,0 +1,162 @@
+#include "sample.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+namespace host::sample
+{
+
+using namespace app;
+
+////////////////////////////////////////
+// Configuration
+
+Settings settings;
+
+void reset()
+{
+	settings = {
+		.camera = { .framesize = 8, .quality = 12, .vflip = false },
+		.control = { .timeout = 2000, .smoothing = 0.5f },
+		.network = { .ssid = "YellowToyCar", .ip = 0x0104A8C0 }, // 192.168.4.1
+	};
+}
+
+template <auto object, auto member>
+constexpr config::Field integer(const char* key)
+{
+	return config::integer(key,
+		[] (const json::Field& field) {
+			settings.*object.*member = std::atoi(field.value);
+			return ESP_OK;
+		},
+		[] { return settings.*object.*member; }
+	);
+}
+
+constexpr config::Field cameraFields[] = {
+	integer<&Settings::camera, &decltype(Settings::camera)::framesize>("framesize"),
+	integer<&Settings::camera, &decltype(Settings::camera)::quality>("quality"),
+	config::boolean("vflip",
+		[] (const json::Field& field) {
+			settings.camera.vflip = parseBooleanFast(field.value);
+			return ESP_OK;
+		},
+		[] { return settings.camera.vflip; }
+	),
+};
+constexpr config::Index cameraIndex { cameraFields };
+config::Generation cameraGeneration;
+const config::Object camera { cameraFields, cameraIndex, nullptr, nullptr, &cameraGeneration };
+
+constexpr config::Field controlFields[] = {
+	integer<&Settings::control, &decltype(Settings::control)::timeout>("timeout"),
+	config::number("smoothing",
+		[] (const json::Field& field) {
+			settings.control.smoothing = std::atof(field.value);
+			return ESP_OK;
+		},
+		[] { return settings.control.smoothing; }
+	),
+};
+constexpr config::Index controlIndex { controlFields };
+config::Generation controlGeneration;
+const config::Object control { controlFields, controlIndex, nullptr, nullptr, &controlGeneration };
+
+constexpr config::Field networkFields[] = {
+	config::string("ssid",
+		[] (const json::Field& field) {
+			if (field.valueLength >= sizeof(settings.network.ssid))
+				return ESP_ERR_INVALID_SIZE;
+			std::memcpy(settings.network.ssid, field.value, field.valueLength + 1);
+			return ESP_OK;
+		},
+		[] { return std::string_view(settings.network.ssid); }
+	),
+	config::ip4("ip",
+		[] (const json::Field& field) {
+			uint8_t bytes[4] = {};
+			const char* p = field.value;
+			for (uint8_t i = 0; i < 4; i++) {
+				char* end;
+				bytes[i] = std::strtoul(p, &end, 10);
+				if (i < 3 && *end != '.') return ESP_ERR_INVALID_ARG;
+				p = end + 1;
+			}
+			std::memcpy(&settings.network.ip, bytes, 4);
+			return ESP_OK;
+		},
+		[] { return static_cast<int32_t>(settings.network.ip); }
+	),
+};
+constexpr config::Index networkIndex { networkFields };
+config::Generation networkGeneration;
+const config::Object network { networkFields, networkIndex, nullptr, nullptr, &networkGeneration };
+
+constexpr config::Field rootFields[] = {
+	config::object("camera", camera),
+	config::object("control", control),
+	config::object("network", network),
+};
+constexpr config::Index rootIndex { rootFields };
+static_assert(cameraIndex.unique && controlIndex.unique && networkIndex.unique && rootIndex.unique, "Keys hashes collision");
+
+const config::Object root { rootFields, rootIndex };
+
+const std::string_view document = R"({
+	"camera": {
+		"framesize": 5,
+		"quality": 10,
+		"vflip": 1,
+		"unknown": [1, 2, { "nested": "ignored" }]
+	},
+	"control": {
+		"timeout": 500,
+		"smoothing": 1.5
+	},
+	"network": {
+		"ssid": "Car \"Yellow\" A",
+		"ip": "10.0.0.2"
+	},
+	"other": { "ignored": true }
+})";
+
+////////////////////////////////////////
+// Packets
+
+std::vector<uint8_t> batch(uint32_t sequence, uint32_t timestamp, std::initializer_list<Command> commands,
+	bool ack, bool sequenced, uint8_t version)
+{
+	udp::BatchHeader header {};
+	header.type = udp::PacketType::Batch;
+	header.version = version;
+	header.ack = ack;
+	header.sequenced = sequenced;
+	header.sequence = sequence;
+	header.timestamp = timestamp;
+
+	const auto* bytes = reinterpret_cast<const uint8_t*>(&header);
+	std::vector<uint8_t> packet(bytes, bytes + sizeof(header));
+	for (const auto& command : commands) {
+		packet.push_back(static_cast<uint8_t>(command.type));
+		packet.push_back(static_cast<uint8_t>(command.payload.size()));
+		packet.insert(packet.end(), command.payload.begin(), command.payload.end());
+	}
+	return packet;
+}
+
+std::vector<uint8_t> controlBatch(uint32_t sequence, bool ack)
+{
+	udp::MotorsCommand motors {};
+	motors.sCurve = true;
+	motors.smoothingTime = 100;
+	motors.left = 50.0f;
+	motors.right = -25.0f;
+	const udp::LightsCommand lights { .mask = 3, .values = 1 };
+	return batch(sequence, sequence * 10, {
+		Command::of(udp::CommandType::Motors, motors),
+		Command::of(udp::CommandType::Lights, lights),
+	}, ack);
+}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <string_view>
+#include <initializer_list>
+#include "config.hpp"
+#include "udp.hpp"
+
+/// Sample inputs shared by the tests and the benchmarks, shaped like the real ones.
+namespace host::sample
+{
+
+////////////////////////////////////////
+// Configuration
+
+/// State behind the sample configuration object.
+struct Settings
+{
+	struct {
+		int32_t framesize;
+		int32_t quality;
+		bool vflip;
+	} camera;
+	struct {
+		int32_t timeout;
+		float smoothing;
+	} control;
+	struct {
+		char ssid[33];
+		uint32_t ip;
+	} network;
+};
+
+extern Settings settings;
+
+/// Restores default values of the settings.
+void reset();
+
+/// Root configuration object, with nested objects like the firmware one
+/// (`camera`, `control` and `network`, see `settings`).
+extern const app::config::Object root;
+
+/// Configuration document, like the one posted by the web UI.
+extern const std::string_view document;
+
+////////////////////////////////////////
+// Packets
+
+struct Command
+{
+	app::udp::CommandType type;
+	std::vector<uint8_t> payload;
+
+	template <typename T>
+	static Command of(app::udp::CommandType type, const T& payload)
+	{
+		const auto* bytes = reinterpret_cast<const uint8_t*>(&payload);
+		return { type, { bytes, bytes + sizeof(T) } };
+	}
+};
+
+/// Builds batch packet (protocol v2), like `scripts/protocol.py` does.
+std::vector<uint8_t> batch(uint32_t sequence, uint32_t timestamp, std::initializer_list<Command> commands,
+	bool ack = false, bool sequenced = true, uint8_t version = app::udp::batchProtocolVersion);
+
+/// Batch with motors and lights commands, like sent by `control.py --batch`.
+std::vector<uint8_t> controlBatch(uint32_t sequence, bool ack = false);
+
+}
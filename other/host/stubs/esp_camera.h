@@ -0,0 +1,16 @@
+#pragma once
+// Host stub of `esp32-camera` driver, only the frame buffer structure.
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include "esp_err.h"
+#include "sensor.h"
+
+typedef struct {
+	uint8_t* buf;
+	size_t len;
+	size_t width;
+	size_t height;
+	pixformat_t format;
+	struct timeval timestamp;
+} camera_fb_t;
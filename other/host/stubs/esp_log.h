@@ -0,0 +1,14 @@
+#pragma once
+// Host stub of ESP-IDF logging: messages are dropped (keeping the tests and
+// benchmarks output clean), but formats are still checked by the compiler.
+#include <stdio.h>
+#include "esp_err.h"
+
+#define ESP_HOST_LOG(tag, format, ...) \
+	do { (void)(tag); if (0) printf(format, ##__VA_ARGS__); } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_HOST_LOG(tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_HOST_LOG(tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_HOST_LOG(tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_HOST_LOG(tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_HOST_LOG(tag, format, ##__VA_ARGS__)
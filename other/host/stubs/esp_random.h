@@ -0,0 +1,13 @@
+#pragma once
+// Host stub of ESP-IDF random numbers generator (see `fakes.cpp`).
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t esp_random(void);
+
+#ifdef __cplusplus
+}
+#endif
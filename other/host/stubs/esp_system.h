@@ -0,0 +1,13 @@
+#pragma once
+// Host stub of ESP-IDF system functions (see `fakes.cpp`).
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t esp_get_free_heap_size(void);
+
+#ifdef __cplusplus
+}
+#endif
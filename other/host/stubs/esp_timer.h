@@ -0,0 +1,14 @@
+#pragma once
+// Host stub of ESP-IDF high resolution timer (see `fakes.cpp`).
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Microseconds since start of the process (steady clock).
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,21 @@
+#pragma once
+// Host stub of ESP-IDF Wi-Fi driver, only for telemetry (see `fakes.cpp`).
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct {
+	uint8_t bssid[6];
+	uint8_t ssid[33];
+	uint8_t primary;
+	int8_t rssi;
+} wifi_ap_record_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t* ap_info);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,44 @@
+#pragma once
+// Host stub of FreeRTOS (as in ESP-IDF), only types and functions used by
+// the compiled sources. Tasks are never started on the host (see `fakes.cpp`).
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define pdPASS  1
+#define pdFAIL  0
+
+#define portMAX_DELAY      0xFFFFFFFFu
+#define portTICK_PERIOD_MS (1000 / CONFIG_FREERTOS_HZ)
+#define portNUM_PROCESSORS 2
+#define tskNO_AFFINITY     0x7FFFFFFF
+
+typedef struct {
+	uint32_t owner;
+	uint32_t count;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED { 0, 0 }
+
+typedef struct { uint8_t dummy[80]; } StaticSemaphore_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void vPortEnterCritical(portMUX_TYPE* mux);
+void vPortExitCritical(portMUX_TYPE* mux);
+BaseType_t xPortGetCoreID(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define portENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux)  vPortExitCritical(mux)
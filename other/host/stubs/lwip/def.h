@@ -0,0 +1,5 @@
+#pragma once
+// Host stub of lwIP byte order macros.
+
+#define PP_HTONS(x) ((uint16_t)((((x) & 0xFF) << 8) | (((x) & 0xFF00) >> 8)))
+#define PP_HTONL(x) ((((x) & 0xFF) << 24) | (((x) & 0xFF00) << 8) | (((x) & 0xFF0000UL) >> 8) | (((x) & 0xFF000000UL) >> 24))
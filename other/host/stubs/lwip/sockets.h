@@ -0,0 +1,32 @@
+#pragma once
+// Host stub of lwIP sockets. Structures and constants are taken from the host,
+// but calls are redirected (like lwIP does with `LWIP_COMPAT_SOCKETS`) to fake
+// socket (see `fakes.cpp`), so no real network is used.
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <errno.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int lwip_socket(int domain, int type, int protocol);
+int lwip_bind(int s, const struct sockaddr* name, socklen_t namelen);
+int lwip_setsockopt(int s, int level, int optname, const void* optval, socklen_t optlen);
+int lwip_shutdown(int s, int how);
+int lwip_close(int s);
+ssize_t lwip_recvfrom(int s, void* mem, size_t len, int flags, struct sockaddr* from, socklen_t* fromlen);
+ssize_t lwip_sendto(int s, const void* data, size_t size, int flags, const struct sockaddr* to, socklen_t tolen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define socket(domain, type, protocol)                    lwip_socket(domain, type, protocol)
+#define bind(s, name, namelen)                            lwip_bind(s, name, namelen)
+#define setsockopt(s, level, optname, optval, optlen)     lwip_setsockopt(s, level, optname, optval, optlen)
+#define shutdown(s, how)                                  lwip_shutdown(s, how)
+#define close(s)                                          lwip_close(s)
+#define recvfrom(s, mem, len, flags, from, fromlen)       lwip_recvfrom(s, mem, len, flags, from, fromlen)
+#define sendto(s, data, size, flags, to, tolen)           lwip_sendto(s, data, size, flags, to, tolen)
@@ -0,0 +1,26 @@
+#pragma once
+// Host build configuration, only for options used by the compiled sources.
+// Values follow defaults of `sdkconfig.release` (see `src/Kconfig`).
+
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_LOG_MAXIMUM_LEVEL 3
+
+#define CONFIG_APP_HTTPD_MAIN_CORE 1
+#define CONFIG_APP_HTTPD_MAIN_PRIORITY 5
+#define CONFIG_APP_HTTPD_WORKER_CORE 1
+#define CONFIG_APP_HTTPD_WORKER_PRIORITY 4
+#define CONFIG_APP_HTTPD_STREAM_CORE 1
+#define CONFIG_APP_HTTPD_STREAM_PRIORITY 5
+#define CONFIG_APP_STREAM_CLIENT_CORE 0
+#define CONFIG_APP_STREAM_CLIENT_PRIORITY 5
+#define CONFIG_APP_CAMERA_LOOP_CORE 1
+#define CONFIG_APP_CAMERA_LOOP_PRIORITY 6
+#define CONFIG_APP_CONTROL_CORE 1
+#define CONFIG_APP_CONTROL_PRIORITY 10
+#define CONFIG_APP_TELEMETRY_CORE 0
+#define CONFIG_APP_TELEMETRY_PRIORITY 3
+#define CONFIG_APP_UDP_VIDEO_CORE 0
+#define CONFIG_APP_UDP_VIDEO_PRIORITY 4
+#define CONFIG_APP_HISTORY_CORE 0
+#define CONFIG_APP_HISTORY_PRIORITY 3
+#define CONFIG_APP_VISION_PRIORITY 4
@@ -0,0 +1,40 @@
+#pragma once
+// Host stub of `esp32-camera` sensor definitions (enumerations only).
+
+typedef enum {
+	PIXFORMAT_RGB565,
+	PIXFORMAT_YUV422,
+	PIXFORMAT_YUV420,
+	PIXFORMAT_GRAYSCALE,
+	PIXFORMAT_JPEG,
+	PIXFORMAT_RGB888,
+	PIXFORMAT_RAW,
+	PIXFORMAT_RGB444,
+	PIXFORMAT_RGB555,
+} pixformat_t;
+
+typedef enum {
+	FRAMESIZE_96X96,
+	FRAMESIZE_QQVGA,
+	FRAMESIZE_QCIF,
+	FRAMESIZE_HQVGA,
+	FRAMESIZE_240X240,
+	FRAMESIZE_QVGA,
+	FRAMESIZE_CIF,
+	FRAMESIZE_HVGA,
+	FRAMESIZE_VGA,
+	FRAMESIZE_SVGA,
+	FRAMESIZE_XGA,
+	FRAMESIZE_HD,
+	FRAMESIZE_SXGA,
+	FRAMESIZE_UXGA,
+	FRAMESIZE_FHD,
+	FRAMESIZE_P_HD,
+	FRAMESIZE_P_3MP,
+	FRAMESIZE_QXGA,
+	FRAMESIZE_QHD,
+	FRAMESIZE_WQXGA,
+	FRAMESIZE_P_FHD,
+	FRAMESIZE_QSXGA,
+	FRAMESIZE_INVALID,
+} framesize_t;
@@ -0,0 +1,501 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include "utils.hpp"
+#include "bmp.hpp"
+#include "camera_formats.hpp"
+#include "querystring.hpp"
+#include "json.hpp"
+#include "config.hpp"
+#include "udp.hpp"
+#include "fakes.hpp"
+#include "sample.hpp"
+
+using namespace app;
+namespace sample = host::sample;
+
+////////////////////////////////////////////////////////////////////////////////
+// Checks
+
+unsigned failures = 0;
+
+#define CHECK(x) do { \
+		if (!(x)) { \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); \
+			failures++; \
+		} \
+	} while (0)
+
+/// Writer into string, flushing in small chunks to cover the flushing too.
+struct StringWriter
+{
+	std::string output;
+	char buffer[16];
+	config::Writer writer { buffer, sizeof(buffer), [] (void* context, const char* data, size_t length) {
+		static_cast<StringWriter*>(context)->output.append(data, length);
+		return true;
+	}, this };
+
+	std::string& str()
+	{
+		writer.flush();
+		return output;
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Utils
+
+void test_utils()
+{
+	CHECK(fnv1a32("") == 2166136261u);
+	CHECK(fnv1a32("a") == 0xE40C292Cu);
+	CHECK(fnv1a32("foobar") == 0xBF9CF968u);
+	CHECK(fnv1a32(std::string_view("foobar")) == fnv1a32("foobar"));
+	CHECK(fnv1a32("foobar!", 6) == fnv1a32("foobar"));
+	CHECK(fnv1a32i("FooBar") == fnv1a32("foobar"));
+	CHECK(fnv1a32i(std::string_view("FOOBAR")) == fnv1a32i("foobar", 6));
+
+	CHECK(parseBooleanFast("1") && parseBooleanFast("true") && parseBooleanFast("yes"));
+	CHECK(!parseBooleanFast("0") && !parseBooleanFast("false") && !parseBooleanFast("No"));
+
+	CHECK(saturatedSubtract(7, 3) == 4);
+	CHECK(saturatedSubtract(3, 7) == 0);
+	CHECK(numberOfSetBits(0) == 0 && numberOfSetBits(0xFFFFFFFF) == 32 && numberOfSetBits(0x80000001) == 2);
+	CHECK(hton<uint16_t>(0x1234) == 0x3412);
+	CHECK(hton<uint32_t>(0x12345678) == 0x78563412);
+	CHECK(hton<uint64_t>(0x0102030405060708ull) == 0x0807060504030201ull);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Querystring
+
+std::vector<std::pair<std::string, std::string>> crawl(const char* uri)
+{
+	std::vector<std::pair<std::string, std::string>> pairs;
+	for (auto&& [key, value] : http::QuerystringCrawler(http::skipToQuerystring(uri)))
+		pairs.emplace_back(key, value);
+	return pairs;
+}
+
+void test_querystring()
+{
+	using Pairs = std::vector<std::pair<std::string, std::string>>;
+	CHECK(http::skipToQuerystring("/capture?bmp=1") == "bmp=1");
+	CHECK(http::skipToQuerystring("bmp=1") == "bmp=1");
+	CHECK(crawl("/capture").size() == 1); // no `?`, so the path is taken as key
+	CHECK(crawl("/capture?").empty());
+	CHECK((crawl("/capture?a=1&b=&c&d=45") == Pairs { { "a", "1" }, { "b", "" }, { "c", "" }, { "d", "45" } }));
+	CHECK((crawl("/x?flag") == Pairs { { "flag", "" } }));
+	CHECK((crawl("/x?a=1&") == Pairs { { "a", "1" } }));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Camera formats
+
+void test_camera_formats()
+{
+	using namespace camera;
+	// Parsed at runtime too, from values as received (not null-terminated)
+	const std::string value = "svga,";
+	CHECK(parseFramesize(std::string_view(value).substr(0, 4)) == FRAMESIZE_SVGA);
+	CHECK(parseFramesize("1280x1024") == FRAMESIZE_SXGA);
+	CHECK(parseFramesize("240X240") == FRAMESIZE_240X240);
+	CHECK(parseFramesize("13") == FRAMESIZE_UXGA);
+	CHECK(parseFramesize("14") == FRAMESIZE_INVALID); // FHD, unsupported by the sensor
+	CHECK(parseFramesize("FHD") == FRAMESIZE_INVALID);
+	CHECK(parseFramesize("") == FRAMESIZE_INVALID);
+	CHECK(parsePixformat("PIXFORMAT_GRAYSCALE") == PIXFORMAT_GRAYSCALE);
+	CHECK(parsePixformat("rgb565") == PIXFORMAT_RGB565);
+	CHECK(parsePixformat("9") == invalidPixformat);
+
+	CHECK(frameBufferSize(PIXFORMAT_GRAYSCALE, FRAMESIZE_96X96) == 96 * 96);
+	CHECK(frameBufferSize(PIXFORMAT_RGB565, FRAMESIZE_QVGA) == 320 * 240 * 2);
+	CHECK(frameBufferSize(PIXFORMAT_JPEG, FRAMESIZE_UXGA) == 1600 * 1200 / 5);
+	CHECK(frameBufferSize(PIXFORMAT_JPEG, FRAMESIZE_FHD) == 0);
+
+	// JPEG frame size can change within the initial one only; raw frames need reinit
+	CHECK(canSwitchWithoutReinit(PIXFORMAT_JPEG, FRAMESIZE_VGA, PIXFORMAT_JPEG, FRAMESIZE_SVGA, FRAMESIZE_SVGA));
+	CHECK(!canSwitchWithoutReinit(PIXFORMAT_JPEG, FRAMESIZE_VGA, PIXFORMAT_JPEG, FRAMESIZE_XGA, FRAMESIZE_SVGA));
+	CHECK(!canSwitchWithoutReinit(PIXFORMAT_JPEG, FRAMESIZE_HD, PIXFORMAT_JPEG, FRAMESIZE_SXGA, FRAMESIZE_HD)); // as wide, but taller
+	CHECK(canSwitchWithoutReinit(PIXFORMAT_RGB565, FRAMESIZE_QVGA, PIXFORMAT_RGB565, FRAMESIZE_QVGA, FRAMESIZE_QVGA));
+	CHECK(!canSwitchWithoutReinit(PIXFORMAT_JPEG, FRAMESIZE_QVGA, PIXFORMAT_GRAYSCALE, FRAMESIZE_QVGA, FRAMESIZE_UXGA));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Bitmaps
+
+void test_bmp()
+{
+	constexpr auto rgb = bmp::makeRgb565Headers(3, 2);
+	CHECK(rgb.file.signature == bmp::expectedSignature);
+	CHECK(bmp::rowStride(3, 16) == 8);
+	CHECK(rgb.dib.imageSize == 16);
+	CHECK(rgb.file.offsetToPixelArray == sizeof(rgb));
+	CHECK(rgb.file.size == sizeof(rgb) + 16);
+	CHECK(rgb.dib.height < 0); // top-down, as the frames are
+
+	constexpr auto gray = bmp::makeGrayscaleHeaders(5, 3);
+	CHECK(bmp::rowStride(5, 8) == 8);
+	CHECK(gray.file.offsetToPixelArray == sizeof(gray) + 1024);
+	CHECK(gray.file.size == sizeof(gray) + 1024 + 24);
+
+	alignas(4) const uint8_t rgb565[] = { 0x12, 0x34, 0x56, 0x78 };
+	alignas(4) uint8_t swapped[4] = {};
+	bmp::convertRowRgb565(rgb565, swapped, 2);
+	CHECK(swapped[0] == 0x34 && swapped[1] == 0x12 && swapped[2] == 0x78 && swapped[3] == 0x56);
+
+	// White and black pair (no chroma), then 4 pixels of luma ramp
+	alignas(4) const uint8_t yuv[] = { 255, 128, 0, 128, 10, 128, 20, 128, 30, 128, 40, 128 };
+	alignas(4) uint8_t colors[12] = {};
+	bmp::convertRowYuv422ToRgb565(yuv, colors, 2);
+	CHECK(colors[0] == 0xFF && colors[1] == 0xFF && colors[2] == 0 && colors[3] == 0);
+	alignas(4) uint8_t luma[8] = {};
+	bmp::convertRowYuv422ToGrayscale(yuv, luma, 6);
+	CHECK(luma[0] == 255 && luma[1] == 0 && luma[2] == 10 && luma[5] == 40);
+
+	// Rows converted in batches fitting the line buffer, padded to the stride
+	alignas(4) uint8_t frame[6 * 2 * 4] = {};
+	for (size_t i = 0; i < sizeof(frame); i++) frame[i] = i;
+	alignas(4) uint8_t line[16];
+	bmp::RowConverter converter(bmp::convertRowYuv422ToGrayscale, frame, 12, 6, 4, 8, line, sizeof(line));
+	CHECK(converter);
+	uint32_t total = 0, batches = 0;
+	while (const uint32_t length = converter.next()) {
+		CHECK(converter.data()[0] == frame[(batches * 2) * 12]);
+		total += length;
+		batches++;
+	}
+	CHECK(total == 4 * 8 && batches == 2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// JSON
+
+struct Recorded
+{
+	json::FieldType type;
+	uint8_t depth;
+	std::string key;
+	std::string value;
+};
+
+esp_err_t record_field(void* context, const json::Field& field)
+{
+	auto& fields = *static_cast<std::vector<Recorded>*>(context);
+	fields.push_back({ field.type, field.depth, std::string(field.key), field.value ? field.value : "" });
+	return ESP_OK;
+}
+
+esp_err_t parse(std::string_view document, std::vector<Recorded>& fields, size_t chunk)
+{
+	json::PushParser parser(record_field, &fields);
+	for (size_t i = 0; i < document.size(); i += chunk) {
+		const esp_err_t ret = parser.feed(document.data() + i, std::min(chunk, document.size() - i));
+		if (ret != ESP_OK) return ret;
+	}
+	return parser.finish();
+}
+
+void test_json()
+{
+	const std::string_view document = R"({"a": 1, "b": {"c": "x\"é", "d": [1, {"e": 2}]}, "f": true})";
+	std::vector<Recorded> whole, bytes;
+	CHECK(parse(document, whole, document.size()) == ESP_OK);
+	CHECK(parse(document, bytes, 1) == ESP_OK);
+	CHECK(whole.size() == 5 && bytes.size() == whole.size());
+	if (whole.size() == 5) {
+		CHECK(whole[0].key == "a" && whole[0].value == "1" && whole[0].type == json::FieldType::Primitive);
+		CHECK(whole[1].key == "b" && whole[1].type == json::FieldType::ObjectBegin);
+		CHECK(whole[2].key == "c" && whole[2].depth == 1 && whole[2].value == "x\"\xC3\xA9");
+		CHECK(whole[3].type == json::FieldType::ObjectEnd && whole[3].depth == 0); // array skipped
+		CHECK(whole[4].key == "f" && whole[4].value == "true");
+	}
+
+	std::vector<Recorded> ignored;
+	CHECK(parse(R"({"a": 1)", ignored, 64) == ESP_ERR_INVALID_ARG);
+	CHECK(parse(R"({"a" 1})", ignored, 64) == ESP_ERR_INVALID_ARG);
+	CHECK(parse(R"([1, 2])", ignored, 64) == ESP_ERR_INVALID_ARG);
+	CHECK(parse(R"({"a": 1} x)", ignored, 64) == ESP_ERR_INVALID_ARG);
+	const std::string longKey = "{\"" + std::string(json::PushParser::maxKeyLength + 1, 'k') + "\": 1}";
+	CHECK(parse(longKey, ignored, 64) == ESP_ERR_INVALID_SIZE);
+	std::string deep = "{";
+	for (uint8_t i = 0; i <= json::PushParser::maxDepth; i++) deep += "\"a\":{";
+	CHECK(parse(deep, ignored, 64) == ESP_ERR_INVALID_SIZE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Configuration
+
+std::string write_json(const config::Object& object, uint32_t since = 0)
+{
+	StringWriter output;
+	config::writeJson(output.writer, object, true, since);
+	return output.str();
+}
+
+void test_config_writer()
+{
+	StringWriter output;
+	config::writeUnsigned(output.writer, 0);
+	output.writer.put(' ');
+	config::writeUnsigned(output.writer, 18446744073709551615ull);
+	output.writer.put(' ');
+	config::writeInteger(output.writer, -2147483647 - 1);
+	output.writer.put(' ');
+	config::writeFloat(output.writer, -1.25f, 1);
+	output.writer.put(' ');
+	config::writeFloat(output.writer, 3.05f, 3);
+	output.writer.put(' ');
+	config::writeIp4(output.writer, 0x0104A8C0);
+	output.writer.put(' ');
+	config::writeJsonString(output.writer, "a\"b\\\n");
+	CHECK(output.str() == R"(0 18446744073709551615 -2147483648 -1.3 3.050 192.168.4.1 "a\"b\\\u000A")");
+
+	char small[4];
+	config::Writer bounded(small, sizeof(small));
+	bounded.write("12345");
+	CHECK(!bounded.ok());
+}
+
+void test_config()
+{
+	sample::reset();
+	CHECK(write_json(sample::root) == R"({"camera":{"framesize":8,"quality":12,"vflip":0},)"
+		R"("control":{"timeout":2000,"smoothing":0.5},"network":{"ssid":"YellowToyCar","ip":"192.168.4.1"}})");
+
+	const uint32_t before = config::currentGeneration();
+	CHECK(config::isValidGeneration(before));
+	config::Dispatcher dispatcher(sample::root);
+	json::PushParser parser(config::Dispatcher::callback, &dispatcher);
+	CHECK(parser.feed(sample::document.data(), sample::document.size()) == ESP_OK);
+	CHECK(parser.finish() == ESP_OK);
+	CHECK(sample::settings.camera.framesize == 5 && sample::settings.camera.quality == 10 && sample::settings.camera.vflip);
+	CHECK(sample::settings.control.timeout == 500 && sample::settings.control.smoothing == 1.5f);
+	CHECK(std::string_view(sample::settings.network.ssid) == "Car \"Yellow\" A");
+	CHECK(sample::settings.network.ip == 0x0200000A);
+
+	// Only changed objects are written for newer generations
+	CHECK(config::currentGeneration() != before);
+	CHECK(write_json(sample::root, config::currentGeneration()) == "{}");
+	CHECK(write_json(sample::root, before).find("\"camera\"") != std::string::npos);
+
+	// Binary round trip
+	StringWriter binary;
+	config::writeBinary(binary.writer, sample::root);
+	const std::string encoded = binary.str();
+	const std::string expected = write_json(sample::root);
+	sample::reset();
+	const auto* data = reinterpret_cast<const uint8_t*>(encoded.data());
+	CHECK(config::readBinary(sample::root, data, encoded.size()) == ESP_OK);
+	CHECK(write_json(sample::root) == expected);
+	CHECK(config::readBinary(sample::root, data, encoded.size() - 1) == ESP_ERR_INVALID_SIZE);
+	std::string mismatched = encoded;
+	mismatched[3] ^= 1;
+	CHECK(config::readBinary(sample::root, reinterpret_cast<const uint8_t*>(mismatched.data()), mismatched.size()) == ESP_ERR_INVALID_VERSION);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// UDP
+
+template <typename T>
+T last_sent_as()
+{
+	T packet {};
+	const auto& sent = host::lastSent();
+	std::memcpy(&packet, sent.data(), std::min(sent.size(), sizeof(T)));
+	return packet;
+}
+
+void push(const std::vector<uint8_t>& packet)
+{
+	host::pushDatagram(packet.data(), packet.size());
+}
+
+void test_udp()
+{
+	using namespace udp;
+	host::resetSocket();
+	host::resetModules();
+	udp::init();
+
+	// Legacy control packet
+	ShortControlPacket shortControl {};
+	shortControl.type = PacketType::ShortControl;
+	shortControl.mainLight = true;
+	shortControl.leftBackward = true;
+	shortControl.leftDuty = 255;
+	shortControl.rightDuty = 0;
+	host::pushDatagram(&shortControl, sizeof(shortControl));
+	udp::listen();
+	CHECK(host::postedCount() == 1);
+	CHECK(host::lastPosted().fields == control::Command::All);
+	CHECK(host::lastPosted().mainLight && !host::lastPosted().otherLight);
+	CHECK(host::lastPosted().left == -1.0f && host::lastPosted().right == 0.0f);
+
+	// Truncated and unknown packets are dropped
+	host::pushDatagram(&shortControl, 2);
+	const uint8_t unknown[] = { 0xEE, 0, 0, 0 };
+	host::pushDatagram(unknown, sizeof(unknown));
+	udp::listen();
+	CHECK(host::postedCount() == 1);
+
+	// Batch with control commands, acknowledged
+	push(sample::controlBatch(100, true));
+	udp::listen();
+	CHECK(host::postedCount() == 2);
+	const auto& command = host::lastPosted();
+	CHECK(command.fields == control::Command::All);
+	CHECK(command.profile == control::SmoothingProfile::SCurve && command.smoothingTime == 100);
+	CHECK(command.left == 50.0f && command.right == -25.0f);
+	CHECK(command.mainLight && !command.otherLight);
+	CHECK(host::sentCount() == 1);
+	auto ack = last_sent_as<AckPacket>();
+	CHECK(ack.type == PacketType::Ack && ack.status == AckStatus::Ok);
+	CHECK(ack.accepted == 2 && ack.rejected == 0 && ack.sequence == 100 && ack.timestamp == 1000);
+
+	// Only the latest control gets posted of all queued ones
+	push(sample::controlBatch(101));
+	push(sample::controlBatch(102));
+	push(sample::controlBatch(103));
+	udp::listen();
+	CHECK(host::postedCount() == 3);
+	CHECK(host::pendingDatagrams() == 0);
+
+	// Stale batch is dropped (acknowledged as such, if requested)
+	push(sample::controlBatch(102, true));
+	udp::listen();
+	CHECK(host::postedCount() == 3);
+	CHECK(last_sent_as<AckPacket>().status == AckStatus::Stale);
+
+	// Other commands applied right away; unknown, short and truncated ones are rejected
+	const CameraQualityCommand quality { .quality = 17 };
+	push(sample::batch(104, 1040, {
+		sample::Command::of(CommandType::CameraQuality, quality),
+		{ static_cast<CommandType>(0x7F), { 1, 2, 3 } },
+		{ CommandType::Motors, { 0, 0 } },
+		{ CommandType::Ping, {} },
+	}, false));
+	udp::listen();
+	CHECK(host::lastStreamQuality() == 17);
+	CHECK(host::postedCount() == 3); // no control commands
+	ack = last_sent_as<AckPacket>(); // requested by ping
+	CHECK(ack.sequence == 104 && ack.accepted == 2 && ack.rejected == 2);
+
+	auto truncated = sample::controlBatch(105, true);
+	truncated.pop_back();
+	push(truncated);
+	udp::listen();
+	ack = last_sent_as<AckPacket>();
+	CHECK(ack.sequence == 105 && ack.accepted == 1 && ack.rejected == 1);
+
+	// Batches of unsupported versions are rejected as whole
+	push(sample::batch(106, 1060, { { CommandType::Ping, {} } }, true, true, batchProtocolVersion + 1));
+	udp::listen();
+	ack = last_sent_as<AckPacket>();
+	CHECK(ack.sequence == 106 && ack.status == AckStatus::UnsupportedVersion && ack.accepted == 0);
+
+	// Coalesced commands are merged, so lights-only one isn't lost by following motors one
+	const LightsCommand lights { .mask = 0b11, .values = 0b10 };
+	const MotorsCommand motors { .smoothingTime = 20, .left = 10.0f, .right = 20.0f };
+	push(sample::batch(107, 1070, { sample::Command::of(CommandType::Lights, lights) }, true));
+	push(sample::batch(108, 1080, { sample::Command::of(CommandType::Motors, motors) }, true));
+	const size_t postedBefore = host::postedCount();
+	udp::listen();
+	CHECK(host::postedCount() == postedBefore + 1);
+	CHECK(host::lastPosted().fields == control::Command::All);
+	CHECK(!host::lastPosted().mainLight && host::lastPosted().otherLight);
+	CHECK(host::lastPosted().left == 10.0f && host::lastPosted().right == 20.0f);
+	CHECK(host::lastPosted().smoothingTime == 20);
+}
+
+/// Replies sent to clients of other transport (see `udp::handlePacket`).
+std::vector<std::pair<int, std::vector<uint8_t>>> replies;
+
+bool reply(int handle, const void* data, size_t length)
+{
+	const auto* bytes = static_cast<const uint8_t*>(data);
+	replies.push_back({ handle, { bytes, bytes + length } });
+	return true;
+}
+
+udp::UnknownPacket as_packet(const std::vector<uint8_t>& bytes)
+{
+	udp::UnknownPacket packet {};
+	std::memcpy(packet.buffer, bytes.data(), std::min(bytes.size(), sizeof(packet.buffer)));
+	return packet;
+}
+
+void test_udp_transports()
+{
+	using namespace udp;
+	host::resetSocket();
+	host::resetModules();
+	replies.clear();
+
+	// Control posted right away, acknowledged by the sender (not the socket)
+	const auto batch = sample::controlBatch(500, true);
+	handlePacket(as_packet(batch), batch.size(), reply, 7);
+	CHECK(host::postedCount() == 1);
+	CHECK(host::sentCount() == 0);
+	CHECK(replies.size() == 1 && replies.back().first == 7);
+	AckPacket ack {};
+	std::memcpy(&ack, replies.back().second.data(), sizeof(ack));
+	CHECK(ack.type == PacketType::Ack && ack.status == AckStatus::Ok && ack.sequence == 500);
+
+	// Sequencing is per client, as each has its own counter and clock
+	push(sample::controlBatch(499, true));
+	udp::listen();
+	CHECK(host::postedCount() == 2);
+	CHECK(last_sent_as<AckPacket>().status == AckStatus::Ok);
+	const auto other = sample::controlBatch(10, true);
+	handlePacket(as_packet(other), other.size(), reply, 8);
+	CHECK(host::postedCount() == 3 && replies.back().first == 8);
+	std::memcpy(&ack, replies.back().second.data(), sizeof(ack));
+	CHECK(ack.status == AckStatus::Ok && ack.sequence == 10);
+	const auto reordered = sample::controlBatch(499, true);
+	handlePacket(as_packet(reordered), reordered.size(), reply, 7);
+	CHECK(host::postedCount() == 3 && replies.back().first == 7);
+	std::memcpy(&ack, replies.back().second.data(), sizeof(ack));
+	CHECK(ack.status == AckStatus::Stale && ack.sequence == 499);
+
+	// Video subscriptions are rejected, truncated packets dropped
+	const VideoSubscribeCommand video { .fragmentLength = 0 };
+	const auto subscribe = sample::batch(501, 5010, { sample::Command::of(CommandType::VideoSubscribe, video) }, true);
+	handlePacket(as_packet(subscribe), subscribe.size(), reply, 7);
+	std::memcpy(&ack, replies.back().second.data(), sizeof(ack));
+	CHECK(ack.sequence == 501 && ack.accepted == 0 && ack.rejected == 1);
+	handlePacket(as_packet(batch), 4, reply, 7);
+	CHECK(replies.size() == 4 && host::postedCount() == 3);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int main()
+{
+	const std::pair<const char*, void (*)()> tests[] = {
+		{ "utils", test_utils },
+		{ "querystring", test_querystring },
+		{ "camera_formats", test_camera_formats },
+		{ "bmp", test_bmp },
+		{ "json", test_json },
+		{ "config_writer", test_config_writer },
+		{ "config", test_config },
+		{ "udp", test_udp },
+		{ "udp_transports", test_udp_transports },
+	};
+	for (const auto& [name, test] : tests) {
+		const unsigned before = failures;
+		test();
+		std::printf("%-16s %s\n", name, failures == before ? "ok" : "FAILED");
+	}
+	if (failures) {
+		std::printf("%u check(s) failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,346 @@
+import os
+import sys
+import glob
+import json
+import time
+import socket
+import argparse
+import threading
+import statistics
+import requests
+
+from protocol import parse_part_headers, batch_packet, parse_ack_packet, COMMAND_PING
+
+DEFAULT_IP = '192.168.4.1' # default for ESP32 esp-idf
+UDP_PORT = 83
+CAMERA_CONFIGS_DIR = os.path.join(os.path.dirname(__file__), 'configs', 'camera')
+
+################################################################################
+# Utils
+
+def log(*args):
+	'''Progress goes to standard error, so the results can be piped.'''
+	print(*args, file=sys.stderr)
+
+def summarize(values):
+	'''Returns summary of the values (i.e. latencies), in the same units.'''
+	if not values:
+		return None
+	ordered = sorted(values)
+	def percentile(p):
+		return ordered[min(len(ordered) - 1, round(p / 100 * (len(ordered) - 1)))]
+	return {
+		'count': len(values),
+		'min': ordered[0],
+		'mean': statistics.fmean(ordered),
+		'p50': percentile(50),
+		'p95': percentile(95),
+		'p99': percentile(99),
+		'max': ordered[-1],
+	}
+
+def fetch_metrics(ip):
+	'''Fetches `/metrics`, returns counters (summed across cores) and histograms (count & sum).'''
+	response = requests.get(f'http://{ip}/metrics', timeout=5)
+	response.raise_for_status()
+	counters = {}
+	histograms = {}
+	uptime = None
+	for line in response.text.splitlines():
+		parts = line.split()
+		if not parts:
+			continue
+		if parts[0] == 'uptime':
+			uptime = int(parts[1])
+		elif parts[0] == 'counter':
+			counters[parts[1]] = sum(int(v) for v in parts[2:])
+		elif parts[0] == 'histogram':
+			histograms[parts[1]] = { 'count': int(parts[2]), 'sum': int(parts[3]), 'max': int(parts[4]) }
+	return { 'uptime': uptime, 'counters': counters, 'histograms': histograms }
+
+def metrics_delta(before, after):
+	'''Differences of the device metrics between two reads (values are cumulative since boot).'''
+	if before is None or after is None:
+		return None
+	counters = {}
+	for name, value in after['counters'].items():
+		delta = (value - before['counters'].get(name, 0)) & 0xFFFFFFFF
+		if delta:
+			counters[name] = delta
+	histograms = {}
+	for name, h in after['histograms'].items():
+		b = before['histograms'].get(name, { 'count': 0, 'sum': 0 })
+		count = (h['count'] - b['count']) & 0xFFFFFFFF
+		if count:
+			histograms[name] = { 'count': count, 'mean': ((h['sum'] - b['sum']) & 0xFFFFFFFF) / count }
+	return {
+		'duration': (after['uptime'] - before['uptime']) / 1000000,
+		'counters': counters,
+		'histograms': histograms,
+	}
+
+class DeviceMetrics:
+	'''Captures the device metrics around the benchmark, tolerating firmware without them.'''
+	def __init__(self, ip):
+		self.ip = ip
+
+	def __enter__(self):
+		self.before = self._fetch()
+		self.delta = None
+		return self
+
+	def __exit__(self, *args):
+		self.delta = metrics_delta(self.before, self._fetch())
+
+	def _fetch(self):
+		try:
+			return fetch_metrics(self.ip)
+		except Exception as e:
+			log(f'Warning: Failed to fetch metrics ({e})')
+			return None
+
+################################################################################
+# Stream FPS vs viewers
+
+def stream_viewer(ip, duration, result):
+	frames = 0
+	total_bytes = 0
+	last_sequence = None
+	gaps = 0
+	start = time.time()
+	try:
+		response = requests.get(f'http://{ip}:81/stream', stream=True, timeout=5)
+		if response.status_code != 200:
+			result['error'] = f'status code {response.status_code}'
+			return
+		buffer = bytes()
+		for chunk in response.iter_content(chunk_size=4096):
+			buffer += chunk
+			total_bytes += len(chunk)
+			while True:
+				a = buffer.find(b'Content-Type:')
+				b = buffer.find(b'\r\n\r\n', a) if a != -1 else -1
+				if b == -1:
+					break
+				headers = parse_part_headers(buffer[a:b])
+				length = int(headers.get('content-length', 0))
+				if len(buffer) < b + 4 + length:
+					break
+				buffer = buffer[b+4+length:]
+				frames += 1
+				if 'x-sequence' in headers:
+					sequence = int(headers['x-sequence'])
+					if last_sequence is not None and sequence > last_sequence + 1:
+						gaps += sequence - last_sequence - 1
+					last_sequence = sequence
+			if time.time() - start >= duration:
+				break
+		response.close()
+	except requests.exceptions.RequestException as e:
+		result['error'] = str(e)
+	elapsed = time.time() - start
+	result.update({
+		'frames': frames,
+		'fps': frames / elapsed,
+		'kbps': total_bytes / elapsed / 1024,
+		'skipped': gaps, # by this viewer, as too slow (or frames grabbed for others)
+	})
+
+def benchmark_stream(args):
+	results = []
+	for viewers in range(1, args.max_viewers + 1):
+		log(f'Stream: {viewers} viewer(s) for {args.duration}s...')
+		with DeviceMetrics(args.ip) as metrics:
+			viewer_results = [{} for _ in range(viewers)]
+			threads = [threading.Thread(target=stream_viewer, args=(args.ip, args.duration, r)) for r in viewer_results]
+			for t in threads:
+				t.start()
+			for t in threads:
+				t.join()
+		fps = [r['fps'] for r in viewer_results if 'fps' in r]
+		results.append({
+			'viewers': viewers,
+			'fps_total': sum(fps),
+			'fps_min': min(fps, default=0),
+			'per_viewer': viewer_results,
+			'device': metrics.delta,
+		})
+		log(f'  FPS per viewer: {", ".join(f"{v:.2f}" for v in fps)}')
+		time.sleep(1) # let the device close the connections
+	return results
+
+################################################################################
+# Capture latency per camera config
+
+def benchmark_capture(args):
+	original = requests.get(f'http://{args.ip}/config', timeout=5).json().get('camera', {})
+	results = []
+	try:
+		for path in sorted(glob.glob(os.path.join(CAMERA_CONFIGS_DIR, '*.json'))):
+			name = os.path.splitext(os.path.basename(path))[0]
+			with open(path) as file:
+				config = json.load(file)
+			log(f'Capture: {name} ({args.count} requests)...')
+			requests.post(f'http://{args.ip}/config', json=config, timeout=10).raise_for_status()
+			time.sleep(0.5) # settle after reinitialization
+			latencies = []
+			sizes = []
+			errors = 0
+			with DeviceMetrics(args.ip) as metrics, requests.Session() as session:
+				for _ in range(args.count):
+					start = time.time()
+					try:
+						response = session.get(f'http://{args.ip}/capture', timeout=10)
+						if response.status_code != 200:
+							errors += 1
+							continue
+					except requests.exceptions.RequestException:
+						errors += 1
+						continue
+					latencies.append((time.time() - start) * 1000)
+					sizes.append(len(response.content))
+			results.append({
+				'config': name,
+				'camera': config.get('camera', {}),
+				'latency_ms': summarize(latencies),
+				'bytes': summarize(sizes),
+				'errors': errors,
+				'device': metrics.delta,
+			})
+			if latencies:
+				log(f'  p50: {statistics.median(latencies):.1f}ms, errors: {errors}')
+	finally:
+		restore = { k: original[k] for k in ['pixformat', 'framesize', 'quality'] if k in original }
+		if restore:
+			requests.post(f'http://{args.ip}/config', json={ 'camera': restore }, timeout=10)
+	return results
+
+################################################################################
+# UDP command-to-ack RTT at varying rates
+
+def benchmark_udp(args):
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	sock.connect((args.ip, UDP_PORT))
+	sock.settimeout(0.001)
+	sequence = 0
+	results = []
+	try:
+		for rate in args.rates:
+			log(f'UDP: pings at {rate}/s for {args.duration}s...')
+			sent = {} # sequence -> send time
+			rtts = []
+			processing = []
+			interval = 1 / rate
+			with DeviceMetrics(args.ip) as metrics:
+				start = time.time()
+				next_send = start
+				end = start + args.duration
+				while True:
+					now = time.time()
+					if now >= next_send and now < end:
+						sequence += 1
+						sent[sequence] = now
+						# Pings don't drive motors, but go through the same dispatch as commands
+						sock.send(batch_packet(sequence, round(now * 1000), [(COMMAND_PING, b'')], ack=True))
+						next_send += interval
+					elif now >= end + 1: # waiting for late acks
+						break
+					try:
+						ack = parse_ack_packet(sock.recv(64))
+					except (socket.timeout, BlockingIOError):
+						continue
+					if ack and ack['sequence'] in sent:
+						rtts.append((time.time() - sent.pop(ack['sequence'])) * 1000)
+						processing.append(ack['processing_time'])
+			total = len(rtts) + len(sent)
+			results.append({
+				'rate': rate,
+				'sent': total,
+				'lost': len(sent),
+				'loss': len(sent) / total if total else None,
+				'rtt_ms': summarize(rtts),
+				'processing_us': summarize(processing),
+				'device': metrics.delta,
+			})
+			if rtts:
+				log(f'  RTT p50: {statistics.median(rtts):.1f}ms, lost: {len(sent)}/{total}')
+	finally:
+		sock.close()
+	return results
+
+################################################################################
+# Config throughput
+
+def config_requests(ip, count, session):
+	latencies = []
+	total_bytes = 0
+	start = time.time()
+	for _ in range(count):
+		t = time.time()
+		response = (session or requests).get(f'http://{ip}/config', timeout=5)
+		response.raise_for_status()
+		latencies.append((time.time() - t) * 1000)
+		total_bytes += len(response.content)
+	elapsed = time.time() - start
+	return {
+		'requests_per_second': count / elapsed,
+		'kbps': total_bytes / elapsed / 1024,
+		'latency_ms': summarize(latencies),
+	}
+
+def benchmark_config(args):
+	results = {}
+	with DeviceMetrics(args.ip) as metrics:
+		log(f'Config: {args.count} requests with persistent connection...')
+		with requests.Session() as session:
+			results['keep_alive'] = config_requests(args.ip, args.count, session)
+		log(f'Config: {args.count} requests with new connections...')
+		results['new_connections'] = config_requests(args.ip, args.count, None)
+	results['device'] = metrics.delta
+	for key in ['keep_alive', 'new_connections']:
+		log(f'  {key}: {results[key]["requests_per_second"]:.1f} req/s')
+	return results
+
+################################################################################
+
+BENCHMARKS = {
+	'stream': benchmark_stream,
+	'capture': benchmark_capture,
+	'udp': benchmark_udp,
+	'config': benchmark_config,
+}
+
+def main():
+	parser = argparse.ArgumentParser(description='''Benchmarks the car network endpoints, writing results as JSON (with device metrics differences for each run).''')
+	parser.add_argument('benchmarks', nargs='*', metavar='BENCHMARK', help=f'Benchmarks to run: {", ".join(BENCHMARKS.keys())}. Default: all.')
+	parser.add_argument('--ip', '--address', default=DEFAULT_IP, help=f'IP of the device. Default: {DEFAULT_IP}')
+	parser.add_argument('--duration', default=10, type=float, help='Duration of stream and UDP runs in seconds. Default: 10')
+	parser.add_argument('--count', default=20, type=int, help='Number of requests per capture config and config run. Default: 20')
+	parser.add_argument('--max-viewers', default=4, type=int, help='Max number of concurrent stream viewers. Default: 4')
+	parser.add_argument('--rates', default=[10, 50, 100, 200], type=int, nargs='+', metavar='RATE', help='Packets per second for UDP runs. Default: 10 50 100 200')
+	parser.add_argument('--output', metavar='PATH', help='File to write the results to. Default: standard output.')
+	args = parser.parse_args()
+	for name in args.benchmarks:
+		if name not in BENCHMARKS:
+			parser.error(f'unknown benchmark: {name}')
+
+	status = requests.get(f'http://{args.ip}/status', timeout=5).json()
+	report = {
+		'device': args.ip,
+		'time': time.strftime('%Y-%m-%dT%H:%M:%S%z'),
+		'uptime': status.get('uptime'),
+		'results': {},
+	}
+	for name in args.benchmarks or BENCHMARKS.keys():
+		report['results'][name] = BENCHMARKS[name](args)
+
+	text = json.dumps(report, indent='\t')
+	if args.output:
+		with open(args.output, 'w') as file:
+			file.write(text)
+		log(f'Results written to {args.output}')
+	else:
+		print(text)
+
+if __name__ == '__main__':
+	main()
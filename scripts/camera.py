@@ -1,11 +1,14 @@
 import os
 import shutil
+import socket
+import struct
 import argparse
 from benedict import benedict
 from time import time, strftime
 import cv2
 import requests
 import numpy as np
+from protocol import parse_part_headers
 
 window_name = 'YellowToyCar Stream'
 
@@ -19,23 +22,6 @@ PIXFORMAT_JPEG      = 4
 JPEG_SOI_MARKER = b'\xff\xd8'
 JPEG_EOI_MARKER = b'\xff\xd9'
 
-FRAMESIZE_TO_DIMS = [
-	(96, 96),      # FRAMESIZE_96X96
-	(160, 120),    # FRAMESIZE_QQVGA
-	(176, 144),    # FRAMESIZE_QCIF
-	(240, 176),    # FRAMESIZE_HQVGA
-	(240, 240),    # FRAMESIZE_240X240
-	(320, 240),    # FRAMESIZE_QVGA
-	(400, 296),    # FRAMESIZE_CIF
-	(480, 320),    # FRAMESIZE_HVGA
-	(640, 480),    # FRAMESIZE_VGA
-	(800, 600),    # FRAMESIZE_SVGA
-	(1024, 768),   # FRAMESIZE_XGA
-	(1280, 720),   # FRAMESIZE_HD
-	(1280, 1024),  # FRAMESIZE_SXGA
-	(1600, 1200),  # FRAMESIZE_UXGA
-]
-
 def check_window_is_closed(window_name):
 	try:
 		cv2.pollKey() # required on some backends to update window state by running queued up events handling
@@ -49,28 +35,72 @@ def generate_frame_filename_for_saving(index):
 
 ################################################################################
 
+def get_framesize_dimensions(args, framesize):
+	'''Returns width and height of the frame size, as described by the device (see `/capabilities`).'''
+	response = requests.get(f'http://{args.ip}/capabilities', timeout=5)
+	response.raise_for_status()
+	for f in response.json()['framesizes']:
+		if f['value'] == framesize:
+			return f['width'], f['height']
+	raise ValueError(f'Error: Unsupported framesize={framesize}')
+
+def estimate_device_clock_offset(args):
+	'''Estimates offset of local clock to the device uptime (seconds), from the status request timing.'''
+	try:
+		before = time()
+		response = requests.get(f'http://{args.ip}/status', timeout=5)
+		after = time()
+		uptime = int(response.json()['uptime']) / 1000000
+		return (before + after) / 2 - uptime, (after - before) / 2
+	except Exception as e:
+		print(f'Warning: Failed to estimate device clock offset, latency will not be shown ({e})')
+		return None, None
+
 def handle_mjpeg_stream(args, config):
 	# Some code adapted from https://stackoverflow.com/questions/21702477/how-to-parse-mjpeg-http-stream-from-ip-camera
 	# Other solution like `cv2.VideoCapture(stream_url)` couldn't be used, as it fails to work here.
+	clock_offset, clock_error = estimate_device_clock_offset(args)
+	if clock_offset is not None:
+		print(f'Device clock offset estimated with +/- {clock_error * 1000:.1f}ms error')
 	start = time()
 	total_frames = 0
 	saved_frames = 0
 	total_bytes = 0
+	dropped_frames = 0
+	last_sequence = None
 	response = requests.get(f'http://{args.ip}:81/stream', stream=True)
 	if response.status_code == 200:
 		buffer = bytes()
 		for chunk in response.iter_content(chunk_size=4096):
 			buffer += chunk
-			a = buffer.find(JPEG_SOI_MARKER)
+			total_bytes += len(chunk)
+
+			# Part headers: Content-Type, Content-Length, X-Timestamp (capture uptime), X-Sequence, X-Motors (duties)
+			a = buffer.find(b'Content-Type:')
 			if a == -1:
 				continue
-			b = buffer.find(JPEG_EOI_MARKER, a)
+			b = buffer.find(b'\r\n\r\n', a)
 			if b == -1:
 				continue
-
-			jpg = buffer[a:b+2]
-			buffer = buffer[b+2:]
+			headers = parse_part_headers(buffer[a:b])
+			if 'content-length' in headers:
+				length = int(headers['content-length'])
+				if len(buffer) < b + 4 + length:
+					continue
+				jpg = buffer[b+4:b+4+length]
+				buffer = buffer[b+4+length:]
+			else: # older firmware, look for the markers instead
+				c = buffer.find(JPEG_EOI_MARKER, b)
+				if c == -1:
+					continue
+				jpg = buffer[b+4:c+2]
+				buffer = buffer[c+2:]
+
+			received = time()
 			image = cv2.imdecode(np.frombuffer(jpg, dtype=np.uint8), cv2.IMREAD_COLOR)
+			if image is None:
+				print('Warning: Failed to decode frame')
+				continue
 			height, width, channels = image.shape
 			if width * args.scale >= 120:
 				cv2.namedWindow(window_name, cv2.WINDOW_NORMAL)
@@ -78,10 +108,21 @@ def handle_mjpeg_stream(args, config):
 			cv2.imshow(window_name, image)
 
 			total_frames += 1
-			from_start = time() - start
+			from_start = received - start
 			fps = total_frames / from_start
-			total_bytes += len(chunk)
-			print(f'{from_start:.3f}s: frame #{total_frames}\tFPS: {fps:.2f}\tKB/s: {total_bytes / from_start / 1024:.3f}')
+			details = ''
+			if 'x-sequence' in headers:
+				sequence = int(headers['x-sequence'])
+				if last_sequence is not None and sequence > last_sequence + 1:
+					dropped_frames += sequence - last_sequence - 1
+				last_sequence = sequence
+				details += f'\tseq: {sequence} (dropped: {dropped_frames})'
+			if 'x-timestamp' in headers and clock_offset is not None:
+				latency = received - (float(headers['x-timestamp']) + clock_offset)
+				details += f'\tlatency: {latency * 1000:.1f}ms'
+			if 'x-motors' in headers:
+				details += f'\tmotors: {headers["x-motors"]}'
+			print(f'{from_start:.3f}s: frame #{total_frames}\tFPS: {fps:.2f}\tKB/s: {total_bytes / from_start / 1024:.3f}{details}')
 
 			if args.save:
 				saved_fps = saved_frames / from_start
@@ -163,7 +204,7 @@ def decode_static_size_frame(data, width, height, pixformat):
 def handle_static_size_stream(args, config, pixformat):
 	# TODO: This doesn't support changing framesize during the stream;
 	#	It would require server to include width & height before the pixels data
-	width, height = FRAMESIZE_TO_DIMS[int(config['camera.framesize'])]
+	width, height = get_framesize_dimensions(args, int(config['camera.framesize']))
 	if width * args.scale >= 120:
 		cv2.namedWindow(window_name, cv2.WINDOW_NORMAL)
 		cv2.resizeWindow(window_name, width * args.scale, height * args.scale)
@@ -209,7 +250,7 @@ def handle_static_size_stream(args, config, pixformat):
 		print(f'Error: Received unexpected status code {response.status_code}')
 
 def handle_static_size_frame(args, config, pixformat):
-	width, height = FRAMESIZE_TO_DIMS[int(config['camera.framesize'])]
+	width, height = get_framesize_dimensions(args, int(config['camera.framesize']))
 	if width * args.scale >= 120:
 		cv2.namedWindow(window_name, cv2.WINDOW_NORMAL)
 		cv2.resizeWindow(window_name, width * args.scale, height * args.scale)
@@ -235,6 +276,130 @@ def handle_static_size_frame(args, config, pixformat):
 
 ################################################################################
 
+UDP_PORT = 83
+UDP_VIDEO_SUBSCRIBE = 6
+UDP_VIDEO_FRAGMENT = 7
+UDP_VIDEO_RENEW_INTERVAL = 5 # seconds, subscription expires after 10
+VIDEO_FRAGMENT_HEADER = struct.Struct('<BBHHHHHIIIq')
+
+def handle_udp_stream(args, config):
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	sock.settimeout(1)
+	subscribe = struct.pack('<BBH', UDP_VIDEO_SUBSCRIBE, 0, args.udp_fragment_length)
+	last_subscribe = 0
+
+	start = time()
+	total_frames = 0
+	saved_frames = 0
+	total_bytes = 0
+	incomplete_frames = 0
+	current = None # (frame, length, pixformat, width, height, timestamp, buffer, received bytes)
+	try:
+		while True:
+			if time() - last_subscribe > UDP_VIDEO_RENEW_INTERVAL:
+				sock.sendto(subscribe, (args.ip, UDP_PORT))
+				last_subscribe = time()
+			try:
+				datagram = sock.recv(2048)
+			except socket.timeout:
+				print('No video fragments received, renewing subscription')
+				last_subscribe = 0
+				continue
+			if len(datagram) < VIDEO_FRAGMENT_HEADER.size or datagram[0] != UDP_VIDEO_FRAGMENT:
+				continue
+			total_bytes += len(datagram)
+			_, pixformat, fragment, fragments, width, height, _, frame, offset, length, timestamp = VIDEO_FRAGMENT_HEADER.unpack_from(datagram)
+			payload = datagram[VIDEO_FRAGMENT_HEADER.size:]
+			if current is None or current[0] != frame:
+				if current is not None:
+					if frame - current[0] < 0:
+						continue # late fragment of older frame
+					incomplete_frames += 1 # newer frame started, drop the incomplete one
+				current = [frame, length, pixformat, width, height, timestamp, bytearray(length), 0]
+			if offset + len(payload) > length:
+				continue
+			current[6][offset:offset+len(payload)] = payload
+			current[7] += len(payload)
+			if current[7] < length:
+				continue
+
+			data = bytes(current[6])
+			current = None
+			if pixformat == PIXFORMAT_JPEG:
+				image = cv2.imdecode(np.frombuffer(data, dtype=np.uint8), cv2.IMREAD_COLOR)
+			else:
+				image = decode_static_size_frame(data, width, height, pixformat)
+			if image is None:
+				continue
+			if width * args.scale >= 120:
+				cv2.namedWindow(window_name, cv2.WINDOW_NORMAL)
+				cv2.resizeWindow(window_name, width * args.scale, height * args.scale)
+			cv2.imshow(window_name, image)
+
+			total_frames += 1
+			from_start = time() - start
+			fps = total_frames / from_start
+			print(f'{from_start:.3f}s: frame #{total_frames}\tFPS: {fps:.2f}\tKB/s: {total_bytes / from_start / 1024:.3f}\tseq: {frame} @ {timestamp / 1000000:.6f}s\tincomplete: {incomplete_frames}')
+
+			if args.save:
+				saved_fps = saved_frames / from_start
+				if not args.save_fps or saved_fps < args.save_fps:
+					filename = generate_frame_filename_for_saving(total_frames) + ('.jpg' if pixformat == PIXFORMAT_JPEG else '.bin')
+					with open(os.path.join(args.save, filename), 'wb') as file:
+						file.write(data)
+					saved_frames += 1
+
+			esc_or_q_pressed = cv2.pollKey() in [27, ord('q')]
+			if check_window_is_closed(window_name) or esc_or_q_pressed:
+				break
+	finally:
+		sock.sendto(struct.pack('<BBH', UDP_VIDEO_SUBSCRIBE, 0, 0xFFFF), (args.ip, UDP_PORT)) # unsubscribe
+		sock.close()
+
+################################################################################
+
+def handle_history(args):
+	params = {}
+	if args.history_freeze:
+		params['freeze'] = 1
+	if args.history_resume:
+		params['resume'] = 1
+	response = requests.get(f'http://{args.ip}/history', params=params, timeout=30)
+	if response.status_code != 200:
+		print(f'Error: Received unexpected status code {response.status_code}')
+		return
+	trigger = response.headers.get('X-Trigger', 'none')
+	if trigger != 'none':
+		print(f'History frozen by {trigger} at {int(response.headers.get("X-Trigger-Timestamp", 0)) / 1000000:.6f}s (uptime)')
+	data = response.content
+	position = 0
+	frames = 0
+	first_timestamp = None
+	while True:
+		# Parts have Content-Length, so the data isn't searched for the boundary
+		a = data.find(b'Content-Type:', position)
+		if a == -1:
+			break
+		b = data.find(b'\r\n\r\n', a)
+		if b == -1:
+			break
+		headers = parse_part_headers(data[a:b])
+		length = int(headers['content-length'])
+		frame = data[b+4:b+4+length]
+		position = b + 4 + length
+		frames += 1
+
+		timestamp = float(headers['x-timestamp'])
+		if first_timestamp is None:
+			first_timestamp = timestamp
+		print(f'{timestamp - first_timestamp:.3f}s: seq: {headers["x-sequence"]}\tmotors: {headers["x-motors"]}\tbytes: {length}')
+		if args.save:
+			extension = '.jpg' if headers['content-type'] == 'image/jpeg' else f'.{headers.get("x-size", "raw")}.bin'
+			filename = f'{headers["x-sequence"]}_{headers["x-timestamp"]}{extension}'
+			with open(os.path.join(args.save, filename), 'wb') as file:
+				file.write(frame)
+	print(f'Received {frames} frames from history')
+
 def fps_type(x):
 	try:
 		x = float(x)
@@ -250,6 +415,11 @@ def main():
 	parser.add_argument('--ip', '--address', help=f'IP of the device. Defaults to the one from the config file or {DEFAULT_IP}.', required=False)
 	parser.add_argument('--stream', help=argparse.SUPPRESS, required=False, action='store_true') # allow '--stream' just because I want to
 	parser.add_argument('--frame', help='If set, only retrieves single frame.', required=False, action='store_true')
+	parser.add_argument('--udp', help='If set, streams frames over UDP (as fragmented datagrams) instead of HTTP.', required=False, action='store_true')
+	parser.add_argument('--udp-fragment-length', metavar='BYTES', help='Max payload of single UDP datagram, 0 for max fitting MTU.', required=False, type=int, default=0)
+	parser.add_argument('--history', help='If set, downloads recent frames recorded by the history (saved to folder if `--save` is used).', required=False, action='store_true')
+	parser.add_argument('--history-freeze', help='Freeze the history (stop recording) before downloading.', required=False, action='store_true')
+	parser.add_argument('--history-resume', help='Resume recording of the history after downloading.', required=False, action='store_true')
 	parser.add_argument('--scale', help='Scale factor for displaying the received image (not saving).', required=False, type=int, default=1)
 	parser.add_argument('--save', metavar='PATH', help='If set, specifies path to file (or folder) for the frame (or stream) to be saved.', required=False)
 	parser.add_argument('--save-fps', metavar='FPS', help='If set, limits number of frames being saved.', required=False, type=fps_type)
@@ -301,13 +471,17 @@ def main():
 		config = benedict(f'http://{args.ip}/config', format='json', requests_options={'timeout': 5})
 
 	pixformat = int(config['camera.pixformat'])
-	if args.frame:
+	if args.history:
+		handle_history(args)
+	elif args.frame:
 		if pixformat == PIXFORMAT_JPEG:
 			handle_jpeg_frame(args, config)
 		else:
 			handle_static_size_frame(args, config, pixformat)
 	else: # stream
-		if pixformat == PIXFORMAT_JPEG:
+		if args.udp:
+			handle_udp_stream(args, config)
+		elif pixformat == PIXFORMAT_JPEG:
 			handle_mjpeg_stream(args, config)
 		else:
 			handle_static_size_stream(args, config, pixformat)
@@ -7,6 +7,7 @@ import keyboard
 import socket
 import struct
 from math import floor
+from protocol import batch_packet, parse_ack_packet, COMMAND_MOTORS, COMMAND_LIGHTS, COMMAND_PING
 
 def clamp(value, low, high): 
 	return max(low, min(value, high))
@@ -56,17 +57,27 @@ class CarControlData:
 			self.right_motor * 100
 		)
 
+	def to_batch_packet(self, sequence: int, timestamp: int):
+		lights = (1 if self.main_light else 0) | (2 if self.other_light else 0)
+		return batch_packet(sequence, timestamp, [
+			(COMMAND_MOTORS, struct.pack('<BBHff', 0, 0, 0, self.left_motor * 100, self.right_motor * 100)),
+			(COMMAND_LIGHTS, struct.pack('<BB', 0b11, lights)),
+		])
+
 ########################################
 
 class CarConnection:
 	"""Represents connection to the car."""
 
-	def __init__(self, ip: str, address: str, port_udp = 83, use_short_packet = False, show_packets = True) -> None:
+	def __init__(self, ip: str, address: str, port_udp = 83, use_short_packet = False, show_packets = True, use_batch = False) -> None:
 		self.ip = ip
 		self.address = address
 		self.port_udp = port_udp
 		self.use_short_packet = use_short_packet
 		self.show_packets = show_packets
+		self.use_batch = use_batch
+		self.sequence = 0
+		self.last_rtt = None
 
 	def get_status(self):
 		response = requests.get(f'http://{self.address}/status', timeout=5)
@@ -91,16 +102,48 @@ class CarConnection:
 		self.sock.connect((self.ip, self.port_udp))
 		local_port = self.sock.getsockname()[1]
 		print(f'UDP socket open at local port {local_port}')
-		# TODO: implement some ping mechanism in the UDP server and use here to test UDP connection
+
+		if self.use_batch:
+			self.sock.settimeout(1)
+			self.sock.send(batch_packet(self.next_sequence(), self.client_time_ms(), [(COMMAND_PING, b'')]))
+			try:
+				self.receive_acks()
+			except socket.timeout:
+				print('Warning: No response for ping, firmware might not support batches')
+			self.sock.setblocking(False)
 
 		return self
 
+	def client_time_ms(self):
+		# Wall clock, so the device doesn't take batches after restart of the script as outdated
+		return floor(time.time() * 1000) & 0xFFFFFFFF
+
+	def next_sequence(self):
+		self.sequence += 1
+		return self.sequence
+
+	def receive_acks(self):
+		"""Handles acknowledgements already received, measuring round trip time from the echoed timestamps."""
+		while True:
+			try:
+				data = self.sock.recv(64)
+			except BlockingIOError:
+				return
+			ack = parse_ack_packet(data)
+			if ack is None:
+				continue
+			self.last_rtt = (self.client_time_ms() - ack['timestamp']) & 0xFFFFFFFF
+			if self.show_packets or self.sock.gettimeout():
+				print(f'  udp: Ack #{ack["sequence"]} {ack["status"]}, accepted: {ack["accepted"]}, rejected: {ack["rejected"]}, RTT: {self.last_rtt}ms (processing: {ack["processing_time"]}us)')
+			if self.sock.gettimeout():
+				return # waiting for single one
+
 	@staticmethod
-	def connect(address: str, port_udp = 83, use_short_packet = False, show_packets = True):
+	def connect(address: str, port_udp = 83, use_short_packet = False, show_packets = True, use_batch = False):
 		ip = socket.gethostbyname(address)
 		
 		print(f"Connecting to {ip}...")
-		instance = CarConnection(ip, address, port_udp, use_short_packet, show_packets)
+		instance = CarConnection(ip, address, port_udp, use_short_packet, show_packets, use_batch)
 		if instance._connect() is None:
 			return None
 		print(f"Connected to {ip}")
@@ -111,14 +154,19 @@ class CarConnection:
 
 	def control_udp(self, data: CarControlData):
 		"""Sends the UDP packet to control the car"""
-		if self.use_short_packet:
+		if self.use_batch:
+			self.receive_acks()
+			bytes = data.to_batch_packet(self.next_sequence(), self.client_time_ms())
+		elif self.use_short_packet:
 			bytes = data.to_short_packet()
 		else:
 			bytes = data.to_long_packet()
 		self.sock.sendto(bytes, (self.ip, self.port_udp))
 		if self.show_packets:
 			expected_uptime_ms = self.start_uptime_ms + floor((time.time() - self.start_time) * 1000)
-			if self.use_short_packet:
+			if self.use_batch:
+				print(f'  ({expected_uptime_ms}) udp: Batch #{self.sequence}: L:{data.left_motor * 100:.2f} R:{data.right_motor * 100:.2f} ML:{int(data.main_light)} OL:{int(data.other_light)}')
+			elif self.use_short_packet:
 				print(f'  ({expected_uptime_ms}) udp: ShortControlPacket: F:{data.flags:02X} T:0ms L:{round(abs(data.left_motor) * 255) * 100:.2f} R:{round(abs(data.right_motor) * 255):.3f}')
 			else:
 				print(f'  ({expected_uptime_ms}) udp: LongControlPacket: F:{data.flags:02X} T:0ms L:{data.left_motor * 100:.2f} R{data.right_motor * 100:.2f}')
@@ -367,6 +415,7 @@ def main():
 	parser.add_argument('--dry-run',           action='store_true', required=False, help='Performs dry-run for testing.')
 	parser.add_argument('--show-packets',      action='store_true', required=False, help='Show sent packets.')
 	parser.add_argument('--short-packet-type', action='store_true', required=False, help='Uses short packet type instead long.')
+	parser.add_argument('--batch',             action='store_true', required=False, help='Uses batch packets (protocol v2) with acknowledgements, measuring RTT.')
 	parser.add_argument('--no-blink',          action='store_true', required=False, help='Prevents default behaviour of constant status led blinking.')
 	driving = parser.add_argument_group('Driving model')
 	driving.add_argument('--max-speed',          default=1.0, type=float, required=False, metavar='VALUE', help='Maximal speed. From 0.0 for still to 1.0 for full.')
@@ -382,9 +431,9 @@ def main():
 		args.show_packets = True
 
 	if args.dry_run:
-		connection = DryRunCarConnection.connect(args.address, args.port, args.short_packet_type, args.show_packets)
+		connection = DryRunCarConnection.connect(args.address, args.port, args.short_packet_type, args.show_packets, args.batch)
 	else:
-		connection = CarConnection.connect(args.address, args.port, args.short_packet_type, args.show_packets)
+		connection = CarConnection.connect(args.address, args.port, args.short_packet_type, args.show_packets, args.batch)
 
 	base_driving_model_options = SmoothedDrivingModelOptions(
 		interval=args.interval / 1000, # from milliseconds to seconds float
@@ -3,15 +3,34 @@ Import("env")
 import os
 import gzip
 import glob
+import hashlib
 
 def gzip_file(src, dst):
-	with open(src, 'rb') as src, gzip.open(dst, 'wb') as dst:
+	# No file name nor time in the header, so the output (and its hash) only depends on the content
+	with open(src, 'rb') as src, open(dst, 'wb') as raw, gzip.GzipFile(filename='', mode='wb', fileobj=raw, mtime=0) as dst:
 		for chunk in iter(lambda: src.read(4096), b""):
 			dst.write(chunk)
 
 filetypes_to_gzip = ['html', 'js', 'css']
 
+content_types = {
+	'html': 'text/html',
+	'js': 'text/javascript',
+	'css': 'text/css',
+	'json': 'application/json',
+	'svg': 'image/svg+xml',
+	'png': 'image/png',
+	'ico': 'image/x-icon',
+}
+
+# Entry page is revalidated on every load (cheap, thanks to the ETag), so updated
+# firmware shows the new UI right away; other assets are cached for longer.
+entry_page = 'index.html'
+entry_cache_control = 'no-cache'
+assets_cache_control = 'public, max-age=604800'
+
 src_dir_path = env.get('PROJECT_SRC_DIR')
+table_path = os.path.join(src_dir_path, 'embedded_files.inc')
 
 files_to_gzip = []
 for extension in filetypes_to_gzip:
@@ -27,3 +46,36 @@ for source_file_path in files_to_gzip:
 		os.remove(target_file_path)
 	print('Compressing web for embedding: ' + source_file_path)
 	gzip_file(source_file_path, target_file_path)
+
+# Table of embedded files for the HTTP server (see `embeddedFiles` in `http.cpp`),
+# with content hashes used as entity tags, so unchanged files aren't sent again.
+def embedded_file_entry(path):
+	file_name = os.path.basename(path)
+	symbol = ''.join(c if c.isalnum() else '_' for c in file_name) # like ESP-IDF `EMBED_FILES`
+	name, encoding = (file_name[:-3], 'gzip') if file_name.endswith('.gz') else (file_name, None)
+	extension = name.rsplit('.', 1)[-1]
+	with open(path, 'rb') as file:
+		digest = hashlib.sha256(file.read()).hexdigest()[:16]
+	return 'EMBEDDED_FILE({}, "{}", "{}", {}, "\\"{}\\"", "{}")'.format(
+		symbol,
+		'/' if name == entry_page else '/' + name,
+		content_types.get(extension, 'application/octet-stream'),
+		'"{}"'.format(encoding) if encoding else 'nullptr',
+		digest,
+		entry_cache_control if name == entry_page else assets_cache_control,
+	)
+
+embed_files = env.GetProjectOption('board_build.embed_files', '').split()
+lines = [
+	'// Generated by `scripts/pio/gzip_web_embeds.py` from `board_build.embed_files`, do not edit.',
+	'// EMBEDDED_FILE(symbol, uri, content type, content encoding, entity tag, cache control)',
+]
+for path in embed_files:
+	lines.append(embedded_file_entry(os.path.join(env.get('PROJECT_DIR'), path)))
+table = '\n'.join(lines) + '\n'
+
+# Written only if changed, to not trigger rebuilding
+if not os.path.exists(table_path) or open(table_path).read() != table:
+	print('Updating embedded files table: ' + table_path)
+	with open(table_path, 'w') as file:
+		file.write(table)
@@ -0,0 +1,44 @@
+"""Helpers for the car protocols, shared by the scripts."""
+import struct
+
+# Protocol v2 (batches of commands), see `udp.hpp`
+PACKET_TYPE_BATCH = 9
+PACKET_TYPE_ACK = 10
+BATCH_PROTOCOL_VERSION = 2
+BATCH_FLAG_ACK = 0b01
+BATCH_FLAG_SEQUENCED = 0b10
+COMMAND_MOTORS = 1
+COMMAND_LIGHTS = 2
+COMMAND_PING = 6
+ACK_STATUSES = ['ok', 'stale', 'unsupported version']
+
+def batch_packet(sequence: int, timestamp: int, commands: list, ack = True):
+	"""Packs batch of commands, each as tuple of type and payload bytes."""
+	flags = BATCH_FLAG_SEQUENCED | (BATCH_FLAG_ACK if ack else 0)
+	data = struct.pack('<BBBBII', PACKET_TYPE_BATCH, BATCH_PROTOCOL_VERSION, flags, 0, sequence & 0xFFFFFFFF, timestamp & 0xFFFFFFFF)
+	for type, payload in commands:
+		data += struct.pack('<BB', type, len(payload)) + payload
+	return data
+
+def parse_ack_packet(data: bytes):
+	if len(data) < 24 or data[0] != PACKET_TYPE_ACK:
+		return None
+	type, status, accepted, rejected, sequence, timestamp, processing_time, uptime = struct.unpack('<BBBBIIIq', data[:24])
+	return {
+		'status': ACK_STATUSES[status] if status < len(ACK_STATUSES) else status,
+		'accepted': accepted,
+		'rejected': rejected,
+		'sequence': sequence,
+		'timestamp': timestamp,
+		'processing_time': processing_time,
+		'uptime': uptime,
+	}
+
+# Metadata headers of the stream (and history) parts
+def parse_part_headers(data):
+	headers = {}
+	for line in data.split(b'\r\n'):
+		key, sep, value = line.partition(b':')
+		if sep:
+			headers[key.strip().decode().lower()] = value.strip().decode()
+	return headers
@@ -1,12 +1,20 @@
 #include "camera.hpp"
+#include "camera_formats.hpp"
 #include <cstdio>
 #include <cstring>
 #include <cctype>
+#include <algorithm>
+#include <iterator>
 #include <esp_err.h>
 #include <esp_log.h>
-#include <jsmn.h>
-#include <to_string.hpp>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <img_converters.h>
 #include "common.hpp"
+#include "metrics.hpp"
+#include "json.hpp"
+#include "config.hpp"
+#include "tasks.hpp"
 
 // Ugly way to force debug & verbose logs to appear, see README > Known issues.
 #undef ESP_LOGD
@@ -25,16 +33,285 @@ SemaphoreHandle_t mutex;
 FrameBufferGuard::~FrameBufferGuard()
 {
 	if (likely(fb)) esp_camera_fb_return(fb);
+	if (SemaphoreGuard::operator bool()) 
+		metrics::recordSince(metrics::Histogram::CameraMutexHold, takenTime);
 }
 
 FrameBufferGuard FrameBufferGuard::take(TickType_t blockTime)
 {
 	camera_fb_t* fb = nullptr;
+	const uptime_t start = esp_timer_get_time();
 	auto sg = SemaphoreGuard::take(mutex, blockTime);
+	const uptime_t taken = esp_timer_get_time();
 	if (sg) {
+		metrics::record(metrics::Histogram::CameraMutexWait, taken - start);
 		fb = esp_camera_fb_get();
+		metrics::recordSince(metrics::Histogram::CameraAcquire, taken);
+		if (fb && fb->format == PIXFORMAT_JPEG) 
+			metrics::record(metrics::Histogram::JpegSize, fb->len);
 	}
-	return FrameBufferGuard { std::move(sg), fb };
+	return FrameBufferGuard { std::move(sg), fb, taken };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Shared capture loop
+
+/// Max number of frame buffers allocated by the camera driver. 
+constexpr uint8_t maxFramebuffersCount = 4;
+/// Min number of frame buffers, so the capture loop always has one free while
+/// a subscriber processes one frame and has another queued.
+constexpr uint8_t minFramebuffersCount = 3;
+
+/// Number of frame buffers allocated by the camera driver, depending on 
+/// frame size and pixel format (see `choose_framebuffers_policy`).
+uint8_t framebuffersCount = maxFramebuffersCount;
+
+/// Slots for frames grabbed by the capture loop. There is no need for more
+/// than the driver buffers, as taking one more frame would block anyway.
+SharedFrame::Slot sharedFrameSlots[maxFramebuffersCount];
+uint32_t sharedFramesSequence = 0;
+
+void SharedFrame::reset()
+{
+	if (slot) {
+		// Read before releasing, as the slot might be reused right after.
+		camera_fb_t* fb = slot->fb;
+		if (slot->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			esp_camera_fb_return(fb);
+		}
+		slot = nullptr;
+	}
+}
+
+SharedFrame SharedFrame::capture(TickType_t blockTime)
+{
+	Slot* slot = nullptr;
+	camera_fb_t* fb = nullptr;
+	const uptime_t start = esp_timer_get_time();
+	if (auto sg = SemaphoreGuard::take(mutex, blockTime)) {
+		const uptime_t taken = esp_timer_get_time();
+		metrics::record(metrics::Histogram::CameraMutexWait, taken - start);
+
+		// Claim free slot first, to avoid waiting for buffer if all are held.
+		// Done under the mutex, so no slots are claimed while flushing them.
+		for (uint8_t i = 0; i < framebuffersCount; i++) {
+			auto& s = sharedFrameSlots[i];
+			uint16_t expected = 0;
+			if (s.references.compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+				slot = &s;
+				break;
+			}
+		}
+		if (unlikely(!slot)) 
+			return {};
+
+		fb = esp_camera_fb_get();
+		const uptime_t acquired = esp_timer_get_time();
+		metrics::record(metrics::Histogram::CameraAcquire, acquired - taken);
+		metrics::record(metrics::Histogram::CameraMutexHold, acquired - taken);
+		if (fb && fb->format == PIXFORMAT_JPEG) 
+			metrics::record(metrics::Histogram::JpegSize, fb->len);
+	}
+	if (unlikely(!fb)) {
+		if (slot) slot->references.store(0, std::memory_order_release);
+		return {};
+	}
+	slot->fb = fb;
+	slot->sequence = ++sharedFramesSequence;
+	return SharedFrame { slot };
+}
+
+/// Max number of subscribers of the capture loop at once.
+constexpr uint8_t maxSubscribers = 8;
+
+FrameSubscriber* subscribers[maxSubscribers];
+std::atomic<uint8_t> subscribersCount;
+SemaphoreHandle_t subscribersMutex;
+TaskHandle_t captureLoopTask;
+
+uint8_t getSubscribersCount()
+{
+	return subscribersCount.load(std::memory_order_relaxed);
+}
+
+FrameSubscriber::FrameSubscriber()
+{
+	readySemaphore = xSemaphoreCreateBinaryStatic(&readySemaphoreBuffer);
+
+	auto guard = SemaphoreGuard::take(subscribersMutex);
+	for (auto& s : subscribers) {
+		if (!s) {
+			s = this;
+			registered = true;
+			break;
+		}
+	}
+	if (likely(registered)) {
+		if (subscribersCount.fetch_add(1, std::memory_order_relaxed) == 0) {
+			xTaskNotifyGive(captureLoopTask); // wake up the loop
+		}
+	}
+	else {
+		ESP_LOGW(TAG_CAMERA, "Too many frame subscribers");
+	}
+}
+
+FrameSubscriber::~FrameSubscriber()
+{
+	if (registered) {
+		auto guard = SemaphoreGuard::take(subscribersMutex);
+		for (auto& s : subscribers) {
+			if (s == this) {
+				s = nullptr;
+				break;
+			}
+		}
+		subscribersCount.fetch_sub(1, std::memory_order_relaxed);
+	}
+	clear();
+	vSemaphoreDelete(readySemaphore);
+}
+
+SharedFrame FrameSubscriber::next(TickType_t blockTime)
+{
+	for (;;) {
+		SharedFrame frame;
+		portENTER_CRITICAL(&lock);
+		if (count) {
+			swap(frame, queue[head]);
+			head = (head + 1) % queueLength;
+			count--;
+		}
+		portEXIT_CRITICAL(&lock);
+		if (frame) 
+			return frame;
+		if (!xSemaphoreTake(readySemaphore, blockTime))
+			return {};
+	}
+}
+
+uint8_t FrameSubscriber::capacity()
+{
+	// One frame might be held by the consumer, one needs to be free for capture.
+	return std::clamp<uint8_t>(framebuffersCount - 2, 1, queueLength);
+}
+
+void FrameSubscriber::push(const SharedFrame& frame)
+{
+	// Frames are released outside the critical section, since returning 
+	// the buffer to the driver is not allowed there.
+	SharedFrame incoming = frame;
+	SharedFrame oldest;
+	portENTER_CRITICAL(&lock);
+	if (count >= capacity()) {
+		swap(oldest, queue[head]);
+		head = (head + 1) % queueLength;
+		count--;
+		dropped++;
+		metrics::count(metrics::Counter::FramesDropped);
+	}
+	swap(incoming, queue[(head + count) % queueLength]);
+	count++;
+	portEXIT_CRITICAL(&lock);
+	xSemaphoreGive(readySemaphore);
+}
+
+void FrameSubscriber::clear()
+{
+	SharedFrame removed[queueLength];
+	portENTER_CRITICAL(&lock);
+	for (uint8_t i = 0; i < count; i++) {
+		swap(removed[i], queue[(head + i) % queueLength]);
+	}
+	count = 0;
+	portEXIT_CRITICAL(&lock);
+}
+
+// Frames grabbed by the loop, counted per second (written only by the loop).
+uint32_t framesSecond;
+uint16_t framesCurrentCount;
+uint16_t framesLastCount;
+
+void count_frame()
+{
+	const uint32_t second = esp_timer_get_time() / 1'000'000;
+	if (second != framesSecond) {
+		framesLastCount = (second == framesSecond + 1) ? framesCurrentCount : 0;
+		framesCurrentCount = 0;
+		framesSecond = second;
+	}
+	framesCurrentCount += 1;
+	metrics::count(metrics::Counter::FramesCaptured);
+}
+
+uint16_t getFrameRate()
+{
+	const uint32_t second = esp_timer_get_time() / 1'000'000;
+	const uint32_t countedSecond = framesSecond;
+	if (second == countedSecond) return framesLastCount;
+	if (second == countedSecond + 1) return framesCurrentCount;
+	return 0;
+}
+
+void update_rate_control();
+
+/// Grabs each frame once and hands it over to all the subscribers.
+void capture_loop(void*)
+{
+	for (;;) {
+		if (getSubscribersCount() == 0) {
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+
+		update_rate_control();
+
+		SharedFrame frame = SharedFrame::capture();
+		if (unlikely(!frame)) {
+			// Might happen while reinitializing or if all buffers are held by consumers.
+			ESP_LOGV(TAG_CAMERA, "Capture loop failed to get frame");
+			delay(10);
+			continue;
+		}
+		count_frame();
+
+		auto guard = SemaphoreGuard::take(subscribersMutex);
+		for (auto* s : subscribers) {
+			if (s) s->push(frame);
+		}
+	}
+}
+
+/// Releases frames queued for subscribers and waits for the ones still held 
+/// by consumers, so the camera can be safely deinitialized. Requires the camera
+/// mutex to be held, so no new frames are captured meanwhile. Returns false
+/// if some frames are still held after the timeout.
+bool flush_shared_frames()
+{
+	{
+		auto guard = SemaphoreGuard::take(subscribersMutex);
+		for (auto* s : subscribers) {
+			if (s) s->clear();
+		}
+	}
+	constexpr uptime_t maxWaitTime = 1'000'000; // us
+	const uptime_t start = esp_timer_get_time();
+	while (true) {
+		bool allReleased = true;
+		for (auto& s : sharedFrameSlots) {
+			if (s.references.load(std::memory_order_acquire) != 0) {
+				allReleased = false;
+				break;
+			}
+		}
+		if (allReleased) 
+			return true;
+		if (esp_timer_get_time() - start > maxWaitTime) 
+			break;
+		vTaskDelay(1); // at least single tick, as `delay(1)` would round down to none
+	}
+	ESP_LOGE(TAG_CAMERA, "Shared frames still held after %" PRIi64 "ms", maxWaitTime / 1000);
+	return false;
 }
 
 /// Checks the camera module & current configuration ability to take picture.
@@ -55,11 +332,54 @@ bool check_can_take_picture()
 
 #include "camera_pins.hpp"
 
+/// Frame size the driver was initialized with, which determines the buffers
+/// size, so JPEG framesize can be later changed (not above) without reinit.
+framesize_t initFramesize = FRAMESIZE_INVALID;
+
+/// Max size of single frame buffer to be kept in DRAM, where pixels are much 
+/// faster to access (i.e. for vision processing) than in PSRAM.
+constexpr size_t maxDramFramebufferSize = 20 * 1024;
+/// Internal memory to be left free after allocating frame buffers in DRAM, for Wi-Fi & others.
+constexpr size_t minDramReserve = 48 * 1024;
+
+struct FramebuffersPolicy
+{
+	uint8_t count;
+	camera_fb_location_t location;
+};
+
+/// Chooses how many frame buffers and where to allocate, by their size: small
+/// raw frames (i.e. 96x96 grayscale) go to DRAM, with the minimal count of
+/// buffers, while larger ones go to PSRAM, with less buffers the bigger they are.
+/// Subscribers queues are limited by the count (see `FrameSubscriber::capacity`).
+FramebuffersPolicy choose_framebuffers_policy(pixformat_t pixformat, framesize_t framesize)
+{
+	const size_t size = frameBufferSize(pixformat, framesize);
+#ifdef BOARD_HAS_PSRAM
+	if (pixformat != PIXFORMAT_JPEG && size <= maxDramFramebufferSize) {
+		const size_t needed = size * minFramebuffersCount + minDramReserve;
+		if (heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA) >= needed
+		 && heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA) >= size)
+			return { minFramebuffersCount, CAMERA_FB_IN_DRAM };
+	}
+	if (size >= 64 * 1024) return { minFramebuffersCount, CAMERA_FB_IN_PSRAM };
+	return { maxFramebuffersCount, CAMERA_FB_IN_PSRAM };
+#else
+	(void) size;
+	return { minFramebuffersCount, CAMERA_FB_IN_DRAM };
+#endif
+}
+
 /// Initializes the camera module using common config.
 esp_err_t my_esp_camera_init(
 	pixformat_t pixformat = PIXFORMAT_JPEG, // For most common applications
 	framesize_t framesize = FRAMESIZE_UXGA  // Max for OV2640
 ) {
+	initFramesize = framesize;
+	const auto policy = choose_framebuffers_policy(pixformat, framesize);
+	framebuffersCount = policy.count;
+	ESP_LOGD(TAG_CAMERA, "Using %u frame buffers in %s", policy.count, 
+		policy.location == CAMERA_FB_IN_DRAM ? "DRAM" : "PSRAM");
 	camera_config_t camera_config = {
 		.pin_pwdn  = CAM_PIN_PWDN,
 		.pin_reset = CAM_PIN_RESET,
@@ -83,38 +403,31 @@ esp_err_t my_esp_camera_init(
 		.pixel_format = pixformat,
 		.frame_size = framesize,
 		.jpeg_quality = 12,
-		.fb_count = 4,
-	#ifdef BOARD_HAS_PSRAM
-		.fb_location	= CAMERA_FB_IN_PSRAM,
-	#else
-		.fb_location	= CAMERA_FB_IN_DRAM, 
-	#endif
+		.fb_count = framebuffersCount,
+		.fb_location = policy.location,
 		.grab_mode = CAMERA_GRAB_LATEST, 
-		// TODO: consider using other fb_count & grab_mode for streaming, 
-		//	and other for AI processing (maybe even CAMERA_FB_IN_DRAM?)
+		// Note: for vision processing, see camera profiles below.
 	};
 	return esp_camera_init(&camera_config);
 }
 
 #define NVS_CAMERA_NAMESPACE "camera"
 
-/// Reinitializes the camera module, finalizing applying some settings.
-/// Required for pixel format & framesize changes.
-void reinit() 
+/// Reinitializes the camera module with given pixel format and frame size,
+/// then loads other settings from NVS. JPEG quality can be overridden too
+/// (negative to keep the stored one), as the sensor handle is invalidated.
+/// Returns false if aborted, because frames were still held by consumers.
+bool reinit(pixformat_t pixformat, framesize_t framesize, int quality = -1) 
 {
 	auto guard = SemaphoreGuard::take(mutex);
 
 	ESP_LOGD(TAG_CAMERA, "beginning reinit");
-	sensor_t* sensor = esp_camera_sensor_get();
-	if (unlikely(!sensor)) {
-		ESP_LOGE(TAG_CAMERA, "Failed to get camera handle");
-		goto fail;
+	if (!flush_shared_frames()) {
+		// Deinit would free buffers still in use
+		ESP_LOGE(TAG_CAMERA, "Aborting reinit");
+		return false;
 	}
-	else /* got sensor handle */ {
-		// Remember the settings required for re-initialization
-		pixformat_t pixformat = sensor->pixformat;
-		framesize_t framesize = sensor->status.framesize;
-
+	{
 		ESP_LOGD(TAG_CAMERA, "calling deinit");
 		ESP_IGNORE_ERROR(esp_camera_deinit());
 
@@ -126,6 +439,13 @@ void reinit()
 		ESP_ERROR_CHECK_OR_GOTO(fail, esp_camera_load_from_nvs(NVS_CAMERA_NAMESPACE));
 		// (error logged inside the function)
 
+		// Stored settings might come from other profile
+		sensor_t* sensor = esp_camera_sensor_get();
+		if (sensor && sensor->status.framesize != framesize) 
+			sensor->set_framesize(sensor, framesize);
+		if (sensor && quality >= 0 && pixformat == PIXFORMAT_JPEG) 
+			sensor->set_quality(sensor, quality);
+
 		ESP_LOGD(TAG_CAMERA, "testing after reinit");
 		if (!check_can_take_picture()) { 
 			// (error logged inside the function)
@@ -133,23 +453,44 @@ void reinit()
 		}
 
 		ESP_LOGD(TAG_CAMERA, "finished reinit");
-		return;
+		return true;
 	}
 
 fail:
-	return; // FIXME: ...; Note: now disabled for debugging
+	return true; // FIXME: ...; Note: now disabled for debugging
 	ESP_LOGW(TAG_CAMERA, "Failed to reinitialize, trying to fall back to defaults");
 
 	ESP_IGNORE_ERROR(esp_camera_deinit());
 
 	ESP_ERROR_CHECK(my_esp_camera_init()); // with most default/safe settings
 	check_can_take_picture(); // (logs in case of error)
+	return true;
 }
 
+/// Reinitializes the camera module, finalizing applying some settings.
+/// Required for pixel format & framesize changes.
+void reinit()
+{
+	sensor_t* sensor = esp_camera_sensor_get();
+	if (unlikely(!sensor)) {
+		ESP_LOGE(TAG_CAMERA, "Failed to get camera handle");
+		return;
+	}
+	// Remember the settings required for re-initialization
+	reinit(sensor->pixformat, sensor->status.framesize);
+}
+
+void sync_stream_profile();
+
+/// Serializes profile switching (from capture loop, stream and capture handlers).
+SemaphoreHandle_t profileMutex;
+
 /// Initializes the camera related code.
 void init()
 {
 	mutex = xSemaphoreCreateMutex();
+	subscribersMutex = xSemaphoreCreateMutex();
+	profileMutex = xSemaphoreCreateMutex();
 
 	// Note: `esp_camera_load_from_nvs` requires sensor to be initialized,
 	// so default/safe settings initializations needs to be performed first.
@@ -163,321 +504,566 @@ void init()
 	else /* loaded from NVS successfully */ {
 		reinit(); // will use settings loaded from NVS
 	}
+
+	sync_stream_profile();
+
+	tasks::create(capture_loop, "camera-loop", 3 * 1024, nullptr, tasks::cameraLoop, &captureLoopTask);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Configuration
+// Profiles
 
-inline bool has_simple_value(const jsmntok_t* token) {
-	if (token->type == JSMN_UNDEFINED) return false;
-	if (token->type == JSMN_OBJECT) return false;
-	if (token->type == JSMN_ARRAY) return false;
-	return true;
+ProfileSettings profiles[static_cast<uint8_t>(Profile::_Count)] = {
+	/* Stream */ { PIXFORMAT_JPEG, FRAMESIZE_SVGA, 12 }, // updated from sensor
+	/* AI */     { PIXFORMAT_GRAYSCALE, FRAMESIZE_QVGA, 12 },
+};
+Profile currentProfile = Profile::Stream;
+
+/// Generation of camera configuration, bumped also on profile switches, 
+/// as they change sensor settings visible in the configuration.
+config::Generation configGeneration;
+
+ProfileSettings& getProfileSettings(Profile profile)
+{
+	return profiles[static_cast<uint8_t>(profile)];
 }
 
-static const char* TAG_CONFIG_CAMERA = "config-camera";
+Profile getCurrentProfile()
+{
+	return currentProfile;
+}
 
-pixformat_t parse_pixformat(std::string_view sv)
-{
-	const auto pos = sv.find('_'); // try skip PIXFORMAT_
-	if (pos != std::string_view::npos) sv.remove_prefix(pos + 1);
-	switch (fnv1a32i(sv)) {
-		case fnv1a32i(to_string<static_cast<uint32_t>(PIXFORMAT_RGB565)>.data()):      case fnv1a32i("RGB565"):    return PIXFORMAT_RGB565;    // 2BPP/RGB565
-		case fnv1a32i(to_string<static_cast<uint32_t>(PIXFORMAT_YUV422)>.data()):      case fnv1a32i("YUV422"):    return PIXFORMAT_YUV422;    // 2BPP/YUV422
-		case fnv1a32i(to_string<static_cast<uint32_t>(PIXFORMAT_YUV420)>.data()):      case fnv1a32i("YUV420"):    return PIXFORMAT_YUV420;    // 1.5BPP/YUV420
-		case fnv1a32i(to_string<static_cast<uint32_t>(PIXFORMAT_GRAYSCALE)>.data()):   case fnv1a32i("GRAYSCALE"): return PIXFORMAT_GRAYSCALE; // 1BPP/GRAYSCALE
-		case fnv1a32i(to_string<static_cast<uint32_t>(PIXFORMAT_JPEG)>.data()):        case fnv1a32i("JPEG"):      return PIXFORMAT_JPEG;      // JPEG/COMPRESSED
-		case fnv1a32i(to_string<static_cast<uint32_t>(PIXFORMAT_RGB888)>.data()):      case fnv1a32i("RGB888"):    return PIXFORMAT_RGB888;    // 3BPP/RGB888
-		case fnv1a32i(to_string<static_cast<uint32_t>(PIXFORMAT_RAW)>.data()):         case fnv1a32i("RAW"):       return PIXFORMAT_RAW;       // RAW
-		case fnv1a32i(to_string<static_cast<uint32_t>(PIXFORMAT_RGB444)>.data()):      case fnv1a32i("RGB444"):    return PIXFORMAT_RGB444;    // 3BP2P/RGB444
-		case fnv1a32i(to_string<static_cast<uint32_t>(PIXFORMAT_RGB555)>.data()):      case fnv1a32i("RGB555"):    return PIXFORMAT_RGB555;    // 3BP2P/RGB555
-		default: return static_cast<pixformat_t>(-1); // No invalid value in enum, so artificial value used here.
-	}
-}
-
-framesize_t parse_framesize(std::string_view sv)
-{
-	const auto pos = sv.find('_'); // try skip FRAMESIZE_
-	if (pos != std::string_view::npos) sv.remove_prefix(pos + 1);
-	switch (fnv1a32i(sv)) {
-		case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_96X96)>.data()):   case fnv1a32i("96x96"):                             return FRAMESIZE_96X96;
-		case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_QQVGA)>.data()):   case fnv1a32i("160x120"):   case fnv1a32i("QQVGA"): return FRAMESIZE_QQVGA;
-		case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_QCIF)>.data()):    case fnv1a32i("176x144"):   case fnv1a32i("QCIF"):  return FRAMESIZE_QCIF;
-		case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_HQVGA)>.data()):   case fnv1a32i("240x176"):   case fnv1a32i("HQVGA"): return FRAMESIZE_HQVGA;
-		case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_240X240)>.data()): case fnv1a32i("240x240"):                           return FRAMESIZE_240X240;
-		case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_QVGA)>.data()):    case fnv1a32i("320x240"):   case fnv1a32i("QVGA"):  return FRAMESIZE_QVGA;
-		case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_CIF)>.data()):     case fnv1a32i("400x296"):   case fnv1a32i("CIF"):   return FRAMESIZE_CIF; // Native for OV2640
-		case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_HVGA)>.data()):    case fnv1a32i("480x320"):   case fnv1a32i("HVGA"):  return FRAMESIZE_HVGA;
-		case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_VGA)>.data()):     case fnv1a32i("640x480"):   case fnv1a32i("VGA"):   return FRAMESIZE_VGA;
-		case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_SVGA)>.data()):    case fnv1a32i("800x600"):   case fnv1a32i("SVGA"):  return FRAMESIZE_SVGA; // Native for OV2640
-		case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_XGA)>.data()):     case fnv1a32i("1024x768"):  case fnv1a32i("XGA"):   return FRAMESIZE_XGA;
-		case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_HD)>.data()):      case fnv1a32i("1280x720"):  case fnv1a32i("HD"):    return FRAMESIZE_HD;
-		case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_SXGA)>.data()):    case fnv1a32i("1280x1024"): case fnv1a32i("SXGA"):  return FRAMESIZE_SXGA;
-		case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_UXGA)>.data()):    case fnv1a32i("1600x1200"): case fnv1a32i("UXGA"):  return FRAMESIZE_UXGA; // Native for OV2640
-		/* Unsupported by OV2640 */
-		// case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_FHD)>.data()):     case fnv1a32i("1920x1080"): case fnv1a32i("FHD"):   return FRAMESIZE_FHD;
-		// case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_P_HD)>.data()):    case fnv1a32i("720x1280"):  case fnv1a32i("P_HD"):  return FRAMESIZE_P_HD;
-		// case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_P_3MP)>.data()):   case fnv1a32i("864x1536"):  case fnv1a32i("P_3MP"): return FRAMESIZE_P_3MP;
-		// case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_QXGA)>.data()):    case fnv1a32i("2048x1536"): case fnv1a32i("QXGA"):  return FRAMESIZE_QXGA;
-		// case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_QHD)>.data()):     case fnv1a32i("2560x1440"): case fnv1a32i("QHD"):   return FRAMESIZE_QHD;
-		// case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_WQXGA)>.data()):   case fnv1a32i("2560x1600"): case fnv1a32i("WQXGA"): return FRAMESIZE_WQXGA;
-		// case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_P_FHD)>.data()):   case fnv1a32i("1080x1920"): case fnv1a32i("P_FHD"): return FRAMESIZE_P_FHD;
-		// case fnv1a32i(to_string<static_cast<uint32_t>(FRAMESIZE_QSXGA)>.data()):   case fnv1a32i("2560x1920"): case fnv1a32i("QSXGA"): return FRAMESIZE_QSXGA;
-		default: return FRAMESIZE_INVALID;
-	}
-}
-
-/// @brief Applies (and/or reads current) JSON configuration for camera.
-/// @param[in] input Buffer with JSON data that was parsed into JSON into tokens.
-///		Note: Passed non-const to allow in-place strings manipulation.
-/// @param[in] root JSMN JSON object token related to the config to be parsed.
-/// @param[out] output Optional buffer for writing JSON with current configuration.
-/// @param[in] output_length Length of output buffer.
-/// @param[out] output_return Used to return number of bytes that would be written 
-/// 	to the output, or negative for error. Basically `printf`-like return.
-/// @return 
-esp_err_t config(
-	char* input, jsmntok_t* root,
-	char* output, size_t output_length, int* output_return
-) {
+void sync_stream_profile()
+{
+	sensor_t* sensor = esp_camera_sensor_get();
+	if (currentProfile != Profile::Stream || !sensor) 
+		return;
+	auto& p = getProfileSettings(Profile::Stream);
+	p.pixformat = sensor->pixformat;
+	p.framesize = sensor->status.framesize;
+	p.quality = sensor->status.quality;
+}
+
+/// Checks whenever the sensor can be switched to the settings by changing
+/// its registers only, without reinitialization of the driver.
+bool can_switch_without_reinit(const sensor_t* sensor, pixformat_t pixformat, framesize_t framesize)
+{
+	return canSwitchWithoutReinit(sensor->pixformat, sensor->status.framesize, pixformat, framesize, initFramesize);
+}
+
+framesize_t getInitFramesize()
+{
+	return initFramesize;
+}
+
+bool requiresReinit(pixformat_t pixformat, framesize_t framesize)
+{
+	const sensor_t* sensor = esp_camera_sensor_get();
+	return !sensor || !can_switch_without_reinit(sensor, pixformat, framesize);
+}
+
+void switchProfile(Profile profile)
+{
+	// Held over whole check & switch, so concurrent callers act on the result of previous one.
+	auto profileGuard = SemaphoreGuard::take(profileMutex);
 	sensor_t* sensor = esp_camera_sensor_get();
 	if (unlikely(!sensor)) {
-		if (output_return) {
-			output[0] = '{';
-			output[1] = '}';
-			output[2] = 0;
-			*output_return = 2;
+		ESP_LOGE(TAG_CAMERA, "Failed to get camera handle");
+		return;
+	}
+	const auto& p = getProfileSettings(profile);
+	const bool same = sensor->pixformat == p.pixformat 
+		&& sensor->status.framesize == p.framesize
+		&& (p.pixformat != PIXFORMAT_JPEG || sensor->status.quality == p.quality);
+	if (same) {
+		currentProfile = profile;
+		return;
+	}
+
+	const uint64_t start = esp_timer_get_time();
+	if (can_switch_without_reinit(sensor, p.pixformat, p.framesize)) {
+		auto guard = SemaphoreGuard::take(mutex);
+		if (!flush_shared_frames()) 
+			return; // (error logged inside the function)
+		if (sensor->status.framesize != p.framesize) 
+			sensor->set_framesize(sensor, p.framesize);
+		if (p.pixformat == PIXFORMAT_JPEG) 
+			sensor->set_quality(sensor, p.quality);
+		// Drop frames grabbed before the change
+		for (size_t i = 0; i < framebuffersCount; i++) {
+			if (camera_fb_t* fb = esp_camera_fb_get()) 
+				esp_camera_fb_return(fb);
 		}
-		ESP_LOGE(TAG_CONFIG_CAMERA, "Failed to get camera handle to access config");
-		return ESP_FAIL;
 	}
+	else {
+		if (!reinit(p.pixformat, p.framesize, p.quality)) 
+			return; // (error logged inside the function)
+	}
+	currentProfile = profile;
+	configGeneration.bump();
+	ESP_LOGD(TAG_CAMERA, "Switched profile to %u in %" PRIu64 " us", 
+		static_cast<unsigned>(profile), esp_timer_get_time() - start);
+}
 
-	// Full re-initialization might be required if either of is true:
-	// + pixformat is changed, 
-	// + framesize is changed outside JPEG mode,
-	// + framesize is widened inside JPEG mode,
-	// See comment from the library maintainer https://github.com/espressif/esp32-camera/issues/612#issuecomment-1880837969
-	// and source code of esp32-camera (especially `cam_config` function).
-	bool require_reinit = false;
-
-	if (input) {
-		if (unlikely(root->type != JSMN_OBJECT))
-			return ESP_FAIL;
-		if (unlikely(root->size < 1)) 
-			return ESP_FAIL;
-		for (jsmntok_t* token = root + 1;;) {
-			auto* key_token   = token;
-			auto* value_token = token + 1;
-			ESP_LOGV(TAG_CONFIG_CAMERA, "key='%.*s' value='%.*s'", 
-				key_token->end - key_token->start, input + key_token->start,
-				value_token->end - value_token->start, input + value_token->start
-			);
-
-			if (unlikely(!has_simple_value(value_token)))
-				return ESP_FAIL;
-			const size_t value_length = value_token->end - value_token->start;
-			switch (fnv1a32(input + key_token->start, input + key_token->end)) {
-				case fnv1a32("framesize"): {
-					input[value_token->end] = 0;
-					auto framesize = parse_framesize({input + value_token->start, value_length});
-					if (sensor->status.framesize != framesize) {
-						require_reinit = true;
-					}
-					sensor->set_framesize(sensor, framesize);
-					break;
-				}	
-				case fnv1a32("pixformat"): {
-					input[value_token->end] = 0;
-					auto pixformat = parse_pixformat({input + value_token->start, value_length});
-					if (sensor->pixformat != pixformat) {
-						require_reinit = true;
-					}
-					sensor->set_pixformat(sensor, pixformat);
-					break;
-				}
-				case fnv1a32("quality"): /* for JPEG compression */
-					sensor->set_quality(sensor, std::atoi(input + value_token->start));
-					break;
-
-				case fnv1a32("hmirror"):
-					sensor->set_hmirror(sensor, parseBooleanFast(input + value_token->start));
-					break;
-				case fnv1a32("vflip"):
-					sensor->set_vflip(sensor, parseBooleanFast(input + value_token->start));
-					break;
-
-				case fnv1a32("contrast"):
-					sensor->set_contrast(sensor, std::atoi(input + value_token->start));
-					break;
-				case fnv1a32("brightness"):
-					sensor->set_brightness(sensor, std::atoi(input + value_token->start));
-					break;
-
-				case fnv1a32("sharpness"): 
-					// TODO: not supported by original library
-					sensor->set_sharpness(sensor, std::atoi(input + value_token->start));
-					break;
-				case fnv1a32("denoise"):
-					// TODO: not supported by original library
-					sensor->set_denoise(sensor, std::atoi(input + value_token->start));
-					break;
-
-				case fnv1a32("gain_ceiling"): {
-					// Clamp value here, because - unlike other params - the library doesn't do that,
-					// expecting users to use values from enum to prevent invalid state...
-					int value = std::atoi(input + value_token->start);
-					if (value < 0) value = 0; else if (value > 6) value = 6;
-					sensor->set_gainceiling(sensor, static_cast<gainceiling_t>(value));
-					break;
-				}
-				case fnv1a32("agc"):
-					sensor->set_gain_ctrl(sensor, parseBooleanFast(input + value_token->start));
-					break;
-				case fnv1a32("agc_gain"):
-					sensor->set_agc_gain(sensor, std::atoi(input + value_token->start));
-					break;
-
-				case fnv1a32("aec"):
-					sensor->set_exposure_ctrl(sensor, parseBooleanFast(input + value_token->start));
-					break;
-				case fnv1a32("night"):
-				case fnv1a32("aec2"): // night mode of automatic gain control
-					sensor->set_aec2(sensor, parseBooleanFast(input + value_token->start));
-					break;
-				case fnv1a32("ae_level"): 
-					sensor->set_ae_level(sensor, std::atoi(input + value_token->start));
-					break;
-				case fnv1a32("exposure"): {
-					input[value_token->end] = 0;
-					char* p = input + value_token->start;
-					if (*p == 'a') { // auto mode
-						sensor->set_exposure_ctrl(sensor, true);
-						while (*++p)
-							if (std::isdigit(*p) || *p == '-')
-								break;
-						sensor->set_ae_level(sensor, std::atoi(p));
-						break;
-					}
-					sensor->set_exposure_ctrl(sensor, false);
-					[[fallthrough]];
-				}
-				case fnv1a32("aec_value"):
-					sensor->set_aec_value(sensor, std::atoi(input + value_token->start));
-					break;
-
-				case fnv1a32("awb"):
-					sensor->set_whitebal(sensor, parseBooleanFast(input + value_token->start));
-					break;
-				case fnv1a32("awb_gain"):
-					sensor->set_awb_gain(sensor, std::atoi(input + value_token->start));
-					break;
-				case fnv1a32("wb_mode"):
-					sensor->set_wb_mode(sensor, std::atoi(input + value_token->start));
-					break;
-				case fnv1a32("dcw"): // advanced auto white balance 
-					sensor->set_dcw(sensor, std::atoi(input + value_token->start));
-					break;
-				case fnv1a32("bpc"):
-					sensor->set_bpc(sensor, parseBooleanFast(input + value_token->start));
-					break;
-				case fnv1a32("wpc"):
-					sensor->set_wpc(sensor, parseBooleanFast(input + value_token->start));
-					break;
-
-				case fnv1a32("raw_gma"):
-					sensor->set_raw_gma(sensor, std::atoi(input + value_token->start));
-					break;
-				case fnv1a32("lenc"):
-					sensor->set_lenc(sensor, std::atoi(input + value_token->start));
-					break;
-
-				case fnv1a32("special"):
-				case fnv1a32("special_effect"):
-					sensor->set_special_effect(sensor, std::atoi(input + value_token->start));
-					break;
-
-				default:
-					ESP_LOGD(TAG_CONFIG_CAMERA, "Unknown field '%.*s', ignoring.", 
-						key_token->end - key_token->start, input + key_token->start);
-					break;
-			}
+void setStreamQuality(uint8_t quality)
+{
+	auto profileGuard = SemaphoreGuard::take(profileMutex);
+	auto& p = getProfileSettings(Profile::Stream);
+	p.quality = quality;
+	sensor_t* sensor = esp_camera_sensor_get();
+	if (unlikely(!sensor)) 
+		return;
+	if (currentProfile == Profile::Stream && sensor->pixformat == PIXFORMAT_JPEG && sensor->status.quality != quality) {
+		sensor->set_quality(sensor, quality);
+		configGeneration.bump();
+	}
+}
+
+////////////////////////////////////////
+// Adaptive rate control
+
+static const char* TAG_RATE_CONTROL = "rate-control";
+
+RateControlSettings rateControlSettings {
+	.enabled = false,
+	.adjustFramesize = true,
+	.fps = 15,
+	.minQuality = 8,
+	.maxQuality = 40,
+	.minFramesize = FRAMESIZE_QVGA,
+	.maxFramesize = FRAMESIZE_SVGA,
+};
+
+RateControlSettings& getRateControlSettings()
+{
+	return rateControlSettings;
+}
+
+/// Steps of frame size used by the rate control, all with 4:3 aspect ratio.
+constexpr framesize_t rateControlFramesizes[] = {
+	FRAMESIZE_QQVGA, FRAMESIZE_QVGA, FRAMESIZE_VGA, FRAMESIZE_SVGA, FRAMESIZE_XGA, FRAMESIZE_UXGA,
+};
 
-			// Skip primitive pair (key & value)
-			token += 2;
-			if (root->end < token->end)
-				goto done;
+/// Measurements reported by stream clients, since last update of the control.
+struct {
+	uint32_t frames;
+	uint32_t bytes;
+	uint64_t sendTime; // us
+} rateControlWindow = {};
+portMUX_TYPE rateControlLock = portMUX_INITIALIZER_UNLOCKED;
+uptime_t rateControlWindowStart = 0;
+constexpr uptime_t rateControlPeriod = 1'000'000; // us
+
+void reportStreamFrame(size_t length, uint32_t sendTime)
+{
+	portENTER_CRITICAL(&rateControlLock);
+	rateControlWindow.frames += 1;
+	rateControlWindow.bytes += length;
+	rateControlWindow.sendTime += sendTime;
+	portEXIT_CRITICAL(&rateControlLock);
+}
+
+/// Steps the frame size by one (up if `direction` is positive) among the 
+/// rate control steps, within the bounds. Returns the same if can't.
+framesize_t step_framesize(framesize_t current, int8_t direction)
+{
+	const auto& s = rateControlSettings;
+	const auto fits = [&s, current] (framesize_t framesize) {
+		return framesize >= s.minFramesize && framesize <= s.maxFramesize
+			// JPEG buffers are sized for the initial frame size
+			&& canSwitchWithoutReinit(PIXFORMAT_JPEG, current, PIXFORMAT_JPEG, framesize, initFramesize);
+	};
+	if (direction > 0) {
+		for (const auto framesize : rateControlFramesizes)
+			if (framesize > current && fits(framesize)) 
+				return framesize;
+	}
+	else {
+		for (auto it = std::rbegin(rateControlFramesizes); it != std::rend(rateControlFramesizes); ++it)
+			if (*it < current && fits(*it)) 
+				return *it;
+	}
+	return current;
+}
+
+/// Updates the rate control, once per period, using measurements from the stream 
+/// clients. Called by the capture loop (without holding any frame), so frame size 
+/// can be changed safely.
+void update_rate_control()
+{
+	const uptime_t now = esp_timer_get_time();
+	if (now - rateControlWindowStart < rateControlPeriod) 
+		return;
+	rateControlWindowStart = now;
+
+	portENTER_CRITICAL(&rateControlLock);
+	const auto window = rateControlWindow;
+	rateControlWindow = {};
+	portEXIT_CRITICAL(&rateControlLock);
+
+	const auto& s = rateControlSettings;
+	if (!s.enabled || window.frames == 0 || currentProfile != Profile::Stream) 
+		return;
+	sensor_t* sensor = esp_camera_sensor_get();
+	if (unlikely(!sensor) || sensor->pixformat != PIXFORMAT_JPEG) 
+		return;
+
+	// Compare average time of sending frame with the budget for target frame rate
+	const uint32_t budget = 1'000'000 / std::max<uint8_t>(s.fps, 1);
+	const uint32_t sendTime = window.sendTime / window.frames;
+	int quality = sensor->status.quality;
+	framesize_t framesize = sensor->status.framesize;
+	if (sendTime > budget * 9 / 10) {
+		// Too slow, lower quality (higher number), then frame size
+		if (quality < s.maxQuality) {
+			quality = std::min<int>(quality + (sendTime > budget * 2 ? 4 : 2), s.maxQuality);
+		}
+		else if (s.adjustFramesize) {
+			framesize = step_framesize(framesize, -1);
+			if (framesize != sensor->status.framesize) 
+				quality = (s.minQuality + s.maxQuality) / 2;
+		}
+	}
+	else if (sendTime < budget / 2) {
+		// Spare time, better quality, then frame size
+		if (quality > s.minQuality) {
+			quality -= 1;
 		}
-		done: /* semicolon for empty statement */ ;
-
-		// TODO: report invalid parameters somehow (i.e. out of bounds contrast/brightness values, invalid framesize etc.)
-	}
-
-	if (output_return) {
-		*output_return = std::snprintf(
-			output, output_length,
-			"{"
-				"\"framesize\":%d,"
-				"\"pixformat\":%d,"
-				"\"quality\":%d,"
-				"\"hmirror\":%d,"
-				"\"vflip\":%d,"
-				"\"contrast\":%d,"
-				"\"brightness\":%d,"
-				"\"sharpness\":%d,"
-				"\"denoise\":%d,"
-				"\"gain_ceiling\":%d,"
-				"\"agc\":%d,"
-				"\"agc_gain\":%d,"
-				"\"aec\":%d,"
-				"\"aec2\":%d,"
-				"\"ae_level\":%d,"
-				"\"aec_value\":%d,"
-				"\"awb\":%d,"
-				"\"awb_gain\":%d,"
-				"\"wb_mode\":%d,"
-				"\"dcw\":%d,"
-				"\"bpc\":%d,"
-				"\"wpc\":%d,"
-				"\"raw_gma\":%d,"
-				"\"lenc\":%d,"
-				"\"special_effect\":%d"
-			"}",
-			static_cast<uint8_t>(sensor->status.framesize),
-			static_cast<uint8_t>(sensor->pixformat),
-			sensor->status.quality,
-			sensor->status.hmirror,
-			sensor->status.vflip,
-			sensor->status.contrast,
-			sensor->status.brightness,
-			sensor->status.sharpness,
-			sensor->status.denoise,
-			sensor->status.gainceiling,
-			sensor->status.agc,
-			sensor->status.agc_gain,
-			sensor->status.aec,
-			sensor->status.aec2,
-			sensor->status.ae_level,
-			sensor->status.aec_value,
-			sensor->status.awb,
-			sensor->status.awb_gain,
-			sensor->status.wb_mode,
-			sensor->status.dcw,
-			sensor->status.bpc,
-			sensor->status.wpc,
-			sensor->status.raw_gma,
-			sensor->status.lenc,
-			sensor->status.special_effect
-		);
-	}
-
-	if (require_reinit) {
+		else if (s.adjustFramesize) {
+			framesize = step_framesize(framesize, +1);
+			if (framesize != sensor->status.framesize) 
+				quality = s.maxQuality; // bigger frame is about twice the bytes, start safe
+		}
+	}
+	quality = std::clamp<int>(quality, s.minQuality, s.maxQuality);
+
+	if (quality == sensor->status.quality && framesize == sensor->status.framesize) 
+		return;
+	ESP_LOGD(TAG_RATE_CONTROL, "send=%" PRIu32 "us/%" PRIu32 "us size=%" PRIu32 "B, quality %d -> %d, framesize %d -> %d", 
+		sendTime, budget, window.bytes / window.frames, 
+		sensor->status.quality, quality, sensor->status.framesize, framesize);
+
+	auto& p = getProfileSettings(Profile::Stream);
+	p.quality = quality;
+	if (framesize != sensor->status.framesize) {
+		p.framesize = framesize;
+		switchProfile(Profile::Stream); // without reinit, since within the initial frame size
+	}
+	else {
+		sensor->set_quality(sensor, quality);
+		configGeneration.bump();
+	}
+	metrics::count(metrics::Counter::RateControlAdjustments);
+}
+
+////////////////////////////////////////
+// Software conversion
+
+ConvertedFrame::ConvertedFrame(ConvertedFrame&& o)
+	: fb(o.fb), buffer(std::move(o.buffer))
+{
+	o.fb.buf = nullptr;
+}
+
+/// Converts big-endian RGB565 pixels into grayscale (luma, BT.601) in place.
+void rgb565_to_grayscale(uint8_t* buffer, size_t pixels)
+{
+	for (size_t i = 0; i < pixels; i++) {
+		const uint16_t c = (buffer[i * 2] << 8) | buffer[i * 2 + 1];
+		const uint32_t r = (c >> 8) & 0xF8;
+		const uint32_t g = (c >> 3) & 0xFC;
+		const uint32_t b = (c << 3) & 0xF8;
+		buffer[i] = (r * 77 + g * 150 + b * 29) >> 8;
+	}
+}
+
+ConvertedFrame ConvertedFrame::fromJpeg(const camera_fb_t* source, pixformat_t pixformat, framesize_t framesize)
+{
+	ConvertedFrame frame;
+	if (unlikely(source->format != PIXFORMAT_JPEG)) 
+		return frame;
+	if (pixformat != PIXFORMAT_RGB565 && pixformat != PIXFORMAT_GRAYSCALE) 
+		return frame;
+
+	const auto* target = findFramesize(framesize);
+	if (unlikely(!target)) 
+		return frame;
+
+	// Decoder can downscale by power of 2, so use the largest one that still fits
+	uint8_t shift = 0;
+	while (shift < JPG_SCALE_MAX && (source->width >> (shift + 1)) >= target->width)
+		shift++;
+	const size_t width  = source->width  >> shift;
+	const size_t height = source->height >> shift;
+
+	frame.buffer = pool::acquire(pool::Kind::Large, width * height * 2);
+	if (unlikely(!frame.buffer)) {
+		ESP_LOGE(TAG_CAMERA, "Failed to get buffer for converted frame");
+		return frame;
+	}
+	uint8_t* buffer = frame.buffer.data();
+	if (unlikely(!jpg2rgb565(source->buf, source->len, buffer, static_cast<jpg_scale_t>(shift)))) {
+		ESP_LOGE(TAG_CAMERA, "Failed to decode JPEG frame");
+		frame.buffer.reset();
+		return frame;
+	}
+	if (pixformat == PIXFORMAT_GRAYSCALE) 
+		rgb565_to_grayscale(buffer, width * height);
+
+	frame.fb.buf = buffer;
+	frame.fb.len = width * height * findPixformat(pixformat)->bitsPerPixel / 8;
+	frame.fb.width = width;
+	frame.fb.height = height;
+	frame.fb.format = pixformat;
+	frame.fb.timestamp = source->timestamp;
+	return frame;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Configuration
+
+static const char* TAG_CONFIG_CAMERA = "config-camera";
+
+/// Full re-initialization is required only for some changes of pixel format or
+/// frame size, see `canSwitchWithoutReinit`. Other frame size changes are only 
+/// saved, to be restored after reinitialization or reboot.
+/// Config requests are handled one by one (by the main web server task).
+bool configRequireReinit = false;
+bool configRequireSave = false;
+
+/// Begins applying (or reading) JSON configuration for camera, see `configFields`.
+esp_err_t config_begin()
+{
+	configRequireReinit = false;
+	configRequireSave = false;
+	if (unlikely(!esp_camera_sensor_get())) {
+		ESP_LOGE(TAG_CONFIG_CAMERA, "Failed to get camera handle to access config");
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+/// Ends applying JSON configuration for camera.
+/// @param apply False if the request failed (or only reading). Changes already 
+///		applied to the sensor are kept anyway, so reinitialization is done if required.
+esp_err_t config_end(bool apply)
+{
+	// TODO: report invalid parameters somehow (i.e. out of bounds contrast/brightness values, invalid framesize etc.)
+	if (configRequireReinit || configRequireSave) 
 		esp_camera_save_to_nvs(NVS_CAMERA_NAMESPACE);
+	if (configRequireReinit) 
 		reinit();
-	}
+	sync_stream_profile();
+	return ESP_OK;
+}
+
+/// Setter for integer sensor setting.
+template <auto setter>
+esp_err_t set_sensor_integer(const json::Field& field)
+{
+	sensor_t* sensor = esp_camera_sensor_get();
+	(sensor->*setter)(sensor, std::atoi(field.value));
+	return ESP_OK;
+}
+
+/// Setter for boolean sensor setting.
+template <auto setter>
+esp_err_t set_sensor_boolean(const json::Field& field)
+{
+	sensor_t* sensor = esp_camera_sensor_get();
+	(sensor->*setter)(sensor, parseBooleanFast(field.value));
+	return ESP_OK;
+}
+
+/// Getter for sensor setting, from sensor status.
+template <auto member>
+int32_t get_sensor_status()
+{
+	return esp_camera_sensor_get()->status.*member;
+}
+
+/// Field for integer sensor setting, using its setter and status member.
+template <auto setter, auto member>
+constexpr config::Field sensor_integer(const char* key)
+{
+	return config::integer(key, set_sensor_integer<setter>, get_sensor_status<member>);
+}
+
+/// Field for boolean sensor setting, using its setter and status member.
+template <auto setter, auto member>
+constexpr config::Field sensor_boolean(const char* key)
+{
+	return config::boolean(key, set_sensor_boolean<setter>, [] { return get_sensor_status<member>() != 0; });
+}
+
+esp_err_t set_framesize(const json::Field& field)
+{
+	sensor_t* sensor = esp_camera_sensor_get();
+	auto framesize = parseFramesize({ field.value, field.valueLength });
+	if (framesize == FRAMESIZE_INVALID || sensor->status.framesize == framesize) 
+		return ESP_OK;
+	if (!can_switch_without_reinit(sensor, sensor->pixformat, framesize)) 
+		configRequireReinit = true;
+	configRequireSave = true;
+	sensor->set_framesize(sensor, framesize);
+	return ESP_OK;
+}
+
+esp_err_t set_pixformat(const json::Field& field)
+{
+	sensor_t* sensor = esp_camera_sensor_get();
+	auto pixformat = parsePixformat({ field.value, field.valueLength });
+	if (pixformat == invalidPixformat || sensor->pixformat == pixformat) 
+		return ESP_OK;
+	configRequireReinit = true;
+	sensor->set_pixformat(sensor, pixformat);
+	return ESP_OK;
+}
 
+esp_err_t set_gain_ceiling(const json::Field& field)
+{
+	// Clamp value here, because - unlike other params - the library doesn't do that,
+	// expecting users to use values from enum to prevent invalid state...
+	sensor_t* sensor = esp_camera_sensor_get();
+	int value = std::atoi(field.value);
+	if (value < 0) value = 0; else if (value > 6) value = 6;
+	sensor->set_gainceiling(sensor, static_cast<gainceiling_t>(value));
 	return ESP_OK;
 }
 
+esp_err_t set_exposure(const json::Field& field)
+{
+	sensor_t* sensor = esp_camera_sensor_get();
+	const char* p = field.value;
+	if (*p == 'a') { // auto mode
+		sensor->set_exposure_ctrl(sensor, true);
+		while (*++p)
+			if (std::isdigit(*p) || *p == '-')
+				break;
+		sensor->set_ae_level(sensor, std::atoi(p));
+		return ESP_OK;
+	}
+	sensor->set_exposure_ctrl(sensor, false);
+	sensor->set_aec_value(sensor, std::atoi(p));
+	return ESP_OK;
+}
+
+/// Field for integer setting of the rate control.
+template <auto member>
+constexpr config::Field rate_control_integer(const char* key)
+{
+	return config::integer(key, 
+		[] (const json::Field& field) {
+			rateControlSettings.*member = std::atoi(field.value);
+			return ESP_OK;
+		},
+		[] { return static_cast<int32_t>(rateControlSettings.*member); }
+	);
+}
+
+/// Field for frame size setting of the rate control.
+template <auto member>
+constexpr config::Field rate_control_framesize(const char* key)
+{
+	return config::integer(key, 
+		[] (const json::Field& field) {
+			auto framesize = parseFramesize({ field.value, field.valueLength });
+			if (framesize == FRAMESIZE_INVALID) return ESP_FAIL;
+			rateControlSettings.*member = framesize;
+			return ESP_OK;
+		},
+		[] { return static_cast<int32_t>(rateControlSettings.*member); }
+	);
+}
+
+constexpr config::Field rateControlConfigFields[] = {
+	config::boolean("enabled", 
+		[] (const json::Field& field) {
+			rateControlSettings.enabled = parseBooleanFast(field.value);
+			return ESP_OK;
+		},
+		[] { return rateControlSettings.enabled; }
+	),
+	rate_control_integer<&RateControlSettings::fps>("fps"),
+	rate_control_integer<&RateControlSettings::minQuality>("minQuality"),
+	rate_control_integer<&RateControlSettings::maxQuality>("maxQuality"),
+	config::boolean("adjustFramesize", 
+		[] (const json::Field& field) {
+			rateControlSettings.adjustFramesize = parseBooleanFast(field.value);
+			return ESP_OK;
+		},
+		[] { return rateControlSettings.adjustFramesize; }
+	),
+	rate_control_framesize<&RateControlSettings::minFramesize>("minFramesize"),
+	rate_control_framesize<&RateControlSettings::maxFramesize>("maxFramesize"),
+};
+constexpr config::Index rateControlConfigIndex { rateControlConfigFields };
+static_assert(rateControlConfigIndex.unique, "Keys hashes collision");
+constexpr config::Object rateControlConfigObject { rateControlConfigFields, rateControlConfigIndex };
+
+constexpr config::Field configFields[] = {
+	config::integer("framesize", set_framesize, [] { return static_cast<int32_t>(esp_camera_sensor_get()->status.framesize); }),
+	config::integer("pixformat", set_pixformat, [] { return static_cast<int32_t>(esp_camera_sensor_get()->pixformat); }),
+	sensor_integer<&sensor_t::set_quality,        &camera_status_t::quality>       ("quality"), /* for JPEG compression */
+	sensor_boolean<&sensor_t::set_hmirror,        &camera_status_t::hmirror>       ("hmirror"),
+	sensor_boolean<&sensor_t::set_vflip,          &camera_status_t::vflip>         ("vflip"),
+	sensor_integer<&sensor_t::set_contrast,       &camera_status_t::contrast>      ("contrast"),
+	sensor_integer<&sensor_t::set_brightness,     &camera_status_t::brightness>    ("brightness"),
+	sensor_integer<&sensor_t::set_sharpness,      &camera_status_t::sharpness>     ("sharpness"), // TODO: not supported by original library
+	sensor_integer<&sensor_t::set_denoise,        &camera_status_t::denoise>       ("denoise"),   // TODO: not supported by original library
+	config::integer("gain_ceiling", set_gain_ceiling, get_sensor_status<&camera_status_t::gainceiling>),
+	sensor_boolean<&sensor_t::set_gain_ctrl,      &camera_status_t::agc>           ("agc"),
+	sensor_integer<&sensor_t::set_agc_gain,       &camera_status_t::agc_gain>      ("agc_gain"),
+	sensor_boolean<&sensor_t::set_exposure_ctrl,  &camera_status_t::aec>           ("aec"),
+	sensor_boolean<&sensor_t::set_aec2,           &camera_status_t::aec2>          ("aec2"), // night mode of automatic gain control
+	sensor_integer<&sensor_t::set_ae_level,       &camera_status_t::ae_level>      ("ae_level"),
+	sensor_integer<&sensor_t::set_aec_value,      &camera_status_t::aec_value>     ("aec_value"),
+	sensor_boolean<&sensor_t::set_whitebal,       &camera_status_t::awb>           ("awb"),
+	sensor_integer<&sensor_t::set_awb_gain,       &camera_status_t::awb_gain>      ("awb_gain"),
+	sensor_integer<&sensor_t::set_wb_mode,        &camera_status_t::wb_mode>       ("wb_mode"),
+	sensor_integer<&sensor_t::set_dcw,            &camera_status_t::dcw>           ("dcw"), // advanced auto white balance 
+	sensor_boolean<&sensor_t::set_bpc,            &camera_status_t::bpc>           ("bpc"),
+	sensor_boolean<&sensor_t::set_wpc,            &camera_status_t::wpc>           ("wpc"),
+	sensor_integer<&sensor_t::set_raw_gma,        &camera_status_t::raw_gma>       ("raw_gma"),
+	sensor_integer<&sensor_t::set_lenc,           &camera_status_t::lenc>          ("lenc"),
+	sensor_integer<&sensor_t::set_special_effect, &camera_status_t::special_effect>("special_effect"),
+	config::integer("ai_framesize", 
+		[] (const json::Field& field) {
+			auto framesize = parseFramesize({ field.value, field.valueLength });
+			if (framesize != FRAMESIZE_INVALID)
+				getProfileSettings(Profile::AI).framesize = framesize;
+			return ESP_OK;
+		},
+		[] { return static_cast<int32_t>(getProfileSettings(Profile::AI).framesize); }
+	),
+	config::integer("ai_pixformat", 
+		[] (const json::Field& field) {
+			auto pixformat = parsePixformat({ field.value, field.valueLength });
+			if (pixformat != invalidPixformat)
+				getProfileSettings(Profile::AI).pixformat = pixformat;
+			return ESP_OK;
+		},
+		[] { return static_cast<int32_t>(getProfileSettings(Profile::AI).pixformat); }
+	),
+	config::integer("ai_quality", 
+		[] (const json::Field& field) {
+			getProfileSettings(Profile::AI).quality = std::atoi(field.value);
+			return ESP_OK;
+		},
+		[] { return static_cast<int32_t>(getProfileSettings(Profile::AI).quality); }
+	),
+	config::object("adaptive", rateControlConfigObject),
+	/* Aliases & write-only */
+	config::alias("night",    set_sensor_boolean<&sensor_t::set_aec2>),
+	config::alias("special",  set_sensor_integer<&sensor_t::set_special_effect>),
+	config::alias("exposure", set_exposure),
+};
+constexpr config::Index configIndex { configFields };
+static_assert(configIndex.unique, "Keys hashes collision");
+
+/// Camera configuration, see `configFields`.
+extern const config::Object configObject { configFields, configIndex, config_begin, config_end, &configGeneration };
+
 ////////////////////////////////////////////////////////////////////////////////
 
 }
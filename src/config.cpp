@@ -0,0 +1,506 @@
+#include "config.hpp"
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <esp_log.h>
+#include <esp_random.h>
+
+namespace app::config
+{
+
+static const char* TAG_CONFIG = "config";
+
+////////////////////////////////////////////////////////////////////////////////
+// Generations
+
+std::atomic<uint32_t> changesCount = 0;
+
+/// Random base of generations for this boot, in range [1, 2^31], so (with less 
+/// than 2^31 changes) generations never are 0, which is used as special value.
+uint32_t generationsBase()
+{
+	static const uint32_t base = (esp_random() >> 1) + 1;
+	return base;
+}
+
+void Generation::bump()
+{
+	value.store(changesCount.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+bool Generation::changedSince(uint32_t since) const
+{
+	return value.load(std::memory_order_acquire) > since - generationsBase();
+}
+
+uint32_t currentGeneration()
+{
+	return generationsBase() + changesCount.load(std::memory_order_relaxed);
+}
+
+bool isValidGeneration(uint32_t generation)
+{
+	return generation != 0 && generation - generationsBase() <= changesCount.load(std::memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Tables
+
+const Field* Object::find(uint32_t hash) const
+{
+	uint8_t low = 0;
+	uint8_t high = count;
+	while (low < high) {
+		const uint8_t middle = (low + high) / 2;
+		const auto& entry = index[middle];
+		if (entry.hash == hash) return &fields[entry.field];
+		if (entry.hash < hash) low = middle + 1;
+		else high = middle;
+	}
+	return nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Output
+
+void Writer::write(const void* data, size_t count)
+{
+	const char* p = static_cast<const char*>(data);
+	while (count) {
+		if (unlikely(used == length) && !flush()) return;
+		const size_t chunk = std::min(count, length - used);
+		std::memcpy(buffer + used, p, chunk);
+		used += chunk;
+		p += chunk;
+		count -= chunk;
+	}
+}
+
+bool Writer::flush()
+{
+	if (unlikely(failed)) return false;
+	if (!callback) {
+		failed = true;
+		return false;
+	}
+	if (used && !callback(context, buffer, used)) {
+		failed = true;
+		return false;
+	}
+	used = 0;
+	return true;
+}
+
+void writeUnsigned(Writer& writer, uint64_t value)
+{
+	char digits[20];
+	uint8_t count = 0;
+	do {
+		digits[sizeof(digits) - ++count] = '0' + value % 10;
+		value /= 10;
+	}
+	while (value);
+	writer.write(digits + sizeof(digits) - count, count);
+}
+
+void writeInteger(Writer& writer, int32_t value)
+{
+	if (value < 0) {
+		writer.put('-');
+		writeUnsigned(writer, -static_cast<uint32_t>(value));
+	}
+	else {
+		writeUnsigned(writer, value);
+	}
+}
+
+void writeFloat(Writer& writer, float value, uint8_t decimals)
+{
+	if (unlikely(value != value)) value = 0; // NaN
+	uint32_t scale = 1;
+	for (uint8_t i = 0; i < decimals; i++) scale *= 10;
+	int64_t scaled = static_cast<int64_t>(value * scale + (value < 0 ? -0.5f : 0.5f));
+	if (scaled < 0) {
+		writer.put('-');
+		scaled = -scaled;
+	}
+	writeUnsigned(writer, static_cast<uint32_t>(scaled / scale));
+	if (decimals) {
+		writer.put('.');
+		uint32_t fraction = scaled % scale;
+		for (scale /= 10; scale > fraction && scale > 1; scale /= 10)
+			writer.put('0');
+		writeUnsigned(writer, fraction);
+	}
+}
+
+void writeIp4(Writer& writer, uint32_t address)
+{
+	// Same as `IP2STR`, bytes in memory order
+	const auto* bytes = reinterpret_cast<const uint8_t*>(&address);
+	for (uint8_t i = 0; i < 4; i++) {
+		if (i) writer.put('.');
+		writeUnsigned(writer, bytes[i]);
+	}
+}
+
+void writeJsonString(Writer& writer, std::string_view sv)
+{
+	writer.put('"');
+	for (const char c : sv) {
+		switch (c) {
+			case '"':  writer.write("\\\"", 2); break;
+			case '\\': writer.write("\\\\", 2); break;
+			default:
+				if (static_cast<uint8_t>(c) < 0x20) {
+					constexpr char hex[] = "0123456789ABCDEF";
+					const char escaped[] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+					writer.write(escaped, sizeof(escaped));
+				}
+				else {
+					writer.put(c);
+				}
+				break;
+		}
+	}
+	writer.put('"');
+}
+
+void writeJson(Writer& writer, const Object& object, bool braces, uint32_t since)
+{
+	if (object.begin && object.begin() != ESP_OK) {
+		if (braces) writer.write("{}", 2);
+		return;
+	}
+	if (braces) writer.put('{');
+	bool first = braces;
+	for (uint8_t i = 0; i < object.count; i++) {
+		const Field& field = object.fields[i];
+		if (!field.readable()) continue;
+		if (since && field.type == Type::Object) {
+			const Generation* generation = field.get.object->generation;
+			if (generation && !generation->changedSince(since)) continue;
+		}
+		if (!first) writer.put(',');
+		first = false;
+
+		writer.put('"');
+		writer.write(field.key, std::strlen(field.key));
+		writer.write("\":", 2);
+		switch (field.type) {
+			case Type::Boolean:
+				writer.put(field.get.boolean() ? '1' : '0');
+				break;
+			case Type::Integer:
+				writeInteger(writer, field.get.integer());
+				break;
+			case Type::Float:
+				writeFloat(writer, field.get.number(), 1);
+				break;
+			case Type::String:
+				writeJsonString(writer, field.get.string());
+				break;
+			case Type::Ip4:
+				writer.put('"');
+				writeIp4(writer, field.get.integer());
+				writer.put('"');
+				break;
+			case Type::Object:
+				writeJson(writer, *field.get.object, true, since);
+				break;
+		}
+	}
+	if (braces) writer.put('}');
+	if (object.end) object.end(false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Input
+
+esp_err_t Dispatcher::callback(void* context, const json::Field& field)
+{
+	return static_cast<Dispatcher*>(context)->dispatch(field);
+}
+
+/// Ends the object, bumping its generation if any setter was called within.
+esp_err_t end_object(const Object* object, bool apply, bool touched)
+{
+	esp_err_t ret = ESP_OK;
+	if (object->end)
+		ret = object->end(apply);
+	if (touched && object->generation)
+		object->generation->bump();
+	return ret;
+}
+
+esp_err_t Dispatcher::dispatch(const json::Field& field)
+{
+	const Object* current = objects[field.depth];
+	const uint16_t bit = 1u << field.depth;
+	switch (field.type) {
+		case json::FieldType::ObjectBegin: {
+			objects[field.depth + 1] = nullptr;
+			touched &= ~(bit << 1);
+			if (!current) return ESP_OK; // inside ignored object
+			const Field* f = current->find(field.keyHash);
+			if (!f || f->type != Type::Object) {
+				ESP_LOGD(TAG_CONFIG, "Unknown object '%.*s', ignoring.", field.key.size(), field.key.data());
+				return ESP_OK;
+			}
+			const Object* child = f->get.object;
+			if (child->begin && child->begin() != ESP_OK)
+				return ESP_FAIL;
+			objects[field.depth + 1] = child;
+			return ESP_OK;
+		}
+		case json::FieldType::ObjectEnd: {
+			const Object* child = std::exchange(objects[field.depth + 1], nullptr);
+			if (!child) return ESP_OK;
+			const bool childTouched = touched & (bit << 1);
+			if (childTouched) touched |= bit; // changes of nested object are changes of the parent too
+			return end_object(child, true, childTouched);
+		}
+		default: {
+			if (!current) return ESP_OK; // inside ignored object
+			const Field* f = current->find(field.keyHash);
+			if (!f || !f->set) {
+				ESP_LOGD(TAG_CONFIG, "Unknown field '%.*s', ignoring.", field.key.size(), field.key.data());
+				return ESP_OK;
+			}
+			ESP_LOGV(TAG_CONFIG, "key='%.*s' value='%s'", field.key.size(), field.key.data(), field.value);
+			touched |= bit;
+			return f->set(field);
+		}
+	}
+}
+
+void Dispatcher::abort()
+{
+	for (uint8_t i = std::size(objects) - 1; i > 0; i--) {
+		// Setters might have been applied already, so generations are bumped anyway
+		const Object* object = std::exchange(objects[i], nullptr);
+		const bool objectTouched = touched & (1u << i);
+		if (objectTouched) touched |= 1u << (i - 1);
+		if (object) end_object(object, false, objectTouched);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Binary encoding
+
+inline void hashAppend(uint32_t& hash, uint8_t byte)
+{
+	hash ^= byte;
+	hash *= 16777619u;
+}
+
+void schemaHashAppend(uint32_t& hash, const Object& object)
+{
+	for (uint8_t i = 0; i < object.count; i++) {
+		const Field& field = object.fields[i];
+		if (!field.readable()) continue;
+		for (const char* p = field.key; *p; p++)
+			hashAppend(hash, *p);
+		hashAppend(hash, static_cast<uint8_t>(field.type));
+		if (field.type == Type::Object) {
+			hashAppend(hash, '{');
+			schemaHashAppend(hash, *field.get.object);
+			hashAppend(hash, '}');
+		}
+	}
+}
+
+uint32_t schemaHash(const Object& object)
+{
+	uint32_t hash = 2166136261u;
+	schemaHashAppend(hash, object);
+	return hash;
+}
+
+inline void writeVarint(Writer& writer, uint32_t value)
+{
+	while (value >= 0x80) {
+		writer.put(static_cast<char>(value | 0x80));
+		value >>= 7;
+	}
+	writer.put(static_cast<char>(value));
+}
+
+void writeBinaryValues(Writer& writer, const Object& object)
+{
+	for (uint8_t i = 0; i < object.count; i++) {
+		const Field& field = object.fields[i];
+		if (!field.readable()) continue;
+		switch (field.type) {
+			case Type::Boolean:
+				writer.put(field.get.boolean());
+				break;
+			case Type::Integer: {
+				const int32_t value = field.get.integer();
+				writeVarint(writer, (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31));
+				break;
+			}
+			case Type::Float: {
+				const float value = field.get.number();
+				writer.write(&value, sizeof(value));
+				break;
+			}
+			case Type::String: {
+				const auto sv = field.get.string();
+				writeVarint(writer, sv.size());
+				writer.write(sv);
+				break;
+			}
+			case Type::Ip4: {
+				const int32_t value = field.get.integer();
+				writer.write(&value, sizeof(value));
+				break;
+			}
+			case Type::Object: {
+				const Object& child = *field.get.object;
+				if (child.begin && child.begin() != ESP_OK) {
+					writer.put(0);
+					break;
+				}
+				writer.put(1);
+				writeBinaryValues(writer, child);
+				if (child.end) child.end(false);
+				break;
+			}
+		}
+	}
+}
+
+void writeBinary(Writer& writer, const Object& object)
+{
+	const uint32_t hash = schemaHash(object);
+	const uint8_t header[binaryHeaderLength] = {
+		binaryMagic[0], binaryMagic[1], binaryVersion,
+		static_cast<uint8_t>(hash), static_cast<uint8_t>(hash >> 8),
+		static_cast<uint8_t>(hash >> 16), static_cast<uint8_t>(hash >> 24),
+	};
+	writer.write(header, sizeof(header));
+	writeBinaryValues(writer, object);
+}
+
+/// Cursor over binary data, with bounds checking.
+struct Reader
+{
+	const uint8_t* data;
+	const uint8_t* end;
+
+	bool read(void* output, size_t length)
+	{
+		if (unlikely(static_cast<size_t>(end - data) < length)) return false;
+		std::memcpy(output, data, length);
+		data += length;
+		return true;
+	}
+
+	bool readVarint(uint32_t& value)
+	{
+		value = 0;
+		for (uint8_t shift = 0; shift < 35; shift += 7) {
+			if (unlikely(data == end)) return false;
+			const uint8_t byte = *data++;
+			value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+			if (!(byte & 0x80)) return true;
+		}
+		return false;
+	}
+};
+
+esp_err_t readBinaryValues(const Object& object, Reader& reader)
+{
+	char text[json::PushParser::maxValueLength + 1];
+	for (uint8_t i = 0; i < object.count; i++) {
+		const Field& field = object.fields[i];
+		if (!field.readable()) continue;
+
+		// Decode the value, converting it to text as if it was parsed from JSON
+		Writer writer(text, sizeof(text) - 1);
+		size_t textLength = 0;
+		bool isString = false;
+		switch (field.type) {
+			case Type::Boolean: {
+				uint8_t value;
+				if (!reader.read(&value, 1)) return ESP_ERR_INVALID_SIZE;
+				writer.put(value ? '1' : '0');
+				break;
+			}
+			case Type::Integer: {
+				uint32_t value;
+				if (!reader.readVarint(value)) return ESP_ERR_INVALID_SIZE;
+				writeInteger(writer, static_cast<int32_t>((value >> 1) ^ -(value & 1)));
+				break;
+			}
+			case Type::Float: {
+				float value;
+				if (!reader.read(&value, sizeof(value))) return ESP_ERR_INVALID_SIZE;
+				writeFloat(writer, value, 4);
+				break;
+			}
+			case Type::String: {
+				uint32_t length;
+				if (!reader.readVarint(length)) return ESP_ERR_INVALID_SIZE;
+				if (length > json::PushParser::maxValueLength) return ESP_ERR_INVALID_SIZE;
+				if (!reader.read(text, length)) return ESP_ERR_INVALID_SIZE;
+				textLength = length;
+				isString = true;
+				break;
+			}
+			case Type::Ip4: {
+				uint32_t value;
+				if (!reader.read(&value, sizeof(value))) return ESP_ERR_INVALID_SIZE;
+				writeIp4(writer, value);
+				break;
+			}
+			case Type::Object: {
+				uint8_t present;
+				if (!reader.read(&present, 1)) return ESP_ERR_INVALID_SIZE;
+				if (!present) continue;
+				const Object& child = *field.get.object;
+				if (child.begin) {
+					const esp_err_t ret = child.begin();
+					if (ret != ESP_OK) return ret;
+				}
+				const esp_err_t ret = readBinaryValues(child, reader);
+				const esp_err_t end_ret = end_object(&child, ret == ESP_OK, true);
+				if (ret != ESP_OK) return ret;
+				if (end_ret != ESP_OK) return end_ret;
+				continue;
+			}
+		}
+		if (!field.set) continue; // read-only
+
+		if (!isString) textLength = writer.size();
+		text[textLength] = 0;
+		json::Field input;
+		input.type = isString ? json::FieldType::String : json::FieldType::Primitive;
+		input.depth = 0;
+		input.path = nullptr;
+		input.key = field.key;
+		input.keyHash = field.hash;
+		input.value = text;
+		input.valueLength = textLength;
+		ESP_LOGV(TAG_CONFIG, "key='%s' value='%s'", field.key, text);
+		const esp_err_t ret = field.set(input);
+		if (ret != ESP_OK) return ret;
+	}
+	return ESP_OK;
+}
+
+esp_err_t readBinary(const Object& object, const uint8_t* data, size_t length)
+{
+	if (length < binaryHeaderLength)
+		return ESP_ERR_INVALID_SIZE;
+	const uint32_t hash = data[3] | (data[4] << 8) | (data[5] << 16) | (static_cast<uint32_t>(data[6]) << 24);
+	if (data[0] != binaryMagic[0] || data[1] != binaryMagic[1] || data[2] != binaryVersion || hash != schemaHash(object)) {
+		ESP_LOGD(TAG_CONFIG, "Binary config header or layout mismatch");
+		return ESP_ERR_INVALID_VERSION;
+	}
+	Reader reader { data + binaryHeaderLength, data + length };
+	return readBinaryValues(object, reader);
+}
+
+}
@@ -1,9 +1,17 @@
 #include <sdkconfig.h>
 #include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <algorithm>
 #include <esp_log.h>
-#include <jsmn.h>
+#include <esp_timer.h>
 #include "control.hpp"
 #include "hal.hpp"
+#include "metrics.hpp"
+#include "json.hpp"
+#include "config.hpp"
+#include "tasks.hpp"
+#include "history.hpp"
 
 namespace app::control
 {
@@ -11,12 +19,34 @@ namespace app::control
 ////////////////////////////////////////////////////////////////////////////////
 // Control with state management
 
+void control_loop(void*);
+void set_motor_ramp(Motor which, float duty, uint32_t smoothingTime, SmoothingProfile profile, uptime_t start);
+bool stop_motor(Motor which, uptime_t now);
+
+constexpr uptime_t controlLoopPeriod = 1'000; // us
+
+TaskHandle_t controlLoopTask;
+esp_timer_handle_t controlLoopTimer;
+
 void init()
 {
 	setMotor(Motor::Left, 0);
 	setMotor(Motor::Right, 0);
 	setMainLight(false);
 	setOtherLight(false);
+
+	tasks::create(control_loop, "control", 3 * 1024, nullptr, tasks::control, &controlLoopTask);
+
+	// FreeRTOS ticks are too coarse for the loop, hence the timer.
+	const esp_timer_create_args_t timerArgs = {
+		.callback = [] (void*) { xTaskNotifyGive(controlLoopTask); },
+		.arg = nullptr,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "control",
+		.skip_unhandled_events = true,
+	};
+	ESP_ERROR_CHECK(esp_timer_create(&timerArgs, &controlLoopTimer));
+	ESP_ERROR_CHECK(esp_timer_start_periodic(controlLoopTimer, controlLoopPeriod));
 }
 
 constexpr uptime_t initialControlTimeout = 2'000'000; // us
@@ -25,23 +55,117 @@ uptime_t controlTimeout = initialControlTimeout; // us
 
 uptime_t mainLightControlTimeout = 30'000'000; // us
 
-void tick()
+/// Safety stop checks (like in case of timeout, for no control request in some time).
+void check_timeouts(uptime_t now)
 {
-	uptime_t timeSinceControl = esp_timer_get_time() - lastControlTime;
+	uptime_t timeSinceControl = now - lastControlTime;
 	if (timeSinceControl > controlTimeout) {
-		setMotor(Motor::Left, 0);
-		setMotor(Motor::Right, 0);
-		delay(1);
+		// Checked every iteration, so acting only on changes
+		const bool moving = getMotor(Motor::Left) != 0 || getMotor(Motor::Right) != 0;
+		const bool stopped = stop_motor(Motor::Left, now) | stop_motor(Motor::Right, now);
+		if (stopped && moving)
+			history::trigger(history::Trigger::SafetyStop); // preserve frames from before stopping
 		if (timeSinceControl > mainLightControlTimeout) {
-			setMainLight(false);
-			setOtherLight(false);
+			if (getMainLight()) setMainLight(false);
+			if (getOtherLight()) setOtherLight(false);
+		}
+	}
+}
+
+////////////////////////////////////////
+// Commands mailbox
+
+// Single slot mailbox, with small pool of commands to allow writers to prepare
+// them without locking. Writers claim free command from the pool, fill it and
+// exchange it into the slot, releasing the replaced one (if not yet taken).
+// The control loop exchanges the slot with null. Enough commands in the pool
+// for few writers at once (one reserved by each, one in slot, one being read).
+constexpr uint8_t commandsPoolSize = 8;
+Command commandsPool[commandsPoolSize];
+std::atomic<uint8_t> commandsPoolFree = (1 << commandsPoolSize) - 1; // bitmask
+static_assert(commandsPoolSize <= 8);
+std::atomic<Command*> latestCommand = nullptr;
+
+Command* claim_command()
+{
+	uint8_t free = commandsPoolFree.load(std::memory_order_relaxed);
+	for (;;) {
+		if (unlikely(free == 0)) {
+			// Should not happen, unless there are too many writers at once.
+			free = commandsPoolFree.load(std::memory_order_relaxed);
+			continue;
+		}
+		const uint8_t bit = free & -free; // lowest set
+		if (commandsPoolFree.compare_exchange_weak(free, free & ~bit, std::memory_order_acquire)) {
+			return &commandsPool[__builtin_ctz(bit)];
+		}
+	}
+}
+
+void release_command(Command* command)
+{
+	const uint8_t bit = 1 << (command - commandsPool);
+	commandsPoolFree.fetch_or(bit, std::memory_order_release);
+}
+
+void post(Command command)
+{
+	command.posted = esp_timer_get_time();
+	Command* slot = claim_command();
+	*slot = command;
+	// Pending command is taken out (to be owned exclusively) and merged, 
+	// so partial commands (like lights only) don't discard pending motors.
+	Command* pending = latestCommand.exchange(nullptr, std::memory_order_acq_rel);
+	for (;;) {
+		if (pending) {
+			mergeCommand(*slot, *pending);
+			release_command(pending);
 		}
+		Command* expected = nullptr;
+		if (latestCommand.compare_exchange_strong(expected, slot, std::memory_order_acq_rel)) 
+			return;
+		// Posted by other writer meanwhile
+		pending = latestCommand.exchange(nullptr, std::memory_order_acq_rel);
 	}
 }
 
-void refresh()
+LatencyStats latencyStats;
+
+LatencyStats getLatencyStats()
 {
-	lastControlTime = esp_timer_get_time();
+	return latencyStats;
+}
+
+/// Applies latest command (if any) posted to the mailbox.
+void apply_latest_command(uptime_t now)
+{
+	Command* slot = latestCommand.exchange(nullptr, std::memory_order_acq_rel);
+	if (!slot) return;
+	const Command command = *slot;
+	release_command(slot);
+
+	if (command.fields & Command::MainLight)
+		setMainLight(command.mainLight);
+	if (command.fields & Command::OtherLight)
+		setOtherLight(command.otherLight);
+	if (command.fields & Command::MotorLeft)
+		set_motor_ramp(Motor::Left, command.left, command.smoothingTime, command.profile, now);
+	if (command.fields & Command::MotorRight)
+		set_motor_ramp(Motor::Right, command.right, command.smoothingTime, command.profile, now);
+	if (!command.hint) 
+		lastControlTime = now; // hints are overridden by safety stop in the same iteration
+
+	// Motors are updated right after, in the same iteration of the loop.
+	const uint32_t latency = now - command.posted;
+	latencyStats.last = latency;
+	latencyStats.average = latencyStats.count 
+		? (latencyStats.average * 7 + latency) / 8
+		: latency;
+	if (latencyStats.max < latency) 
+		latencyStats.max = latency;
+	latencyStats.count += 1;
+	metrics::record(metrics::Histogram::ControlLatency, latency);
+	metrics::count(metrics::Counter::ControlCommands);
 }
 
 // TODO: allow configure control timeout?
@@ -50,11 +174,18 @@ void refresh()
 ////////////////////////////////////////
 // Lights
 
+/// Generation of controls configuration (and status), bumped on actual changes
+/// of lights or motors outputs, so it stays the same while the car is idle.
+config::Generation configGeneration;
+
 bool mainLightState;
 void setMainLight(bool on)
 {
 	hal::setMainLight(on);
-	mainLightState = on;
+	if (mainLightState != on) {
+		mainLightState = on;
+		configGeneration.bump();
+	}
 }
 bool getMainLight()
 {
@@ -65,7 +196,10 @@ bool otherLightState;
 void setOtherLight(bool on)
 {
 	hal::setOtherLight(on);
-	otherLightState = on;
+	if (otherLightState != on) {
+		otherLightState = on;
+		configGeneration.bump();
+	}
 }
 bool getOtherLight()
 {
@@ -75,7 +209,42 @@ bool getOtherLight()
 ////////////////////////////////////////
 // Motors
 
-float lastMotorDuty[static_cast<uint8_t>(Motor::_Count)];
+constexpr uint8_t motorsCount = static_cast<uint8_t>(Motor::_Count);
+
+/// Smooth transition of motor duty, interpolated by the control loop.
+struct MotorRamp
+{
+	float from;
+	float to;
+	uptime_t start;    // us
+	uptime_t duration; // us, 0 for immediate change
+	SmoothingProfile profile;
+};
+
+/// Returns duty for given point in time of the transition. Points before 
+/// the start (i.e. ramp set by other task meanwhile) are at the beginning.
+constexpr float interpolate(const MotorRamp& ramp, uptime_t now)
+{
+	if (ramp.duration <= 0) 
+		return ramp.to;
+	const uptime_t elapsed = std::max<uptime_t>(now - ramp.start, 0);
+	if (elapsed >= ramp.duration) 
+		return ramp.to;
+	float t = static_cast<float>(elapsed) / ramp.duration;
+	if (ramp.profile == SmoothingProfile::SCurve) 
+		t = t * t * (3 - 2 * t);
+	return ramp.from + (ramp.to - ramp.from) * t;
+}
+static_assert(interpolate({ 0, 100, 0, 1000, SmoothingProfile::Linear }, 250) == 25);
+static_assert(interpolate({ 0, 100, 0, 1000, SmoothingProfile::SCurve }, 500) == 50);
+static_assert(interpolate({ 0, 100, 0, 0, SmoothingProfile::Linear }, 0) == 100);
+static_assert(interpolate({ 0, 100, 10, 0, SmoothingProfile::Linear }, 5) == 100);
+static_assert(interpolate({ 0, 100, 10, 1000, SmoothingProfile::SCurve }, 5) == 0);
+
+portMUX_TYPE motorsLock = portMUX_INITIALIZER_UNLOCKED;
+MotorRamp motorRamps[motorsCount];
+float lastMotorDuty[motorsCount]; // as applied by the control loop
+int32_t lastMotorDutyTicks[motorsCount] = { INT32_MIN, INT32_MIN }; // to force initial update
 
 // No translation for motor enums (aside from casting) is required between
 // `control` and `hal` modules because it just so happens next MCPWM timers
@@ -83,10 +252,50 @@ float lastMotorDuty[static_cast<uint8_t>(Motor::_Count)];
 static_assert(static_cast<int>(control::Motor::Left)  == static_cast<int>(hal::Motor::Left));
 static_assert(static_cast<int>(control::Motor::Right) == static_cast<int>(hal::Motor::Right));
 
+/// Sets motor ramp starting at given time, used by the control loop with time
+/// of its iteration, so the ramp doesn't start after the motors update.
+void set_motor_ramp(Motor which, float duty, uint32_t smoothingTime, SmoothingProfile profile, uptime_t start)
+{
+	const auto i = static_cast<uint8_t>(which);
+	portENTER_CRITICAL(&motorsLock);
+	motorRamps[i] = {
+		.from = lastMotorDuty[i],
+		.to = duty,
+		.start = start,
+		.duration = static_cast<uptime_t>(smoothingTime) * 1000,
+		.profile = profile,
+	};
+	portEXIT_CRITICAL(&motorsLock);
+}
+
+/// Stops the motor right away, unless already stopping. Returns false if nothing changed.
+bool stop_motor(Motor which, uptime_t now)
+{
+	const auto i = static_cast<uint8_t>(which);
+	bool changed = false;
+	portENTER_CRITICAL(&motorsLock);
+	if (motorRamps[i].to != 0 || motorRamps[i].duration != 0) {
+		motorRamps[i] = {
+			.from = lastMotorDuty[i],
+			.to = 0,
+			.start = now,
+			.duration = 0,
+			.profile = SmoothingProfile::Linear,
+		};
+		changed = true;
+	}
+	portEXIT_CRITICAL(&motorsLock);
+	return changed;
+}
+
+void setMotor(Motor which, float duty, uint32_t smoothingTime, SmoothingProfile profile)
+{
+	set_motor_ramp(which, duty, smoothingTime, profile, esp_timer_get_time());
+}
+
 void setMotor(Motor which, float duty)
 {
-	hal::setMotor(static_cast<hal::Motor>(which), duty);
-	lastMotorDuty[static_cast<uint8_t>(which)] = duty;
+	setMotor(which, duty, 0);
 }
 
 float getMotor(Motor which)
@@ -94,95 +303,108 @@ float getMotor(Motor which)
 	return lastMotorDuty[static_cast<uint8_t>(which)];
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// Configuration
+/// Interpolates motors duty towards the targets, updating the PWM outputs 
+/// only if the change is big enough to actually affect them.
+void update_motors(uptime_t now)
+{
+	for (uint8_t i = 0; i < motorsCount; i++) {
+		portENTER_CRITICAL(&motorsLock);
+		const MotorRamp ramp = motorRamps[i];
+		portEXIT_CRITICAL(&motorsLock);
 
-inline bool has_simple_value(const jsmntok_t* token)
-{
-	if (token->type == JSMN_UNDEFINED) return false;
-	if (token->type == JSMN_OBJECT) return false;
-	if (token->type == JSMN_ARRAY) return false;
-	return true;
-}
-
-static const char* TAG_CONFIG_CONTROL = "config-control";
-
-/// @brief Applies (and/or reads current) JSON configuration and status for controls.
-/// @param[in] input Buffer with JSON data that was parsed into JSON into tokens.
-///		Note: Passed non-const to allow in-place strings manipulation.
-/// @param[in] root JSMN JSON object token related to the config to be parsed.
-/// @param[out] output Optional buffer for writing JSON with current configuration.
-/// @param[in] output_length Length of output buffer.
-/// @param[out] output_return Used to return number of bytes that would be written 
-/// 	to the output, or negative for error. Basically `printf`-like return.
-/// @return 
-esp_err_t config(
-	char* input, jsmntok_t* root,
-	char* output, size_t output_length, int* output_return
-) {
-	if (input) {
-		if (unlikely(root->type != JSMN_OBJECT))
-			return ESP_FAIL;
-		if (unlikely(root->size < 1)) 
-			return ESP_FAIL;
-		for (jsmntok_t* token = root + 1;;) {
-			auto* key_token   = token;
-			auto* value_token = token + 1;
-			ESP_LOGV(TAG_CONFIG_CONTROL, "key='%.*s' value='%.*s'", 
-				key_token->end - key_token->start, input + key_token->start,
-				value_token->end - value_token->start, input + value_token->start
-			);
-
-			if (unlikely(!has_simple_value(value_token)))
-				return ESP_FAIL;
-			const size_t value_length = value_token->end - value_token->start;
-			switch (fnv1a32(input + key_token->start, input + key_token->end)) {
-				case fnv1a32("mainLight"):
-					control::setMainLight(parseBooleanFast(input + value_token->start));
-					break;
-				case fnv1a32("otherLight"):
-					control::setOtherLight(parseBooleanFast(input + value_token->start));
-					break;
-				case fnv1a32("left"):
-					control::setOtherLight(std::atoi(input + value_token->start));
-					break;
-				case fnv1a32("right"):
-					control::setOtherLight(std::atoi(input + value_token->start));
-					break;
-				default:
-					ESP_LOGD(TAG_CONFIG_CONTROL, "Unknown field '%.*s', ignoring.", 
-						key_token->end - key_token->start, input + key_token->start);
-					break;
-			}
-
-			// Skip primitive pair (key & value)
-			token += 2;
-			if (root->end < token->end)
-				goto done;
-		}
-		done: /* semicolon for empty statement */ ;
+		const float duty = interpolate(ramp, now);
+		lastMotorDuty[i] = duty;
 
-		// Control object existing, even empty, marks the control state as fresh
-		control::refresh();
+		const int32_t ticks = hal::quantizeMotorDuty(duty);
+		if (ticks != lastMotorDutyTicks[i]) {
+			hal::setMotor(static_cast<hal::Motor>(i), duty);
+			lastMotorDutyTicks[i] = ticks;
+			configGeneration.bump();
+		}
 	}
+}
 
-	if (output_return) {
-		*output_return = std::snprintf(
-			output, output_length,
-			"{"
-				"\"mainLight\":%u,"
-				"\"otherLight\":%u,"
-				"\"left\":%.1f,"
-				"\"right\":%.1f"
-			"}",
-			getMainLight(),
-			getOtherLight(),
-			getMotor(Motor::Left),
-			getMotor(Motor::Right)
-		);
+/// Control loop, running at fixed rate (woken up by the timer).
+void control_loop(void*)
+{
+	for (;;) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		const uptime_t now = esp_timer_get_time();
+		apply_latest_command(now);
+		check_timeouts(now);
+		update_motors(now);
 	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Configuration
+
+/// Command being built from the config fields, posted at the end.
+/// Config requests are handled one by one (by the main web server task).
+Command configCommand;
 
+/// Begins applying JSON configuration (and status) for controls, see `configFields`.
+esp_err_t config_begin()
+{
+	configCommand = {};
+	return ESP_OK;
+}
+
+/// Ends applying JSON configuration for controls.
+/// @param apply False if the request failed (or only reading), to discard the changes.
+esp_err_t config_end(bool apply)
+{
+	// Control object existing, even empty, marks the control state as fresh
+	if (apply) 
+		post(configCommand);
 	return ESP_OK;
 }
 
+constexpr config::Field configFields[] = {
+	config::boolean("mainLight", 
+		[] (const json::Field& field) {
+			configCommand.mainLight = parseBooleanFast(field.value);
+			configCommand.fields |= Command::MainLight;
+			return ESP_OK;
+		},
+		getMainLight
+	),
+	config::boolean("otherLight", 
+		[] (const json::Field& field) {
+			configCommand.otherLight = parseBooleanFast(field.value);
+			configCommand.fields |= Command::OtherLight;
+			return ESP_OK;
+		},
+		getOtherLight
+	),
+	config::number("left", 
+		[] (const json::Field& field) {
+			configCommand.left = std::atof(field.value);
+			configCommand.fields |= Command::MotorLeft;
+			return ESP_OK;
+		},
+		[] { return getMotor(Motor::Left); }
+	),
+	config::number("right", 
+		[] (const json::Field& field) {
+			configCommand.right = std::atof(field.value);
+			configCommand.fields |= Command::MotorRight;
+			return ESP_OK;
+		},
+		[] { return getMotor(Motor::Right); }
+	),
+	/* Write-only */
+	config::alias("smoothingTime", 
+		[] (const json::Field& field) {
+			configCommand.smoothingTime = std::atoi(field.value);
+			return ESP_OK;
+		}
+	),
+};
+constexpr config::Index configIndex { configFields };
+static_assert(configIndex.unique, "Keys hashes collision");
+
+/// Controls configuration (and status), see `configFields`.
+extern const config::Object configObject { configFields, configIndex, config_begin, config_end, &configGeneration };
+
 }
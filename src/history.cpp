@@ -0,0 +1,369 @@
+#include <sdkconfig.h>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+#include <algorithm>
+#include <atomic>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <freertos/semphr.h>
+#include "history.hpp"
+#include "camera.hpp"
+#include "control.hpp"
+#include "metrics.hpp"
+#include "json.hpp"
+#include "config.hpp"
+#include "tasks.hpp"
+
+namespace app::history
+{
+
+static const char* TAG_HISTORY = "history";
+
+Settings settings = {
+	.enabled = false,
+	.budget = 512,
+	.duration = 5000,
+	.interval = 0,
+};
+
+Settings& getSettings()
+{
+	return settings;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Trigger
+
+std::atomic<bool> triggerClaimed = false;
+std::atomic<Trigger> triggerReason = Trigger::None;
+uptime_t triggerTime = 0; // us, written only by the claimant, before publishing the reason
+
+TaskHandle_t historyTask;
+
+const char* toString(Trigger trigger)
+{
+	switch (trigger) {
+		case Trigger::None:       return "none";
+		case Trigger::SafetyStop: return "safety-stop";
+		case Trigger::Request:    return "request";
+	}
+	return "?";
+}
+
+void trigger(Trigger reason)
+{
+	if (!settings.enabled)
+		return;
+	if (triggerClaimed.exchange(true, std::memory_order_relaxed))
+		return; // already frozen, only the first one is kept
+	triggerTime = esp_timer_get_time();
+	triggerReason.store(reason, std::memory_order_release);
+	metrics::count(metrics::Counter::HistoryTriggers);
+}
+
+void resume()
+{
+	triggerReason.store(Trigger::None, std::memory_order_relaxed);
+	triggerClaimed.store(false, std::memory_order_release);
+	xTaskNotifyGive(historyTask);
+}
+
+inline bool frozen()
+{
+	return triggerClaimed.load(std::memory_order_acquire);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Ring
+
+// Frames data are placed one after another, wrapping around to the beginning
+// if the next one doesn't fit at the end, overwriting the oldest frames.
+// Entries (metadata) are kept in their own ring, allocated along the data.
+
+/// Memory per entry (of the budget), assuming frames are at least that large.
+constexpr uint32_t bytesPerEntry = 2048;
+constexpr uint16_t minEntries = 8;
+
+SemaphoreHandle_t mutex; // for modifying the ring (recording, reallocating) and claiming the reader
+bool reading = false;
+
+uint8_t* memory = nullptr; // single allocation for both entries and data
+Entry* entries = nullptr;
+uint16_t entriesCapacity = 0;
+uint16_t head = 0; // index of the oldest entry
+uint16_t count = 0;
+uint8_t* data = nullptr;
+uint32_t capacity = 0; // of the data, bytes
+
+inline Entry& at(uint16_t index)
+{
+	return entries[(head + index) % entriesCapacity];
+}
+
+inline void drop_oldest()
+{
+	head = (head + 1) % entriesCapacity;
+	count--;
+}
+
+uint32_t used_bytes()
+{
+	uint32_t used = 0;
+	for (uint16_t i = 0; i < count; i++)
+		used += at(i).length;
+	return used;
+}
+
+void release()
+{
+	heap_caps_free(memory);
+	memory = nullptr;
+	entries = nullptr;
+	data = nullptr;
+	entriesCapacity = 0;
+	capacity = 0;
+	head = count = 0;
+}
+
+/// Reallocates the ring to fit the budget, dropping recorded frames.
+/// Must be called with the mutex taken, not while reading.
+bool prepare(uint32_t budget)
+{
+	const uint16_t wantedEntries = std::max<uint32_t>(minEntries, budget / bytesPerEntry);
+	const uint32_t entriesSize = (wantedEntries * sizeof(Entry) + 3) & ~3;
+	if (budget <= entriesSize) {
+		release();
+		return false;
+	}
+	if (memory && capacity + entriesSize == budget)
+		return true;
+	release();
+	memory = static_cast<uint8_t*>(heap_caps_malloc(budget, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+	if (unlikely(!memory)) {
+		// Unlikely to fit in internal RAM, but small budgets might
+		memory = static_cast<uint8_t*>(heap_caps_malloc(budget, MALLOC_CAP_8BIT));
+		if (unlikely(!memory)) {
+			ESP_LOGE(TAG_HISTORY, "Failed to allocate %" PRIu32 " bytes", budget);
+			return false;
+		}
+	}
+	entries = reinterpret_cast<Entry*>(memory);
+	entriesCapacity = wantedEntries;
+	data = memory + entriesSize;
+	capacity = budget - entriesSize;
+	ESP_LOGI(TAG_HISTORY, "Allocated %" PRIu32 " bytes for up to %u frames", budget, wantedEntries);
+	return true;
+}
+
+/// Copies the frame into the ring, dropping the oldest frames to make space
+/// (and ones older than configured duration). Must be called with the mutex taken.
+void record(const camera::SharedFrame& fb)
+{
+	const uint32_t length = fb->len;
+	if (unlikely(length > capacity)) {
+		ESP_LOGD(TAG_HISTORY, "Frame too large: %" PRIu32, length);
+		return;
+	}
+	const uptime_t timestamp = static_cast<uptime_t>(fb->timestamp.tv_sec) * 1'000'000 + fb->timestamp.tv_usec;
+
+	while (count && timestamp - at(0).timestamp > static_cast<uptime_t>(settings.duration) * 1000)
+		drop_oldest();
+	if (count == entriesCapacity)
+		drop_oldest();
+
+	uint32_t start = 0;
+	if (count) {
+		const Entry& newest = at(count - 1);
+		start = (newest.offset + newest.length + 3) & ~3;
+	}
+	if (start + length > capacity) {
+		// Wrap around, dropping frames at the end (the oldest, as placed before the wrap)
+		while (count && at(0).offset >= start)
+			drop_oldest();
+		start = 0;
+	}
+	while (count && at(0).offset < start + length && at(0).offset + at(0).length > start)
+		drop_oldest();
+
+	std::memcpy(data + start, fb->buf, length);
+	at(count) = {
+		.offset = start,
+		.length = length,
+		.timestamp = timestamp,
+		.sequence = fb.sequence(),
+		.width = static_cast<uint16_t>(fb->width),
+		.height = static_cast<uint16_t>(fb->height),
+		.pixformat = static_cast<uint8_t>(fb->format),
+		.left = control::getMotor(control::Motor::Left),
+		.right = control::getMotor(control::Motor::Right),
+	};
+	count++;
+}
+
+Status getStatus()
+{
+	Status status {};
+	status.trigger = triggerReason.load(std::memory_order_acquire);
+	if (status.trigger != Trigger::None)
+		status.triggerTime = triggerTime;
+	xSemaphoreTake(mutex, portMAX_DELAY);
+	status.count = count;
+	status.used = used_bytes();
+	status.capacity = capacity;
+	xSemaphoreGive(mutex);
+	return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Reader
+
+Reader::Reader()
+	: acquired(false)
+{
+	xSemaphoreTake(mutex, portMAX_DELAY);
+	if (!reading)
+		acquired = reading = true;
+	xSemaphoreGive(mutex);
+}
+
+Reader::~Reader()
+{
+	if (!acquired) return;
+	xSemaphoreTake(mutex, portMAX_DELAY);
+	reading = false;
+	xSemaphoreGive(mutex);
+	xTaskNotifyGive(historyTask); // might be waiting to reallocate
+}
+
+uint16_t Reader::count() const
+{
+	return history::count;
+}
+
+const Entry& Reader::entry(uint16_t index) const
+{
+	return at(index);
+}
+
+const uint8_t* Reader::data(const Entry& entry) const
+{
+	return history::data + entry.offset;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Task
+
+constexpr TickType_t frameTimeout = 1000 / portTICK_PERIOD_MS;
+
+inline uint32_t budget_bytes()
+{
+	return static_cast<uint32_t>(settings.budget) * 1024;
+}
+
+/// Records frames from the shared capture loop. Registered in the capture loop
+/// only while enabled and not frozen. Frames are copied (once), as holding
+/// the camera driver buffers would stall the capture.
+void history_loop(void*)
+{
+	for (;;) {
+		if (!settings.enabled) {
+			xSemaphoreTake(mutex, portMAX_DELAY);
+			if (!reading)
+				release();
+			xSemaphoreGive(mutex);
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+		if (frozen()) {
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+
+		xSemaphoreTake(mutex, portMAX_DELAY);
+		const bool prepared = !reading && prepare(budget_bytes());
+		xSemaphoreGive(mutex);
+		if (!prepared) {
+			ulTaskNotifyTake(pdTRUE, frameTimeout);
+			continue;
+		}
+
+		camera::FrameSubscriber subscriber;
+		if (!subscriber) {
+			ESP_LOGW(TAG_HISTORY, "Failed to subscribe for frames");
+			ulTaskNotifyTake(pdTRUE, frameTimeout);
+			continue;
+		}
+		const uint32_t budget = budget_bytes();
+		uptime_t lastTimestamp = 0;
+		while (settings.enabled && !frozen() && budget == budget_bytes()) {
+			auto fb = subscriber.next(frameTimeout);
+			if (unlikely(!fb)) continue;
+			const uptime_t timestamp = static_cast<uptime_t>(fb->timestamp.tv_sec) * 1'000'000 + fb->timestamp.tv_usec;
+			if (timestamp - lastTimestamp < static_cast<uptime_t>(settings.interval) * 1000)
+				continue;
+
+			xSemaphoreTake(mutex, portMAX_DELAY);
+			// Checked again, as could be triggered while waiting for the frame
+			const bool recording = !reading && !frozen();
+			if (recording)
+				record(fb);
+			xSemaphoreGive(mutex);
+			if (recording)
+				lastTimestamp = timestamp;
+		}
+	}
+}
+
+void init()
+{
+	mutex = xSemaphoreCreateMutex();
+	tasks::create(history_loop, "history", 3 * 1024, nullptr, tasks::history, &historyTask);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Configuration
+
+config::Generation configGeneration;
+
+/// Ends applying JSON configuration for history, waking up the task.
+esp_err_t config_end(bool apply)
+{
+	if (apply)
+		xTaskNotifyGive(historyTask);
+	return ESP_OK;
+}
+
+/// Field for integer setting.
+template <auto member>
+constexpr config::Field settings_integer(const char* key)
+{
+	return config::integer(key,
+		[] (const json::Field& field) {
+			settings.*member = std::atoi(field.value);
+			return ESP_OK;
+		},
+		[] { return static_cast<int32_t>(settings.*member); }
+	);
+}
+
+constexpr config::Field configFields[] = {
+	config::boolean("enabled",
+		[] (const json::Field& field) {
+			settings.enabled = parseBooleanFast(field.value);
+			return ESP_OK;
+		},
+		[] { return settings.enabled; }
+	),
+	settings_integer<&Settings::budget>("budget"),
+	settings_integer<&Settings::duration>("duration"),
+	settings_integer<&Settings::interval>("interval"),
+};
+constexpr config::Index configIndex { configFields };
+static_assert(configIndex.unique, "Keys hashes collision");
+
+/// History configuration, see `configFields`.
+extern const config::Object configObject { configFields, configIndex, nullptr, config_end, &configGeneration };
+
+}
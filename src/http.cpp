@@ -3,28 +3,48 @@
 #include <ctime>
 #include <cstring>
 #include <cstdio>
+#include <cctype>
 #include <string_view>
 #include <memory>
-#include <vector>
 #include <algorithm>
+#include <atomic>
 #include <esp_log.h>
 #include <esp_wifi.h>
 #include <esp_mac.h>
 #include <freertos/timers.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include <esp_http_server.h>
-#include <jsmn.h>
+#include <esp_heap_caps.h>
+#include <lwip/sockets.h>
 #include "common.hpp"
 #include "camera.hpp"
+#include "camera_formats.hpp"
+#include "control.hpp"
+#include "udp.hpp"
+#include "metrics.hpp"
+#include "json.hpp"
+#include "config.hpp"
 #include "bmp.hpp"
+#include "pool.hpp"
+#include "tasks.hpp"
+#include "history.hpp"
+#include "querystring.hpp"
 
 namespace app::network { // from network.cpp
-	esp_err_t config(char* input, jsmntok_t* root, char* output, size_t output_length, int* output_return); 
+	extern const config::Object configObject;
 }
 namespace app::camera { // from camera.cpp
-	esp_err_t config(char* input, jsmntok_t* root, char* output, size_t output_length, int* output_return);
+	extern const config::Object configObject;
 }
 namespace app::control { // from control.cpp
-	esp_err_t config(char* input, jsmntok_t* root, char* output, size_t output_length, int* output_return);
+	extern const config::Object configObject;
+}
+namespace app::vision { // from vision.cpp
+	extern const config::Object configObject;
+}
+namespace app::history { // from history.cpp
+	extern const config::Object configObject;
 }
 
 namespace app::http
@@ -38,98 +58,99 @@ inline esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_u
 	return httpd_register_uri_handler(handle, &uri_handler);
 }
 
-#define GENERATE_HTTPD_HANDLER_FOR_EMBEDDED_FILE_I(n, t, e)                    \
-	esp_err_t embedded_##n##_handler(httpd_req_t* req)                         \
-	{                                                                          \
-		extern const unsigned char n##_start[] asm("_binary_" #n "_start");    \
-		extern const unsigned char n##_end[]   asm("_binary_" #n "_end");      \
-		const size_t n##_size = (n##_end - n##_start);                         \
-		httpd_resp_set_type(req, t);                                           \
-		if (sizeof(e) > 1) httpd_resp_set_hdr(req, "Content-Encoding", e);     \
-		httpd_resp_send(req, (const char*)n##_start, n##_size);                \
-		return ESP_OK;                                                         \
-	}
-#define GENERATE_HTTPD_HANDLER_FOR_EMBEDDED_FILE(snake_name, type, encoding) \
-	GENERATE_HTTPD_HANDLER_FOR_EMBEDDED_FILE_I(snake_name, type, encoding)
-
-std::string_view skipToQuerystring(std::string_view uri) {
-	auto pos = uri.rfind('?');
-	if (pos != std::string_view::npos) uri.remove_prefix(pos + 1);
-	return uri;
-}
-
-class QuerystringCrawlerIterator
-{
-	const char* keyStart;
-	const char* keyEnd;
-	const char* valueEnd;
-
-	void forward() noexcept {
-		const char* p = keyStart;
-		for(;;) {
-			if (*p == '=') {
-				keyEnd = p;
-				while (*++p)
-					if (*p == '&')
-						break;
-				valueEnd = p;
-				return;
-			}
-			if (*p == '&' || !*p) {
-				keyEnd = p;
-				valueEnd = keyEnd + 1; // will end up as 0 length value
-				return;
-			}
-			p++;
-		}
-	}
+////////////////////////////////////////////////////////////////////////////////
+// Bitmaps
 
-public:
-	QuerystringCrawlerIterator(const char* position)
-		: keyStart(position)
-	{
-		forward();
+/// Size of line buffer used to convert raw frames into bitmaps, row by row.
+/// Enough for at least single row of any frame size (up to QSXGA RGB565).
+constexpr size_t bitmapLineBufferSize = 6 * 1024;
+
+/// Bitmap output format requested for raw frames.
+enum class BitmapMode : uint8_t {
+	None,      // frames are sent as is
+	Color,     // RGB565 bitmap, or grayscale for grayscale frames
+	Grayscale, // grayscale bitmap, converted if possible (YUV422)
+};
+
+BitmapMode parse_bitmap_mode(std::string_view value)
+{
+	switch (fnv1a32i(value)) {
+		case fnv1a32i("bmp"):  return BitmapMode::Color;
+		case fnv1a32i("gray"): return BitmapMode::Grayscale;
+		default:               return BitmapMode::None;
 	}
+}
 
-	QuerystringCrawlerIterator& operator++() noexcept {
-		if (*keyEnd && *valueEnd) {
-			keyStart = valueEnd + 1;
-			forward();
-		}
-		else {
-			keyStart = *keyEnd ? valueEnd : keyEnd;
+/// Describes how to send the camera frame as bitmap: headers and row kernel.
+struct FrameBitmap
+{
+	uint8_t headers[std::max(sizeof(bmp::Rgb565Headers), sizeof(bmp::GrayscaleHeaders))];
+	uint16_t headersSize;
+	uint32_t fileSize;
+	uint16_t bitsPerPixel;
+	uint32_t sourceStride;
+	bmp::RowKernel kernel;
+
+	/// Prepares the bitmap for the frame. Returns false if format is not supported.
+	bool prepare(const camera_fb_t* fb, BitmapMode mode)
+	{
+		switch (fb->format) {
+			case PIXFORMAT_RGB565:
+				prepareRgb565(fb, bmp::convertRowRgb565);
+				return true;
+			case PIXFORMAT_YUV422:
+				if (mode == BitmapMode::Grayscale)
+					prepareGrayscale(fb, fb->width * 2, bmp::convertRowYuv422ToGrayscale);
+				else
+					prepareRgb565(fb, bmp::convertRowYuv422ToRgb565);
+				return true;
+			case PIXFORMAT_GRAYSCALE:
+				// Sent straight from the frame buffer, unless rows need padding
+				prepareGrayscale(fb, fb->width, (fb->width % 4) ? copy_row : nullptr);
+				return true;
+			default:
+				return false;
 		}
-		return *this;
-	}
-	
-	std::pair<std::string_view, std::string_view> operator*() const noexcept {
-		const auto valueStart = keyEnd + 1;
-		return {
-			{ keyStart, static_cast<size_t>(keyEnd - keyStart) }, 
-			{ valueStart, static_cast<size_t>(valueEnd - valueStart) }
-		};
 	}
 
-	bool operator!=(const QuerystringCrawlerIterator& other) const noexcept {
-		return this->keyStart != other.keyStart;
-	}
-};
+	bool hasColorTable() const { return bitsPerPixel == 8; }
 
-class QuerystringCrawler
-{
-	const std::string_view view;
-public:
-	using iterator = QuerystringCrawlerIterator;
+	/// Total length of the bitmap file, in bytes.
+	uint32_t length() const { return fileSize; }
 
-	QuerystringCrawler(std::string_view&& view)
-		: view(view)
-	{}
+	bmp::RowConverter converter(const camera_fb_t* fb, uint8_t* lineBuffer) const
+	{
+		return bmp::RowConverter(
+			kernel, fb->buf, sourceStride, fb->width, fb->height, bitsPerPixel,
+			lineBuffer, bitmapLineBufferSize);
+	}
+
+private:
+	static void copy_row(const uint8_t* source, uint8_t* destination, int32_t width)
+	{
+		std::memcpy(destination, source, width);
+	}
 
-	iterator begin() const noexcept {
-		return iterator(std::cbegin(this->view));
+	void prepareRgb565(const camera_fb_t* fb, bmp::RowKernel k)
+	{
+		const auto h = bmp::makeRgb565Headers(fb->width, fb->height);
+		std::memcpy(headers, &h, sizeof(h));
+		headersSize = sizeof(h);
+		fileSize = h.file.size;
+		bitsPerPixel = 16;
+		sourceStride = fb->width * 2;
+		kernel = k;
 	}
-	iterator end() const noexcept {
-		return iterator(std::cend(this->view));
+
+	void prepareGrayscale(const camera_fb_t* fb, uint32_t stride, bmp::RowKernel k)
+	{
+		const auto h = bmp::makeGrayscaleHeaders(fb->width, fb->height);
+		std::memcpy(headers, &h, sizeof(h));
+		headersSize = sizeof(h);
+		fileSize = h.file.size;
+		bitsPerPixel = 8;
+		sourceStride = stride;
+		kernel = k;
 	}
 };
 
@@ -138,169 +159,75 @@ public:
 
 static const char* TAG_CONFIG_ROOT = "config-root";
 
-inline bool has_simple_value(const jsmntok_t* token)
+esp_err_t set_restart(const json::Field& field)
 {
-	if (token->type == JSMN_UNDEFINED) return false;
-	if (token->type == JSMN_OBJECT) return false;
-	if (token->type == JSMN_ARRAY) return false;
-	return true;
-}
-
-/// @brief Applies (and/or reads current) JSON configuration for the whole app.
-/// @param[in] input Buffer with JSON data that was parsed into JSON into tokens.
-///		Note: Passed non-const to allow in-place strings manipulation.
-/// @param[in] root JSMN JSON object token related to the config to be parsed.
-/// @param[out] output Optional buffer for writing JSON with current configuration.
-/// @param[in] output_length Length of output buffer.
-/// @param[out] output_return Used to return number of bytes that would be written 
-/// 	to the output, or negative for error. Basically `printf`-like return.
-/// @return 
-esp_err_t config_root(
-	char* input, jsmntok_t* root,
-	char* output, size_t output_length, int* output_return
-) {
-	if (input) {
-		if (unlikely(root->type != JSMN_OBJECT))
-			return ESP_FAIL;
-		if (unlikely(root->size < 1)) 
-			return ESP_FAIL;
-		for (jsmntok_t* token = root + 1;;) {
-			auto* key_token   = token;
-			auto* value_token = token + 1;
-			ESP_LOGV(TAG_CONFIG_ROOT, "key='%.*s' value='%.*s'", 
-				key_token->end - key_token->start, input + key_token->start,
-				value_token->end - value_token->start, input + value_token->start
-			);
-
-			// Dispatch based on type and key
-			const auto key_hash = fnv1a32(input + key_token->start, input + key_token->end);
-			if (value_token->type == JSMN_OBJECT) {
-				ESP_LOGV(TAG_CONFIG_ROOT, "type=object size=%zu", value_token->size);
-				switch (key_hash) {
-					case fnv1a32("network"): {
-						if (network::config(input, value_token, nullptr, 0, nullptr) != ESP_OK)
-							return ESP_FAIL;
-						break;
-					}
-					case fnv1a32("camera"): {
-						if (camera::config(input, value_token, nullptr, 0, nullptr) != ESP_OK)
-							return ESP_FAIL;
-						break;
-					}
-					case fnv1a32("control"): {
-						if (control::config(input, value_token, nullptr, 0, nullptr) != ESP_OK)
-							return ESP_FAIL;
-						break;
-					}
-					default:
-						ESP_LOGD(TAG_CONFIG_ROOT, "Unknown field '%.*s', ignoring.", 
-							key_token->end - key_token->start, input + key_token->start);
-						break;
-				}
-
-				// Skip object
-				jsmntok_t* other = value_token + 1;
-				while(1) {
-					if (root->end < other->end)
-						goto done;
-					if (value_token->end < other->end) {
-						break;
-					}
-					other++;
-				}
-				token = other;
+	uint32_t delay = std::atoi(field.value);
+	if (delay || parseBooleanFast(field.value)) {
+		if (delay < 100) delay = 100;
+		const auto restartTimer = xTimerCreate(
+			"restart", delay / portTICK_PERIOD_MS, pdFALSE, static_cast<void*>(0), 
+			[] (TimerHandle_t) {
+				ESP_LOGI(TAG_CONFIG_ROOT, "Restarting...");
+				esp_restart();
 			}
-			else {
-				if (unlikely(!has_simple_value(value_token)))
-					return ESP_FAIL;
-
-				switch (key_hash) {
-					case fnv1a32("restart"): {
-						uint32_t delay = std::atoi(input + value_token->start);
-						if (delay || parseBooleanFast(input + value_token->start)) {
-							if (delay < 100) delay = 100;
-							const auto restartTimer = xTimerCreate(
-								"restart", delay / portTICK_PERIOD_MS, pdFALSE, static_cast<void*>(0), 
-								[] (TimerHandle_t) {
-									ESP_LOGI(TAG_CONFIG_ROOT, "Restarting...");
-									esp_restart();
-								}
-							);
-							xTimerStart(restartTimer, portMAX_DELAY);
-							ESP_LOGD(TAG_CONFIG_ROOT, "Timer set to restart in %" PRIu32 "ms", delay);
-						}
-						break;
-					}
-					default:
-						ESP_LOGD(TAG_CONFIG_ROOT, "Unknown field '%.*s', ignoring.", 
-							key_token->end - key_token->start, input + key_token->start);
-						break;
-				}
-
-				// Skip primitive pair (key & value)
-				token += 2;
-				if (root->end < token->end)
-					goto done;
-			}
-		}
-		done: /* semicolon for empty statement */ ;
-	}
-
-	if (output_return) {
-		int ret;
-		char* position = output;
-		size_t remaining = output_length;
-
-		ret = std::snprintf(
-			position, remaining,
-			"{"
-				"\"uptime\":%llu,"
-				"\"control\":",
-			esp_timer_get_time()
 		);
-		if (unlikely(ret < 0)) goto output_fail;
-		position += ret;
-		remaining = saturatedSubtract(remaining, ret);
-
-		control::config(nullptr, nullptr, position, remaining, &ret);
-		if (unlikely(ret < 0)) goto output_fail;
-		position += ret;
-		remaining = saturatedSubtract(remaining, ret);
-
-		ret = std::snprintf(position, remaining, ",\"network\":");
-		if (unlikely(ret < 0)) goto output_fail;
-		position += ret;
-		remaining = saturatedSubtract(remaining, ret);
-
-		network::config(nullptr, nullptr, position, remaining, &ret);
-		if (unlikely(ret < 0)) goto output_fail;
-		position += ret;
-		remaining = saturatedSubtract(remaining, ret);
+		xTimerStart(restartTimer, portMAX_DELAY);
+		ESP_LOGD(TAG_CONFIG_ROOT, "Timer set to restart in %" PRIu32 "ms", delay);
+	}
+	return ESP_OK;
+}
 
-		ret = std::snprintf(position, remaining, ",\"camera\":");
-		if (unlikely(ret < 0)) goto output_fail;
-		position += ret;
-		remaining = saturatedSubtract(remaining, ret);
+/// Sections of the configuration, each handled by its module.
+constexpr config::Field rootConfigFields[] = {
+	config::object("control", control::configObject),
+	config::object("network", network::configObject),
+	config::object("camera",  camera::configObject),
+	config::object("vision",  vision::configObject),
+	config::object("history", history::configObject),
+	/* Actions */
+	config::alias("restart", set_restart),
+};
+constexpr config::Index rootConfigIndex { rootConfigFields };
+static_assert(rootConfigIndex.unique, "Keys hashes collision");
+constexpr config::Object rootConfig { rootConfigFields, rootConfigIndex };
 
-		camera::config(nullptr, nullptr, position, remaining, &ret);
-		if (unlikely(ret < 0)) goto output_fail;
-		position += ret;
-		remaining = saturatedSubtract(remaining, ret);
+/// Passes written data as chunk of the response, used as `config::Writer` callback.
+bool send_chunk(void* context, const char* data, size_t length)
+{
+	return httpd_resp_send_chunk(static_cast<httpd_req_t*>(context), data, length) == ESP_OK;
+}
 
-		if (unlikely(remaining < 1)) 
-			position++;
-		else
-			*position++ = '}';
+/// @brief Sends current configuration for the whole app as chunked response.
+/// @param req Request to respond to.
+/// @param buffer Buffer used for writing the response, flushed (sent as chunk) when full.
+/// @param bufferLength Length of the buffer.
+/// @param binary True to use the binary encoding (see `config::writeBinary`) instead of JSON.
+/// @param generation Generation of the configuration, taken before reading it.
+/// @param since Generation to skip sections not changed since (JSON only), or 0 for all.
+/// @return 
+esp_err_t config_root_output(httpd_req_t* req, char* buffer, size_t bufferLength, bool binary, uint32_t generation, uint32_t since)
+{
+	config::Writer writer(buffer, bufferLength, send_chunk, req);
 
-		*output_return = position - output;
-		return ESP_OK;
+	if (binary) {
+		httpd_resp_set_type(req, "application/octet-stream");
+		config::writeBinary(writer, rootConfig);
+	}
+	else {
+		httpd_resp_set_type(req, "application/json");
+		writer.write("{\"uptime\":");
+		config::writeUnsigned(writer, esp_timer_get_time());
+		writer.write(",\"generation\":");
+		config::writeUnsigned(writer, generation);
+		config::writeJson(writer, rootConfig, false, since);
+		writer.put('}');
+	}
 
-		output_fail:
-		*output_return = -1;
+	if (unlikely(!writer.flush())) {
+		ESP_LOGD(TAG_CONFIG_ROOT, "Failed to write config output");
 		return ESP_FAIL;
 	}
-
-	return ESP_OK;
+	return httpd_resp_send_chunk(req, nullptr, 0); // end
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -310,8 +237,9 @@ static const char* TAG_HTTPD_MAIN = "httpd-main";
 
 esp_err_t status_handler(httpd_req_t* req)
 {
+	metrics::ScopedTimer timer(metrics::Histogram::HttpStatus);
 	int ret;
-	char buffer[512];
+	char buffer[768];
 	const size_t bufferLength = sizeof(buffer);
 
 	char timeString[32];
@@ -325,6 +253,8 @@ esp_err_t status_handler(httpd_req_t* req)
 		ap.rssi = 0;
 	}
 
+	const auto packets = udp::getPacketsStats();
+
 	// For now, just use this simple version for detailed mode
 	bool detailedMode = std::strstr(req->uri, "?detail") != nullptr;
 	// Parse querystring
@@ -349,6 +279,10 @@ esp_err_t status_handler(httpd_req_t* req)
 			sta_list.num = 0;
 		}
 
+		const auto latency = control::getLatencyStats();
+		const auto internalPool = pool::getStats(pool::Kind::Internal);
+		const auto largePool = pool::getStats(pool::Kind::Large);
+
 		char* position = buffer;
 		size_t remaining = bufferLength;
 
@@ -359,13 +293,41 @@ esp_err_t status_handler(httpd_req_t* req)
 				"\"time\":\"%s\","
 				"\"freeHeap\":%" PRIu32 ","
 				"\"minFreeHeap\":%" PRIu32 ","
+				"\"largestFreeBlock\":%zu,"
+				"\"pools\":{"
+					"\"internal\":{\"capacity\":%" PRIu32 ",\"used\":%u,\"allocated\":%u,\"count\":%u},"
+					"\"large\":{\"capacity\":%" PRIu32 ",\"used\":%u,\"allocated\":%u,\"count\":%u}"
+				"},"
 				"\"rssi\":%d,"
+				"\"udp\":{"
+					"\"received\":%u,"
+					"\"stale\":%u,"
+					"\"coalesced\":%u,"
+					"\"applied\":%u"
+				"},"
+				"\"controlLatency\":{"
+					"\"last\":%" PRIu32 ","
+					"\"average\":%" PRIu32 ","
+					"\"max\":%" PRIu32 ","
+					"\"count\":%" PRIu32
+				"},"
 				"\"stations\":[",
 			esp_timer_get_time(),
 			timeString,
 			esp_get_free_heap_size(),
 			esp_get_minimum_free_heap_size(),
-			ap.rssi
+			heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+			internalPool.capacity, internalPool.used, internalPool.allocated, internalPool.count,
+			largePool.capacity, largePool.used, largePool.allocated, largePool.count,
+			ap.rssi,
+			packets.received,
+			packets.stale,
+			packets.coalesced,
+			packets.applied,
+			latency.last,
+			latency.average,
+			latency.max,
+			latency.count
 		);
 		if (unlikely(ret < 0 || static_cast<size_t>(ret) >= remaining)) goto fail;
 		position += ret;
@@ -397,11 +359,21 @@ esp_err_t status_handler(httpd_req_t* req)
 			"{"
 				"\"uptime\":%" PRIi64 ","
 				"\"time\":\"%s\","
-				"\"rssi\":%d"
+				"\"rssi\":%d,"
+				"\"udp\":{"
+					"\"received\":%u,"
+					"\"stale\":%u,"
+					"\"coalesced\":%u,"
+					"\"applied\":%u"
+				"}"
 			"}",
 			esp_timer_get_time(),
 			timeString,
-			ap.rssi
+			ap.rssi,
+			packets.received,
+			packets.stale,
+			packets.coalesced,
+			packets.applied
 		);
 		if (unlikely(ret < 0 || static_cast<size_t>(ret) >= bufferLength)) goto fail;
 
@@ -416,129 +388,176 @@ esp_err_t status_handler(httpd_req_t* req)
 	return ESP_FAIL;
 }
 
+/// Size of buffer used by config handler, both for receiving the request 
+/// in chunks (parsed on the fly) and sending the response. Binary encoded
+/// configuration has to fit whole.
+constexpr size_t configBufferLength = 1024;
+
+/// Checks if the request body uses the binary encoding (by content type).
+bool is_binary_body(httpd_req_t* req)
+{
+	char type[32];
+	if (httpd_req_get_hdr_value_str(req, "Content-Type", type, sizeof(type)) != ESP_OK)
+		return false;
+	return std::strncmp(type, "application/octet-stream", sizeof(type)) == 0;
+}
+
 esp_err_t config_handler(httpd_req_t* req)
 {
-	int ret;
-	char buffer[2048];
-	const size_t bufferLength = sizeof(buffer);
+	metrics::ScopedTimer timer(metrics::Histogram::HttpConfig);
+	auto buffer = std::unique_ptr<char, decltype(&heap_caps_free)>(
+		static_cast<char*>(heap_caps_malloc(configBufferLength, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)), 
+		&heap_caps_free);
+	if (unlikely(!buffer)) {
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
 
 	if (req->method == HTTP_POST || req->method == HTTP_PUT) {
-		////////////////////////////////////////////////////////////////////////////////
-		// Handle new configuration as JSON 
-
-		ret = httpd_req_recv(req, buffer, bufferLength);
-		if (ret <= 0) {
-			if (ret == HTTPD_SOCK_ERR_TIMEOUT)
-				httpd_resp_send_408(req);
-			else
-				httpd_resp_send_500(req);
-			return ESP_FAIL;
+		const bool binary = is_binary_body(req);
+		esp_err_t err = ESP_OK;
+		if (binary) {
+			////////////////////////////////////////////////////////////////////////////////
+			// Handle new configuration in binary encoding, received whole
+
+			if (req->content_len > configBufferLength) {
+				err = ESP_ERR_INVALID_SIZE;
+			}
+			else {
+				for (size_t received = 0; received < req->content_len;) {
+					int ret = httpd_req_recv(req, buffer.get() + received, req->content_len - received);
+					if (ret <= 0) {
+						if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+							httpd_resp_send_408(req);
+						else
+							httpd_resp_send_500(req);
+						return ESP_FAIL;
+					}
+					received += ret;
+				}
+				err = config::readBinary(rootConfig, reinterpret_cast<uint8_t*>(buffer.get()), req->content_len);
+			}
 		}
-		const size_t bytes_received = ret;
-
-		jsmn_parser parser;
-		jsmntok_t tokens[128]; 
-		const size_t max_tokens = sizeof(tokens) / sizeof(tokens[0]);
-		jsmn_init(&parser);
-		ret = jsmn_parse(&parser, buffer, bytes_received, tokens, max_tokens - 1);
-		if (ret <= 0) {
-			if (ret == JSMN_ERROR_NOMEM)
-				// TODO: Ask esp-idf to support "413 Payload Too Large" https://developer.mozilla.org/en-US/docs/Web/HTTP/Status/413
-				httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Payload Too Large");
-			else
-				httpd_resp_send_500(req);
-			return ESP_FAIL;
+		else {
+			////////////////////////////////////////////////////////////////////////////////
+			// Handle new configuration as JSON, parsing while receiving
+
+			config::Dispatcher dispatcher(rootConfig);
+			json::PushParser parser(config::Dispatcher::callback, &dispatcher);
+			for (size_t remaining = req->content_len; remaining > 0;) {
+				int ret = httpd_req_recv(req, buffer.get(), std::min(remaining, configBufferLength));
+				if (ret <= 0) {
+					dispatcher.abort();
+					if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+						httpd_resp_send_408(req);
+					else
+						httpd_resp_send_500(req);
+					return ESP_FAIL;
+				}
+				remaining -= ret;
+				err = parser.feed(buffer.get(), ret);
+				if (err != ESP_OK) break;
+			}
+			if (err == ESP_OK) 
+				err = parser.finish();
+			if (err != ESP_OK) 
+				dispatcher.abort();
 		}
-
-		// Add guard token (useful for skipping objects in parsing)
-		tokens[ret].end = std::numeric_limits<decltype(jsmntok_t::end)>::max();
-
-		const size_t tokens_count = ret + 1;
-		ESP_LOGV(TAG_HTTPD_MAIN, "config_handler! bytes_received=%zu tokens_count=%zu", bytes_received, tokens_count);
-
-		if (config_root(buffer, tokens, nullptr, 0, nullptr) != ESP_OK) {
-			httpd_resp_send_500(req);
+		ESP_LOGV(TAG_HTTPD_MAIN, "config_handler! content_len=%zu binary=%d err=%d", req->content_len, binary, err);
+		if (err != ESP_OK) {
+			switch (err) {
+				case ESP_ERR_INVALID_SIZE:
+					// TODO: Ask esp-idf to support "413 Payload Too Large" https://developer.mozilla.org/en-US/docs/Web/HTTP/Status/413
+					httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, binary ? "Truncated or too large" : "Payload Too Large");
+					break;
+				case ESP_ERR_INVALID_ARG:
+					httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Malformed JSON");
+					break;
+				case ESP_ERR_INVALID_VERSION:
+					httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Incompatible binary configuration");
+					break;
+				default:
+					httpd_resp_send_500(req);
+					break;
+			}
 			return ESP_FAIL;
 		}
 	}
 
 	////////////////////////////////////////////////////////////////////////////////
-	// Response with current configuration as JSON
+	// Response with current configuration
 
-	if (unlikely(
-		config_root(nullptr, nullptr, buffer, bufferLength, &ret) != ESP_OK ||
-	    ret < 0 || static_cast<size_t>(ret) >= bufferLength
-	)) {
-		httpd_resp_send_500(req);
-		return ESP_FAIL;
-	};
-	const size_t bytes_written = ret;
+	const bool binary = std::strstr(req->uri, "format=binary") != nullptr;
 
-	httpd_resp_set_type(req, "application/json");
-	httpd_resp_send(req, buffer, bytes_written);
-	return ESP_OK;
-}
+	// Taken before reading, so changes made meanwhile are not missed by clients
+	const uint32_t generation = config::currentGeneration();
+	char etag[16];
+	std::snprintf(etag, sizeof(etag), "\"%" PRIu32 "%s\"", generation, binary ? "b" : "");
 
-esp_err_t capture_handler(httpd_req_t* req)
-{
-	uint64_t start = esp_timer_get_time();
-	auto fb = camera::FrameBufferGuard::take();
-	if (unlikely(!fb)) {
-		ESP_LOGE(TAG_HTTPD_MAIN, "Failed to get frame buffer of camera");
-		httpd_resp_send_500(req);
-		return ESP_FAIL;
+	uint32_t since = 0;
+	if (const char* p = std::strstr(req->uri, "since=")) {
+		since = std::strtoul(p + 6, nullptr, 10);
+		if (binary || !config::isValidGeneration(since)) 
+			since = 0; // i.e. from before reboot, so everything
 	}
-	uint64_t end = esp_timer_get_time();
-	ESP_LOGI(TAG_HTTPD_MAIN, "Frame captured. Time: %llu us. Length: %u", end - start, fb->len);
 
+	if (req->method == HTTP_GET) {
+		char ifNoneMatch[16];
+		const bool notModified = since == generation || (
+			httpd_req_get_hdr_value_str(req, "If-None-Match", ifNoneMatch, sizeof(ifNoneMatch)) == ESP_OK
+			&& std::strcmp(ifNoneMatch, etag) == 0
+		);
+		if (notModified) {
+			metrics::count(metrics::Counter::HttpNotModified);
+			httpd_resp_set_status(req, "304 Not Modified");
+			httpd_resp_set_hdr(req, "ETag", etag);
+			return httpd_resp_send(req, nullptr, 0);
+		}
+	}
+	httpd_resp_set_hdr(req, "ETag", etag);
+	httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+	return config_root_output(req, buffer.get(), configBufferLength, binary, generation, since);
+}
+
+/// Sends the frame as the response, JPEG as is, raw formats as bitmaps.
+esp_err_t send_frame(httpd_req_t* req, const camera_fb_t* fb, BitmapMode mode)
+{
 	switch (fb->format) {
-		case PIXFORMAT_GRAYSCALE: {
-			// Prepare BMP header with 8 bpp, which requires palette
-			using namespace bmp;
-			BITMAPFILEHEADER fileHeader;
-			fileHeader.reserved1 = fileHeader.reserved2 = 0x4141;
-			BITMAPINFOHEADER dibHeader;
-			dibHeader.width = fb->width;
-			dibHeader.height = fb->height;
-			dibHeader.bitsPerPixel = 8;
-			dibHeader.compression = BI_RGB;
-			dibHeader.colorsUsed = 256;
-			std::vector<ColorTableEntry> colorTable(dibHeader.colorsUsed);
-			const size_t colorTableBytesSize = dibHeader.colorsUsed * sizeof(ColorTableEntry);
-			uint8_t i = 0;
-			for (auto&& entry : colorTable) {
-				entry = { i, i, i, 0 };
-				i += 1;
-			}
-			dibHeader.imageSize = fb->len;
-			fileHeader.offsetToPixelArray = sizeof(fileHeader) + sizeof(dibHeader) + colorTableBytesSize;
-			fileHeader.size = fileHeader.offsetToPixelArray + dibHeader.imageSize;
-
-			// BMP pixels data order is bottom-to-top, so swap rows
-			auto iRow = fb->buf;
-			auto jRow = fb->buf + (fb->height - 1) * fb->width;
-			while (iRow < jRow) {
-				std::swap_ranges(iRow, iRow + fb->width, jRow);
-				iRow += fb->width;
-				jRow -= fb->width;
+		case PIXFORMAT_JPEG: {
+			httpd_resp_set_type(req, "image/jpeg");
+			httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+			httpd_resp_send(req, (const char*)fb->buf, fb->len);
+			return ESP_OK;
+		}
+		case PIXFORMAT_GRAYSCALE:
+		case PIXFORMAT_RGB565:
+		case PIXFORMAT_YUV422: {
+			// Top-down bitmaps, so rows can be sent in order, straight from the frame 
+			// buffer for grayscale, or converted row by row for other formats.
+			FrameBitmap bitmap;
+			bitmap.prepare(fb, mode);
+
+			pool::Buffer lineBuffer;
+			if (bitmap.kernel) 
+				lineBuffer = pool::acquire(pool::Kind::Internal, bitmapLineBufferSize);
+			if (unlikely(bitmap.kernel && !lineBuffer)) {
+				httpd_resp_send_500(req);
+				return ESP_FAIL;
 			}
+			auto converter = bitmap.converter(fb, lineBuffer.data());
 
 			httpd_resp_set_type(req, "image/bmp");
 			httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.bmp");
-			httpd_resp_send_chunk(req, reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
-			httpd_resp_send_chunk(req, reinterpret_cast<const char*>(&dibHeader), sizeof(dibHeader));
-			httpd_resp_send_chunk(req, reinterpret_cast<const char*>(colorTable.data()), colorTableBytesSize);
-			httpd_resp_send_chunk(req, reinterpret_cast<const char*>(fb->buf), fb->len);
+			httpd_resp_send_chunk(req, reinterpret_cast<const char*>(bitmap.headers), bitmap.headersSize);
+			if (bitmap.hasColorTable())
+				httpd_resp_send_chunk(req, reinterpret_cast<const char*>(&bmp::grayscaleColorTable), sizeof(bmp::grayscaleColorTable));
+			while (const uint32_t length = converter.next()) {
+				if (httpd_resp_send_chunk(req, reinterpret_cast<const char*>(converter.data()), length) != ESP_OK)
+					return ESP_FAIL;
+			}
 			httpd_resp_send_chunk(req, nullptr, 0); // end
 			return ESP_OK;
 		}
-		case PIXFORMAT_JPEG: {
-			httpd_resp_set_type(req, "image/jpeg");
-			httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
-			httpd_resp_send(req, (const char*)fb->buf, fb->len);
-			return ESP_OK;
-		}
-		// TODO: return BMP if PIXFORMAT_RGB565, see https://en.wikipedia.org/wiki/BMP_file_format
 		default: {
 			ESP_LOGW(TAG_HTTPD_MAIN, "Camera frame with invalid format: %d ", fb->format);
 			httpd_resp_set_type(req, "application/octet-stream");
@@ -554,7 +573,437 @@ esp_err_t capture_handler(httpd_req_t* req)
 	}
 }
 
-GENERATE_HTTPD_HANDLER_FOR_EMBEDDED_FILE(index_html_gz, "text/html", "gzip");
+constexpr TickType_t captureFrameTimeout = 5000 / portTICK_PERIOD_MS;
+
+esp_err_t capture_handler(httpd_req_t* req)
+{
+	metrics::ScopedTimer timer(metrics::Histogram::HttpCapture);
+	BitmapMode mode = BitmapMode::Color;
+	camera::Profile profile = camera::Profile::Stream;
+	for (auto&& [key, value] : QuerystringCrawler(skipToQuerystring(req->uri))) {
+		switch (fnv1a32(key.begin(), key.end())) {
+			case fnv1a32("format"):
+				mode = parse_bitmap_mode(value);
+				break;
+			case fnv1a32("profile"):
+				if (fnv1a32i(value) == fnv1a32i("ai"))
+					profile = camera::Profile::AI;
+				break;
+		}
+	}
+
+	// Switch the sensor only if not streaming, otherwise convert in software
+	if (camera::getSubscribersCount() == 0) 
+		camera::switchProfile(profile);
+
+	// Frame taken from the shared capture loop, so the camera (and other 
+	// subscribers) aren't held up while sending it, even if slow (i.e. UXGA or BMP).
+	uint64_t start = esp_timer_get_time();
+	camera::SharedFrame fb;
+	{
+		camera::FrameSubscriber subscriber;
+		if (likely(subscriber)) 
+			fb = subscriber.next(captureFrameTimeout);
+	}
+	if (unlikely(!fb)) {
+		ESP_LOGE(TAG_HTTPD_MAIN, "Failed to get frame buffer of camera");
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
+	uint64_t end = esp_timer_get_time();
+	ESP_LOGI(TAG_HTTPD_MAIN, "Frame captured. Time: %llu us. Length: %u", end - start, fb->len);
+
+	if (profile == camera::Profile::AI) {
+		const auto& settings = camera::getProfileSettings(profile);
+		if (fb->format == PIXFORMAT_JPEG && settings.pixformat != PIXFORMAT_JPEG) {
+			auto converted = camera::ConvertedFrame::fromJpeg(fb, settings.pixformat, settings.framesize);
+			{ auto release = std::move(fb); } // release the camera before sending
+			if (unlikely(!converted)) {
+				httpd_resp_send_500(req);
+				return ESP_FAIL;
+			}
+			ESP_LOGI(TAG_HTTPD_MAIN, "Frame converted. Time: %llu us", esp_timer_get_time() - end);
+			return send_frame(req, converted, mode);
+		}
+		if (settings.pixformat == PIXFORMAT_GRAYSCALE) 
+			mode = BitmapMode::Grayscale;
+	}
+	return send_frame(req, fb, mode);
+}
+
+esp_err_t metrics_handler(httpd_req_t* req)
+{
+	httpd_resp_set_type(req, "text/plain");
+	const bool sent = metrics::write([] (void* context, const char* line, size_t length) {
+		return httpd_resp_send_chunk(static_cast<httpd_req_t*>(context), line, length) == ESP_OK;
+	}, req);
+	if (!sent) 
+		return ESP_FAIL;
+	httpd_resp_send_chunk(req, nullptr, 0); // end
+	return ESP_OK;
+}
+
+/// Describes supported frame sizes and pixel formats (see `camera_formats.hpp`),
+/// so clients don't need own tables. Each frame size tells whenever switching to it
+/// (in current pixel format) requires reinitialization of the driver (stalling the stream).
+esp_err_t capabilities_handler(httpd_req_t* req)
+{
+	const sensor_t* sensor = esp_camera_sensor_get();
+	if (unlikely(!sensor)) {
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
+	}
+	const pixformat_t pixformat = sensor->pixformat;
+
+	httpd_resp_set_type(req, "application/json");
+	char buffer[160];
+	int length = std::snprintf(buffer, sizeof(buffer), 
+		"{\"pixformat\":%u,\"framesize\":%u,\"initFramesize\":%u,\"framesizes\":[",
+		pixformat, sensor->status.framesize, camera::getInitFramesize());
+	if (httpd_resp_send_chunk(req, buffer, length) != ESP_OK)
+		return ESP_FAIL;
+	for (const auto& f : camera::framesizes) {
+		length = std::snprintf(buffer, sizeof(buffer), 
+			"%s{\"value\":%u,\"name\":\"%s\",\"width\":%u,\"height\":%u,\"native\":%s,\"reinit\":%s}",
+			&f == camera::framesizes ? "" : ",", f.framesize, f.name, f.width, f.height,
+			f.native ? "true" : "false", camera::requiresReinit(pixformat, f.framesize) ? "true" : "false");
+		if (httpd_resp_send_chunk(req, buffer, length) != ESP_OK)
+			return ESP_FAIL;
+	}
+	if (httpd_resp_send_chunk(req, "],\"pixformats\":[", HTTPD_RESP_USE_STRLEN) != ESP_OK)
+		return ESP_FAIL;
+	for (const auto& p : camera::pixformats) {
+		length = std::snprintf(buffer, sizeof(buffer), 
+			"%s{\"value\":%u,\"name\":\"%s\",\"bitsPerPixel\":%u,\"compressed\":%s}",
+			&p == camera::pixformats ? "" : ",", p.pixformat, p.name, p.bitsPerPixel, 
+			p.compressed() ? "true" : "false");
+		if (httpd_resp_send_chunk(req, buffer, length) != ESP_OK)
+			return ESP_FAIL;
+	}
+	httpd_resp_send_chunk(req, "]}", HTTPD_RESP_USE_STRLEN);
+	httpd_resp_send_chunk(req, nullptr, 0); // end
+	return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Embedded files
+
+/// File embedded into the firmware (see `board_build.embed_files`), served straight
+/// from flash-mapped read-only data. Entries are generated at build time, with hashes
+/// of the content as entity tags (see `scripts/pio/gzip_web_embeds.py`).
+struct EmbeddedFile
+{
+	const char* uri;
+	const char* type;
+	const char* encoding; // or null if sent as is
+	const char* etag;     // strong, quoted
+	const char* cacheControl;
+	const unsigned char* start;
+	const unsigned char* end;
+
+	inline size_t size() const { return end - start; }
+};
+
+#define EMBEDDED_FILE(n, ...)                                           \
+	extern const unsigned char n##_start[] asm("_binary_" #n "_start"); \
+	extern const unsigned char n##_end[]   asm("_binary_" #n "_end");
+#include "embedded_files.inc"
+#undef EMBEDDED_FILE
+
+const EmbeddedFile embeddedFiles[] = {
+#define EMBEDDED_FILE(n, uri, type, encoding, etag, cacheControl) \
+	{ uri, type, encoding, etag, cacheControl, n##_start, n##_end },
+#include "embedded_files.inc"
+#undef EMBEDDED_FILE
+};
+
+/// Size of chunks the embedded files are sent in.
+constexpr size_t embeddedFileChunkSize = 4 * 1024;
+
+enum class ByteRange : uint8_t {
+	Ignored,       // no range, other units or multiple ranges, whole file is sent
+	Satisfiable,
+	Unsatisfiable, // starts after the end
+};
+
+/// Parses single range of `Range` header value (`bytes=a-b`, `bytes=a-` or `bytes=-n`)
+/// into first and last position in the file of given size.
+ByteRange parse_byte_range(const char* value, size_t size, size_t& first, size_t& last)
+{
+	if (std::strncmp(value, "bytes=", 6) != 0 || std::strchr(value, ','))
+		return ByteRange::Ignored;
+	const char* p = value + 6;
+	char* end;
+	if (*p == '-') {
+		// Suffix, last N bytes
+		if (!std::isdigit(p[1]))
+			return ByteRange::Ignored;
+		const size_t n = std::strtoul(p + 1, &end, 10);
+		if (*end)
+			return ByteRange::Ignored;
+		if (n == 0 || size == 0)
+			return ByteRange::Unsatisfiable;
+		first = n < size ? size - n : 0;
+		last = size - 1;
+		return ByteRange::Satisfiable;
+	}
+	if (!std::isdigit(*p))
+		return ByteRange::Ignored;
+	first = std::strtoul(p, &end, 10);
+	if (*end != '-')
+		return ByteRange::Ignored;
+	p = end + 1;
+	if (*p) {
+		if (!std::isdigit(*p))
+			return ByteRange::Ignored;
+		last = std::strtoul(p, &end, 10);
+		if (*end || last < first)
+			return ByteRange::Ignored;
+	}
+	else {
+		last = std::numeric_limits<size_t>::max();
+	}
+	if (first >= size)
+		return ByteRange::Unsatisfiable;
+	last = std::min(last, size - 1);
+	return ByteRange::Satisfiable;
+}
+
+/// Serves embedded file (passed as user context), with support for conditional
+/// requests by entity tag (`If-None-Match`, `If-Range`) and single byte range.
+esp_err_t embedded_file_handler(httpd_req_t* req)
+{
+	const auto& file = *static_cast<const EmbeddedFile*>(req->user_ctx);
+	httpd_resp_set_hdr(req, "ETag", file.etag);
+	httpd_resp_set_hdr(req, "Cache-Control", file.cacheControl);
+
+	char buffer[64];
+	if (httpd_req_get_hdr_value_str(req, "If-None-Match", buffer, sizeof(buffer)) == ESP_OK
+		&& (std::strstr(buffer, file.etag) || std::strcmp(buffer, "*") == 0)
+	) {
+		metrics::count(metrics::Counter::HttpNotModified);
+		httpd_resp_set_status(req, "304 Not Modified");
+		return httpd_resp_send(req, nullptr, 0);
+	}
+
+	const unsigned char* data = file.start;
+	size_t length = file.size();
+	char contentRange[40]; // must be valid until headers are sent
+	bool rangeApplies = true; // unless client has other version of the file
+	if (httpd_req_get_hdr_value_str(req, "If-Range", buffer, sizeof(buffer)) == ESP_OK)
+		rangeApplies = std::strcmp(buffer, file.etag) == 0;
+	if (rangeApplies && httpd_req_get_hdr_value_str(req, "Range", buffer, sizeof(buffer)) == ESP_OK) {
+		size_t first, last;
+		switch (parse_byte_range(buffer, length, first, last)) {
+			case ByteRange::Satisfiable:
+				std::snprintf(contentRange, sizeof(contentRange), "bytes %zu-%zu/%zu", first, last, length);
+				httpd_resp_set_status(req, "206 Partial Content");
+				httpd_resp_set_hdr(req, "Content-Range", contentRange);
+				data += first;
+				length = last - first + 1;
+				break;
+			case ByteRange::Unsatisfiable:
+				std::snprintf(contentRange, sizeof(contentRange), "bytes */%zu", length);
+				httpd_resp_set_status(req, "416 Range Not Satisfiable");
+				httpd_resp_set_hdr(req, "Content-Range", contentRange);
+				return httpd_resp_send(req, nullptr, 0);
+			case ByteRange::Ignored:
+				break;
+		}
+	}
+
+	httpd_resp_set_type(req, file.type);
+	if (file.encoding) httpd_resp_set_hdr(req, "Content-Encoding", file.encoding);
+	httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+	for (size_t offset = 0; offset < length; offset += embeddedFileChunkSize) {
+		const size_t chunkLength = std::min(embeddedFileChunkSize, length - offset);
+		if (httpd_resp_send_chunk(req, reinterpret_cast<const char*>(data + offset), chunkLength) != ESP_OK)
+			return ESP_FAIL;
+	}
+	return httpd_resp_send_chunk(req, nullptr, 0); // end
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// WebSocket (control packets & telemetry, for browsers)
+
+httpd_handle_t mainServer = nullptr;
+
+/// Packet to be sent to WebSocket client by the main server task, 
+/// so frames sent by other tasks (i.e. telemetry) don't interleave.
+struct WebSocketSend
+{
+	int fd;
+	uint8_t length;
+	alignas(4) uint8_t data[sizeof(udp::VisionPacket)]; // largest pushed
+};
+static_assert(sizeof(udp::VisionPacket) >= sizeof(udp::TelemetryPacket));
+static_assert(sizeof(udp::VisionPacket) >= sizeof(udp::AckPacket));
+
+// Fixed pool of packets waiting to be sent, so pushing doesn't allocate.
+// Enough for telemetry & vision of few subscribers, with acknowledgements.
+constexpr uint8_t webSocketSendsPoolSize = 8;
+WebSocketSend webSocketSendsPool[webSocketSendsPoolSize];
+std::atomic<uint8_t> webSocketSendsFree = (1 << webSocketSendsPoolSize) - 1; // bitmask
+static_assert(webSocketSendsPoolSize <= 8);
+
+/// Claims free packet from the pool, or returns null if all are waiting.
+WebSocketSend* claim_websocket_send()
+{
+	uint8_t free = webSocketSendsFree.load(std::memory_order_relaxed);
+	while (free) {
+		const uint8_t bit = free & -free; // lowest set
+		if (webSocketSendsFree.compare_exchange_weak(free, free & ~bit, std::memory_order_acquire)) 
+			return &webSocketSendsPool[__builtin_ctz(bit)];
+	}
+	return nullptr;
+}
+
+void release_websocket_send(WebSocketSend* send)
+{
+	const uint8_t bit = 1 << (send - webSocketSendsPool);
+	webSocketSendsFree.fetch_or(bit, std::memory_order_release);
+}
+
+void websocket_send_work(void* arg)
+{
+	auto* send = static_cast<WebSocketSend*>(arg);
+	httpd_ws_frame_t frame = {
+		.final = true,
+		.fragmented = false,
+		.type = HTTPD_WS_TYPE_BINARY,
+		.payload = send->data,
+		.len = send->length,
+	};
+	if (httpd_ws_send_frame_async(mainServer, send->fd, &frame) != ESP_OK)
+		ESP_LOGD(TAG_HTTPD_MAIN, "Failed to send WebSocket frame, fd %d", send->fd);
+	release_websocket_send(send);
+}
+
+/// Sends packet to WebSocket client (see `udp::Sender`).
+bool websocket_send(int fd, const void* data, size_t length)
+{
+	if (httpd_ws_get_fd_info(mainServer, fd) != HTTPD_WS_CLIENT_WEBSOCKET)
+		return false; // closed
+	if (length > sizeof(WebSocketSend::data))
+		return false;
+	WebSocketSend* send = claim_websocket_send();
+	if (unlikely(!send)) {
+		// Dropped, like by busy UDP socket; the client is still there
+		ESP_LOGV(TAG_HTTPD_MAIN, "WebSocket sends pool full, dropping frame for fd %d", fd);
+		return true;
+	}
+	send->fd = fd;
+	send->length = static_cast<uint8_t>(length);
+	std::memcpy(send->data, data, length);
+	if (httpd_queue_work(mainServer, websocket_send_work, send) != ESP_OK) {
+		release_websocket_send(send);
+		return false;
+	}
+	return true; // released by the work
+}
+
+/// Handles binary frames of WebSocket clients as UDP packets (see `udp::handlePacket`),
+/// sharing control mailbox and sequencing. Acknowledgements and telemetry (if subscribed)
+/// are pushed back as binary frames. Control frames are handled by the server itself.
+esp_err_t websocket_handler(httpd_req_t* req)
+{
+	if (req->method == HTTP_GET) {
+		ESP_LOGD(TAG_HTTPD_MAIN, "WebSocket client connected, fd %d", httpd_req_to_sockfd(req));
+		return ESP_OK; // handshake done
+	}
+
+	udp::UnknownPacket packet = {};
+	httpd_ws_frame_t frame = {};
+	frame.payload = reinterpret_cast<uint8_t*>(packet.buffer);
+	esp_err_t err = httpd_ws_recv_frame(req, &frame, 0); // only length
+	if (err != ESP_OK)
+		return err;
+	if (unlikely(frame.len > udp::maxPacketLength)) {
+		ESP_LOGW(TAG_HTTPD_MAIN, "WebSocket frame too large: %zu", frame.len);
+		return ESP_FAIL; // closes connection, as the payload is not read
+	}
+	err = httpd_ws_recv_frame(req, &frame, udp::maxPacketLength);
+	if (err != ESP_OK)
+		return err;
+	metrics::count(metrics::Counter::WebSocketMessages);
+	if (frame.type != HTTPD_WS_TYPE_BINARY) {
+		ESP_LOGD(TAG_HTTPD_MAIN, "Ignoring WebSocket frame of type %d", frame.type);
+		return ESP_OK;
+	}
+	udp::handlePacket(packet, frame.len, websocket_send, httpd_req_to_sockfd(req));
+	return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Async workers (for long requests of the main server)
+
+/// Number of long requests (captures, web page) served at once, besides
+/// the main server task itself (which handles them if all workers are busy).
+constexpr uint8_t asyncWorkersCount = 2;
+
+struct AsyncWork
+{
+	httpd_req_t* req;
+	esp_err_t (*handler)(httpd_req_t* req);
+};
+
+QueueHandle_t asyncWorkQueue;
+SemaphoreHandle_t asyncWorkersReady; // counts idle workers
+
+void async_worker_task(void*)
+{
+	AsyncWork work;
+	while (true) {
+		xSemaphoreGive(asyncWorkersReady);
+		if (xQueueReceive(asyncWorkQueue, &work, portMAX_DELAY) != pdTRUE)
+			continue;
+		if (work.handler(work.req) != ESP_OK) {
+			// Like returning failure from synchronous handler: response
+			// might be incomplete, so the connection can't be reused.
+			httpd_sess_trigger_close(work.req->handle, httpd_req_to_sockfd(work.req));
+		}
+		httpd_req_async_handler_complete(work.req);
+	}
+}
+
+/// Passes the request to idle async worker, so the main server task can serve
+/// other (short) requests meanwhile. If all workers are busy, handles it in place.
+template <esp_err_t (*handler)(httpd_req_t* req)>
+esp_err_t async_handler(httpd_req_t* req)
+{
+	if (xSemaphoreTake(asyncWorkersReady, 0) != pdTRUE) {
+		metrics::count(metrics::Counter::HttpAsyncFallbacks);
+		return handler(req);
+	}
+	AsyncWork work { .req = nullptr, .handler = handler };
+	if (unlikely(httpd_req_async_handler_begin(req, &work.req) != ESP_OK)) {
+		xSemaphoreGive(asyncWorkersReady);
+		metrics::count(metrics::Counter::HttpAsyncFallbacks);
+		return handler(req);
+	}
+	// Queue has place for every worker, and the worker was claimed, so it can't fail
+	xQueueSend(asyncWorkQueue, &work, 0);
+	return ESP_OK;
+}
+
+void init_async_workers(void)
+{
+	asyncWorkQueue = xQueueCreate(asyncWorkersCount, sizeof(AsyncWork));
+	asyncWorkersReady = xSemaphoreCreateCounting(asyncWorkersCount, 0);
+	if (unlikely(!asyncWorkQueue || !asyncWorkersReady)) {
+		ESP_LOGE(TAG_HTTPD_MAIN, "Failed to create async workers queue");
+		abort();
+	}
+	for (uint8_t i = 0; i < asyncWorkersCount; i++) {
+		// Same stack as the main server task, as it runs the same handlers
+		if (tasks::create(async_worker_task, "httpd-worker", 8 * 1024, nullptr, tasks::httpdWorker) != pdPASS) {
+			// Not fatal, the remaining ones (or server task itself) will handle the requests
+			ESP_LOGE(TAG_HTTPD_MAIN, "Failed to start async worker");
+		}
+	}
+}
+
+esp_err_t history_handler(httpd_req_t* req); // see below, uses stream parts
 
 void init_httpd_main(void)
 {
@@ -562,19 +1011,38 @@ void init_httpd_main(void)
 	httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 	config.server_port = 80;
 	config.ctrl_port = 32080;
-	config.core_id = 0;
+	config.core_id = tasks::httpdMain.core;
+	config.task_priority = tasks::httpdMain.priority;
 	config.lru_purge_enable = true;
 	config.stack_size = 8 * 1024;
+	config.max_uri_handlers = 9 + std::size(embeddedFiles) + 2; // with few spare
+
+	// Sockets are kept open between requests (HTTP/1.1 persistent connections),
+	// so web UI polling doesn't reconnect each time. Enough for few clients with
+	// couple connections each, before closing least recently used ones.
+	config.max_open_sockets = 8;
+	config.backlog_conn = 4;
+	// TCP keep-alive probes free sockets of clients that disappeared (i.e. phone
+	// going out of range) in ~15 seconds, instead of waiting for the LRU purge.
+	config.keep_alive_enable = true;
+	config.keep_alive_idle = 5;
+	config.keep_alive_interval = 5;
+	config.keep_alive_count = 3;
+
+	init_async_workers();
 
 	ESP_LOGI(TAG_HTTPD_MAIN, "Starting main HTTP server on port: '%d'", config.server_port);
 	ESP_ERROR_CHECK(httpd_start(&server, &config));
-
-	httpd_register_uri_handler(server, {
-		.uri      = "/",
-		.method   = HTTP_GET,
-		.handler  = embedded_index_html_gz_handler,
-		.user_ctx = nullptr,
-	});
+	mainServer = server;
+
+	for (const auto& file : embeddedFiles) {
+		httpd_register_uri_handler(server, {
+			.uri      = file.uri,
+			.method   = HTTP_GET,
+			.handler  = async_handler<embedded_file_handler>,
+			.user_ctx = const_cast<EmbeddedFile*>(&file),
+		});
+	}
 	httpd_register_uri_handler(server, {
 		.uri      = "/status",
 		.method   = HTTP_GET,
@@ -596,9 +1064,34 @@ void init_httpd_main(void)
 	httpd_register_uri_handler(server, {
 		.uri      = "/capture",
 		.method   = HTTP_GET,
-		.handler  = capture_handler,
+		.handler  = async_handler<capture_handler>,
 		.user_ctx = nullptr,
 	});
+	httpd_register_uri_handler(server, {
+		.uri      = "/history",
+		.method   = HTTP_GET,
+		.handler  = async_handler<history_handler>,
+		.user_ctx = nullptr,
+	});
+	httpd_register_uri_handler(server, {
+		.uri      = "/metrics",
+		.method   = HTTP_GET,
+		.handler  = metrics_handler,
+		.user_ctx = nullptr,
+	});
+	httpd_register_uri_handler(server, {
+		.uri      = "/capabilities",
+		.method   = HTTP_GET,
+		.handler  = capabilities_handler,
+		.user_ctx = nullptr,
+	});
+	httpd_register_uri_handler(server, {
+		.uri      = "/ws",
+		.method   = HTTP_GET,
+		.handler  = websocket_handler,
+		.user_ctx = nullptr,
+		.is_websocket = true,
+	});
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -610,23 +1103,178 @@ static const char* TAG_HTTPD_STREAM = "httpd-stream";
 #define PART_BOUNDARY "123456789000000000000987654321"
 #define _STREAM_CONTENT_TYPE "multipart/x-mixed-replace;boundary=" PART_BOUNDARY
 #define _STREAM_BOUNDARY "\r\n--" PART_BOUNDARY "\r\n"
-#define _STREAM_PART "Content-Type: %s\r\nContent-Length: %u\r\n\r\n"
 
-esp_err_t stream_handler(httpd_req_t* req)
+/// Max number of stream clients served at once.
+constexpr uint8_t maxStreamClients = 4;
+/// Time after which stream is ended if no new frames arrive.
+constexpr TickType_t streamFrameTimeout = 5000 / portTICK_PERIOD_MS;
+
+std::atomic<uint8_t> streamClientsCount;
+
+/// Buffer the frames are copied into before sending, so the camera driver
+/// gets its buffer back immediately, instead of after (possibly slow) send.
+/// Taken from the large buffers pool (PSRAM), growing as required by frames sizes,
+/// and kept there for next clients.
+class StreamSendBuffer
 {
-	int ret;
-	esp_err_t err;
+	pool::Buffer buffer;
 
-	httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
-	httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+public:
+	/// Copies given data into the buffer. Returns false if allocation failed.
+	bool assign(const uint8_t* source, size_t length)
+	{
+#ifdef BOARD_HAS_PSRAM
+		if (unlikely(!buffer)) {
+			buffer = pool::acquire(pool::Kind::Large, length);
+			if (unlikely(!buffer)) 
+				return false;
+		}
+		else if (unlikely(!buffer.reserve(length))) {
+			return false;
+		}
+		std::memcpy(buffer.data(), source, length);
+		return true;
+#else
+		return false; // No PSRAM to spare, so zero-copy sending is used
+#endif
+	}
+
+	const uint8_t* get() const { return buffer.data(); }
+};
+
+/// State of single stream client. Each client is served by own task, 
+/// fed from the shared camera capture loop, so adding viewers doesn't
+/// take more frames from the sensor nor blocks the stream server.
+struct StreamClient
+{
+	httpd_req_t* req; // async copy of the request
+	camera::FrameSubscriber subscriber;
+	StreamSendBuffer sendBuffer;
+	BitmapMode bitmapMode = BitmapMode::None;
+	pool::Buffer lineBuffer; // taken only if bitmaps are requested 
+
+	StreamClient(httpd_req_t* req)
+		: req(req)
+	{}
+};
+
+/// Writes all the buffers to the socket (scatter-gather), handling partial writes.
+/// Returns false on error (i.e. client disconnected or send timeout).
+bool send_all(int sock, struct iovec* iov, int iovcnt)
+{
+	while (iovcnt > 0) {
+		const ssize_t ret = lwip_writev(sock, iov, iovcnt);
+		if (unlikely(ret < 0)) {
+			if (errno == EINTR) continue;
+			ESP_LOGD(TAG_HTTPD_STREAM, "Failed to send, errno %d", errno);
+			return false;
+		}
+		size_t written = ret;
+		while (iovcnt > 0 && written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+			iov->iov_len -= written;
+		}
+	}
+	return true;
+}
+
+/// Max length of the part header, see `write_part_header`.
+constexpr size_t streamPartHeaderLength = 192;
+
+/// Writes header of the stream part, with metadata of the frame: capture time
+/// (uptime in microseconds, sent like `uptime` in status), sequence number 
+/// of the capture loop (gaps are dropped frames) and motor duties.
+/// Fixed format, written digit by digit instead of `printf`, as it is done per frame.
+/// Extra header lines (each ending with CRLF) can be appended. 
+/// Returns length of the header.
+size_t write_part_header(char* buffer, std::string_view contentType, size_t contentLength, uptime_t timestamp, uint32_t sequence, float left, float right, std::string_view extra = {})
+{
+	config::Writer writer(buffer, streamPartHeaderLength);
+	writer.write("Content-Type: ");
+	writer.write(contentType);
+	writer.write("\r\nContent-Length: ");
+	config::writeUnsigned(writer, contentLength);
+	writer.write("\r\nX-Timestamp: ");
+	config::writeUnsigned(writer, timestamp / 1'000'000);
+	writer.put('.');
+	const uint32_t usec = timestamp % 1'000'000;
+	for (uint32_t divisor = 100000; divisor; divisor /= 10)
+		writer.put('0' + usec / divisor % 10);
+	writer.write("\r\nX-Sequence: ");
+	config::writeUnsigned(writer, sequence);
+	writer.write("\r\nX-Motors: ");
+	config::writeFloat(writer, left, 1);
+	writer.put(',');
+	config::writeFloat(writer, right, 1);
+	writer.write("\r\n");
+	writer.write(extra);
+	writer.write("\r\n");
+	return writer.size();
+}
+
+/// Writes header of the stream part for the frame, with motor duties at the time of sending.
+size_t write_part_header(char* buffer, std::string_view contentType, size_t contentLength, const camera::SharedFrame& fb)
+{
+	const uptime_t timestamp = static_cast<uptime_t>(fb->timestamp.tv_sec) * 1'000'000 + fb->timestamp.tv_usec;
+	return write_part_header(buffer, contentType, contentLength, timestamp, fb.sequence(),
+		control::getMotor(control::Motor::Left), control::getMotor(control::Motor::Right));
+}
+
+/// Sends the stream straight to the client socket, bypassing the server 
+/// (which would send 3 chunks per frame, with chunked transfer encoding).
+void stream_client_task(void* arg)
+{
+	auto client = std::unique_ptr<StreamClient>(static_cast<StreamClient*>(arg));
+	httpd_req_t* req = client->req;
+	httpd_handle_t server = req->handle;
+	const int sock = httpd_req_to_sockfd(req);
+
+	static const char responseHeader[] = 
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Type: " _STREAM_CONTENT_TYPE "\r\n"
+		"Access-Control-Allow-Origin: *\r\n"
+		"\r\n";
+	struct iovec iov[3];
+	iov[0] = { const_cast<char*>(responseHeader), sizeof(responseHeader) - 1 };
 
 	ESP_LOGI(TAG_HTTPD_STREAM, "Starting stream");
+	if (unlikely(!send_all(sock, iov, 1)))
+		goto end;
 	for (;;) {
-		auto fb = camera::FrameBufferGuard::take();
+		auto fb = client->subscriber.next(streamFrameTimeout);
 		if (unlikely(!fb)) {
-			ESP_LOGE(TAG_HTTPD_STREAM, "Failed to get frame buffer of camera");
-			httpd_resp_send_500(req);
-			return ESP_FAIL;
+			ESP_LOGE(TAG_HTTPD_STREAM, "No frames from camera");
+			break;
+		}
+
+		FrameBitmap bitmap;
+		if (client->bitmapMode != BitmapMode::None && bitmap.prepare(fb, client->bitmapMode)) {
+			// Convert row by row, without copying whole frame
+			const uptime_t start = esp_timer_get_time();
+			char partHeaderBuffer[streamPartHeaderLength];
+			iov[0] = { partHeaderBuffer, write_part_header(partHeaderBuffer, "image/bmp", bitmap.length(), fb) };
+			iov[1] = { bitmap.headers, bitmap.headersSize };
+			iov[2] = { const_cast<bmp::GrayscaleColorTable*>(&bmp::grayscaleColorTable), sizeof(bmp::grayscaleColorTable) };
+			if (!send_all(sock, iov, bitmap.hasColorTable() ? 3 : 2)) break;
+
+			auto converter = bitmap.converter(fb, client->lineBuffer.data());
+			bool sent = true;
+			while (const uint32_t length = converter.next()) {
+				iov[0] = { const_cast<uint8_t*>(converter.data()), length };
+				if (!(sent = send_all(sock, iov, 1))) break;
+			}
+			if (!sent) break;
+
+			iov[0] = { const_cast<char*>(_STREAM_BOUNDARY), sizeof(_STREAM_BOUNDARY) - 1 };
+			if (!send_all(sock, iov, 1)) break;
+			metrics::recordSince(metrics::Histogram::StreamSend, start);
+			metrics::count(metrics::Counter::StreamFramesSent);
+			continue;
 		}
 
 		const char* contentType = nullptr;
@@ -642,23 +1290,93 @@ esp_err_t stream_handler(httpd_req_t* req)
 				break;
 			}
 		}
-		if (contentType == nullptr) {
-			httpd_resp_send_500(req);
-			return ESP_FAIL;
+
+		char partHeaderBuffer[streamPartHeaderLength];
+		const size_t partHeaderLength = write_part_header(partHeaderBuffer, contentType, fb->len, fb);
+		const size_t length = fb->len;
+		const pixformat_t format = fb->format;
+
+		// Copy the frame if possible, releasing it before sending
+		const uint8_t* data;
+		if (client->sendBuffer.assign(fb->buf, length)) {
+			data = client->sendBuffer.get();
+			fb.reset();
 		}
+		else {
+			data = fb->buf;
+		}
+
+		iov[0] = { partHeaderBuffer, partHeaderLength };
+		iov[1] = { const_cast<uint8_t*>(data), length };
+		iov[2] = { const_cast<char*>(_STREAM_BOUNDARY), sizeof(_STREAM_BOUNDARY) - 1 };
+		const uptime_t start = esp_timer_get_time();
+		if (!send_all(sock, iov, 3)) break;
+		const uint32_t sendTime = esp_timer_get_time() - start;
+		metrics::record(metrics::Histogram::StreamSend, sendTime);
+		metrics::count(metrics::Counter::StreamFramesSent);
+		if (format == PIXFORMAT_JPEG) 
+			camera::reportStreamFrame(length, sendTime);
+	}
+
+	end:
+	ESP_LOGI(TAG_HTTPD_STREAM, "Stream ended, dropped frames: %" PRIu32, client->subscriber.droppedCount());
+	client.reset();
+	httpd_req_async_handler_complete(req);
+	httpd_sess_trigger_close(server, sock); // no content length, so the end of the response is marked by closing
+	streamClientsCount.fetch_sub(1, std::memory_order_relaxed);
+	vTaskDelete(nullptr);
+}
 
-		char partHeaderBuffer[64];
-		ret = std::snprintf(partHeaderBuffer, sizeof(partHeaderBuffer), _STREAM_PART, contentType, fb->len);
-		err = httpd_resp_send_chunk(req, partHeaderBuffer, ret);
-		if (err != ESP_OK) break;
-		err = httpd_resp_send_chunk(req, reinterpret_cast<char*>(fb->buf), fb->len);
-		if (err != ESP_OK) break;
-		err = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, sizeof(_STREAM_BOUNDARY));
-		if (err != ESP_OK) break;
+esp_err_t stream_handler(httpd_req_t* req)
+{
+	if (streamClientsCount.fetch_add(1, std::memory_order_relaxed) >= maxStreamClients) {
+		streamClientsCount.fetch_sub(1, std::memory_order_relaxed);
+		ESP_LOGW(TAG_HTTPD_STREAM, "Too many stream clients");
+		httpd_resp_set_status(req, "503 Service Unavailable");
+		httpd_resp_send(req, nullptr, 0);
+		return ESP_OK;
+	}
+
+	// Detach the request from the server, to allow serving other clients
+	httpd_req_t* async_req;
+	if (httpd_req_async_handler_begin(req, &async_req) != ESP_OK) {
+		streamClientsCount.fetch_sub(1, std::memory_order_relaxed);
+		httpd_resp_send_500(req);
+		return ESP_FAIL;
 	}
 
-	ESP_LOGI(TAG_HTTPD_STREAM, "Stream ended");
+	if (camera::getSubscribersCount() == 0) 
+		camera::switchProfile(camera::Profile::Stream);
+
+	auto client = new (std::nothrow) StreamClient(async_req);
+	if (unlikely(!client || !client->subscriber)) {
+		delete client;
+		goto fail;
+	}
+	for (auto&& [key, value] : QuerystringCrawler(skipToQuerystring(async_req->uri))) {
+		if (fnv1a32(key.begin(), key.end()) == fnv1a32("format"))
+			client->bitmapMode = parse_bitmap_mode(value);
+	}
+	if (client->bitmapMode != BitmapMode::None) {
+		client->lineBuffer = pool::acquire(pool::Kind::Internal, bitmapLineBufferSize);
+		if (unlikely(!client->lineBuffer)) {
+			delete client;
+			goto fail;
+		}
+	}
+	if (tasks::create(stream_client_task, "stream-client", 4 * 1024, client, tasks::streamClient) != pdPASS) {
+		delete client;
+		goto fail;
+	}
+	metrics::count(metrics::Counter::StreamClients);
 	return ESP_OK;
+
+	fail:
+	ESP_LOGE(TAG_HTTPD_STREAM, "Failed to start stream client");
+	httpd_resp_send_500(async_req);
+	httpd_req_async_handler_complete(async_req);
+	streamClientsCount.fetch_sub(1, std::memory_order_relaxed);
+	return ESP_FAIL;
 }
 
 void init_httpd_stream(void)
@@ -667,7 +1385,8 @@ void init_httpd_stream(void)
 	httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 	config.server_port = 81;
 	config.ctrl_port = 32081;
-	config.core_id = 0;
+	config.core_id = tasks::httpdStream.core;
+	config.task_priority = tasks::httpdStream.priority;
 	config.lru_purge_enable = true;
 	config.max_uri_handlers = 1;
 
@@ -682,6 +1401,64 @@ void init_httpd_stream(void)
 	});
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Frames history (served by the main server, as multipart like the stream)
+
+esp_err_t history_handler(httpd_req_t* req)
+{
+	bool resume = false;
+	for (auto&& [key, value] : QuerystringCrawler(skipToQuerystring(req->uri))) {
+		switch (fnv1a32(key.begin(), key.end())) {
+			case fnv1a32("freeze"):
+				if (parseBooleanFast(value.data()))
+					history::trigger(history::Trigger::Request);
+				break;
+			case fnv1a32("resume"):
+				resume = parseBooleanFast(value.data());
+				break;
+		}
+	}
+
+	history::Reader reader;
+	if (!reader) {
+		httpd_resp_set_status(req, "503 Service Unavailable");
+		httpd_resp_send(req, nullptr, 0);
+		return ESP_OK;
+	}
+
+	const auto status = history::getStatus();
+	char triggerTime[24];
+	std::snprintf(triggerTime, sizeof(triggerTime), "%llu", status.triggerTime);
+	httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
+	httpd_resp_set_hdr(req, "X-Trigger", history::toString(status.trigger));
+	httpd_resp_set_hdr(req, "X-Trigger-Timestamp", triggerTime); // us
+	httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=history.mjpeg");
+
+	// Frames are sent straight from the ring, recording is paused meanwhile
+	for (uint16_t i = 0; i < reader.count(); i++) {
+		const auto& entry = reader.entry(i);
+		const bool jpeg = entry.pixformat == PIXFORMAT_JPEG;
+		char extra[48] = "";
+		if (!jpeg)
+			std::snprintf(extra, sizeof(extra), "X-Size: %ux%u\r\nX-Pixformat: %u\r\n", entry.width, entry.height, entry.pixformat);
+		char partHeader[streamPartHeaderLength + sizeof(_STREAM_BOUNDARY)];
+		std::memcpy(partHeader, _STREAM_BOUNDARY, sizeof(_STREAM_BOUNDARY) - 1);
+		const size_t partHeaderLength = sizeof(_STREAM_BOUNDARY) - 1 + write_part_header(
+			partHeader + sizeof(_STREAM_BOUNDARY) - 1, jpeg ? "image/jpeg" : "application/octet-stream",
+			entry.length, entry.timestamp, entry.sequence, entry.left, entry.right, extra);
+		if (httpd_resp_send_chunk(req, partHeader, partHeaderLength) != ESP_OK)
+			return ESP_FAIL;
+		if (httpd_resp_send_chunk(req, reinterpret_cast<const char*>(reader.data(entry)), entry.length) != ESP_OK)
+			return ESP_FAIL;
+	}
+	httpd_resp_send_chunk(req, "\r\n--" PART_BOUNDARY "--\r\n", HTTPD_RESP_USE_STRLEN);
+	httpd_resp_send_chunk(req, nullptr, 0); // end
+
+	if (resume)
+		history::resume();
+	return ESP_OK;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void init(void)
@@ -0,0 +1,287 @@
+#include "json.hpp"
+#include <esp_log.h>
+
+namespace app::json
+{
+
+static const char* TAG_JSON = "json";
+
+inline bool isWhitespace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline int8_t hexDigitValue(char c)
+{
+	if ('0' <= c && c <= '9') return c - '0';
+	if ('a' <= c && c <= 'f') return c - 'a' + 10;
+	if ('A' <= c && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+esp_err_t PushParser::emit(FieldType type)
+{
+	if (!emitting()) return ESP_OK;
+	Field field;
+	field.type = type;
+	field.path = path;
+	if (type == FieldType::ObjectEnd) {
+		field.depth = depth - 2;
+		field.key = {};
+		field.keyHash = path[depth - 2];
+		field.value = nullptr;
+		field.valueLength = 0;
+	}
+	else {
+		field.depth = depth - 1;
+		field.key = { key, keyLength };
+		field.keyHash = keyHash;
+		if (type == FieldType::ObjectBegin) {
+			field.value = nullptr;
+			field.valueLength = 0;
+		}
+		else {
+			value[valueLength] = 0;
+			field.value = value;
+			field.valueLength = valueLength;
+		}
+	}
+	return callback(context, field);
+}
+
+esp_err_t PushParser::open(bool array)
+{
+	if (unlikely(depth > maxDepth)) {
+		ESP_LOGD(TAG_JSON, "Nesting too deep");
+		return ESP_ERR_INVALID_SIZE;
+	}
+	if (depth > 0 && !inArray()) {
+		if (!array) {
+			const esp_err_t ret = emit(FieldType::ObjectBegin);
+			if (unlikely(ret != ESP_OK)) return ret;
+			path[depth - 1] = keyHash;
+		}
+	}
+	if (array) {
+		arrays |= 1u << depth;
+		if (arrayDepth == 0) arrayDepth = depth + 1;
+	}
+	else {
+		arrays &= ~(1u << depth);
+	}
+	depth++;
+	state = array ? State::ValueOrEnd : State::KeyOrEnd;
+	return ESP_OK;
+}
+
+esp_err_t PushParser::close(bool array)
+{
+	if (unlikely(array != inArray()))
+		return ESP_ERR_INVALID_ARG;
+	if (array) {
+		if (arrayDepth == depth) arrayDepth = 0;
+	}
+	else if (depth > 1 && !(arrays & (1u << (depth - 2)))) {
+		const esp_err_t ret = emit(FieldType::ObjectEnd);
+		if (unlikely(ret != ESP_OK)) return ret;
+	}
+	depth--;
+	state = depth ? State::CommaOrEnd : State::Finished;
+	return ESP_OK;
+}
+
+bool PushParser::append(char c)
+{
+	if (!emitting()) return true; // no need to buffer
+	if (state == State::KeyString) {
+		if (unlikely(keyLength >= maxKeyLength)) return false;
+		key[keyLength++] = c;
+	}
+	else {
+		if (unlikely(valueLength >= maxValueLength)) return false;
+		value[valueLength++] = c;
+	}
+	return true;
+}
+
+bool PushParser::appendCodepoint(uint16_t cp)
+{
+	if (cp < 0x80) {
+		return append(cp);
+	}
+	if (cp < 0x800) {
+		return append(0xC0 | (cp >> 6))
+			&& append(0x80 | (cp & 0x3F));
+	}
+	return append(0xE0 | (cp >> 12))
+		&& append(0x80 | ((cp >> 6) & 0x3F))
+		&& append(0x80 | (cp & 0x3F));
+}
+
+esp_err_t PushParser::feed(const char* data, size_t length)
+{
+	if (unlikely(error != ESP_OK))
+		return error;
+
+	for (size_t i = 0; i < length; i++) {
+		const char c = data[i];
+		switch (state) {
+			case State::Start:
+				if (isWhitespace(c)) continue;
+				if (c != '{') goto invalid;
+				if (unlikely((error = open(false)) != ESP_OK)) return error;
+				continue;
+
+			case State::KeyOrEnd:
+				if (isWhitespace(c)) continue;
+				if (c == '}') {
+					if (unlikely((error = close(false)) != ESP_OK)) return error;
+					continue;
+				}
+				[[fallthrough]];
+			case State::Key:
+				if (isWhitespace(c)) continue;
+				if (c != '"') goto invalid;
+				keyLength = 0;
+				state = State::KeyString;
+				continue;
+
+			case State::KeyString:
+			case State::ValueString:
+				if (escape == 1) {
+					char e;
+					switch (c) {
+						case '"':  e = '"';  break;
+						case '\\': e = '\\'; break;
+						case '/':  e = '/';  break;
+						case 'b':  e = '\b'; break;
+						case 'f':  e = '\f'; break;
+						case 'n':  e = '\n'; break;
+						case 'r':  e = '\r'; break;
+						case 't':  e = '\t'; break;
+						case 'u':
+							escape = 2;
+							codepoint = 0;
+							continue;
+						default: goto invalid;
+					}
+					escape = 0;
+					if (unlikely(!append(e))) goto too_long;
+					continue;
+				}
+				if (escape > 1) {
+					const int8_t digit = hexDigitValue(c);
+					if (unlikely(digit < 0)) goto invalid;
+					codepoint = (codepoint << 4) | digit;
+					if (++escape == 6) {
+						escape = 0;
+						if (unlikely(!appendCodepoint(codepoint))) goto too_long;
+					}
+					continue;
+				}
+				if (c == '\\') {
+					escape = 1;
+					continue;
+				}
+				if (c == '"') {
+					if (state == State::KeyString) {
+						keyHash = fnv1a32(key, keyLength);
+						state = State::Colon;
+					}
+					else {
+						state = State::CommaOrEnd;
+						if (unlikely((error = emit(FieldType::String)) != ESP_OK)) return error;
+					}
+					continue;
+				}
+				if (unlikely(static_cast<uint8_t>(c) < 0x20)) goto invalid;
+				if (unlikely(!append(c))) goto too_long;
+				continue;
+
+			case State::Colon:
+				if (isWhitespace(c)) continue;
+				if (c != ':') goto invalid;
+				state = State::Value;
+				continue;
+
+			case State::ValueOrEnd:
+				if (isWhitespace(c)) continue;
+				if (c == ']') {
+					if (unlikely((error = close(true)) != ESP_OK)) return error;
+					continue;
+				}
+				[[fallthrough]];
+			case State::Value:
+				if (isWhitespace(c)) continue;
+				switch (c) {
+					case '{':
+						if (unlikely((error = open(false)) != ESP_OK)) return error;
+						continue;
+					case '[':
+						if (unlikely((error = open(true)) != ESP_OK)) return error;
+						continue;
+					case '"':
+						valueLength = 0;
+						state = State::ValueString;
+						continue;
+					case '}': case ']': case ',': case ':':
+						goto invalid;
+					default:
+						valueLength = 0;
+						state = State::ValuePrimitive;
+						if (unlikely(!append(c))) goto too_long;
+						continue;
+				}
+
+			case State::ValuePrimitive:
+				if (isWhitespace(c) || c == ',' || c == '}' || c == ']') {
+					state = State::CommaOrEnd;
+					if (unlikely((error = emit(FieldType::Primitive)) != ESP_OK)) return error;
+					i--; // process the character again as the delimiter
+					continue;
+				}
+				if (c == '"' || c == ':' || c == '{' || c == '[') goto invalid;
+				if (unlikely(!append(c))) goto too_long;
+				continue;
+
+			case State::CommaOrEnd:
+				if (isWhitespace(c)) continue;
+				switch (c) {
+					case ',':
+						state = inArray() ? State::Value : State::Key;
+						continue;
+					case '}':
+					case ']':
+						if (unlikely((error = close(c == ']')) != ESP_OK)) return error;
+						continue;
+					default:
+						goto invalid;
+				}
+
+			case State::Finished:
+				if (isWhitespace(c)) continue;
+				goto invalid;
+		}
+	}
+	return ESP_OK;
+
+invalid:
+	ESP_LOGD(TAG_JSON, "Malformed JSON");
+	return error = ESP_ERR_INVALID_ARG;
+too_long:
+	ESP_LOGD(TAG_JSON, "Key or value too long");
+	return error = ESP_ERR_INVALID_SIZE;
+}
+
+esp_err_t PushParser::finish()
+{
+	if (unlikely(error != ESP_OK))
+		return error;
+	if (unlikely(state != State::Finished)) {
+		ESP_LOGD(TAG_JSON, "Unexpected end of JSON");
+		return error = ESP_ERR_INVALID_ARG;
+	}
+	return ESP_OK;
+}
+
+}
@@ -23,9 +23,18 @@ namespace app::network { // from network.cpp
 namespace app::camera { // from camera.cpp
 	void init(void);
 }
+namespace app::vision { // from vision.cpp
+	void init(void);
+}
+namespace app::history { // from history.cpp
+	void init(void);
+}
 namespace app::http { // from http.cpp
 	void init(void);
 }
+namespace app::tasks { // from tasks.cpp
+	void init(void);
+}
 namespace app::time {
 	inline void init()
 	{
@@ -58,16 +67,20 @@ extern "C" void app_main(void)
 	network::init();
 	camera::init();
 	control::init();
+	vision::init();
+	history::init();
 	http::init();
 	time::init();
+	tasks::init();
 
 	////////////////////////////////////////
 
 	udp::init();
 	for (;;) {
 		udp::listen();
-		if (errno) udp::init();
-		delay(1);
-		control::tick();
+		if (errno) {
+			delay(100);
+			udp::init();
+		}
 	}
 }
@@ -0,0 +1,98 @@
+#include "metrics.hpp"
+#include <cstdio>
+#include <cinttypes>
+#include <algorithm>
+#include <iterator>
+
+namespace app::metrics
+{
+
+PerCoreData perCoreData[portNUM_PROCESSORS];
+
+static const char* counterNames[] = {
+	"frames_captured",
+	"frames_dropped",
+	"stream_frames_sent",
+	"udp_packets",
+	"control_commands",
+	"wifi_disconnects",
+	"wifi_reconnects",
+	"wifi_fast_reconnects",
+	"wifi_fallbacks",
+	"radio_profile_switches",
+	"rate_control_adjustments",
+	"udp_video_frames_sent",
+	"udp_video_frames_dropped",
+	"pool_allocations",
+	"http_async_fallbacks",
+	"history_triggers",
+	"stream_clients",
+	"udp_batches",
+	"udp_acks_sent",
+	"http_not_modified",
+	"websocket_messages",
+};
+static_assert(std::size(counterNames) == static_cast<uint8_t>(Counter::_Count));
+
+static const char* histogramNames[] = {
+	"camera_mutex_wait_us",
+	"camera_mutex_hold_us",
+	"camera_acquire_us",
+	"jpeg_size_bytes",
+	"stream_send_us",
+	"control_latency_us",
+	"http_status_us",
+	"http_config_us",
+	"http_capture_us",
+	"wifi_reconnect_ms",
+	"vision_process_us",
+	"udp_batch_process_us",
+};
+static_assert(std::size(histogramNames) == static_cast<uint8_t>(Histogram::_Count));
+
+// Format (one metric per line, values separated by spaces):
+//   counter <name> <per core values...>
+//   histogram <name> <count> <sum> <max> <buckets...>
+// Histograms are summed across the cores. Bucket `i` counts values
+// in range [2^(i-1), 2^i), bucket 0 counts zeros, last one is open.
+bool write(bool (*callback)(void* context, const char* line, size_t length), void* context)
+{
+	char line[320];
+	int ret;
+
+	ret = std::snprintf(line, sizeof(line), "uptime %" PRIi64 "\nbuckets %u\n", esp_timer_get_time(), bucketsCount);
+	if (!callback(context, line, ret)) return false;
+
+	for (uint8_t c = 0; c < static_cast<uint8_t>(Counter::_Count); c++) {
+		size_t length = std::snprintf(line, sizeof(line), "counter %s", counterNames[c]);
+		for (auto& core : perCoreData) {
+			length += std::snprintf(line + length, sizeof(line) - length, " %" PRIu32,
+				core.counters[c].load(std::memory_order_relaxed));
+		}
+		line[length++] = '\n';
+		if (!callback(context, line, length)) return false;
+	}
+
+	for (uint8_t h = 0; h < static_cast<uint8_t>(Histogram::_Count); h++) {
+		uint32_t count = 0, sum = 0, max = 0;
+		uint32_t buckets[bucketsCount] = {};
+		for (auto& core : perCoreData) {
+			const auto& data = core.histograms[h];
+			count += data.count.load(std::memory_order_relaxed);
+			sum   += data.sum.load(std::memory_order_relaxed);
+			max = std::max(max, data.max.load(std::memory_order_relaxed));
+			for (uint8_t b = 0; b < bucketsCount; b++)
+				buckets[b] += data.buckets[b].load(std::memory_order_relaxed);
+		}
+		size_t length = std::snprintf(line, sizeof(line), "histogram %s %" PRIu32 " %" PRIu32 " %" PRIu32,
+			histogramNames[h], count, sum, max);
+		for (uint8_t b = 0; b < bucketsCount; b++) {
+			length += std::snprintf(line + length, sizeof(line) - length, " %" PRIu32, buckets[b]);
+		}
+		line[length++] = '\n';
+		if (!callback(context, line, length)) return false;
+	}
+	return true;
+}
+
+}
@@ -1,13 +1,18 @@
 #include <sdkconfig.h>
 #include <cstring>
+#include <algorithm>
 #include <esp_err.h>
 #include <esp_log.h>
+#include <esp_system.h>
+#include <esp_random.h>
 #include <nvs_handle.hpp>
 #include <esp_netif.h>
 #include <esp_wifi.h>
 #include <freertos/timers.h>
-#include <jsmn.h>
 #include "utils.hpp"
+#include "metrics.hpp"
+#include "json.hpp"
+#include "config.hpp"
 
 #define FORCE_WIFI_DEFAULTS 0
 
@@ -22,11 +27,15 @@ namespace app::control { // from control.cpp
 	extern uptime_t lastControlTime;
 	extern uptime_t controlTimeout;
 }
+namespace app::camera { // from camera.cpp
+	uint8_t getSubscribersCount();
+}
 
 namespace app::network
 {
 
-esp_err_t config(char* input, jsmntok_t* root, char* output, size_t output_length, int* output_return);
+extern const config::Object configObject;
+config::Generation configGeneration;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Utils
@@ -63,13 +72,6 @@ esp_err_t save_ip_info_to_nvs(nvs::NVSHandle& nvs_handle, wifi_interface_t inter
 	ESP_ERROR_CHECK_RETURN(nvs_handle.set_item(interface == WIFI_IF_AP ? "ap.mask" : "sta.mask", reinterpret_cast<const uint32_t&>(ip_info.netmask)));
 	return ESP_OK;
 }
-/// Get IP info for given interface (if initialized), optionally falling back to reading from NVS.
-esp_err_t get_ip_info(wifi_interface_t interface, esp_netif_ip_info_t& ip_info, nvs::NVSHandle* nvs_handle)
-{
-	esp_netif_t* netif = interface == WIFI_IF_AP ? ap_netif : sta_netif;
-	if (!netif && nvs_handle) return load_ip_info_from_nvs(*nvs_handle, interface, ip_info);
-	return esp_netif_get_ip_info(netif, &ip_info);
-}
 
 static_assert(sizeof(wifi_mode_t) == sizeof(uint32_t), "Assuming `wifi_mode_t` is 32 bits value.");
 inline esp_err_t load_wifi_mode_from_nvs(nvs::NVSHandle& nvs_handle, wifi_mode_t& mode)
@@ -81,36 +83,253 @@ inline esp_err_t save_wifi_mode_to_nvs(nvs::NVSHandle& nvs_handle, wifi_mode_t m
 	return nvs_handle.set_item("wifi_mode", static_cast<uint32_t>(mode));
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Settings
+
+static const char* TAG_SETTINGS = "network-settings";
+
+/// Radio profiles, switched depending on activity, see `update_radio_profile`.
+enum class RadioProfile : uint8_t {
+	Active, // while being controlled or streaming
+	Idle,
+	_Count,
+};
+
+struct RadioProfileSettings
+{
+	wifi_ps_type_t ps; // only for station, AP doesn't sleep anyway
+	wifi_bandwidth_t bandwidth;
+	int8_t txPower;    // in 0.25 dBm units
+};
+
+struct RadioSettings
+{
+	RadioProfileSettings profiles[static_cast<uint8_t>(RadioProfile::_Count)];
+	uint32_t idleDelay; // ms, since the last control (and stream) activity
+};
+
+/// Networking settings persisted in NVS. Kept in RAM, loaded once on init, 
+/// since flash reads (and writes) stall cache of both cores, causing hiccups 
+/// of i.e. camera frames. Note that Wi-Fi specific config (SSIDs, passwords 
+/// etc.) is persisted by the Wi-Fi stack internally.
+struct Settings
+{
+	esp_netif_ip_info_t ap_ip_info;
+	esp_netif_ip_info_t sta_ip_info;
+	wifi_mode_t mode;
+	bool sta_static;
+	uptime_t fallbackTimeout;
+	RadioSettings radio;
+};
+
+Settings settings {
+	.ap_ip_info = {},
+	.sta_ip_info = {},
+	.mode = WIFI_MODE_AP,
+	.sta_static = false,
+	.fallbackTimeout = 10'000'000,
+	.radio = {
+		.profiles = {
+			/* Active */ { WIFI_PS_NONE,      WIFI_BW_HT40, 80 },
+			/* Idle */   { WIFI_PS_MAX_MODEM, WIFI_BW_HT20, 80 },
+		},
+		.idleDelay = 10'000,
+	},
+};
+Settings persistedSettings; // as last written to NVS
+portMUX_TYPE settingsLock = portMUX_INITIALIZER_UNLOCKED;
+
+/// Quiet period after last change, before writing the settings to NVS,
+/// to batch changes and reduce flash wear when config is pushed repeatedly.
+constexpr TickType_t settingsCommitDelay = 3000 / portTICK_PERIOD_MS;
+TimerHandle_t settingsCommitTimer = nullptr;
+
+/// Loads the settings from NVS, writing defaults for missing IP info.
+void load_settings(nvs::NVSHandle& nvs_handle)
+{
+	if (unlikely(load_ip_info_from_nvs(nvs_handle, WIFI_IF_AP, settings.ap_ip_info) != ESP_OK)) {
+		ESP_LOGD(TAG_SETTINGS, "Missing IP info for %s interface, using defaults", "AP");
+		esp_netif_t* ap_netif = esp_netif_create_default_wifi_ap();
+		esp_netif_get_ip_info(ap_netif, &settings.ap_ip_info);
+		save_ip_info_to_nvs(nvs_handle, WIFI_IF_AP, settings.ap_ip_info);
+		esp_netif_destroy_default_wifi(ap_netif);
+	}
+
+	if (unlikely(load_ip_info_from_nvs(nvs_handle, WIFI_IF_STA, settings.sta_ip_info) != ESP_OK)) {
+		ESP_LOGD(TAG_SETTINGS, "Missing IP info for %s interface, using defaults", "STA");
+		// Note: DHCP client is used on default, so use preset to avoid uninitialized garbage.
+		settings.sta_ip_info = {
+			.ip = {0},
+			.netmask = {ESP_IP4TOADDR(255, 255, 255, 0)},
+			.gw = {0},
+		};
+		save_ip_info_to_nvs(nvs_handle, WIFI_IF_STA, settings.sta_ip_info);
+	}
+
+	ESP_IGNORE_ERROR(load_wifi_mode_from_nvs(nvs_handle, settings.mode));
+	ESP_IGNORE_ERROR(nvs_handle.get_item("sta.static", reinterpret_cast<uint8_t&>(settings.sta_static)));
+	ESP_IGNORE_ERROR(nvs_handle.get_item("fallback", reinterpret_cast<uint64_t&>(settings.fallbackTimeout)));
+	size_t radioSize = 0;
+	if (nvs_handle.get_item_size(nvs::ItemType::BLOB, "radio", radioSize) == ESP_OK && radioSize == sizeof(RadioSettings))
+		ESP_IGNORE_ERROR(nvs_handle.get_blob("radio", &settings.radio, sizeof(RadioSettings)));
+	persistedSettings = settings;
+}
+
+/// Writes changed settings to NVS, committing once. Called after the quiet period
+/// (from the timer task) and before restart (to not lose pending changes).
+void commit_settings()
+{
+	portENTER_CRITICAL(&settingsLock);
+	const Settings s = settings;
+	portEXIT_CRITICAL(&settingsLock);
+	const bool ap_ip_info_changed  = std::memcmp(&s.ap_ip_info,  &persistedSettings.ap_ip_info,  sizeof(esp_netif_ip_info_t)) != 0;
+	const bool sta_ip_info_changed = std::memcmp(&s.sta_ip_info, &persistedSettings.sta_ip_info, sizeof(esp_netif_ip_info_t)) != 0;
+	const bool mode_changed        = s.mode            != persistedSettings.mode;
+	const bool sta_static_changed  = s.sta_static      != persistedSettings.sta_static;
+	const bool fallback_changed    = s.fallbackTimeout != persistedSettings.fallbackTimeout;
+	const bool radio_changed       = std::memcmp(&s.radio, &persistedSettings.radio, sizeof(RadioSettings)) != 0;
+	if (!ap_ip_info_changed && !sta_ip_info_changed && !mode_changed && !sta_static_changed && !fallback_changed && !radio_changed) 
+		return;
+
+	esp_err_t ret;
+	std::shared_ptr<nvs::NVSHandle> nvs_handle = nvs::open_nvs_handle(NVS_NETWORK_NAMESPACE, NVS_READWRITE, &ret);
+	if (ret != ESP_OK) goto fail;
+
+	if (ap_ip_info_changed)
+		if ((ret = save_ip_info_to_nvs(*nvs_handle, WIFI_IF_AP, s.ap_ip_info)) != ESP_OK) goto fail;
+	if (sta_ip_info_changed)
+		if ((ret = save_ip_info_to_nvs(*nvs_handle, WIFI_IF_STA, s.sta_ip_info)) != ESP_OK) goto fail;
+	if (mode_changed)
+		if ((ret = save_wifi_mode_to_nvs(*nvs_handle, s.mode)) != ESP_OK) goto fail;
+	if (sta_static_changed)
+		if ((ret = nvs_handle->set_item("sta.static", static_cast<uint8_t>(s.sta_static))) != ESP_OK) goto fail;
+	if (fallback_changed)
+		if ((ret = nvs_handle->set_item("fallback", static_cast<uint64_t>(s.fallbackTimeout))) != ESP_OK) goto fail;
+	if (radio_changed)
+		if ((ret = nvs_handle->set_blob("radio", &s.radio, sizeof(RadioSettings))) != ESP_OK) goto fail;
+	if ((ret = nvs_handle->commit()) != ESP_OK) goto fail;
+
+	persistedSettings = s;
+	ESP_LOGD(TAG_SETTINGS, "Settings committed to NVS");
+	return;
+
+	fail:
+	ESP_LOGE(TAG_SETTINGS, "Failed to commit settings to NVS: %s", esp_err_to_name(ret));
+	xTimerReset(settingsCommitTimer, 0); // retry later
+}
+
+/// Updates the settings, scheduling (or postponing) writing them to NVS.
+void update_settings(const Settings& s)
+{
+	portENTER_CRITICAL(&settingsLock);
+	settings = s;
+	portEXIT_CRITICAL(&settingsLock);
+	xTimerReset(settingsCommitTimer, portMAX_DELAY);
+}
+
+void init_settings(nvs::NVSHandle& nvs_handle)
+{
+	load_settings(nvs_handle);
+	settingsCommitTimer = xTimerCreate(
+		"settings-commit", settingsCommitDelay, pdFALSE, nullptr, 
+		[] (TimerHandle_t) { commit_settings(); }
+	);
+	// Make sure pending changes are written before (requested) restart
+	ESP_ERROR_CHECK(esp_register_shutdown_handler(commit_settings));
+}
+
+/// Get IP info for given interface (if initialized), falling back to the settings.
+esp_err_t get_ip_info(wifi_interface_t interface, esp_netif_ip_info_t& ip_info)
+{
+	esp_netif_t* netif = interface == WIFI_IF_AP ? ap_netif : sta_netif;
+	if (!netif) {
+		ip_info = interface == WIFI_IF_AP ? settings.ap_ip_info : settings.sta_ip_info;
+		return ESP_OK;
+	}
+	return esp_netif_get_ip_info(netif, &ip_info);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Fallback
 
 static const char* TAG_FALLBACK = "ap-fallback";
 
 constexpr uptime_t reconnectMinimalDelay = 100'000;
+constexpr uptime_t reconnectMaximalDelay = 3'200'000;         // Cap of the backoff, in microseconds, when there is no AP running.
 constexpr uptime_t reconnectDelayWhenNoStations = 5'000'000;  // Delay, in microseconds, necessary to allow new stations to connect properly.
+constexpr uptime_t reconnectMaximalDelayWhenNoStations = 20'000'000;
 constexpr uptime_t reconnectDelayWhenStationsConnected = 60'000'000; // Delay, in microseconds, for reconnect attempts when there are stations connected.
 constexpr bool reconnectWhenStationsConnected = true; // Whenever we want want to try reconnect even while there are stations connected.
 constexpr bool reconnectWhenBeingControlled = false;
+constexpr uint8_t fastReconnectAttempts = 3; // Attempts using cached BSSID & channel (without full scan), before scanning.
 
 uptime_t fallbackTimeout = 10'000'000;  // Microseconds after which we start AP if we can't connect with STA. Configurable by config.
 uptime_t disconnectedTimestamp = 0;     // Timestamp when our device (station) lost connection to AP, or 0 if connected, or in AP only mode.
 uptime_t nextReconnectTimestamp;        // Timestamp for next reconnect attempt, only valid when `disconnectedTimestamp` is not 0.
+uint8_t reconnectAttempts = 0;          // Since disconnected, for the backoff.
+
+/// Last AP we were connected to, allowing to reconnect directly, without full scan.
+struct {
+	uint8_t bssid[6];
+	uint8_t channel;
+	bool valid;
+} lastAp = {};
 
 TimerHandle_t reconnectTimer = nullptr;
 
 void scheduleDelayedReconnectAsStation();
 
+/// Returns delay for the next reconnect attempt: growing exponentially with
+/// the attempts (from minimal up to maximal one), with random jitter (up to 1/4),
+/// to avoid many devices (or clients) retrying in sync on shared channel.
+uptime_t backoffDelay(uptime_t minimal, uptime_t maximal)
+{
+	const uint8_t exponent = std::min<uint8_t>(reconnectAttempts, 8);
+	uptime_t delay = std::min(minimal << exponent, maximal);
+	delay += esp_random() % (delay / 4 + 1);
+	return delay;
+}
+
+/// Makes the station target (or not) the last AP directly, skipping full scan. 
+/// Stored in RAM only, to not wear the flash with volatile data.
+void targetLastAp(bool use)
+{
+	wifi_config_t wifi_config;
+	if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK) return;
+	auto& sta = wifi_config.sta;
+	if (use) {
+		if (sta.bssid_set && sta.channel == lastAp.channel && std::memcmp(sta.bssid, lastAp.bssid, sizeof(sta.bssid)) == 0) 
+			return;
+		sta.bssid_set = true;
+		std::memcpy(sta.bssid, lastAp.bssid, sizeof(sta.bssid));
+		sta.channel = lastAp.channel;
+	}
+	else {
+		if (!sta.bssid_set) 
+			return;
+		sta.bssid_set = false;
+		sta.channel = 0;
+	}
+	esp_wifi_set_storage(WIFI_STORAGE_RAM);
+	ESP_ERROR_CHECK_WITHOUT_ABORT(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+	esp_wifi_set_storage(WIFI_STORAGE_FLASH);
+}
+
 esp_err_t connectAsStation()
 {
 	const auto now = esp_timer_get_time();
 	const bool isControlled = now - control::lastControlTime < control::controlTimeout;
 	if (!isControlled || reconnectWhenBeingControlled) {
+		const bool fast = lastAp.valid && reconnectAttempts < fastReconnectAttempts;
 		if (isControlled && reconnectWhenBeingControlled) {
 			ESP_LOGW(TAG_FALLBACK, "Connecting while still being controlled");
 		}
 		else {
-			ESP_LOGD(TAG_FALLBACK, "Connecting");
+			ESP_LOGD(TAG_FALLBACK, "Connecting (attempt %u%s)", reconnectAttempts + 1, fast ? ", to last AP" : "");
 		}
+		targetLastAp(fast);
+		if (reconnectAttempts < UINT8_MAX) reconnectAttempts++;
+		metrics::count(fast ? metrics::Counter::WifiFastReconnects : metrics::Counter::WifiReconnects);
 		esp_err_t err = ESP_ERROR_CHECK_WITHOUT_ABORT(esp_wifi_connect());
 		if (err != ESP_OK) {
 			scheduleDelayedReconnectAsStation();
@@ -144,7 +363,8 @@ void scheduleDelayedReconnectAsStation()
 		if (sta_list.num > 0) {
 			if (reconnectWhenStationsConnected) {
 				ESP_LOGV(TAG_FALLBACK, "Reconnect retry scheduled, with %u stations connected to AP", sta_list.num);
-				scheduleDelayedReconnectAsStation(reconnectDelayWhenStationsConnected / 1000 / portTICK_PERIOD_MS);
+				const auto delay = backoffDelay(reconnectDelayWhenStationsConnected, reconnectDelayWhenStationsConnected);
+				scheduleDelayedReconnectAsStation(delay / 1000 / portTICK_PERIOD_MS);
 				return;
 			}
 			else {
@@ -154,7 +374,8 @@ void scheduleDelayedReconnectAsStation()
 		}
 		else /* sta_list.num == 0 */ {
 			ESP_LOGV(TAG_FALLBACK, "Reconnect retry scheduled, since no stations connected to AP");
-			scheduleDelayedReconnectAsStation(reconnectDelayWhenNoStations / 1000 / portTICK_PERIOD_MS);
+			const auto delay = backoffDelay(reconnectDelayWhenNoStations, reconnectMaximalDelayWhenNoStations);
+			scheduleDelayedReconnectAsStation(delay / 1000 / portTICK_PERIOD_MS);
 			return;
 		}
 	}
@@ -162,6 +383,7 @@ void scheduleDelayedReconnectAsStation()
 		const auto timeSinceDisconnect = esp_timer_get_time() - disconnectedTimestamp;
 		if (timeSinceDisconnect >= fallbackTimeout) {
 			ESP_LOGI(TAG_FALLBACK, "Cannot reconnect as STA, falling back to AP...");
+			metrics::count(metrics::Counter::WifiFallbacks);
 
 			if (!ap_netif) ap_netif = esp_netif_create_default_wifi_ap();
 			// IP not set, using the default one (192.168.4.1)
@@ -169,16 +391,38 @@ void scheduleDelayedReconnectAsStation()
 			esp_wifi_set_mode(WIFI_MODE_APSTA);
 			esp_netif_dhcps_start(ap_netif);
 
-			scheduleDelayedReconnectAsStation(reconnectDelayWhenNoStations / 1000 / portTICK_PERIOD_MS);
+			reconnectAttempts = 0; // backoff starts over, with AP delays
+			scheduleDelayedReconnectAsStation(backoffDelay(reconnectDelayWhenNoStations, reconnectDelayWhenNoStations) / 1000 / portTICK_PERIOD_MS);
 			return;
 		}
 		const auto remainingTime = fallbackTimeout - timeSinceDisconnect;
-		ESP_LOGV(TAG_FALLBACK, "Reconnect retry scheduled - fallback to AP in %" PRIi64 "us", remainingTime);
+		const auto delay = std::min(backoffDelay(reconnectMinimalDelay, reconnectMaximalDelay), remainingTime);
+		ESP_LOGV(TAG_FALLBACK, "Reconnect retry scheduled in %" PRIi64 "us - fallback to AP in %" PRIi64 "us", delay, remainingTime);
+		scheduleDelayedReconnectAsStation(std::max<TickType_t>(delay / 1000 / portTICK_PERIOD_MS, 1));
+		return;
 	}
 	else {
 		ESP_LOGV(TAG_FALLBACK, "Reconnect retry scheduled - fallback not configured");
 	}
-	scheduleDelayedReconnectAsStation(reconnectMinimalDelay / 1000 / portTICK_PERIOD_MS);
+	scheduleDelayedReconnectAsStation(backoffDelay(reconnectMinimalDelay, reconnectMaximalDelay) / 1000 / portTICK_PERIOD_MS);
+}
+
+/// Event handler for WIFI_EVENT_STA_CONNECTED, remembering the AP for fast reconnects.
+void handle_sta_connected(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
+{
+	const auto& eventData = *static_cast<const wifi_event_sta_connected_t*>(event_data);
+	std::memcpy(lastAp.bssid, eventData.bssid, sizeof(lastAp.bssid));
+	lastAp.channel = eventData.channel;
+	lastAp.valid = true;
+
+	if (disconnectedTimestamp) {
+		const uptime_t duration = esp_timer_get_time() - disconnectedTimestamp;
+		metrics::record(metrics::Histogram::WifiReconnectTime, duration / 1000);
+		ESP_LOGD(TAG_FALLBACK, "Reconnected after %" PRIi64 "ms and %u attempts", duration / 1000, reconnectAttempts);
+	}
+	disconnectedTimestamp = 0;
+	reconnectAttempts = 0;
+	xTimerStop(reconnectTimer, 0);
 }
 
 /// Event handler for WIFI_EVENT_STA_DISCONNECTED, called when our STA disconnects from AP, but also on connect failure.
@@ -192,6 +436,8 @@ void handle_sta_disconnected(void* arg, esp_event_base_t event_base, int32_t eve
 	else /* disconnectedTimestamp == 0, was connected, but not anymore */ {
 		ESP_LOGD(TAG_FALLBACK, "Disconnected! reason=%u rssi=%d", eventData.reason, eventData.rssi);
 		disconnectedTimestamp = esp_timer_get_time();
+		reconnectAttempts = 0;
+		metrics::count(metrics::Counter::WifiDisconnects);
 	}
 	scheduleDelayedReconnectAsStation();
 }
@@ -204,23 +450,111 @@ void handle_ap_stadisconnect(void* arg, esp_event_base_t event_base, int32_t eve
 	}
 }
 
+void handle_ap_staconnect(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
+{
+	// Station connecting to our AP needs the channel to stay put (i.e. for DHCP), 
+	// so postpone reconnecting as STA, as if the station was there already.
+	if (disconnectedTimestamp) {
+		scheduleDelayedReconnectAsStation();
+	}
+}
+
 esp_event_handler_instance_t ehi_sta_disconnect;
 esp_event_handler_instance_t ehi_ap_stadisconnect;
+esp_event_handler_instance_t ehi_ap_staconnect;
 
 esp_err_t registerDisconnectEventHandlers() {
 	ESP_LOGV(TAG_FALLBACK, "Registering disconnect event handlers");
 	if (esp_err_t err = esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, handle_sta_disconnected, nullptr, &ehi_sta_disconnect); err != ESP_OK) return err;
 	if (esp_err_t err = esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_AP_STADISCONNECTED, handle_ap_stadisconnect, nullptr, &ehi_ap_stadisconnect); err != ESP_OK) return err;
-	// TODO: add WIFI_EVENT_AP_STACONNECTED to delay reconnecting as STA
+	if (esp_err_t err = esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_AP_STACONNECTED, handle_ap_staconnect, nullptr, &ehi_ap_staconnect); err != ESP_OK) return err;
 	return ESP_OK;
 }
 esp_err_t unregisterDisconnectEventHandlers() {
 	ESP_LOGV(TAG_FALLBACK, "Unregistering disconnect event handlers");
 	if (esp_err_t err = esp_event_handler_instance_unregister(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, ehi_sta_disconnect); err != ESP_OK) return err;
 	if (esp_err_t err = esp_event_handler_instance_unregister(WIFI_EVENT, WIFI_EVENT_AP_STADISCONNECTED, ehi_ap_stadisconnect); err != ESP_OK) return err;
+	if (esp_err_t err = esp_event_handler_instance_unregister(WIFI_EVENT, WIFI_EVENT_AP_STACONNECTED, ehi_ap_staconnect); err != ESP_OK) return err;
 	return ESP_OK;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Radio profiles
+
+static const char* TAG_RADIO = "radio";
+
+/// Period of checking the activity, which also is the worst delay 
+/// of switching to active profile (i.e. when control starts).
+constexpr TickType_t radioProfileCheckPeriod = 250 / portTICK_PERIOD_MS;
+
+TimerHandle_t radioProfileTimer = nullptr;
+RadioProfile currentRadioProfile = RadioProfile::_Count; // none applied yet
+
+const char* radio_profile_to_cstr(RadioProfile profile)
+{
+	switch (profile) {
+		case RadioProfile::Active:  return "active";
+		case RadioProfile::Idle:    return "idle";
+		default:                    return "none";
+	}
+}
+
+/// Applies the radio profile (power save, bandwidth and TX power).
+/// @param force True to apply even if it seems already applied, i.e. after Wi-Fi restart.
+void apply_radio_profile(RadioProfile profile, bool force = false)
+{
+	if (profile == currentRadioProfile && !force) 
+		return;
+	const auto& p = settings.radio.profiles[static_cast<uint8_t>(profile)];
+
+	wifi_mode_t mode;
+	if (esp_wifi_get_mode(&mode) != ESP_OK) 
+		return; // not initialized
+	const bool use_ap  = mode == WIFI_MODE_AP  || mode == WIFI_MODE_APSTA;
+	const bool use_sta = mode == WIFI_MODE_STA || mode == WIFI_MODE_APSTA;
+
+	// Errors are expected for some combinations (i.e. power save while AP is running), 
+	// so they are only logged, the rest of the profile is applied anyway.
+	esp_err_t err;
+	if (use_sta) {
+		if ((err = esp_wifi_set_ps(p.ps)) != ESP_OK) 
+			ESP_LOGV(TAG_RADIO, "Failed to set power save: %s", esp_err_to_name(err));
+		// Bandwidth of the station takes effect on next connection
+		if ((err = esp_wifi_set_bandwidth(WIFI_IF_STA, p.bandwidth)) != ESP_OK) 
+			ESP_LOGV(TAG_RADIO, "Failed to set %s bandwidth: %s", "STA", esp_err_to_name(err));
+	}
+	if (use_ap) {
+		if ((err = esp_wifi_set_bandwidth(WIFI_IF_AP, p.bandwidth)) != ESP_OK) 
+			ESP_LOGV(TAG_RADIO, "Failed to set %s bandwidth: %s", "AP", esp_err_to_name(err));
+	}
+	if ((err = esp_wifi_set_max_tx_power(p.txPower)) != ESP_OK) 
+		ESP_LOGV(TAG_RADIO, "Failed to set TX power: %s", esp_err_to_name(err));
+
+	ESP_LOGD(TAG_RADIO, "Switched to %s profile", radio_profile_to_cstr(profile));
+	currentRadioProfile = profile;
+	metrics::count(metrics::Counter::RadioProfileSwitches);
+	configGeneration.bump(); // current profile is reported in the config
+}
+
+/// Selects the radio profile depending on activity: being controlled 
+/// (recently, within the idle delay) or streaming (any frames subscribers).
+void update_radio_profile()
+{
+	const uptime_t now = esp_timer_get_time();
+	const bool active = now - control::lastControlTime < static_cast<uptime_t>(settings.radio.idleDelay) * 1000
+		|| camera::getSubscribersCount() > 0;
+	apply_radio_profile(active ? RadioProfile::Active : RadioProfile::Idle);
+}
+
+void init_radio_profiles()
+{
+	radioProfileTimer = xTimerCreate(
+		"radio-profile", radioProfileCheckPeriod, pdTRUE, nullptr, 
+		[] (TimerHandle_t) { update_radio_profile(); }
+	);
+	xTimerStart(radioProfileTimer, portMAX_DELAY);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Initialization
 
@@ -238,33 +572,11 @@ void init()
 	wifi_init_config_t wifi_init_config = WIFI_INIT_CONFIG_DEFAULT();
 	ESP_ERROR_CHECK(esp_wifi_init(&wifi_init_config));
 
-	esp_netif_ip_info_t ap_ip_info;
-	if (unlikely(load_ip_info_from_nvs(*nvs_handle, WIFI_IF_AP, ap_ip_info) != ESP_OK)) {
-		ESP_LOGD(TAG_INIT_NETWORK, "Missing IP info for %s interface, using defaults", "AP");
-		esp_netif_t* ap_netif = esp_netif_create_default_wifi_ap();
-		esp_netif_get_ip_info(ap_netif, &ap_ip_info);
-		save_ip_info_to_nvs(*nvs_handle, WIFI_IF_AP, ap_ip_info);
-		esp_netif_destroy_default_wifi(ap_netif);
-	}
-
-	esp_netif_ip_info_t sta_ip_info;
-	if (unlikely(load_ip_info_from_nvs(*nvs_handle, WIFI_IF_STA, sta_ip_info) != ESP_OK)) {
-		ESP_LOGD(TAG_INIT_NETWORK, "Missing IP info for %s interface, using defaults", "STA");
-		// Note: DHCP client is used on default, so use preset to avoid uninitialized garbage.
-		// esp_netif_t* sta_netif = esp_netif_create_default_wifi_sta();
-		// esp_netif_get_ip_info(sta_netif, &ap_ip_info);
-		// save_ip_info_to_nvs(*nvs_handle, WIFI_IF_STA, sta_ip_info);
-		// esp_netif_destroy_default_wifi(sta_netif);
-		esp_netif_ip_info_t preset = {
-			.ip = {0},
-			.netmask = {ESP_IP4TOADDR(255, 255, 255, 0)},
-			.gw = {0},
-		};
-		save_ip_info_to_nvs(*nvs_handle, WIFI_IF_STA, preset);
-	}
+	init_settings(*nvs_handle);
+	fallbackTimeout = settings.fallbackTimeout;
 
 	wifi_mode_t mode;
-	if (likely(load_wifi_mode_from_nvs(*nvs_handle, mode)) == ESP_OK && !FORCE_WIFI_DEFAULTS) {
+	if (likely(load_wifi_mode_from_nvs(*nvs_handle, mode) == ESP_OK) && !FORCE_WIFI_DEFAULTS) {
 		// Start networking as configured (in NVS). 
 		// Note that some stuff (like SSIDs & passwords) are persisted by Wi-Fi stack internally.
 
@@ -273,25 +585,22 @@ void init()
 
 		if (use_ap) {
 			ap_netif = esp_netif_create_default_wifi_ap();
-			esp_netif_set_ip_info(ap_netif, &ap_ip_info);
+			esp_netif_set_ip_info(ap_netif, &settings.ap_ip_info);
 		}
 		if (use_sta) {
 			sta_netif = esp_netif_create_default_wifi_sta();
-			esp_netif_set_ip_info(sta_netif, &sta_ip_info);
-
-			bool sta_static = false;
-			ESP_IGNORE_ERROR(nvs_handle->get_item("sta.static", reinterpret_cast<uint8_t&>(sta_static)));
+			esp_netif_set_ip_info(sta_netif, &settings.sta_ip_info);
 
-			if (sta_static) esp_netif_dhcpc_stop(sta_netif);
+			if (settings.sta_static) esp_netif_dhcpc_stop(sta_netif);
 		}
 
 		ESP_ERROR_CHECK(esp_wifi_set_mode(mode));
 
 		if (esp_log_level_get(TAG_INIT_NETWORK) >= ESP_LOG_DEBUG || FORCE_DUMP_NETWORK_CONFIG) {
 			char buffer[1024];
-			int ret;
-			config(nullptr, nullptr, buffer, sizeof(buffer), &ret);
-			ESP_LOGD(TAG_INIT_NETWORK, "Networking config dump: %.*s", 1024 - 1, buffer);
+			config::Writer writer(buffer, sizeof(buffer));
+			config::writeJson(writer, configObject);
+			ESP_LOGD(TAG_INIT_NETWORK, "Networking config dump: %.*s", writer.size(), buffer);
 		}
 	}
 	else {
@@ -317,8 +626,6 @@ void init()
 		ESP_LOGW(TAG_INIT_NETWORK, "Missing data! Defaulting to AP with SSID: '%s' and PSK: '%s'", DEFAULT_SSID, DEFAULT_PASSWORD);
 	}
 
-	ESP_IGNORE_ERROR(nvs_handle->get_item("fallback", reinterpret_cast<uint64_t&>(fallbackTimeout)));
-
 	ESP_ERROR_CHECK(esp_event_handler_instance_register(
 		WIFI_EVENT, WIFI_EVENT_STA_START, 
 		[] (void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
@@ -329,12 +636,7 @@ void init()
 	));
 
 	ESP_ERROR_CHECK(esp_event_handler_instance_register(
-		WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, 
-		[] (void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
-			disconnectedTimestamp = 0;
-			xTimerStop(reconnectTimer, 0);
-		}, 
-		nullptr, nullptr
+		WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, handle_sta_connected, nullptr, nullptr
 	));
 
 	ESP_ERROR_CHECK(registerDisconnectEventHandlers());
@@ -348,6 +650,8 @@ void init()
 	);
 
 	ESP_ERROR_CHECK(esp_wifi_start());
+
+	init_radio_profiles();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -371,396 +675,425 @@ struct wifi_common_config_t
 	char password[64];
 };
 
-inline bool has_simple_value(const jsmntok_t* token)
-{
-	if (token->type == JSMN_UNDEFINED) return false;
-	if (token->type == JSMN_OBJECT) return false;
-	if (token->type == JSMN_ARRAY) return false;
-	return true;
-}
-
-esp_err_t config__common_keys(
-	char* input, uint32_t key_hash, jsmntok_t* value_token,
-	wifi_common_config_t& wifi_config, esp_netif_ip_info_t& ip_info
-) {
-	const size_t value_length = value_token->end - value_token->start;
-	switch (key_hash) {
-		case fnv1a32("ip"): {
-			input[value_token->end] = 0;
-			if (esp_netif_str_to_ip4(input + value_token->start, &ip_info.ip) != ESP_OK)
-				return ESP_FAIL;
-			break;
-		}
-		case fnv1a32("gateway"):
-		case fnv1a32("gw"): {
-			input[value_token->end] = 0;
-			if (esp_netif_str_to_ip4(input + value_token->start, &ip_info.gw) != ESP_OK)
-				return ESP_FAIL;
-			break;
-		}
-		case fnv1a32("mask"):
-		case fnv1a32("netmask"): {
-			input[value_token->end] = 0;
-			if (std::strchr(input + value_token->start, '.') == nullptr) {
-				const uint8_t maskLength = std::atoi(input + value_token->start);
-				if (maskLength > 30) 
-					return ESP_FAIL;
-				ip_info.netmask.addr = hton(~0u << (32 - maskLength));
-				ESP_LOGV(TAG_CONFIG_NETWORK, "Setting mask as length %u. Resulting address: " IPSTR, 
-					maskLength, IP2STR(&ip_info.netmask));
-			}
-			else {
-				if (esp_netif_str_to_ip4(input + value_token->start, &ip_info.netmask) != ESP_OK)
-					return ESP_FAIL;
-			}
-			break;
-		}
-		case fnv1a32("ssid"): {
-			if (value_length > sizeof(wifi_config.ssid)) return ESP_FAIL;
-			std::strncpy(wifi_config.ssid, input + value_token->start, value_length);
-			wifi_config.ssid[value_length] = '\0';
-			break;
-		}
-		case fnv1a32("psk"):
-		case fnv1a32("password"): {
-			if (value_token->type == JSMN_STRING && value_length != 0) {
-				if (value_length > sizeof(wifi_config.password) - 1) return ESP_FAIL;
-				std::strncpy(wifi_config.password, input + value_token->start, value_length);
-				wifi_config.password[value_length] = '\0';
-			}
-			else {
-				std::memset(wifi_config.password, 0, sizeof(wifi_config.password));
-			}
-			break;
-		}
+/// Networking configuration being edited, loaded at the beginning 
+/// of config request (or output) and applied at the end.
+struct ConfigSession
+{
+	wifi_ap_config_t ap_config;
+	wifi_sta_config_t sta_config;
+	esp_netif_ip_info_t ap_ip_info;
+	esp_netif_ip_info_t sta_ip_info;
+	wifi_mode_t mode;
+	bool sta_static;
+
+	/// Loads the session from memory only (Wi-Fi stack and the settings), without touching NVS.
+	esp_err_t load()
+	{
+		ap_config = {};
+		sta_config = {};
+		esp_wifi_get_config(WIFI_IF_AP,  reinterpret_cast<wifi_config_t*>(&ap_config));
+		esp_wifi_get_config(WIFI_IF_STA, reinterpret_cast<wifi_config_t*>(&sta_config));
+		sta_config.bssid_set = false; // not persisting the last AP targeted by fast reconnect
+		sta_config.channel = 0;
+
+		get_ip_info(WIFI_IF_AP,  ap_ip_info);
+		get_ip_info(WIFI_IF_STA, sta_ip_info);
+
+		mode = settings.mode;
+		sta_static = settings.sta_static;
+		fallbackTimeout = settings.fallbackTimeout;
+		return ESP_OK;
 	}
-	return ESP_OK;
+};
+
+/// Config requests are handled one by one (by the main web server task).
+ConfigSession configSession;
+ConfigSession loadedConfigSession; // to skip restarting Wi-Fi if nothing changed
+
+/// Begins applying (or reading) JSON configuration for networking, see `configFields`.
+esp_err_t config_begin()
+{
+	const esp_err_t ret = configSession.load();
+	std::memcpy(&loadedConfigSession, &configSession, sizeof(ConfigSession));
+	return ret;
 }
 
-inline esp_err_t config__ap(
-	char* input, jsmntok_t* root,
-	wifi_ap_config_t& wifi_config, esp_netif_ip_info_t& ip_info
-) {
-	if (unlikely(root->type != JSMN_OBJECT))
-		return ESP_FAIL;
-	if (unlikely(root->size < 1)) 
-		return ESP_FAIL;
-	for (jsmntok_t* token = root + 1;;) {
-		auto* key_token   = token;
-		auto* value_token = token + 1;
-		ESP_LOGV(TAG_CONFIG_NETWORK, "key='%.*s' value='%.*s'", 
-			key_token->end - key_token->start, input + key_token->start,
-			value_token->end - value_token->start, input + value_token->start
-		);
-		if (unlikely(!has_simple_value(value_token)))
-			return ESP_FAIL;
-		const size_t value_length = value_token->end - value_token->start;
-		const auto key_hash = fnv1a32(input + key_token->start, input + key_token->end);
-		if (config__common_keys(input, key_hash, value_token, reinterpret_cast<wifi_common_config_t&>(wifi_config), ip_info) != ESP_OK)
-			return ESP_FAIL;
-		switch (key_hash) {
-			case fnv1a32("ssid"): {
-				wifi_config.ssid_len = value_length;
-				break;
-			}
-			case fnv1a32("psk"):
-			case fnv1a32("password"): {
-				if (value_token->type == JSMN_STRING && value_length != 0) {
-					wifi_config.authmode = WIFI_AUTH_WPA2_PSK;
-				}
-				else {
-					wifi_config.authmode = WIFI_AUTH_OPEN;
-				}
-				break;
-			}
-			case fnv1a32("channel"): {
-				wifi_config.channel = std::atoi(input + value_token->start);
-				break;
-			}
-			case fnv1a32("hidden"): {
-				wifi_config.ssid_hidden = parseBooleanFast(input + value_token->start);
-				break;
-			}
-		}
+template <wifi_interface_t interface>
+inline wifi_common_config_t& session_common_config()
+{
+	if constexpr (interface == WIFI_IF_AP)
+		return reinterpret_cast<wifi_common_config_t&>(configSession.ap_config);
+	else
+		return reinterpret_cast<wifi_common_config_t&>(configSession.sta_config);
+}
 
-		// Skip primitive pair (key & value)
-		token += 2;
-		if (root->end < token->end)
-			break;
-	}
+template <wifi_interface_t interface>
+inline esp_netif_ip_info_t& session_ip_info()
+{
+	return interface == WIFI_IF_AP ? configSession.ap_ip_info : configSession.sta_ip_info;
+}
 
+template <wifi_interface_t interface>
+esp_err_t set_ssid(const json::Field& field)
+{
+	auto& wifi_config = session_common_config<interface>();
+	const size_t value_length = field.valueLength;
+	if (value_length > sizeof(wifi_config.ssid)) return ESP_FAIL;
+	std::memcpy(wifi_config.ssid, field.value, value_length);
+	if (value_length < sizeof(wifi_config.ssid)) 
+		wifi_config.ssid[value_length] = '\0';
+	if constexpr (interface == WIFI_IF_AP)
+		configSession.ap_config.ssid_len = value_length;
 	return ESP_OK;
 }
 
-inline esp_err_t config__sta(
-	char* input, jsmntok_t* root,
-	wifi_sta_config_t& wifi_config, esp_netif_ip_info_t& ip_info, bool& static_ip
-) {
-	if (unlikely(root->type != JSMN_OBJECT))
-		return ESP_FAIL;
-	if (unlikely(root->size < 1)) 
-		return ESP_FAIL;
-	for (jsmntok_t* token = root + 1;;) {
-		auto* key_token   = token;
-		auto* value_token = token + 1;
-		ESP_LOGV(TAG_CONFIG_NETWORK, "key='%.*s' value='%.*s'", 
-			key_token->end - key_token->start, input + key_token->start,
-			value_token->end - value_token->start, input + value_token->start
-		);
-		if (unlikely(!has_simple_value(value_token)))
+template <wifi_interface_t interface>
+esp_err_t set_password(const json::Field& field)
+{
+	auto& wifi_config = session_common_config<interface>();
+	const size_t value_length = field.valueLength;
+	const bool open = !field.isString() || value_length == 0;
+	if (!open) {
+		if (value_length > sizeof(wifi_config.password) - 1) return ESP_FAIL;
+		std::memcpy(wifi_config.password, field.value, value_length);
+		wifi_config.password[value_length] = '\0';
+	}
+	else {
+		std::memset(wifi_config.password, 0, sizeof(wifi_config.password));
+	}
+	if constexpr (interface == WIFI_IF_AP) {
+		configSession.ap_config.authmode = open ? WIFI_AUTH_OPEN : WIFI_AUTH_WPA2_PSK;
+	}
+	else {
+		configSession.sta_config.sae_pwe_h2e = WPA3_SAE_PWE_BOTH;
+		configSession.sta_config.threshold.authmode = open ? WIFI_AUTH_OPEN : WIFI_AUTH_WPA2_PSK;
+	}
+	return ESP_OK;
+}
+
+template <wifi_interface_t interface>
+esp_err_t set_ip(const json::Field& field)
+{
+	return esp_netif_str_to_ip4(field.value, &session_ip_info<interface>().ip) == ESP_OK ? ESP_OK : ESP_FAIL;
+}
+
+template <wifi_interface_t interface>
+esp_err_t set_gateway(const json::Field& field)
+{
+	return esp_netif_str_to_ip4(field.value, &session_ip_info<interface>().gw) == ESP_OK ? ESP_OK : ESP_FAIL;
+}
+
+template <wifi_interface_t interface>
+esp_err_t set_mask(const json::Field& field)
+{
+	auto& ip_info = session_ip_info<interface>();
+	if (std::strchr(field.value, '.') == nullptr) {
+		const uint8_t maskLength = std::atoi(field.value);
+		if (maskLength > 30) 
 			return ESP_FAIL;
-		const size_t value_length = value_token->end - value_token->start;
-		const auto key_hash = fnv1a32(input + key_token->start, input + key_token->end);
-		if (config__common_keys(input, key_hash, value_token, reinterpret_cast<wifi_common_config_t&>(wifi_config), ip_info) != ESP_OK)
+		ip_info.netmask.addr = hton(~0u << (32 - maskLength));
+		ESP_LOGV(TAG_CONFIG_NETWORK, "Setting mask as length %u. Resulting address: " IPSTR, 
+			maskLength, IP2STR(&ip_info.netmask));
+	}
+	else {
+		if (esp_netif_str_to_ip4(field.value, &ip_info.netmask) != ESP_OK)
 			return ESP_FAIL;
-		switch (key_hash) {
-			case fnv1a32("static"): {
-				static_ip = parseBooleanFast(input + value_token->start);
-				break;
-			}
-			case fnv1a32("psk"):
-			case fnv1a32("password"): {
-				wifi_config.sae_pwe_h2e = WPA3_SAE_PWE_BOTH;
-				if (value_token->type == JSMN_STRING && value_length != 0) {
-					wifi_config.threshold.authmode = WIFI_AUTH_WPA2_PSK;
-				}
-				else {
-					wifi_config.threshold.authmode = WIFI_AUTH_OPEN;
-				}
-				break;
-			}
-		}
-
-		// Skip primitive pair (key & value)
-		token += 2;
-		if (root->end < token->end)
-			break;
 	}
-
 	return ESP_OK;
 }
 
-/// @brief Applies (and/or reads current) JSON configuration for networking.
-/// @param[in] input Buffer with JSON data that was parsed into JSON into tokens.
-///		Note: Passed non-const to allow in-place strings manipulation.
-/// @param[in] root JSMN JSON object token related to the config to be parsed.
-/// @param[out] output Optional buffer for writing JSON with current configuration.
-/// @param[in] output_length Length of output buffer.
-/// @param[out] output_return Used to return number of bytes that would be written 
-/// 	to the output, or negative for error. Basically `printf`-like return.
-/// @return 
-esp_err_t config(
-	char* input, jsmntok_t* root,
-	char* output, size_t output_length, int* output_return
-) {
-	esp_err_t nvs_result;
-	std::shared_ptr<nvs::NVSHandle> nvs_handle = nvs::open_nvs_handle(NVS_NETWORK_NAMESPACE, NVS_READWRITE, &nvs_result);
-	ESP_ERROR_CHECK(nvs_result);
+template <wifi_interface_t interface>
+std::string_view get_ssid()
+{
+	const auto& wifi_config = session_common_config<interface>();
+	return { wifi_config.ssid, strnlen(wifi_config.ssid, sizeof(wifi_config.ssid)) };
+}
 
-	wifi_ap_config_t ap_config = {};
-	wifi_sta_config_t sta_config = {};
-	esp_wifi_get_config(WIFI_IF_AP,  reinterpret_cast<wifi_config_t*>(&ap_config));
-	esp_wifi_get_config(WIFI_IF_STA, reinterpret_cast<wifi_config_t*>(&sta_config));
+template <wifi_interface_t interface>
+std::string_view get_password()
+{
+	const auto& wifi_config = session_common_config<interface>();
+	return { wifi_config.password, strnlen(wifi_config.password, sizeof(wifi_config.password)) };
+}
 
-	esp_netif_ip_info_t ap_ip_info;
-	esp_netif_ip_info_t sta_ip_info;
-	get_ip_info(WIFI_IF_AP,  ap_ip_info,  nvs_handle.get());
-	get_ip_info(WIFI_IF_STA, sta_ip_info, nvs_handle.get());
+template <wifi_interface_t interface>
+int32_t get_ip() { return session_ip_info<interface>().ip.addr; }
+
+template <wifi_interface_t interface>
+int32_t get_gateway() { return session_ip_info<interface>().gw.addr; }
+
+template <wifi_interface_t interface>
+int32_t get_mask() { return numberOfSetBits(session_ip_info<interface>().netmask.addr); }
+
+constexpr config::Field staConfigFields[] = {
+	config::string ("ssid",    set_ssid<WIFI_IF_STA>,     get_ssid<WIFI_IF_STA>),
+	config::string ("psk",     set_password<WIFI_IF_STA>, get_password<WIFI_IF_STA>),
+	config::ip4    ("ip",      set_ip<WIFI_IF_STA>,       get_ip<WIFI_IF_STA>),
+	config::integer("mask",    set_mask<WIFI_IF_STA>,     get_mask<WIFI_IF_STA>),
+	config::ip4    ("gateway", set_gateway<WIFI_IF_STA>,  get_gateway<WIFI_IF_STA>),
+	config::boolean("static", 
+		[] (const json::Field& field) {
+			configSession.sta_static = parseBooleanFast(field.value);
+			return ESP_OK;
+		},
+		[] { return configSession.sta_static; }
+	),
+	/* Aliases */
+	config::alias("password", set_password<WIFI_IF_STA>),
+	config::alias("netmask",  set_mask<WIFI_IF_STA>),
+	config::alias("gw",       set_gateway<WIFI_IF_STA>),
+};
+constexpr config::Index staConfigIndex { staConfigFields };
+static_assert(staConfigIndex.unique, "Keys hashes collision");
+constexpr config::Object staConfigObject { staConfigFields, staConfigIndex };
+
+constexpr config::Field apConfigFields[] = {
+	config::string ("ssid",    set_ssid<WIFI_IF_AP>,     get_ssid<WIFI_IF_AP>),
+	config::string ("psk",     set_password<WIFI_IF_AP>, get_password<WIFI_IF_AP>),
+	config::ip4    ("ip",      set_ip<WIFI_IF_AP>,       get_ip<WIFI_IF_AP>),
+	config::integer("mask",    set_mask<WIFI_IF_AP>,     get_mask<WIFI_IF_AP>),
+	config::ip4    ("gateway", set_gateway<WIFI_IF_AP>,  get_gateway<WIFI_IF_AP>),
+	config::integer("channel", 
+		[] (const json::Field& field) {
+			configSession.ap_config.channel = std::atoi(field.value);
+			return ESP_OK;
+		},
+		[] { return static_cast<int32_t>(configSession.ap_config.channel); }
+	),
+	config::boolean("hidden", 
+		[] (const json::Field& field) {
+			configSession.ap_config.ssid_hidden = parseBooleanFast(field.value);
+			return ESP_OK;
+		},
+		[] { return configSession.ap_config.ssid_hidden != 0; }
+	),
+	/* Aliases */
+	config::alias("password", set_password<WIFI_IF_AP>),
+	config::alias("netmask",  set_mask<WIFI_IF_AP>),
+	config::alias("gw",       set_gateway<WIFI_IF_AP>),
+};
+constexpr config::Index apConfigIndex { apConfigFields };
+static_assert(apConfigIndex.unique, "Keys hashes collision");
+constexpr config::Object apConfigObject { apConfigFields, apConfigIndex };
 
-	wifi_mode_t mode = WIFI_MODE_AP;
-	bool sta_static = false;
-	ESP_IGNORE_ERROR(load_wifi_mode_from_nvs(*nvs_handle, mode));
-	ESP_IGNORE_ERROR(nvs_handle->get_item("fallback", reinterpret_cast<uint64_t&>(fallbackTimeout)));
-	ESP_IGNORE_ERROR(nvs_handle->get_item("sta.static", reinterpret_cast<uint8_t&>(sta_static)));
+/// Radio settings being edited, applied at the end, without restarting Wi-Fi.
+/// Config requests are handled one by one (by the main web server task).
+RadioSettings configRadio;
 
-	if (input) {
-		if (unlikely(root->type != JSMN_OBJECT))
-			return ESP_FAIL;
-		if (unlikely(root->size < 1)) 
-			return ESP_FAIL;
-		for (jsmntok_t* token = root + 1;;) {
-			auto* key_token   = token;
-			auto* value_token = token + 1;
-			ESP_LOGV(TAG_CONFIG_NETWORK, "key='%.*s' value='%.*s'", 
-				key_token->end - key_token->start, input + key_token->start,
-				value_token->end - value_token->start, input + value_token->start
-			);
-
-			// Dispatch based on type and key
-			const auto key_hash = fnv1a32(input + key_token->start, input + key_token->end);
-			if (value_token->type == JSMN_OBJECT) {
-				ESP_LOGV(TAG_CONFIG_NETWORK, "type=object size=%zu", value_token->size);
-				switch (key_hash) {
-					case fnv1a32("ap"): {
-						if (config__ap(input, value_token, ap_config, ap_ip_info) != ESP_OK)
-							return ESP_FAIL;
-						break;
-					}
-					case fnv1a32("sta"): {
-						if (config__sta(input, value_token, sta_config, sta_ip_info, sta_static) != ESP_OK)
-							return ESP_FAIL;
-						break;
-					}
-					default:
-						ESP_LOGD(TAG_CONFIG_NETWORK, "Unknown field '%.*s', ignoring.", 
-							key_token->end - key_token->start, input + key_token->start);
-						break;
-				}
-
-				// Skip object
-				jsmntok_t* other = value_token + 1;
-				while(1) {
-					if (root->end < other->end)
-						goto done;
-					if (value_token->end < other->end) {
-						break;
-					}
-					other++;
-				}
-				token = other;
+esp_err_t radio_config_begin()
+{
+	configRadio = settings.radio;
+	return ESP_OK;
+}
+
+esp_err_t radio_config_end(bool apply)
+{
+	if (!apply) 
+		return ESP_OK;
+	portENTER_CRITICAL(&settingsLock);
+	settings.radio = configRadio;
+	portEXIT_CRITICAL(&settingsLock);
+	// Persisted together with rest of the networking settings, at its end
+	if (currentRadioProfile != RadioProfile::_Count)
+		apply_radio_profile(currentRadioProfile, true);
+	return ESP_OK;
+}
+
+template <RadioProfile profile>
+inline RadioProfileSettings& config_radio_profile()
+{
+	return configRadio.profiles[static_cast<uint8_t>(profile)];
+}
+
+template <RadioProfile profile>
+constexpr config::Field radioProfileConfigFields[] = {
+	config::string("ps", 
+		[] (const json::Field& field) {
+			auto& p = config_radio_profile<profile>();
+			switch (fnv1a32(field.value, field.valueLength)) {
+				case fnv1a32("none"): p.ps = WIFI_PS_NONE; break;
+				case fnv1a32("min"):  p.ps = WIFI_PS_MIN_MODEM; break;
+				case fnv1a32("max"):  p.ps = WIFI_PS_MAX_MODEM; break;
+				default:
+					return ESP_FAIL;
 			}
-			else {
-				if (unlikely(!has_simple_value(value_token)))
+			return ESP_OK;
+		},
+		[] {
+			switch (config_radio_profile<profile>().ps) {
+				case WIFI_PS_NONE:      return std::string_view("none");
+				case WIFI_PS_MIN_MODEM: return std::string_view("min");
+				case WIFI_PS_MAX_MODEM: return std::string_view("max");
+				default:                return std::string_view();
+			}
+		}
+	),
+	config::integer("bandwidth", 
+		[] (const json::Field& field) {
+			switch (std::atoi(field.value)) {
+				case 20: config_radio_profile<profile>().bandwidth = WIFI_BW_HT20; break;
+				case 40: config_radio_profile<profile>().bandwidth = WIFI_BW_HT40; break;
+				default:
 					return ESP_FAIL;
-
-				switch (key_hash) {
-					case fnv1a32("mode"): {
-						const uint32_t value_hash = fnv1a32(input + value_token->start, input + value_token->end);
-						switch (value_hash) {
-							case fnv1a32("sta"):   mode = WIFI_MODE_STA; break;
-							case fnv1a32("ap"):    mode = WIFI_MODE_AP; break;
-							case fnv1a32("nat"):
-							case fnv1a32("apsta"): mode = WIFI_MODE_APSTA; break;
-							default:
-								return ESP_FAIL;
-						}
-						break;
-					}
-					case fnv1a32("fallback"): {
-						fallbackTimeout = std::atoi(input + value_token->start) * 1000;
-						if (fallbackTimeout && fallbackTimeout < reconnectDelayWhenNoStations) {
-							ESP_LOGD(TAG_CONFIG_NETWORK, "Fallback timeout clamped to minimal value.");
-							fallbackTimeout = reconnectDelayWhenNoStations;
-						}
-						break;
-					}
-					default:
-						ESP_LOGD(TAG_CONFIG_NETWORK, "Unknown field '%.*s', ignoring.", 
-							key_token->end - key_token->start, input + key_token->start);
-						break;
-				}
-
-				// Skip primitive pair (key & value)
-				token += 2;
-				if (root->end < token->end)
-					goto done;
 			}
+			return ESP_OK;
+		},
+		[] { return static_cast<int32_t>(config_radio_profile<profile>().bandwidth == WIFI_BW_HT40 ? 40 : 20); }
+	),
+	config::number("txPower", // dBm
+		[] (const json::Field& field) {
+			const float dBm = std::atof(field.value);
+			config_radio_profile<profile>().txPower = std::clamp(static_cast<int>(dBm * 4), 8, 84);
+			return ESP_OK;
+		},
+		[] { return config_radio_profile<profile>().txPower / 4.0f; }
+	),
+};
+template <RadioProfile profile>
+constexpr config::Index radioProfileConfigIndex { radioProfileConfigFields<profile> };
+static_assert(radioProfileConfigIndex<RadioProfile::Active>.unique, "Keys hashes collision");
+template <RadioProfile profile>
+constexpr config::Object radioProfileConfigObject { radioProfileConfigFields<profile>, radioProfileConfigIndex<profile> };
+
+constexpr config::Field radioConfigFields[] = {
+	config::object("active", radioProfileConfigObject<RadioProfile::Active>),
+	config::object("idle",   radioProfileConfigObject<RadioProfile::Idle>),
+	config::integer("idleDelay", 
+		[] (const json::Field& field) {
+			configRadio.idleDelay = std::atoi(field.value);
+			return ESP_OK;
+		},
+		[] { return static_cast<int32_t>(configRadio.idleDelay); }
+	),
+	config::string("profile", nullptr, [] { return std::string_view(radio_profile_to_cstr(currentRadioProfile)); }),
+};
+constexpr config::Index radioConfigIndex { radioConfigFields };
+static_assert(radioConfigIndex.unique, "Keys hashes collision");
+constexpr config::Object radioConfigObject { radioConfigFields, radioConfigIndex, radio_config_begin, radio_config_end };
+
+constexpr config::Field configFields[] = {
+	config::string("mode", 
+		[] (const json::Field& field) {
+			switch (fnv1a32(field.value, field.valueLength)) {
+				case fnv1a32("sta"):   configSession.mode = WIFI_MODE_STA; break;
+				case fnv1a32("ap"):    configSession.mode = WIFI_MODE_AP; break;
+				case fnv1a32("nat"):
+				case fnv1a32("apsta"): configSession.mode = WIFI_MODE_APSTA; break;
+				default:
+					return ESP_FAIL;
+			}
+			return ESP_OK;
+		},
+		[] { 
+			const char* mode = wifi_mode_to_cstr(configSession.mode);
+			return std::string_view(mode ? mode : "");
 		}
-		done:
+	),
+	config::integer("fallback", 
+		[] (const json::Field& field) {
+			fallbackTimeout = std::atoi(field.value) * 1000;
+			if (fallbackTimeout && fallbackTimeout < reconnectDelayWhenNoStations) {
+				ESP_LOGD(TAG_CONFIG_NETWORK, "Fallback timeout clamped to minimal value.");
+				fallbackTimeout = reconnectDelayWhenNoStations;
+			}
+			return ESP_OK;
+		},
+		[] { return static_cast<int32_t>(fallbackTimeout / 1000); }
+	),
+	config::object("sta", staConfigObject),
+	config::object("ap",  apConfigObject),
+	config::object("radio", radioConfigObject),
+};
+constexpr config::Index configIndex { configFields };
+static_assert(configIndex.unique, "Keys hashes collision");
 
-		ESP_ERROR_CHECK_RETURN(save_ip_info_to_nvs(*nvs_handle, WIFI_IF_AP,  ap_ip_info));
-		ESP_ERROR_CHECK_RETURN(save_ip_info_to_nvs(*nvs_handle, WIFI_IF_STA, sta_ip_info));
-		ESP_ERROR_CHECK_RETURN(save_wifi_mode_to_nvs(*nvs_handle, mode));
-		ESP_ERROR_CHECK_RETURN(nvs_handle->set_item("fallback", reinterpret_cast<uint64_t&>(fallbackTimeout)));
-		ESP_ERROR_CHECK_RETURN(nvs_handle->set_item("sta.static", reinterpret_cast<uint8_t&>(sta_static)));
-		ESP_ERROR_CHECK_RETURN(nvs_handle->commit());
+/// Ends applying JSON configuration for networking, persisting and applying it.
+/// @param apply False if the request failed, to discard the changes.
+esp_err_t config_end(bool apply)
+{
+	auto& session = configSession;
+	auto& ap_config = session.ap_config;
+	auto& sta_config = session.sta_config;
+	auto& ap_ip_info = session.ap_ip_info;
+	auto& sta_ip_info = session.sta_ip_info;
+	const auto mode = session.mode;
+	const auto sta_static = session.sta_static;
+
+	if (!apply) {
+		// Fallback timeout is set directly, so restore it
+		fallbackTimeout = settings.fallbackTimeout;
+		return ESP_OK;
+	}
 
-		const bool use_ap  = mode == WIFI_MODE_AP  || mode == WIFI_MODE_APSTA;
-		const bool use_sta = mode == WIFI_MODE_STA || mode == WIFI_MODE_APSTA;
+	// Persisted later, after quiet period (see `commit_settings`)
+	update_settings({
+		.ap_ip_info = ap_ip_info,
+		.sta_ip_info = sta_ip_info,
+		.mode = mode,
+		.sta_static = sta_static,
+		.fallbackTimeout = fallbackTimeout,
+		.radio = settings.radio, // already updated, if changed
+	});
+
+	if (std::memcmp(&session, &loadedConfigSession, sizeof(ConfigSession)) == 0) {
+		ESP_LOGD(TAG_CONFIG_NETWORK, "No Wi-Fi changes to apply");
+		return ESP_OK;
+	}
 
-		// WiFi AP/STA specific config will persisted by WiFi component (`esp_wifi_set_config`)
+	const bool use_ap  = mode == WIFI_MODE_AP  || mode == WIFI_MODE_APSTA;
+	const bool use_sta = mode == WIFI_MODE_STA || mode == WIFI_MODE_APSTA;
 
-		// Stop reconnecting behaviour
-		unregisterDisconnectEventHandlers();
-		disconnectedTimestamp = 0;
-		xTimerStop(reconnectTimer, 0);
+	// WiFi AP/STA specific config will persisted by WiFi component (`esp_wifi_set_config`)
 
-		esp_wifi_disconnect();
-		esp_wifi_stop();
+	// Stop reconnecting behaviour
+	unregisterDisconnectEventHandlers();
+	disconnectedTimestamp = 0;
+	xTimerStop(reconnectTimer, 0);
 
-		if (!ap_netif)  ap_netif  = esp_netif_create_default_wifi_ap();
-		if (!sta_netif) sta_netif = esp_netif_create_default_wifi_sta();
+	esp_wifi_disconnect();
+	esp_wifi_stop();
 
-		esp_netif_dhcps_stop(ap_netif);
-		esp_netif_dhcpc_stop(sta_netif);
+	if (!ap_netif)  ap_netif  = esp_netif_create_default_wifi_ap();
+	if (!sta_netif) sta_netif = esp_netif_create_default_wifi_sta();
 
-		ESP_ERROR_CHECK_RETURN(esp_netif_set_ip_info(ap_netif, &ap_ip_info));
-		ESP_ERROR_CHECK_RETURN(esp_netif_set_ip_info(sta_netif, &sta_ip_info));
+	esp_netif_dhcps_stop(ap_netif);
+	esp_netif_dhcpc_stop(sta_netif);
 
-		// FIXME: need to update DHCP server addresses (incl. leases) if AP address was changed
+	ESP_ERROR_CHECK_RETURN(esp_netif_set_ip_info(ap_netif, &ap_ip_info));
+	ESP_ERROR_CHECK_RETURN(esp_netif_set_ip_info(sta_netif, &sta_ip_info));
 
-		esp_wifi_set_mode(WIFI_MODE_APSTA); // to allow setting config without error
-		ESP_ERROR_CHECK_RETURN(esp_wifi_set_config(WIFI_IF_AP,  reinterpret_cast<wifi_config_t*>(&ap_config)));
-		ESP_ERROR_CHECK_RETURN(esp_wifi_set_config(WIFI_IF_STA, reinterpret_cast<wifi_config_t*>(&sta_config)));
+	// FIXME: need to update DHCP server addresses (incl. leases) if AP address was changed
 
-		esp_wifi_set_mode(mode);
+	esp_wifi_set_mode(WIFI_MODE_APSTA); // to allow setting config without error
+	ESP_ERROR_CHECK_RETURN(esp_wifi_set_config(WIFI_IF_AP,  reinterpret_cast<wifi_config_t*>(&ap_config)));
+	ESP_ERROR_CHECK_RETURN(esp_wifi_set_config(WIFI_IF_STA, reinterpret_cast<wifi_config_t*>(&sta_config)));
 
-		if (use_ap) esp_netif_dhcps_start(ap_netif);
-		if (use_sta && !sta_static) esp_netif_dhcpc_start(sta_netif);
+	esp_wifi_set_mode(mode);
 
-		ESP_ERROR_CHECK_RETURN(registerDisconnectEventHandlers());
+	if (use_ap) esp_netif_dhcps_start(ap_netif);
+	if (use_sta && !sta_static) esp_netif_dhcpc_start(sta_netif);
 
-		esp_wifi_start();
-		// esp_wifi_connect(); on WIFI_EVENT_STA_START event
+	ESP_ERROR_CHECK_RETURN(registerDisconnectEventHandlers());
 
-		if (mode == WIFI_MODE_APSTA) {
-			// TODO: NAT
-		}
+	esp_wifi_start();
+	// esp_wifi_connect(); on WIFI_EVENT_STA_START event
 
-		// TODO: is restart necessary to apply the changes?
-		// TODO: use separate one-time task to apply all those changes, to allow for outputting response
+	apply_radio_profile(currentRadioProfile == RadioProfile::_Count ? RadioProfile::Active : currentRadioProfile, true);
 
-		ESP_LOGI(TAG_CONFIG_NETWORK, "Network config applied");
-		return ESP_OK;
+	if (mode == WIFI_MODE_APSTA) {
+		// TODO: NAT
 	}
 
-	if (output_return) {
-		*output_return = std::snprintf(
-			output, output_length,
-			"{"
-				"\"mode\":\"%s\","
-				"\"fallback\":%u,"
-				"\"sta\":{"
-					"\"ssid\":\"%.32s\","
-					"\"psk\":\"%.64s\","
-					"\"ip\":\"" IPSTR "\","
-					"\"mask\":%u,"
-					"\"gateway\":\"" IPSTR "\","
-					"\"static\":%c"
-				"},"
-				"\"ap\":{"
-					"\"ssid\":\"%.32s\","
-					"\"psk\":\"%.64s\","
-					"\"ip\":\"" IPSTR "\","
-					"\"mask\":%u,"
-					"\"gateway\":\"" IPSTR "\","
-					"\"channel\":%u,"
-					"\"hidden\":%c"
-				"}"
-			"}",
-			wifi_mode_to_cstr(mode),
-			static_cast<unsigned int>(fallbackTimeout / 1000),
-			/* network.sta */
-			sta_config.ssid,
-			sta_config.password,
-			IP2STR(&sta_ip_info.ip),
-			numberOfSetBits(sta_ip_info.netmask.addr),
-			IP2STR(&sta_ip_info.gw),
-			'0' + sta_static,
-			/* network.ap */
-			ap_config.ssid,
-			ap_config.password,
-			IP2STR(&ap_ip_info.ip),
-			numberOfSetBits(ap_ip_info.netmask.addr),
-			IP2STR(&ap_ip_info.gw),
-			ap_config.channel,
-			'0' + ap_config.ssid_hidden
-		);
-	}
+	// TODO: is restart necessary to apply the changes?
+	// TODO: use separate one-time task to apply all those changes, to allow for outputting response
 
+	ESP_LOGI(TAG_CONFIG_NETWORK, "Network config applied");
 	return ESP_OK;
 }
 
+/// Networking configuration, see `configFields`.
+extern const config::Object configObject { configFields, configIndex, config_begin, config_end, &configGeneration };
+
 ////////////////////////////////////////////////////////////////////////////////
 
 }
@@ -0,0 +1,133 @@
+#include <sdkconfig.h>
+#include <iterator>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include "pool.hpp"
+#include "metrics.hpp"
+
+namespace app::pool
+{
+
+static const char* TAG_POOL = "pool";
+
+struct Pool
+{
+	uint32_t caps;
+	uint32_t fallbackCaps; // used if allocation with the preferred ones failed, or 0
+	size_t granularity;    // allocations are rounded up, so slightly bigger frames fit again
+	Slot* slots;
+	uint8_t count;
+	portMUX_TYPE lock;
+};
+
+Slot internalSlots[6]; // line buffers for up to 4 stream clients and captures
+Slot largeSlots[8];    // send buffers for up to 4 stream clients, converted frames
+
+Pool pools[static_cast<uint8_t>(Kind::_Count)] = {
+	{
+		.caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+		.fallbackCaps = 0,
+		.granularity = 256,
+		.slots = internalSlots,
+		.count = std::size(internalSlots),
+		.lock = portMUX_INITIALIZER_UNLOCKED,
+	},
+	{
+#ifdef BOARD_HAS_PSRAM
+		.caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+		.fallbackCaps = MALLOC_CAP_8BIT,
+#else
+		.caps = MALLOC_CAP_8BIT,
+		.fallbackCaps = 0,
+#endif
+		.granularity = 16 * 1024,
+		.slots = largeSlots,
+		.count = std::size(largeSlots),
+		.lock = portMUX_INITIALIZER_UNLOCKED,
+	},
+};
+
+inline Pool& get(Kind kind)
+{
+	return pools[static_cast<uint8_t>(kind)];
+}
+
+void Buffer::reset()
+{
+	if (!slot) return;
+	Pool& pool = get(kind);
+	portENTER_CRITICAL(&pool.lock);
+	slot->used = false;
+	portEXIT_CRITICAL(&pool.lock);
+	slot = nullptr;
+}
+
+bool Buffer::reserve(size_t size)
+{
+	if (likely(slot->capacity >= size))
+		return true;
+	const Pool& pool = get(kind);
+	const size_t capacity = (size + pool.granularity - 1) / pool.granularity * pool.granularity;
+	// Free the old one first, to lower the peak usage
+	heap_caps_free(slot->data);
+	slot->data = static_cast<uint8_t*>(heap_caps_malloc(capacity, pool.caps));
+	if (unlikely(!slot->data && pool.fallbackCaps))
+		slot->data = static_cast<uint8_t*>(heap_caps_malloc(capacity, pool.fallbackCaps));
+	if (unlikely(!slot->data)) {
+		ESP_LOGE(TAG_POOL, "Failed to allocate %zu bytes", capacity);
+		slot->capacity = 0;
+		return false;
+	}
+	slot->capacity = capacity;
+	metrics::count(metrics::Counter::PoolAllocations);
+	return true;
+}
+
+Buffer acquire(Kind kind, size_t size)
+{
+	Pool& pool = get(kind);
+	Slot* best = nullptr;
+	portENTER_CRITICAL(&pool.lock);
+	for (uint8_t i = 0; i < pool.count; i++) {
+		Slot& s = pool.slots[i];
+		if (s.used) continue;
+		if (!best) {
+			best = &s;
+			continue;
+		}
+		// Smallest one that fits, or the largest one otherwise (to grow it)
+		const bool fits = s.capacity >= size;
+		const bool bestFits = best->capacity >= size;
+		if (fits ? (!bestFits || s.capacity < best->capacity) : (!bestFits && s.capacity > best->capacity))
+			best = &s;
+	}
+	if (best) 
+		best->used = true;
+	portEXIT_CRITICAL(&pool.lock);
+
+	if (unlikely(!best)) {
+		ESP_LOGW(TAG_POOL, "No free buffers in the pool");
+		return {};
+	}
+	Buffer buffer { kind, best };
+	if (unlikely(!buffer.reserve(size)))
+		return {};
+	return buffer;
+}
+
+Stats getStats(Kind kind)
+{
+	Pool& pool = get(kind);
+	Stats stats = { .count = pool.count };
+	portENTER_CRITICAL(&pool.lock);
+	for (uint8_t i = 0; i < pool.count; i++) {
+		const Slot& s = pool.slots[i];
+		stats.capacity += s.capacity;
+		stats.used += s.used;
+		stats.allocated += s.capacity != 0;
+	}
+	portEXIT_CRITICAL(&pool.lock);
+	return stats;
+}
+
+}
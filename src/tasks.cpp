@@ -0,0 +1,91 @@
+#include <sdkconfig.h>
+#include <cinttypes>
+#include <esp_log.h>
+#include "tasks.hpp"
+
+namespace app::tasks
+{
+
+#if CONFIG_APP_TASKS_BENCHMARK
+
+static const char* TAG_TASKS = "tasks";
+
+constexpr UBaseType_t maxTasks = 32;
+constexpr TickType_t benchmarkInterval = CONFIG_APP_TASKS_BENCHMARK_INTERVAL / portTICK_PERIOD_MS;
+
+struct Sample
+{
+	TaskHandle_t handle;
+	configRUN_TIME_COUNTER_TYPE runTime;
+};
+
+TaskStatus_t statuses[maxTasks];
+Sample previous[maxTasks];
+UBaseType_t previousCount = 0;
+configRUN_TIME_COUNTER_TYPE previousTotal = 0;
+
+/// Returns run time of the task in previous sample, or 0 if it didn't exist then.
+configRUN_TIME_COUNTER_TYPE previous_run_time(TaskHandle_t handle)
+{
+	for (UBaseType_t i = 0; i < previousCount; i++)
+		if (previous[i].handle == handle)
+			return previous[i].runTime;
+	return 0;
+}
+
+/// Logs CPU usage of every task (as share of single core) since the previous 
+/// report, with load of each core (derived from its idle task).
+void report()
+{
+	configRUN_TIME_COUNTER_TYPE total;
+	const UBaseType_t count = uxTaskGetSystemState(statuses, maxTasks, &total);
+	if (unlikely(count == 0)) {
+		ESP_LOGW(TAG_TASKS, "Too many tasks to report");
+		return;
+	}
+	const configRUN_TIME_COUNTER_TYPE elapsed = total - previousTotal;
+	if (previousTotal != 0 && elapsed != 0) {
+		float idle[portNUM_PROCESSORS] = {};
+		for (UBaseType_t i = 0; i < count; i++) {
+			const TaskStatus_t& s = statuses[i];
+			const float usage = 100.0f * (s.ulRunTimeCounter - previous_run_time(s.xHandle)) / elapsed;
+			const BaseType_t core = xTaskGetCoreID(s.xHandle);
+			if (s.xHandle == xTaskGetIdleTaskHandleForCore(0)) idle[0] = usage;
+#if portNUM_PROCESSORS > 1
+			if (s.xHandle == xTaskGetIdleTaskHandleForCore(1)) idle[1] = usage;
+#endif
+			ESP_LOGI(TAG_TASKS, "%-16s %-4s prio %2u %6.2f%% stack free %" PRIu32,
+				s.pcTaskName, core == tskNO_AFFINITY ? "any" : (core == 0 ? "CPU0" : "CPU1"),
+				s.uxCurrentPriority, usage, static_cast<uint32_t>(s.usStackHighWaterMark));
+		}
+		for (uint8_t c = 0; c < portNUM_PROCESSORS; c++)
+			ESP_LOGI(TAG_TASKS, "CPU%u load %.2f%%", c, 100.0f - idle[c]);
+	}
+
+	for (UBaseType_t i = 0; i < count; i++)
+		previous[i] = { statuses[i].xHandle, statuses[i].ulRunTimeCounter };
+	previousCount = count;
+	previousTotal = total;
+}
+
+void benchmark_loop(void*)
+{
+	for (;;) {
+		report();
+		vTaskDelay(benchmarkInterval);
+	}
+}
+
+void init()
+{
+	xTaskCreatePinnedToCore(benchmark_loop, "tasks-bench", 3 * 1024, nullptr, 1, nullptr, tskNO_AFFINITY);
+}
+
+#else
+
+void init()
+{}
+
+#endif
+
+}
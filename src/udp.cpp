@@ -1,14 +1,20 @@
 #include <sdkconfig.h>
 #include <cstring>
+#include <cinttypes>
+#include <limits>
+#include <algorithm>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp_wifi.h>
 #include <lwip/sockets.h>
 #include <lwip/def.h>
 #include "udp.hpp"
 #include "control.hpp"
-
-// Ugly way to force debug & verbose logs to appear, see README > Known issues.
-#undef ESP_LOGD
-#define ESP_LOGD(...) ESP_LOGI(__VA_ARGS__)
+#include "camera.hpp"
+#include "metrics.hpp"
+#include "vision.hpp"
+#include "tasks.hpp"
 
 namespace app::udp
 {
@@ -24,37 +30,122 @@ toFloatMotorDuty(T value, bool backwards)
 	return (backwards ? -a : a) / std::numeric_limits<T>::max();
 }
 
-void handlePacket(const UnknownPacket& packet)
+/// Converts control packet to command for the control loop.
+/// Returns false for packets of other types.
+bool toCommand(const UnknownPacket& packet, control::Command& command)
 {
 	using namespace control;
 	switch (packet.type) {
 		case PacketType::ShortControl: {
 			const auto& v = packet.asShortControl;
-			ESP_LOGD(TAG, "ShortControlPacket: F:%02X L:%u R:%u ", 
+			ESP_LOGV(TAG, "ShortControlPacket: F:%02X L:%u R:%u ", 
 				v.flags, v.leftDuty, v.rightDuty);
-			setMainLight(v.mainLight);
-			setOtherLight(v.otherLight);
-			setMotor(Motor::Left,  toFloatMotorDuty(v.leftDuty, v.leftBackward));
-			setMotor(Motor::Right, toFloatMotorDuty(v.rightDuty, v.rightBackward));
-			refresh();
-			return;
+			command = {
+				.fields = Command::All,
+				.mainLight = v.mainLight,
+				.otherLight = v.otherLight,
+				.left  = toFloatMotorDuty(v.leftDuty, v.leftBackward),
+				.right = toFloatMotorDuty(v.rightDuty, v.rightBackward),
+			};
+			return true;
 		}
 		case PacketType::LongControl: {
 			const auto& v = packet.asLongControl;
-			ESP_LOGD(TAG, "LongControlPacket: F:%02X T:%ums L:%.2f R:%.2f ", 
+			ESP_LOGV(TAG, "LongControlPacket: F:%02X T:%ums L:%.2f R:%.2f ", 
 				v.flags, v.smoothingTime, v.targetLeftDuty, v.targetRightDuty);
-			setMainLight(v.mainLight);
-			setOtherLight(v.otherLight);
-			setMotor(Motor::Left,  v.targetLeftDuty);
-			setMotor(Motor::Right, v.targetRightDuty);
-			refresh();
-			// TODO: implement smooth phasing
-			return;
+			command = {
+				.fields = Command::All,
+				.mainLight = v.mainLight,
+				.otherLight = v.otherLight,
+				.profile = v.sCurve ? SmoothingProfile::SCurve : SmoothingProfile::Linear,
+				.smoothingTime = v.smoothingTime,
+				.left  = v.targetLeftDuty,
+				.right = v.targetRightDuty,
+			};
+			return true;
+		}
+		case PacketType::SequencedControl: {
+			const auto& v = packet.asSequencedControl;
+			ESP_LOGV(TAG, "SequencedControlPacket: #%" PRIu32 " @%" PRIu32 " F:%02X T:%ums L:%.2f R:%.2f ", 
+				v.sequence, v.timestamp, v.flags, v.smoothingTime, v.targetLeftDuty, v.targetRightDuty);
+			command = {
+				.fields = Command::All,
+				.mainLight = v.mainLight,
+				.otherLight = v.otherLight,
+				.profile = v.sCurve ? SmoothingProfile::SCurve : SmoothingProfile::Linear,
+				.smoothingTime = v.smoothingTime,
+				.left  = v.targetLeftDuty,
+				.right = v.targetRightDuty,
+			};
+			return true;
 		}
+		default:
+			break;
 	}
 	ESP_LOGW(TAG, "Invalid packet!");
+	return false;
+}
+
+/// Returns expected length of the packet, or 0 for unknown type.
+constexpr size_t getPacketLength(PacketType type)
+{
+	switch (type) {
+		case PacketType::ShortControl:     return sizeof(ShortControlPacket);
+		case PacketType::LongControl:      return sizeof(LongControlPacket);
+		case PacketType::SequencedControl: return sizeof(SequencedControlPacket);
+		case PacketType::TelemetrySubscribe: return sizeof(TelemetrySubscribePacket);
+		case PacketType::Telemetry:        return 0; // only sent
+		case PacketType::VideoSubscribe:   return sizeof(VideoSubscribePacket);
+		case PacketType::VideoFragment:    return 0; // only sent
+		case PacketType::Vision:           return 0; // only sent
+		case PacketType::Batch:            return sizeof(BatchHeader); // at least
+		case PacketType::Ack:              return 0; // only sent
+	}
+	return 0;
+}
+
+////////////////////////////////////////
+// Statistics
+
+portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
+uint32_t statsSecond; // uptime in seconds for the current counters
+PacketsStats currentStats;
+PacketsStats lastStats;
+
+/// Moves to next second of statistics, if necessary. Requires the lock.
+void rolloverStats(uint32_t second)
+{
+	if (second == statsSecond) return;
+	lastStats = (second == statsSecond + 1) ? currentStats : PacketsStats {};
+	currentStats = {};
+	statsSecond = second;
+}
+
+void countStats(const PacketsStats& batch)
+{
+	const uint32_t second = esp_timer_get_time() / 1'000'000;
+	portENTER_CRITICAL(&statsLock);
+	rolloverStats(second);
+	currentStats.received  += batch.received;
+	currentStats.stale     += batch.stale;
+	currentStats.coalesced += batch.coalesced;
+	currentStats.applied   += batch.applied;
+	portEXIT_CRITICAL(&statsLock);
+}
+
+PacketsStats getPacketsStats()
+{
+	const uint32_t second = esp_timer_get_time() / 1'000'000;
+	portENTER_CRITICAL(&statsLock);
+	rolloverStats(second);
+	const PacketsStats stats = lastStats;
+	portEXIT_CRITICAL(&statsLock);
+	return stats;
 }
 
+////////////////////////////////////////
+// Socket
+
 const struct sockaddr_in server_addr = {
 	.sin_family = AF_INET,
 	.sin_port = PP_HTONS(UDP_PORT),
@@ -64,14 +155,570 @@ const struct sockaddr_in server_addr = {
 };
 static_assert(sizeof(sockaddr_in) == sizeof(sockaddr));
 
-#if UDP_TIMEOUT > 0
-const struct timeval timeout = {
-	.tv_sec  = UDP_TIMEOUT / 1'000'000,
-	.tv_usec = UDP_TIMEOUT % 1'000'000,
+int sock = -1;
+
+/// Client to send packets back to: address for the UDP socket, 
+/// or handle with sender of other transport (see `handlePacket`).
+struct Client {
+	struct sockaddr_in address;
+	Sender sender; // or null for the UDP socket
+	int handle;
+
+	bool operator==(const Client& other) const {
+		if (sender || other.sender) 
+			return sender == other.sender && handle == other.handle;
+		return address.sin_addr.s_addr == other.address.sin_addr.s_addr && address.sin_port == other.address.sin_port;
+	}
 };
-#endif
 
-int sock = -1;
+/// Sends the packet to the client. Returns false on failure (or if the client is gone).
+bool sendTo(const Client& client, const void* data, size_t length)
+{
+	if (client.sender)
+		return client.sender(client.handle, data, length);
+	return sendto(sock, data, length, 0, reinterpret_cast<const sockaddr*>(&client.address), sizeof(client.address)) >= 0;
+}
+
+////////////////////////////////////////
+// Sequencing
+
+constexpr uint32_t sequenceResetTime = 1'000; // ms
+
+/// Max number of clients with sequence tracked at once, least recently seen is forgotten.
+constexpr uint8_t maxSequencedClients = 4;
+/// Time after which sequence of silent client is forgotten.
+constexpr uptime_t sequenceExpiryTime = 10'000'000; // us
+
+/// Last accepted sequence (and client timestamp) of the client, as each
+/// client has its own counter & clock.
+struct ClientSequence {
+	Client client;
+	uint32_t sequence;
+	uint32_t timestamp;
+	uptime_t seen; // us, or 0 if unused
+};
+
+portMUX_TYPE sequenceLock = portMUX_INITIALIZER_UNLOCKED; // shared with other transports
+ClientSequence clientSequences[maxSequencedClients];
+
+/// Checks whenever the sequenced packet is reordered or outdated. 
+/// Sequence going back is accepted if the timestamp moved forward noticeably,
+/// which suggests the client was restarted. Uses wrap-around safe comparisons.
+bool isStale(const ClientSequence& last, uint32_t sequence, uint32_t timestamp)
+{
+	if (static_cast<int32_t>(sequence - last.sequence) > 0) 
+		return false;
+	return static_cast<int32_t>(timestamp - last.timestamp) < static_cast<int32_t>(sequenceResetTime);
+}
+
+/// Marks the sequenced packet as the last one of the client, unless it is stale 
+/// (see `isStale`). Returns false for stale ones, which should be dropped.
+bool acceptSequence(const Client& client, uint32_t sequence, uint32_t timestamp)
+{
+	const uptime_t now = esp_timer_get_time();
+	bool stale = false;
+	portENTER_CRITICAL(&sequenceLock);
+	ClientSequence* slot = nullptr;
+	ClientSequence* oldest = &clientSequences[0];
+	for (auto& s : clientSequences) {
+		if (s.seen && now - s.seen > sequenceExpiryTime) 
+			s.seen = 0;
+		if (s.seen && s.client == client) {
+			slot = &s;
+			break;
+		}
+		if (oldest->seen && (!s.seen || s.seen < oldest->seen)) 
+			oldest = &s;
+	}
+	if (slot) 
+		stale = isStale(*slot, sequence, timestamp);
+	else
+		slot = oldest; // unused or least recently seen
+	if (!stale) {
+		slot->client = client;
+		slot->sequence = sequence;
+		slot->timestamp = timestamp;
+		slot->seen = std::max<uptime_t>(now, 1);
+	}
+	portEXIT_CRITICAL(&sequenceLock);
+	return !stale;
+}
+
+////////////////////////////////////////
+// Telemetry
+
+constexpr uint8_t maxTelemetrySubscribers = 4;
+constexpr uint16_t minTelemetryInterval = 10; // ms, single FreeRTOS tick
+constexpr uptime_t telemetrySubscriptionTimeout = 10'000'000; // us, unless renewed
+
+struct TelemetrySubscriber {
+	Client client;
+	uptime_t interval; // us, or 0 if unused
+	uptime_t next;     // us
+	uptime_t expires;  // us
+	uint32_t visionFrame; // of the last vision results sent
+};
+
+portMUX_TYPE telemetryLock = portMUX_INITIALIZER_UNLOCKED;
+TelemetrySubscriber telemetrySubscribers[maxTelemetrySubscribers];
+TaskHandle_t telemetryTask;
+
+void subscribe(const Client& client, uint16_t interval)
+{
+	const uptime_t now = esp_timer_get_time();
+	TelemetrySubscriber* slot = nullptr;
+	portENTER_CRITICAL(&telemetryLock);
+	for (auto& s : telemetrySubscribers) {
+		if (s.interval && s.client == client) {
+			slot = &s;
+			break;
+		}
+	}
+	if (!slot && interval) {
+		for (auto& s : telemetrySubscribers) {
+			if (!s.interval) {
+				slot = &s;
+				break;
+			}
+		}
+	}
+	if (slot) {
+		if (interval) {
+			if (!slot->interval) 
+				slot->visionFrame = 0; // new subscriber
+			slot->client = client;
+			slot->interval = static_cast<uptime_t>(std::max(interval, minTelemetryInterval)) * 1000;
+			slot->next = now;
+			slot->expires = now + telemetrySubscriptionTimeout;
+		}
+		else {
+			slot->interval = 0;
+		}
+	}
+	portEXIT_CRITICAL(&telemetryLock);
+
+	if (!slot && interval) {
+		ESP_LOGW(TAG, "Too many telemetry subscribers");
+		return;
+	}
+	xTaskNotifyGive(telemetryTask);
+}
+
+void fill_telemetry(TelemetryPacket& packet)
+{
+	wifi_ap_record_t ap;
+	if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+		ap.rssi = 0;
+	}
+	const auto latency = control::getLatencyStats().average;
+
+	packet.type = PacketType::Telemetry;
+	packet.flags = 0;
+	packet.mainLight = control::getMainLight();
+	packet.otherLight = control::getOtherLight();
+	packet.rssi = ap.rssi;
+	packet.sequence += 1;
+	packet.uptime = esp_timer_get_time();
+	packet.leftDuty = control::getMotor(control::Motor::Left);
+	packet.rightDuty = control::getMotor(control::Motor::Right);
+	packet.freeHeap = esp_get_free_heap_size();
+	packet.frameRate = camera::getFrameRate();
+	packet.controlLatency = std::min<uint32_t>(latency, std::numeric_limits<uint16_t>::max());
+}
+
+/// Fills the packet with the latest vision results. Returns false if there are none yet.
+bool fill_vision(VisionPacket& packet)
+{
+	const auto results = vision::getResults();
+	if (results.frame == 0)
+		return false;
+	if (results.frame == packet.frame) 
+		return true; // already filled
+	packet.type = PacketType::Vision;
+	packet._reserved = 0;
+	packet.processingTime = std::min<uint32_t>(results.processingTime, std::numeric_limits<uint16_t>::max());
+	packet.frame = results.frame;
+	packet.timestamp = results.timestamp;
+	packet.width = results.width;
+	packet.height = results.height;
+	packet.darkPixels = results.darkPixels;
+	packet.changedPixels = results.changedPixels;
+	packet.centroidX = results.centroidX;
+	packet.centroidY = results.centroidY;
+	packet.boxLeft = results.boxLeft;
+	packet.boxTop = results.boxTop;
+	packet.boxRight = results.boxRight;
+	packet.boxBottom = results.boxBottom;
+	packet._reserved2 = 0;
+	return true;
+}
+
+/// Pushes telemetry packets to the subscribers, sleeping until next one is due.
+void telemetry_loop(void*)
+{
+	TelemetryPacket packet = {};
+	VisionPacket visionPacket = {};
+	struct Due {
+		Client client;
+		bool vision; // new vision results for the subscriber
+	};
+	Due due[maxTelemetrySubscribers];
+	for (;;) {
+		const uptime_t now = esp_timer_get_time();
+		uptime_t earliest = std::numeric_limits<uptime_t>::max();
+		uint8_t dueCount = 0;
+		// Tracked per subscriber, as they are due at different times
+		const bool hasVision = fill_vision(visionPacket);
+		portENTER_CRITICAL(&telemetryLock);
+		for (auto& s : telemetrySubscribers) {
+			if (!s.interval) continue;
+			if (s.expires < now) {
+				s.interval = 0;
+				continue;
+			}
+			if (s.next <= now) {
+				const bool vision = hasVision && s.visionFrame != visionPacket.frame;
+				if (vision) 
+					s.visionFrame = visionPacket.frame;
+				due[dueCount++] = { s.client, vision };
+				// Skip missed ones instead of bursting them
+				s.next = std::max(s.next + s.interval, now + s.interval / 2);
+			}
+			earliest = std::min(earliest, s.next);
+		}
+		portEXIT_CRITICAL(&telemetryLock);
+
+		if (dueCount) {
+			fill_telemetry(packet);
+			for (uint8_t i = 0; i < dueCount; i++) {
+				if (!sendTo(due[i].client, &packet, sizeof(packet)) && due[i].client.sender) 
+					subscribe(due[i].client, 0); // gone, not only busy like UDP socket
+			}
+			for (uint8_t i = 0; i < dueCount; i++) {
+				if (due[i].vision) 
+					sendTo(due[i].client, &visionPacket, sizeof(visionPacket));
+			}
+		}
+
+		TickType_t wait = portMAX_DELAY;
+		if (earliest != std::numeric_limits<uptime_t>::max()) {
+			const uptime_t remaining = earliest - std::min(earliest, esp_timer_get_time());
+			wait = (remaining + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000);
+		}
+		ulTaskNotifyTake(pdTRUE, wait);
+	}
+}
+
+////////////////////////////////////////
+// Video
+
+constexpr uint8_t maxVideoSubscribers = 2;
+constexpr uint16_t minVideoFragmentLength = 256;
+constexpr uptime_t videoSubscriptionTimeout = 10'000'000; // us, unless renewed
+constexpr TickType_t videoFrameTimeout = 1000 / portTICK_PERIOD_MS;
+
+struct VideoSubscriber {
+	struct sockaddr_in address;
+	uint16_t fragmentLength; // bytes, or 0 if unused
+	uptime_t expires; // us
+};
+
+portMUX_TYPE videoLock = portMUX_INITIALIZER_UNLOCKED;
+VideoSubscriber videoSubscribers[maxVideoSubscribers];
+TaskHandle_t videoTask;
+
+void subscribeVideo(const struct sockaddr_in& address, uint16_t fragmentLength)
+{
+	const bool unsubscribe = fragmentLength == 0xFFFF;
+	if (fragmentLength == 0 || fragmentLength > maxVideoFragmentLength)
+		fragmentLength = maxVideoFragmentLength;
+	fragmentLength = std::max(fragmentLength, minVideoFragmentLength);
+
+	VideoSubscriber* slot = nullptr;
+	portENTER_CRITICAL(&videoLock);
+	for (auto& s : videoSubscribers) {
+		if (s.fragmentLength && s.address.sin_addr.s_addr == address.sin_addr.s_addr && s.address.sin_port == address.sin_port) {
+			slot = &s;
+			break;
+		}
+	}
+	if (!slot && !unsubscribe) {
+		for (auto& s : videoSubscribers) {
+			if (!s.fragmentLength) {
+				slot = &s;
+				break;
+			}
+		}
+	}
+	if (slot) {
+		if (unsubscribe) {
+			slot->fragmentLength = 0;
+		}
+		else {
+			slot->address = address;
+			slot->fragmentLength = fragmentLength;
+			slot->expires = esp_timer_get_time() + videoSubscriptionTimeout;
+		}
+	}
+	portEXIT_CRITICAL(&videoLock);
+
+	if (!slot && !unsubscribe) {
+		ESP_LOGW(TAG, "Too many video subscribers");
+		return;
+	}
+	xTaskNotifyGive(videoTask);
+}
+
+/// Copies active video subscribers, dropping expired ones. Returns their count.
+uint8_t collectVideoSubscribers(VideoSubscriber (&active)[maxVideoSubscribers])
+{
+	const uptime_t now = esp_timer_get_time();
+	uint8_t count = 0;
+	portENTER_CRITICAL(&videoLock);
+	for (auto& s : videoSubscribers) {
+		if (!s.fragmentLength) continue;
+		if (s.expires < now) {
+			s.fragmentLength = 0;
+			continue;
+		}
+		active[count++] = s;
+	}
+	portEXIT_CRITICAL(&videoLock);
+	return count;
+}
+
+uint8_t videoDatagram[maxVideoDatagramLength];
+
+/// Sends the frame as fragments. Gives up on the frame (leaving it incomplete,
+/// to be dropped by the receiver) if the network buffers are full, 
+/// instead of holding up newer frames.
+bool sendVideoFrame(const VideoSubscriber& subscriber, const camera_fb_t* fb, uint32_t frame)
+{
+	auto& header = *reinterpret_cast<VideoFragmentHeader*>(videoDatagram);
+	header.type = PacketType::VideoFragment;
+	header.pixformat = fb->format;
+	header.fragmentsCount = (fb->len + subscriber.fragmentLength - 1) / subscriber.fragmentLength;
+	header.width = fb->width;
+	header.height = fb->height;
+	header._reserved = 0;
+	header.frame = frame;
+	header.length = fb->len;
+	header.timestamp = static_cast<int64_t>(fb->timestamp.tv_sec) * 1'000'000 + fb->timestamp.tv_usec;
+
+	uint32_t offset = 0;
+	for (uint16_t fragment = 0; fragment < header.fragmentsCount; fragment++) {
+		const size_t length = std::min<size_t>(fb->len - offset, subscriber.fragmentLength);
+		header.fragment = fragment;
+		header.offset = offset;
+		std::memcpy(videoDatagram + sizeof(VideoFragmentHeader), fb->buf + offset, length);
+		const auto* address = reinterpret_cast<const sockaddr*>(&subscriber.address);
+		const size_t datagramLength = sizeof(VideoFragmentHeader) + length;
+		if (sendto(sock, videoDatagram, datagramLength, 0, address, sizeof(subscriber.address)) < 0) {
+			if (errno != ENOMEM && errno != EAGAIN) return false;
+			// Let the Wi-Fi drain the buffers, but only once per fragment
+			vTaskDelay(1);
+			if (sendto(sock, videoDatagram, datagramLength, 0, address, sizeof(subscriber.address)) < 0) {
+				ESP_LOGD(TAG, "Dropping video frame #%" PRIu32 ", errno %d", frame, errno);
+				return false;
+			}
+		}
+		offset += length;
+	}
+	return true;
+}
+
+/// Pushes frames from the shared capture loop to the video subscribers. 
+/// Registered in the capture loop only while anyone is subscribed.
+void video_loop(void*)
+{
+	VideoSubscriber active[maxVideoSubscribers];
+	for (;;) {
+		if (!collectVideoSubscribers(active)) {
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+
+		camera::FrameSubscriber subscriber;
+		if (!subscriber) {
+			ESP_LOGW(TAG, "Failed to subscribe for video frames");
+			ulTaskNotifyTake(pdTRUE, videoFrameTimeout);
+			continue;
+		}
+		while (const uint8_t count = collectVideoSubscribers(active)) {
+			auto fb = subscriber.next(videoFrameTimeout);
+			if (unlikely(!fb)) continue;
+			for (uint8_t i = 0; i < count; i++) {
+				if (sendVideoFrame(active[i], fb, fb.sequence()))
+					metrics::count(metrics::Counter::UdpVideoFramesSent);
+				else
+					metrics::count(metrics::Counter::UdpVideoFramesDropped);
+			}
+		}
+	}
+}
+
+////////////////////////////////////////
+// Batches (protocol v2)
+
+/// State of handling single batch.
+struct BatchContext {
+	const Client& client;
+	control::Command command; // gathered from the commands, handled like single control packet
+	uint8_t accepted;
+	uint8_t rejected;
+	bool ack;
+};
+
+/// Handles command payload, returns false if it was rejected.
+using CommandHandler = bool (*)(const void* payload, BatchContext& context);
+
+struct CommandDescriptor {
+	uint8_t minLength; // of the payload, shorter commands are rejected
+	uint8_t length;    // of the payload structure, longer payloads are truncated
+	CommandHandler handler;
+};
+
+/// Describes command with payload of given type, handled by given function.
+template <typename T, bool (*handler)(const T&, BatchContext&)>
+constexpr CommandDescriptor describe(uint8_t minLength = sizeof(T))
+{
+	return { minLength, sizeof(T), [] (const void* payload, BatchContext& context) {
+		return handler(*static_cast<const T*>(payload), context);
+	} };
+}
+
+bool handle_motors(const MotorsCommand& v, BatchContext& context)
+{
+	auto& command = context.command;
+	command.fields |= control::Command::Motors;
+	command.profile = v.sCurve ? control::SmoothingProfile::SCurve : control::SmoothingProfile::Linear;
+	command.smoothingTime = v.smoothingTime;
+	command.left = v.left;
+	command.right = v.right;
+	return true;
+}
+
+bool handle_lights(const LightsCommand& v, BatchContext& context)
+{
+	auto& command = context.command;
+	if (v.mask & 1) {
+		command.fields |= control::Command::MainLight;
+		command.mainLight = v.values & 1;
+	}
+	if (v.mask & 2) {
+		command.fields |= control::Command::OtherLight;
+		command.otherLight = v.values & 2;
+	}
+	return true;
+}
+
+bool handle_camera_quality(const CameraQualityCommand& v, BatchContext&)
+{
+	camera::setStreamQuality(v.quality);
+	return true;
+}
+
+bool handle_telemetry_subscribe(const TelemetrySubscribeCommand& v, BatchContext& context)
+{
+	subscribe(context.client, v.interval);
+	return true;
+}
+
+bool handle_video_subscribe(const VideoSubscribeCommand& v, BatchContext& context)
+{
+	if (context.client.sender)
+		return false; // only by UDP socket
+	subscribeVideo(context.client.address, v.fragmentLength);
+	return true;
+}
+
+bool handle_ping(const uint8_t&, BatchContext& context)
+{
+	context.ack = true;
+	return true;
+}
+
+/// Commands by their type, see `CommandType`.
+constexpr CommandDescriptor commandDescriptors[] = {
+	{}, // none
+	describe<MotorsCommand, handle_motors>(),
+	describe<LightsCommand, handle_lights>(),
+	describe<CameraQualityCommand, handle_camera_quality>(),
+	describe<TelemetrySubscribeCommand, handle_telemetry_subscribe>(),
+	describe<VideoSubscribeCommand, handle_video_subscribe>(),
+	describe<uint8_t, handle_ping>(0),
+};
+static_assert(std::size(commandDescriptors) == static_cast<size_t>(CommandType::_Count));
+
+void sendAck(const BatchHeader& header, const BatchContext& context, AckStatus status, uptime_t received)
+{
+	const uptime_t now = esp_timer_get_time();
+	const AckPacket ack = {
+		.type = PacketType::Ack,
+		.status = status,
+		.accepted = context.accepted,
+		.rejected = context.rejected,
+		.sequence = header.sequence,
+		.timestamp = header.timestamp,
+		.processingTime = static_cast<uint32_t>(now - received),
+		.uptime = now,
+	};
+	if (!sendTo(context.client, &ack, sizeof(ack)))
+		ESP_LOGD(TAG, "Failed to send ack, errno %d", errno);
+	else
+		metrics::count(metrics::Counter::UdpAcksSent);
+}
+
+/// Dispatches commands of the batch (using `commandDescriptors`), gathering
+/// the control ones into single command. Returns status other than `Ok` if the batch was dropped.
+AckStatus handleBatch(const UnknownPacket& packet, size_t length, BatchContext& context, uptime_t received)
+{
+	const auto& header = packet.asBatch;
+	context.ack = header.ack;
+	if (unlikely(header.version != batchProtocolVersion)) {
+		ESP_LOGW(TAG, "Unsupported batch version: %u", header.version);
+		if (context.ack)
+			sendAck(header, context, AckStatus::UnsupportedVersion, received);
+		return AckStatus::UnsupportedVersion;
+	}
+	if (header.sequenced && !acceptSequence(context.client, header.sequence, header.timestamp)) {
+		if (context.ack)
+			sendAck(header, context, AckStatus::Stale, received);
+		return AckStatus::Stale;
+	}
+
+	size_t offset = sizeof(BatchHeader);
+	while (offset + sizeof(CommandHeader) <= length) {
+		CommandHeader command;
+		std::memcpy(&command, packet.buffer + offset, sizeof(command));
+		offset += sizeof(command);
+		if (unlikely(offset + command.length > length)) {
+			context.rejected += 1; // truncated
+			break;
+		}
+		const uint8_t index = static_cast<uint8_t>(command.type);
+		const CommandDescriptor* descriptor = index < std::size(commandDescriptors) ? &commandDescriptors[index] : nullptr;
+		if (unlikely(!descriptor || !descriptor->handler || command.length < descriptor->minLength)) {
+			ESP_LOGD(TAG, "Invalid command %u (length %u)", index, command.length);
+			context.rejected += 1;
+		}
+		else {
+			// Copied, as payloads are unaligned; missing optional fields are zeroed
+			alignas(4) uint8_t payload[16] = {};
+			std::memcpy(payload, packet.buffer + offset, std::min<size_t>(command.length, descriptor->length));
+			if (descriptor->handler(payload, context))
+				context.accepted += 1;
+			else
+				context.rejected += 1;
+		}
+		offset += command.length;
+	}
+	metrics::recordSince(metrics::Histogram::UdpBatchProcess, received);
+	metrics::count(metrics::Counter::UdpBatches);
+	if (context.ack)
+		sendAck(header, context, AckStatus::Ok, received);
+	return AckStatus::Ok;
+}
 
 /// Shutdowns the UDP socket
 void destroy()
@@ -101,14 +748,6 @@ void init()
 	}
 	ESP_LOGV(TAG, "Socket created");
 
-#if UDP_TIMEOUT > 0
-	// Set timeout
-	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-#else
-	// Set non-blocking
-	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
-#endif
-
 	// Try to reuse address & port
 	ret = 1; // reuse the variable (well, before using it, so it's pre-use, isn't it?)
 	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &ret, sizeof(int));
@@ -122,31 +761,138 @@ void init()
 		return;
 	}
 	ESP_LOGV(TAG, "Socket bound, port %d", UDP_PORT);
+
+	if (!telemetryTask) {
+		tasks::create(telemetry_loop, "telemetry", 3 * 1024, nullptr, tasks::telemetry, &telemetryTask);
+	}
+	if (!videoTask) {
+		tasks::create(video_loop, "udp-video", 3 * 1024, nullptr, tasks::udpVideo, &videoTask);
+	}
+}
+
+/// Handles single received packet (already checked to be of expected length).
+/// Subscriptions and other commands are applied right away. Returns true
+/// if there is control command (to be coalesced with other ones).
+bool dispatch(const UnknownPacket& packet, size_t length, const Client& client, PacketsStats& batch, control::Command& command)
+{
+	if (packet.type == PacketType::TelemetrySubscribe) {
+		subscribe(client, packet.asTelemetrySubscribe.interval);
+		return false;
+	}
+	if (packet.type == PacketType::VideoSubscribe) {
+		if (client.sender) 
+			ESP_LOGD(TAG, "Video subscriptions only by UDP socket");
+		else
+			subscribeVideo(client.address, packet.asVideoSubscribe.fragmentLength);
+		return false;
+	}
+
+	if (packet.type == PacketType::Batch) {
+		// Other commands are applied right away, only control ones get coalesced
+		BatchContext context { .client = client, .command = {} };
+		const AckStatus status = handleBatch(packet, length, context, esp_timer_get_time());
+		if (status != AckStatus::Ok) {
+			if (status == AckStatus::Stale) 
+				batch.stale += 1;
+			return false;
+		}
+		if (context.command.fields == control::Command::None) 
+			return false;
+		command = context.command;
+		return true;
+	}
+
+	if (packet.type == PacketType::SequencedControl) {
+		const auto& v = packet.asSequencedControl;
+		if (!acceptSequence(client, v.sequence, v.timestamp)) {
+			batch.stale += 1;
+			return false;
+		}
+	}
+	return toCommand(packet, command);
 }
 
-/// Listens for incoming packet (until timeout)
+void handlePacket(const UnknownPacket& packet, size_t length, Sender sender, int handle)
+{
+	PacketsStats batch = { .received = 1 };
+	const size_t expectedLength = getPacketLength(packet.type);
+	if (unlikely(expectedLength == 0 || length < expectedLength)) {
+		ESP_LOGW(TAG, "Invalid packet!");
+	}
+	else {
+		const Client client { .address = {}, .sender = sender, .handle = handle };
+		control::Command command;
+		if (dispatch(packet, length, client, batch, command)) {
+			batch.applied = 1;
+			control::post(command);
+		}
+	}
+	countStats(batch);
+}
+
+constexpr uint8_t maxBatchLength = 16;
+
+/// Waits for incoming packets, drains all already queued ones and handles only
+/// the newest control one (latest wins), dropping reordered or outdated ones.
+/// Other commands of batches (and subscriptions) are applied right away. Blocks 
+/// indefinitely, as safety stop timeouts are handled by the control loop.
+/// Sets `errno` on failure, which requires reinitialization.
 void listen()
 {
-	ESP_LOGV(TAG, "Listening for UDP packet");
+	ESP_LOGV(TAG, "Listening for UDP packets");
 	int ret;
 	struct sockaddr_in client_addr;
 	UnknownPacket packet;
-	std::memset(&packet, 0, sizeof(packet));
-	socklen_t len;
-	ret = recvfrom(sock, packet.buffer, maxPacketLength, 0, reinterpret_cast<sockaddr*>(&client_addr), &len);
-	if (ret < 0) {
-		if (errno == EAGAIN || errno == EWOULDBLOCK) {
-			// Timeouts are expected, they stop the movement.
-			errno = 0;
-			return;
+	control::Command latest;
+	PacketsStats batch = {};
+	int flags = 0; // block only for the first one
+	errno = 0;
+	for (uint8_t i = 0; i < maxBatchLength; i++) {
+		std::memset(&packet, 0, sizeof(packet));
+		socklen_t len = sizeof(client_addr);
+		ret = recvfrom(sock, packet.buffer, maxPacketLength, flags, reinterpret_cast<sockaddr*>(&client_addr), &len);
+		if (ret < 0) {
+			if (flags && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				// Nothing more queued
+				errno = 0;
+				break;
+			}
+			ESP_LOGW(TAG, "Failed to receive, errno %d", errno);
+			break;
 		}
-		ESP_LOGW(TAG, "Failed to receive (not timeout), errno %d", errno);
-		return;
+		flags = MSG_DONTWAIT;
+		batch.received += 1;
+		metrics::count(metrics::Counter::UdpPackets);
+
+		const size_t bytesReceived = ret;
+		ESP_LOGV(TAG, "Got packet! bytes received: %zu", bytesReceived);
+		const size_t expectedLength = getPacketLength(packet.type);
+		if (unlikely(expectedLength == 0 || bytesReceived < expectedLength)) {
+			ESP_LOGW(TAG, "Invalid packet!");
+			continue;
+		}
+
+		const Client client { .address = client_addr, .sender = nullptr, .handle = -1 };
+		control::Command command;
+		if (!dispatch(packet, bytesReceived, client, batch, command)) 
+			continue;
+
+		if (batch.applied) {
+			// Coalesced, so fields of former ones (like lights) are kept unless overridden
+			batch.coalesced += 1;
+			control::mergeCommand(command, latest);
+		}
+		else
+			batch.applied = 1;
+		latest = command;
 	}
-	const size_t bytesReceived = ret;
 
-	ESP_LOGV(TAG, "Got packet! bytes received: %zu", bytesReceived);
-	handlePacket(packet);
+	const int error = errno;
+	if (batch.applied) 
+		control::post(latest);
+	if (batch.received) 
+		countStats(batch);
+	errno = error;
 }
 
 }
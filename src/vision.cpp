@@ -0,0 +1,392 @@
+#include <sdkconfig.h>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include "vision.hpp"
+#include "camera.hpp"
+#include "control.hpp"
+#include "metrics.hpp"
+#include "json.hpp"
+#include "config.hpp"
+#include "tasks.hpp"
+
+namespace app::vision
+{
+
+static const char* TAG_VISION = "vision";
+
+////////////////////////////////////////////////////////////////////////////////
+// Word-wide (4 pixels per 32-bit word) operations
+
+constexpr uint32_t bytesHigh = 0x80808080;
+constexpr uint32_t bytesLow  = 0x7F7F7F7F;
+
+constexpr uint32_t broadcast(uint8_t value)
+{
+	return value * 0x01010101u;
+}
+
+/// Subtracts every byte separately (modulo 256), without borrows crossing bytes.
+constexpr uint32_t subtractBytes(uint32_t a, uint32_t b)
+{
+	return ((a | bytesHigh) - (b & bytesLow)) ^ ((a ^ ~b) & bytesHigh);
+}
+
+/// Compares every byte separately, setting the high bit of the byte if `a < b`.
+constexpr uint32_t lessBytes(uint32_t a, uint32_t b)
+{
+	const uint32_t d = subtractBytes(a, b);
+	return ((~a & b) | (~(a ^ b) & d)) & bytesHigh;
+}
+
+/// Calculates absolute difference of every byte separately.
+constexpr uint32_t absoluteDifferenceBytes(uint32_t a, uint32_t b)
+{
+	const uint32_t negative = lessBytes(a, b) >> 7; // 1 in bytes to negate
+	return (subtractBytes(a, b) ^ (negative * 0xFF)) + negative;
+}
+
+static_assert(subtractBytes(0x00FF1080, 0x01FE2070) == 0xFF01F010);
+static_assert(lessBytes(0x00FF1080, 0x01FE1080) == 0x80000000);
+static_assert(lessBytes(0x7F80FF00, 0x807F00FF) == 0x80000080);
+static_assert(absoluteDifferenceBytes(0x00FF1080, 0x01FE2070) == 0x01011010);
+static_assert(absoluteDifferenceBytes(0x00FF00FF, 0xFF00FF00) == 0xFFFFFFFF);
+
+////////////////////////////////////////////////////////////////////////////////
+// Processing
+
+Settings settings = {
+	.enabled = false,
+	.threshold = 64,
+	.motionThreshold = 24,
+	.minDarkPixels = 32,
+	.steering = false,
+	.speed = 30.0f,
+	.gain = 20.0f,
+};
+
+Settings& getSettings()
+{
+	return settings;
+}
+
+portMUX_TYPE resultsLock = portMUX_INITIALIZER_UNLOCKED;
+Results results = {};
+
+Results getResults()
+{
+	portENTER_CRITICAL(&resultsLock);
+	const Results copy = results;
+	portEXIT_CRITICAL(&resultsLock);
+	return copy;
+}
+
+/// Buffers of the processing, reallocated when the frame size changes.
+struct Buffers
+{
+	uint16_t width = 0;
+	uint16_t height = 0;
+	uint32_t* previous = nullptr; // previous frame, for differencing
+	uint32_t* columnsPacked = nullptr; // 4 columns counters (8 bits) per word, flushed every 255 rows
+	uint16_t* columns = nullptr;
+	uint16_t* rows = nullptr;
+	bool hasPrevious = false;
+
+	~Buffers() { release(); }
+
+	void release()
+	{
+		heap_caps_free(previous);
+		heap_caps_free(columnsPacked);
+		heap_caps_free(columns);
+		heap_caps_free(rows);
+		previous = nullptr;
+		columnsPacked = nullptr;
+		columns = nullptr;
+		rows = nullptr;
+		width = height = 0;
+		hasPrevious = false;
+	}
+
+	static void* allocate(size_t size)
+	{
+		// Prefer internal RAM, as it's much faster to iterate over
+		void* p = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT);
+		if (unlikely(!p))
+			p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+		return p;
+	}
+
+	bool prepare(uint16_t w, uint16_t h)
+	{
+		if (w == width && h == height)
+			return true;
+		release();
+		previous = static_cast<uint32_t*>(allocate(w * h));
+		columnsPacked = static_cast<uint32_t*>(allocate(w));
+		columns = static_cast<uint16_t*>(allocate(w * sizeof(uint16_t)));
+		rows = static_cast<uint16_t*>(allocate(h * sizeof(uint16_t)));
+		if (unlikely(!previous || !columnsPacked || !columns || !rows)) {
+			ESP_LOGE(TAG_VISION, "Failed to allocate buffers for %ux%u", w, h);
+			release();
+			return false;
+		}
+		width = w;
+		height = h;
+		return true;
+	}
+
+	void flushColumns()
+	{
+		for (uint16_t w = 0; w < width / 4; w++) {
+			const uint32_t packed = columnsPacked[w];
+			columns[w * 4 + 0] += packed & 0xFF;
+			columns[w * 4 + 1] += (packed >> 8) & 0xFF;
+			columns[w * 4 + 2] += (packed >> 16) & 0xFF;
+			columns[w * 4 + 3] += packed >> 24;
+			columnsPacked[w] = 0;
+		}
+	}
+};
+
+Buffers buffers;
+
+/// Finds the first and the last index with count at least given one.
+void find_extent(const uint16_t* counts, uint16_t length, uint16_t minCount, uint16_t& first, uint16_t& last)
+{
+	first = 1;
+	last = 0;
+	for (uint16_t i = 0; i < length; i++) {
+		if (counts[i] < minCount) continue;
+		if (first > last) first = i;
+		last = i;
+	}
+}
+
+/// Processes grayscale frame: dark pixels (rows & columns histograms, centroid,
+/// bounding box) and differencing with previous frame. Width must be multiple of 4.
+void process(const camera_fb_t* fb, uint32_t frame, Results& r)
+{
+	const uint16_t width = fb->width;
+	const uint16_t height = fb->height;
+	const uint16_t wordsPerRow = width / 4;
+	const auto* pixels = reinterpret_cast<const uint32_t*>(fb->buf);
+	const uint32_t threshold = broadcast(settings.threshold);
+	const uint32_t motionThreshold = broadcast(settings.motionThreshold);
+	const bool differencing = buffers.hasPrevious;
+
+	std::memset(buffers.columnsPacked, 0, wordsPerRow * sizeof(uint32_t));
+	std::memset(buffers.columns, 0, width * sizeof(uint16_t));
+
+	uint32_t dark = 0;
+	uint32_t changed = 0;
+	uint64_t sumY = 0;
+	for (uint16_t y = 0; y < height; y++) {
+		const uint32_t* row = pixels + y * wordsPerRow;
+		uint32_t* previous = buffers.previous + y * wordsPerRow;
+		uint32_t rowDark = 0;
+		for (uint16_t w = 0; w < wordsPerRow; w++) {
+			const uint32_t p = row[w];
+			const uint32_t mask = lessBytes(p, threshold);
+			rowDark += __builtin_popcount(mask);
+			buffers.columnsPacked[w] += mask >> 7;
+			if (differencing)
+				changed += __builtin_popcount(lessBytes(motionThreshold, absoluteDifferenceBytes(p, previous[w])));
+			previous[w] = p;
+		}
+		buffers.rows[y] = rowDark;
+		dark += rowDark;
+		sumY += static_cast<uint32_t>(y) * rowDark;
+		if (y % 255 == 254)
+			buffers.flushColumns();
+	}
+	buffers.flushColumns();
+	buffers.hasPrevious = true;
+
+	uint64_t sumX = 0;
+	for (uint16_t x = 0; x < width; x++)
+		sumX += static_cast<uint32_t>(x) * buffers.columns[x];
+
+	r.frame = frame;
+	r.timestamp = static_cast<uptime_t>(fb->timestamp.tv_sec) * 1'000'000 + fb->timestamp.tv_usec;
+	r.width = width;
+	r.height = height;
+	r.darkPixels = dark;
+	r.changedPixels = changed;
+	if (dark) {
+		r.centroidX = (static_cast<float>(sumX) / dark + 0.5f) / width * 2 - 1;
+		r.centroidY = (static_cast<float>(sumY) / dark + 0.5f) / height * 2 - 1;
+	}
+	else {
+		r.centroidX = r.centroidY = 0;
+	}
+	// Ignore single noisy pixels in the rows & columns for the bounding box
+	find_extent(buffers.columns, width, 2, r.boxLeft, r.boxRight);
+	find_extent(buffers.rows, height, 2, r.boxTop, r.boxBottom);
+}
+
+/// Drives the motors towards the dark pixels centroid (i.e. following the line),
+/// stopping if not found. Posted as hint, so the safety stop still applies
+/// if the operator stops controlling.
+void steer(const Results& r)
+{
+	control::Command command = {
+		.fields = control::Command::Motors,
+		.smoothingTime = 100,
+		.hint = true,
+	};
+	if (r.darkPixels >= settings.minDarkPixels) {
+		command.left  = settings.speed + settings.gain * r.centroidX;
+		command.right = settings.speed - settings.gain * r.centroidX;
+	}
+	control::post(command);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Task
+
+constexpr TickType_t frameTimeout = 1000 / portTICK_PERIOD_MS;
+
+TaskHandle_t visionTask;
+
+/// Processes frames from the shared capture loop. Registered in the capture
+/// loop only while enabled. Raw frames are processed in place, JPEG ones are
+/// decoded (as grayscale, to the vision profile frame size) first.
+void vision_loop(void*)
+{
+	for (;;) {
+		if (!settings.enabled) {
+			buffers.release();
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+
+		camera::FrameSubscriber subscriber;
+		if (!subscriber) {
+			ESP_LOGW(TAG_VISION, "Failed to subscribe for frames");
+			ulTaskNotifyTake(pdTRUE, frameTimeout);
+			continue;
+		}
+		while (settings.enabled) {
+			auto fb = subscriber.next(frameTimeout);
+			if (unlikely(!fb)) continue;
+			const uptime_t start = esp_timer_get_time();
+			const uint32_t frame = fb.sequence();
+
+			const bool jpeg = fb->format == PIXFORMAT_JPEG;
+			const camera::ConvertedFrame converted = jpeg
+				? camera::ConvertedFrame::fromJpeg(fb, PIXFORMAT_GRAYSCALE, camera::getProfileSettings(camera::Profile::AI).framesize)
+				: camera::ConvertedFrame();
+			const camera_fb_t* source = fb;
+			if (jpeg) {
+				fb.reset();
+				if (unlikely(!converted)) continue;
+				source = converted;
+			}
+			else if (unlikely(source->format != PIXFORMAT_GRAYSCALE)) {
+				ESP_LOGW(TAG_VISION, "Unsupported pixel format: %d", source->format);
+				ulTaskNotifyTake(pdTRUE, frameTimeout);
+				continue;
+			}
+			if (unlikely(source->width % 4 != 0 || reinterpret_cast<uintptr_t>(source->buf) % 4 != 0)) {
+				ESP_LOGW(TAG_VISION, "Unsupported frame layout");
+				continue;
+			}
+			if (unlikely(!buffers.prepare(source->width, source->height))) {
+				ulTaskNotifyTake(pdTRUE, frameTimeout);
+				continue;
+			}
+
+			Results r;
+			process(source, frame, r);
+			fb.reset();
+			r.processingTime = esp_timer_get_time() - start;
+			metrics::record(metrics::Histogram::VisionProcess, r.processingTime);
+
+			portENTER_CRITICAL(&resultsLock);
+			results = r;
+			portEXIT_CRITICAL(&resultsLock);
+
+			if (settings.steering)
+				steer(r);
+		}
+	}
+}
+
+void init()
+{
+	// Second core only, next to the camera loop, leaving the first one for networking
+	tasks::create(vision_loop, "vision", 3 * 1024, nullptr, tasks::vision, &visionTask);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Configuration
+
+config::Generation configGeneration;
+
+/// Ends applying JSON configuration for vision, waking up the task if enabled.
+esp_err_t config_end(bool apply)
+{
+	if (apply)
+		xTaskNotifyGive(visionTask);
+	return ESP_OK;
+}
+
+/// Field for integer setting.
+template <auto member>
+constexpr config::Field settings_integer(const char* key)
+{
+	return config::integer(key,
+		[] (const json::Field& field) {
+			settings.*member = std::atoi(field.value);
+			return ESP_OK;
+		},
+		[] { return static_cast<int32_t>(settings.*member); }
+	);
+}
+
+/// Field for boolean setting.
+template <auto member>
+constexpr config::Field settings_boolean(const char* key)
+{
+	return config::boolean(key,
+		[] (const json::Field& field) {
+			settings.*member = parseBooleanFast(field.value);
+			return ESP_OK;
+		},
+		[] { return settings.*member; }
+	);
+}
+
+/// Field for float setting.
+template <auto member>
+constexpr config::Field settings_number(const char* key)
+{
+	return config::number(key,
+		[] (const json::Field& field) {
+			settings.*member = std::atof(field.value);
+			return ESP_OK;
+		},
+		[] { return settings.*member; }
+	);
+}
+
+constexpr config::Field configFields[] = {
+	settings_boolean<&Settings::enabled>("enabled"),
+	settings_integer<&Settings::threshold>("threshold"),
+	settings_integer<&Settings::motionThreshold>("motionThreshold"),
+	settings_integer<&Settings::minDarkPixels>("minDarkPixels"),
+	settings_boolean<&Settings::steering>("steering"),
+	settings_number<&Settings::speed>("speed"),
+	settings_number<&Settings::gain>("gain"),
+};
+constexpr config::Index configIndex { configFields };
+static_assert(configIndex.unique, "Keys hashes collision");
+
+/// Vision configuration, see `configFields`.
+extern const config::Object configObject { configFields, configIndex, nullptr, config_end, &configGeneration };
+
+}